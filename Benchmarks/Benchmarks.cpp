@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include "logging\Logger.h"
+#include "EffectBenchmarks.h"
+#include "TerrainBenchmarks.h"
+#include "Benchmarks.h"
+
+// Each is run with its flag as the first command line argument.
+static const Benchmark BenchmarkList[] =
+{
+    { "--benchmark-tile-lookups", BenchmarkSetup::HIDDEN_WINDOW, &TerrainBenchmarks::BenchmarkTileLookups, "Unable to change the view distance!" },
+    { "--benchmark-streaming", BenchmarkSetup::HIDDEN_WINDOW, &TerrainBenchmarks::BenchmarkStreaming, nullptr },
+    { "--benchmark-terrain-pack-kernels", BenchmarkSetup::NONE, &TerrainBenchmarks::BenchmarkTerrainPackKernels, "The terrain pack row kernels do not match the reference code!" },
+    { "--compare-heightfield-raycasts", BenchmarkSetup::NONE, &TerrainBenchmarks::CompareHeightfieldRaycasts, "Raycasts against the 16-bit heightfields do not match the float heightfields!" },
+    { "--benchmark-physics-area", BenchmarkSetup::TERRAIN_PHYSICS, &TerrainBenchmarks::BenchmarkPhysicsArea, nullptr },
+    { "--benchmark-terrain-queries", BenchmarkSetup::TERRAIN, &TerrainBenchmarks::BenchmarkTerrainQueries, "Batched terrain queries do not match single queries, or loaded terrain!" },
+    { "--benchmark-terrain-deformation", BenchmarkSetup::TERRAIN_PHYSICS, &TerrainBenchmarks::BenchmarkTerrainDeformation, "Deformed terrain borders or physics heightfields do not match the deformed heights!" },
+    { "--benchmark-horizon", BenchmarkSetup::GAME_WINDOW, &TerrainBenchmarks::BenchmarkHorizon, "Unable to read the benchmark arguments, or change the view distance!" },
+    { "--check-terrain-culling", BenchmarkSetup::NONE, &TerrainBenchmarks::CheckTerrainCulling, "The terrain culler culled subtiles that are visible!" },
+    { "--check-packed-types", BenchmarkSetup::CONFIG, &TerrainBenchmarks::CheckPackedTypes, "The packed terrain types do not match the terrain images!" },
+    { "--check-resource-retirement", BenchmarkSetup::CONFIG, &TerrainBenchmarks::CheckResourceRetirement, "Deferred destruction reused a resource while it was still in flight!" },
+    { "--benchmark-effect-builds", BenchmarkSetup::HIDDEN_WINDOW, &EffectBenchmarks::BenchmarkEffectBuilds, "Terrain effects are placed differently depending on the build threads!" },
+    { "--benchmark-effect-random", BenchmarkSetup::NONE, &EffectBenchmarks::BenchmarkEffectRandom, "The effect random numbers are not deterministic!" },
+    { "--benchmark-type-index", BenchmarkSetup::NONE, &EffectBenchmarks::BenchmarkTypeIndex, "The terrain type index does not visit the same pixels as a full scan!" },
+    { "--benchmark-subtile-layouts", BenchmarkSetup::NONE, &EffectBenchmarks::BenchmarkSubtileLayouts, "The Morton-ordered subtile passes do not match the row-major passes!" },
+};
+
+const Benchmark* Benchmarks::Find(const std::string& flag)
+{
+    for (const Benchmark& benchmark : BenchmarkList)
+    {
+        if (flag == benchmark.flag)
+        {
+            return &benchmark;
+        }
+    }
+
+    return nullptr;
+}
+
+bool Benchmarks::ReadArgument(const BenchmarkContext& context, size_t index, int* value)
+{
+    if (index >= context.arguments.size())
+    {
+        return true;
+    }
+
+    char* end;
+    long argument = std::strtol(context.arguments[index].c_str(), &end, 10);
+    if (end == context.arguments[index].c_str() || *end != '\0')
+    {
+        Logger::LogError("Expected a whole number for benchmark argument ", index + 1, ", not '", context.arguments[index], "'.");
+        return false;
+    }
+
+    *value = (int)argument;
+    return true;
+}
+
+bool Benchmarks::ReadArgument(const BenchmarkContext& context, size_t index, float* value)
+{
+    if (index >= context.arguments.size())
+    {
+        return true;
+    }
+
+    char* end;
+    float argument = std::strtof(context.arguments[index].c_str(), &end);
+    if (end == context.arguments[index].c_str() || *end != '\0')
+    {
+        Logger::LogError("Expected a number for benchmark argument ", index + 1, ", not '", context.arguments[index], "'.");
+        return false;
+    }
+
+    *value = argument;
+    return true;
+}
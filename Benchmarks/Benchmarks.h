@@ -0,0 +1,64 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include "Managers\RegionManager.h"
+#include "Physics.h"
+
+// What is loaded before a benchmark runs. Benchmarks that don't need OpenGL run without opening the game window.
+enum class BenchmarkSetup
+{
+    // Nothing, not even the config files.
+    NONE,
+
+    // The config files.
+    CONFIG,
+
+    // The config files, with the terrain pack open and streaming.
+    TERRAIN,
+
+    // As TERRAIN, with the physics world loaded.
+    TERRAIN_PHYSICS,
+
+    // Everything the game loads, with a hidden game window no frames are drawn to.
+    HIDDEN_WINDOW,
+
+    // Everything the game loads, with the game window. Frames aren't limited to the refresh rate, so frame times are the actual cost of each frame.
+    GAME_WINDOW,
+};
+
+// What a benchmark can use once its setup is loaded.
+struct BenchmarkContext
+{
+    RegionManager* regionManager;
+    Physics* physics;
+
+    // Runs a single frame of the game from wherever the player is, waiting for the GPU to finish it. Only set with a window.
+    std::function<void(float gameTime, float frameTime)> renderFrame;
+
+    // The command line arguments after the flag.
+    std::vector<std::string> arguments;
+};
+
+// A benchmark or check run from the command line instead of the game.
+struct Benchmark
+{
+    const char* flag;
+    BenchmarkSetup setup;
+
+    // Returns false if the check failed, in which case the failure message is logged.
+    bool (*run)(const BenchmarkContext& context);
+    const char* failureMessage;
+};
+
+// Lists the benchmarks and checks by their command line flags.
+class Benchmarks
+{
+public:
+    // Returns the benchmark run by a command line flag, or nullptr if there isn't one.
+    static const Benchmark* Find(const std::string& flag);
+
+    // Reads the argument at an index if it was given, leaving the value as is if not. Returns false if the argument isn't a number.
+    static bool ReadArgument(const BenchmarkContext& context, size_t index, int* value);
+    static bool ReadArgument(const BenchmarkContext& context, size_t index, float* value);
+};
@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <SFML\System.hpp>
+#include <glm\gtc\random.hpp>
+#include "Cache\TerrainRowKernels.h"
+#include "Data\SubtileLayout.h"
+#include "Data\TerrainTypeIndex.h"
+#include "Math\EffectRandom.h"
+#include "TerrainEffects\CityEffect.h"
+#include "TerrainEffects\SignEffect.h"
+#include "logging\Logger.h"
+#include "EffectBenchmarks.h"
+
+bool EffectBenchmarks::BenchmarkEffectBuilds(const BenchmarkContext& context)
+{
+    RegionManager* regionManager = context.regionManager;
+    TerrainManager& terrainManager = regionManager->GetTerrainManager();
+    int viewDistance = regionManager->GetViewDistance();
+
+    // Everything visible from the center of the terrain, as when the game starts.
+    std::vector<glm::ivec2> tiles;
+    regionManager->ComputeVisibleTiles((regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2, glm::vec2(1, 0), viewDistance, &tiles);
+    for (const glm::ivec2& tile : tiles)
+    {
+        regionManager->LoadTileImmediately(tile);
+    }
+
+    // The first build pages in the terrain and warms the allocator, so isn't timed. Every later build must place the effects exactly as it did.
+    int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    unsigned int expectedChecksum = 0;
+    terrainManager.BuildAndDiscardEffects(tiles, hardwareThreads, &expectedChecksum);
+    context.physics->StepImmediately(0.0f);
+
+    const int threadCounts[] = { 1, 4, hardwareThreads };
+    long usSingleThreadTime = 0;
+    bool isDeterministic = true;
+    for (int threadCount : threadCounts)
+    {
+        unsigned int placementChecksum = 0;
+        sf::Clock clock;
+        int effectsBuilt = terrainManager.BuildAndDiscardEffects(tiles, threadCount, &placementChecksum);
+        long usBuildTime = (long)clock.getElapsedTime().asMicroseconds();
+        usSingleThreadTime = threadCount == 1 ? usBuildTime : usSingleThreadTime;
+
+        // Discarded effects queue their bodies for deletion.
+        context.physics->StepImmediately(0.0f);
+        Logger::Log("Effect build benchmark at view distance ", viewDistance, " on ", threadCount, " threads: ", effectsBuilt, " effects in ", tiles.size(), " subtiles built in ",
+            (float)usBuildTime / 1000.0f, " ms (", (float)usBuildTime / (float)tiles.size(), " us/subtile, ", (float)usSingleThreadTime / (float)std::max(usBuildTime, 1L), "x the single thread).");
+
+        if (placementChecksum != expectedChecksum)
+        {
+            Logger::LogError("Effects built on ", threadCount, " threads were placed differently (checksum ", placementChecksum, ", expected ", expectedChecksum, ").");
+            isDeterministic = false;
+        }
+    }
+
+    return isDeterministic;
+}
+
+bool EffectBenchmarks::LogTypeIndexBenchmark(const std::string& name, const unsigned char* packedTypes)
+{
+    const int typeCount = 6;
+    const int effectTypes[typeCount] = { TerrainTypes::GRASSLAND, TerrainTypes::TREES, TerrainTypes::ROCKS, TerrainTypes::ROADS, TerrainTypes::DIRTLAND, TerrainTypes::CITY };
+    const int iterations = 1000;
+    const int size = TerrainTile::SubtileSize;
+
+    sf::Clock clock;
+    TerrainTypeIndex typeIndex;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        typeIndex.Build(packedTypes, size);
+    }
+
+    sf::Int64 buildUs = clock.restart().asMicroseconds();
+
+    // The index must visit the same pixels in the same order, as the effects count and draw random numbers as they go.
+    bool matches = true;
+    for (int t = 0; t < typeCount; t++)
+    {
+        std::vector<int> scannedPixels;
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                if (TerrainTypes::GetPackedType(packedTypes, i + j * size) == effectTypes[t])
+                {
+                    scannedPixels.push_back(i + j * size);
+                }
+            }
+        }
+
+        std::vector<int> indexedPixels;
+        typeIndex.ForEachPixel(packedTypes, effectTypes[t], [&](int i, int j) { indexedPixels.push_back(i + j * size); });
+        if (scannedPixels != indexedPixels || typeIndex.GetPixelCount(effectTypes[t]) != (int)scannedPixels.size())
+        {
+            Logger::LogError("The type index of the ", name, " subtile does not match a full scan for type ", effectTypes[t], ".");
+            matches = false;
+        }
+    }
+
+    // Each effect scans the subtile once when it is loaded.
+    long checksum = 0;
+    clock.restart();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int t = 0; t < typeCount; t++)
+        {
+            for (int i = 0; i < size; i++)
+            {
+                for (int j = 0; j < size; j++)
+                {
+                    if (TerrainTypes::GetPackedType(packedTypes, i + j * size) == effectTypes[t])
+                    {
+                        checksum += i + j;
+                    }
+                }
+            }
+        }
+    }
+
+    sf::Int64 scanUs = clock.restart().asMicroseconds();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int t = 0; t < typeCount; t++)
+        {
+            typeIndex.ForEachPixel(packedTypes, effectTypes[t], [&](int i, int j) { checksum += i + j; });
+        }
+    }
+
+    sf::Int64 indexUs = clock.getElapsedTime().asMicroseconds();
+    Logger::Log("Type index benchmark (", name, " subtile, ", typeIndex.IsIndexed() ? "indexed" : "scanned", ", ", typeIndex.GetByteSize(), " bytes): ",
+        (float)buildUs / (float)iterations, " us to build, ", (float)scanUs / (float)iterations, " us/subtile with full scans, ",
+        (float)indexUs / (float)iterations, " us/subtile with the index. [", checksum, "]");
+    return matches;
+}
+
+bool EffectBenchmarks::GetSubtileTypes(int subtile, std::string* name, std::vector<unsigned char>* types)
+{
+    const int size = TerrainTile::SubtileSize;
+    const char* names[] = { "dense city", "sparse lake", "mixed" };
+    if (subtile < 0 || subtile >= 3)
+    {
+        return false;
+    }
+
+    *name = names[subtile];
+    types->resize(size * size);
+    unsigned int seed = 12345;
+    for (int j = 0; j < size; j++)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            unsigned char type = (unsigned char)TerrainTypes::LAKE;
+            if (subtile == 0)
+            {
+                // Blocks of city between a road grid, with a park.
+                type = (unsigned char)TerrainTypes::CITY;
+                if (i % 25 < 2 || j % 25 < 2)
+                {
+                    type = (unsigned char)TerrainTypes::ROADS;
+                }
+                else if (i >= 60 && i < 70 && j >= 60 && j < 70)
+                {
+                    type = (unsigned char)TerrainTypes::GRASSLAND;
+                }
+            }
+            else if (subtile == 1)
+            {
+                // Open water, with a sandy shore along one edge and a small wooded island.
+                if (j < 3)
+                {
+                    type = (unsigned char)TerrainTypes::SAND;
+                }
+                else if (i >= 45 && i < 50 && j >= 45 && j < 50)
+                {
+                    type = (i == 45 || j == 45) ? (unsigned char)TerrainTypes::ROCKS : (unsigned char)TerrainTypes::TREES;
+                }
+            }
+            else
+            {
+                // Grassland with 5x5 patches of dirt and every other type, crossed by a river and bordering a lake.
+                unsigned int block = (unsigned int)((i / 5) + (j / 5) * (size / 5));
+                unsigned int hash = (block + seed) * 2654435761u;
+                type = (unsigned char)TerrainTypes::GRASSLAND;
+                if (i >= 40 && i < 43)
+                {
+                    type = (unsigned char)TerrainTypes::RIVER;
+                }
+                else if (j >= 85)
+                {
+                    type = (unsigned char)TerrainTypes::LAKE;
+                }
+                else if ((hash >> 28) < 4)
+                {
+                    type = (unsigned char)TerrainTypes::DIRTLAND;
+                }
+                else if ((hash >> 28) < 8)
+                {
+                    type = TerrainTypes::Palette[(hash >> 8) % TerrainTypes::PaletteSize];
+                }
+            }
+
+            (*types)[i + j * size] = type;
+        }
+    }
+
+    return true;
+}
+
+bool EffectBenchmarks::BenchmarkTypeIndex(const BenchmarkContext& context)
+{
+    const int size = TerrainTile::SubtileSize;
+    bool matches = true;
+    std::string name;
+    std::vector<unsigned char> types;
+    for (int subtile = 0; GetSubtileTypes(subtile, &name, &types); subtile++)
+    {
+        std::vector<unsigned char> packedTypes(size * size / 2);
+        TerrainTypes::PackTypes(&types[0], size * size, &packedTypes[0]);
+        matches = LogTypeIndexBenchmark(name, &packedTypes[0]) && matches;
+    }
+
+    return matches;
+}
+
+bool EffectBenchmarks::LogSubtileLayoutBenchmark(const std::string& name, const std::vector<unsigned char>& types)
+{
+    const int iterations = 1000;
+    const int size = TerrainTile::SubtileSize;
+    const int borderedSize = TerrainTile::BorderedSubtileSize;
+    RowMajorLayout rowLayout(size);
+    MortonLayout mortonLayout(size);
+    RowMajorLayout borderedRowLayout(borderedSize);
+    MortonLayout borderedMortonLayout(borderedSize);
+    bool matches = true;
+
+    // Depressions run on the bordered types and heights while building the pack, so the border repeats the edges here.
+    std::vector<unsigned char> borderedTypes(borderedRowLayout.GetStorageSize());
+    std::vector<float> initialHeights(borderedRowLayout.GetStorageSize());
+    for (int y = 0; y < borderedSize; y++)
+    {
+        for (int x = 0; x < borderedSize; x++)
+        {
+            int pixelX = std::min(std::max(x - 1, 0), size - 1);
+            int pixelY = std::min(std::max(y - 1, 0), size - 1);
+            borderedTypes[x + y * borderedSize] = types[pixelX + pixelY * size];
+            initialHeights[x + y * borderedSize] = (float)((x * 7 + y * 13) % 101) / 100.0f;
+        }
+    }
+
+    sf::Clock clock;
+    std::vector<unsigned char> mortonBorderedTypes(borderedMortonLayout.GetStorageSize(), 0);
+    std::vector<float> mortonInitialHeights(borderedMortonLayout.GetStorageSize(), 0.0f);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        ConvertLayout(borderedRowLayout, &borderedTypes[0], borderedMortonLayout, &mortonBorderedTypes[0]);
+        ConvertLayout(borderedRowLayout, &initialHeights[0], borderedMortonLayout, &mortonInitialHeights[0]);
+    }
+
+    sf::Int64 convertUs = clock.restart().asMicroseconds();
+
+    // Each depression variant must give bit-identical heights.
+    std::vector<float> rowKernelHeights = initialHeights;
+    std::vector<float> rowHeights = initialHeights;
+    std::vector<float> mortonHeights = mortonInitialHeights;
+    for (int y = 0; y < borderedSize; y++)
+    {
+        TerrainRowKernels::LowerDepressionsRow(&borderedTypes[y * borderedSize], &borderedTypes[std::max(0, y - 1) * borderedSize], borderedSize, &rowKernelHeights[y * borderedSize]);
+    }
+
+    TerrainRowKernels::LowerDepressions(borderedRowLayout, &borderedTypes[0], &rowHeights[0]);
+    TerrainRowKernels::LowerDepressions(borderedMortonLayout, &mortonBorderedTypes[0], &mortonHeights[0]);
+    borderedRowLayout.ForEachPixel([&](int x, int y, int index)
+    {
+        float mortonHeight = mortonHeights[borderedMortonLayout.GetIndex(x, y)];
+        if (memcmp(&rowKernelHeights[index], &rowHeights[index], sizeof(float)) != 0 || memcmp(&rowKernelHeights[index], &mortonHeight, sizeof(float)) != 0)
+        {
+            matches = false;
+        }
+    });
+
+    clock.restart();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int y = 0; y < borderedSize; y++)
+        {
+            TerrainRowKernels::LowerDepressionsRow(&borderedTypes[y * borderedSize], &borderedTypes[std::max(0, y - 1) * borderedSize], borderedSize, &rowKernelHeights[y * borderedSize]);
+        }
+    }
+
+    sf::Int64 depressionRowKernelUs = clock.restart().asMicroseconds();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        TerrainRowKernels::LowerDepressions(borderedRowLayout, &borderedTypes[0], &rowHeights[0]);
+    }
+
+    sf::Int64 depressionRowUs = clock.restart().asMicroseconds();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        TerrainRowKernels::LowerDepressions(borderedMortonLayout, &mortonBorderedTypes[0], &mortonHeights[0]);
+    }
+
+    sf::Int64 depressionMortonUs = clock.restart().asMicroseconds();
+
+    // Signs and cities read the packed types, visiting the pixels the type index lists.
+    std::vector<unsigned char> rowPackedTypes(rowLayout.GetStorageSize() / 2);
+    std::vector<unsigned char> mortonPackedTypes(mortonLayout.GetStorageSize() / 2, 0);
+    TerrainTypes::PackTypes(&types[0], size * size, &rowPackedTypes[0]);
+    ConvertPackedTypeLayout(rowLayout, &rowPackedTypes[0], mortonLayout, &mortonPackedTypes[0]);
+    TerrainTypeIndex typeIndex;
+    typeIndex.Build(&rowPackedTypes[0], size);
+
+    sf::Int64 signChecksums[2] = { 0, 0 };
+    sf::Int64 signUs[2];
+    clock.restart();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        typeIndex.ForEachPixel(&rowPackedTypes[0], TerrainTypes::DIRTLAND, [&](int i, int j)
+        {
+            if (i >= 1 && j >= 1 && i < size - 4 && j < size - 4 && SignEffect::IsSignCorner(rowLayout, &rowPackedTypes[0], rowLayout.GetIndex(i, j)))
+            {
+                signChecksums[0] += 1 + i + j * size;
+            }
+        });
+    }
+
+    signUs[0] = clock.restart().asMicroseconds();
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        typeIndex.ForEachPixel(&rowPackedTypes[0], TerrainTypes::DIRTLAND, [&](int i, int j)
+        {
+            if (i >= 1 && j >= 1 && i < size - 4 && j < size - 4 && SignEffect::IsSignCorner(mortonLayout, &mortonPackedTypes[0], mortonLayout.GetIndex(i, j)))
+            {
+                signChecksums[1] += 1 + i + j * size;
+            }
+        });
+    }
+
+    signUs[1] = clock.restart().asMicroseconds();
+    matches = matches && signChecksums[0] == signChecksums[1];
+
+    sf::Int64 cityChecksums[2] = { 0, 0 };
+    sf::Int64 cityUs[2];
+    bool* checkedPixels = new bool[mortonLayout.GetStorageSize()];
+    for (int layout = 0; layout < 2; layout++)
+    {
+        clock.restart();
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            int storageSize = layout == 0 ? rowLayout.GetStorageSize() : mortonLayout.GetStorageSize();
+            for (int i = 0; i < storageSize; i++)
+            {
+                checkedPixels[i] = false;
+            }
+
+            typeIndex.ForEachPixel(&rowPackedTypes[0], TerrainTypes::CITY, [&](int i, int j)
+            {
+                int regionSize = 0;
+                if (layout == 0 && !checkedPixels[rowLayout.GetIndex(i, j)])
+                {
+                    regionSize = CityEffect::GrowSquareRegion(rowLayout, &rowPackedTypes[0], i, j, checkedPixels);
+                }
+                else if (layout == 1 && !checkedPixels[mortonLayout.GetIndex(i, j)])
+                {
+                    regionSize = CityEffect::GrowSquareRegion(mortonLayout, &mortonPackedTypes[0], i, j, checkedPixels);
+                }
+
+                cityChecksums[layout] += regionSize * (1 + i + j * size);
+            });
+        }
+
+        cityUs[layout] = clock.restart().asMicroseconds();
+    }
+
+    delete[] checkedPixels;
+    matches = matches && cityChecksums[0] == cityChecksums[1];
+
+    auto getWinner = [](sf::Int64 rowUs, sf::Int64 mortonUs) { return rowUs <= mortonUs ? "row-major" : "Morton"; };
+    Logger::Log("Subtile layout benchmark (", name, " subtile), in us/subtile: converting to Morton ", (float)convertUs / (float)iterations,
+        ". Depressions: row kernels ", (float)depressionRowKernelUs / (float)iterations, ", row-major ", (float)depressionRowUs / (float)iterations,
+        ", Morton ", (float)depressionMortonUs / (float)iterations, " (", getWinner(std::min(depressionRowKernelUs, depressionRowUs), depressionMortonUs), " wins).");
+    Logger::Log("  Sign corners: row-major ", (float)signUs[0] / (float)iterations, ", Morton ", (float)signUs[1] / (float)iterations, " (", getWinner(signUs[0], signUs[1]), " wins). ",
+        "City regions: row-major ", (float)cityUs[0] / (float)iterations, ", Morton ", (float)cityUs[1] / (float)iterations, " (", getWinner(cityUs[0], cityUs[1]), " wins). [",
+        signChecksums[0], ", ", cityChecksums[0], "]");
+
+    if (!matches)
+    {
+        Logger::LogError("The Morton layout passes of the ", name, " subtile do not match the row-major passes.");
+    }
+
+    return matches;
+}
+
+bool EffectBenchmarks::BenchmarkSubtileLayouts(const BenchmarkContext& context)
+{
+    bool matches = true;
+    std::string name;
+    std::vector<unsigned char> types;
+    for (int subtile = 0; GetSubtileTypes(subtile, &name, &types); subtile++)
+    {
+        matches = LogSubtileLayoutBenchmark(name, types) && matches;
+    }
+
+    return matches;
+}
+
+bool EffectBenchmarks::BenchmarkEffectRandom(const BenchmarkContext& context)
+{
+    // A few neighboring subtiles, as effects on different build threads would draw them.
+    const int subtileCount = 8;
+    const int drawCount = 100000;
+    std::vector<std::vector<float>> expectedDraws(subtileCount);
+    std::vector<std::vector<float>> threadDraws(subtileCount, std::vector<float>(drawCount));
+    for (int i = 0; i < subtileCount; i++)
+    {
+        EffectRandom random(glm::ivec2(i % 4, i / 4), EffectRandom::GRASS);
+        for (int j = 0; j < drawCount; j++)
+        {
+            expectedDraws[i].push_back(random.Float());
+        }
+    }
+
+    // Each thread fills its draws at once, so this also checks bulk fills match single draws.
+    std::vector<std::thread> threads;
+    for (int i = 0; i < subtileCount; i++)
+    {
+        threads.push_back(std::thread([i, &threadDraws]()
+        {
+            EffectRandom random(glm::ivec2(i % 4, i / 4), EffectRandom::GRASS);
+            random.Fill(&threadDraws[i][0], drawCount, 0.0f, 1.0f);
+        }));
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    bool matches = true;
+    for (int i = 0; i < subtileCount; i++)
+    {
+        if (threadDraws[i] != expectedDraws[i])
+        {
+            Logger::LogError("Effect random numbers for subtile ", i, " differ when filled on another thread.");
+            matches = false;
+        }
+
+        if (i != 0 && expectedDraws[i] == expectedDraws[0])
+        {
+            Logger::LogError("Effect random numbers for subtile ", i, " repeat those of subtile 0.");
+            matches = false;
+        }
+    }
+
+    // Effects of the same subtile must not draw the same numbers either, and vectors must fill as they're drawn.
+    EffectRandom grassRandom(glm::ivec2(0, 0), EffectRandom::GRASS);
+    EffectRandom rockRandom(glm::ivec2(0, 0), EffectRandom::ROCKS);
+    if (grassRandom.Next() == rockRandom.Next() && grassRandom.Next() == rockRandom.Next())
+    {
+        Logger::LogError("Effect random numbers repeat across effects of the same subtile.");
+        matches = false;
+    }
+
+    const int vectorCount = drawCount / 3;
+    const glm::vec3 minVector(-1.0f, 0.0f, 10.0f);
+    const glm::vec3 maxVector(1.0f, 5.0f, 20.0f);
+    std::vector<glm::vec3> drawnVectors;
+    std::vector<glm::vec3> filledVectors(vectorCount);
+    EffectRandom drawnRandom(glm::ivec2(-3, 7), EffectRandom::TREES);
+    EffectRandom filledRandom(glm::ivec2(-3, 7), EffectRandom::TREES);
+    for (int i = 0; i < vectorCount; i++)
+    {
+        drawnVectors.push_back(drawnRandom.Vec3(minVector, maxVector));
+    }
+
+    filledRandom.Fill(&filledVectors[0], vectorCount, minVector, maxVector);
+    if (drawnVectors != filledVectors || drawnRandom.Next() != filledRandom.Next())
+    {
+        Logger::LogError("Filled effect random vectors differ from drawn ones.");
+        matches = false;
+    }
+
+    // Time filling a buffer with glm's numbers, then single and bulk draws.
+    const int iterations = 100;
+    std::vector<float> values(drawCount);
+    std::vector<glm::vec3> vectors(vectorCount);
+    sf::Clock clock;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int i = 0; i < drawCount; i++)
+        {
+            values[i] = glm::linearRand(0.0f, 1.0f);
+        }
+    }
+
+    sf::Int64 glmUs = clock.restart().asMicroseconds();
+    float checksum = values[drawCount / 2];
+    EffectRandom random(glm::ivec2(0, 0), EffectRandom::GRASS);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int i = 0; i < drawCount; i++)
+        {
+            values[i] = random.Float();
+        }
+    }
+
+    sf::Int64 drawUs = clock.restart().asMicroseconds();
+    checksum += values[drawCount / 2];
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        random.Fill(&values[0], drawCount, 0.0f, 1.0f);
+    }
+
+    sf::Int64 fillUs = clock.restart().asMicroseconds();
+    checksum += values[drawCount / 2];
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int i = 0; i < vectorCount; i++)
+        {
+            vectors[i] = glm::linearRand(minVector, maxVector);
+        }
+    }
+
+    sf::Int64 glmVectorUs = clock.restart().asMicroseconds();
+    checksum += vectors[vectorCount / 2].x;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        random.Fill(&vectors[0], vectorCount, minVector, maxVector);
+    }
+
+    sf::Int64 fillVectorUs = clock.getElapsedTime().asMicroseconds();
+    checksum += vectors[vectorCount / 2].x;
+
+    float floatsDrawn = (float)drawCount * (float)iterations;
+    float vectorsDrawn = (float)vectorCount * (float)iterations;
+    Logger::Log("Effect random benchmark, in ns/float: glm::linearRand ", (float)glmUs * 1000.0f / floatsDrawn, ", single draws ", (float)drawUs * 1000.0f / floatsDrawn,
+        ", bulk fills ", (float)fillUs * 1000.0f / floatsDrawn, " (", (float)glmUs / (float)std::max(fillUs, (sf::Int64)1), "x glm).");
+    Logger::Log("  In ns/vec3: glm::linearRand ", (float)glmVectorUs * 1000.0f / vectorsDrawn, ", bulk fills ", (float)fillVectorUs * 1000.0f / vectorsDrawn,
+        " (", (float)glmVectorUs / (float)std::max(fillVectorUs, (sf::Int64)1), "x glm). [", checksum, "]");
+    return matches;
+}
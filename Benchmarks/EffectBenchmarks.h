@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Benchmarks.h"
+
+// Benchmarks and checks of building the terrain effects.
+class EffectBenchmarks
+{
+    // Checks the type index visits the same pixels as a full scan for each effect type, logging both times.
+    static bool LogTypeIndexBenchmark(const std::string& name, const unsigned char* packedTypes);
+
+    // Fills in the types of a synthetic subtile, returning false once past the last one.
+    static bool GetSubtileTypes(int subtile, std::string* name, std::vector<unsigned char>* types);
+
+    // Checks the neighbor-heavy passes give the same results in the row-major and Morton layouts, logging the time of each.
+    static bool LogSubtileLayoutBenchmark(const std::string& name, const std::vector<unsigned char>& types);
+
+public:
+    // Logs the time taken to build the effects of the visible terrain on increasing numbers of threads, checking they're placed the same way each time.
+    static bool BenchmarkEffectBuilds(const BenchmarkContext& context);
+
+    // Checks effect random numbers don't depend on the thread drawing them, and that bulk fills match single draws, logging their speed against glm's.
+    static bool BenchmarkEffectRandom(const BenchmarkContext& context);
+
+    // Compares effect pixel scans with the type index against full scans, over dense city, sparse lake and mixed subtiles.
+    static bool BenchmarkTypeIndex(const BenchmarkContext& context);
+
+    // Compares the depression, sign and city passes over row-major and Morton-ordered subtiles.
+    static bool BenchmarkSubtileLayouts(const BenchmarkContext& context);
+};
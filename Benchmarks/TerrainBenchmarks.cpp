@@ -0,0 +1,940 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <SFML\System.hpp>
+#include <glm\gtc\matrix_transform.hpp>
+#include "Cache\TerrainPack.h"
+#include "Cache\TerrainPackBuilder.h"
+#include "Config\TerrainConfig.h"
+#include "logging\Logger.h"
+#include "Utils\Constants.h"
+#include "Utils\SlotAllocator.h"
+#include "TerrainBenchmarks.h"
+
+void TerrainBenchmarks::LoadCenterTiles(RegionManager* regionManager, int viewDistance, std::vector<glm::ivec2>* tiles)
+{
+    regionManager->ComputeVisibleTiles((regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2, glm::vec2(1, 0), viewDistance, tiles);
+    for (const glm::ivec2& tile : *tiles)
+    {
+        regionManager->LoadTileImmediately(tile);
+    }
+}
+
+void TerrainBenchmarks::RenderView(RegionManager* regionManager, Physics* physics, const glm::vec3& position, const glm::vec2& direction, const glm::vec3& velocity, float gameTime, float frameTime)
+{
+    glm::mat4 viewMatrix = glm::lookAt(position, position + glm::vec3(direction, -0.2f), glm::vec3(0, 0, 1));
+    regionManager->UpdateVisibleRegion(position, direction, velocity, physics);
+    regionManager->SimulateVisibleRegions(gameTime, frameTime);
+    regionManager->RenderRegions(Constants::PerspectiveMatrix, position, direction, viewMatrix);
+}
+
+bool TerrainBenchmarks::LogLookupBenchmark(RegionManager* regionManager, Physics* physics, int viewDistance)
+{
+    if (!regionManager->SetViewDistance(viewDistance))
+    {
+        return false;
+    }
+
+    // Stand in the center of the terrain until everything visible is activated, so every lookup finds a subtile with effects.
+    const float frameTime = 1.0f / 60.0f;
+    const float maxLoadSeconds = 60.0f;
+    glm::ivec2 centerTile = (regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2;
+    glm::vec2 center = (glm::vec2((float)centerTile.x, (float)centerTile.y) + glm::vec2(0.5f)) * (float)TerrainTile::SubtileSize;
+    glm::vec3 position(center, regionManager->GetPointHeight(physics, center) + 2.0f);
+    glm::vec2 direction(1, 0);
+    float gameTime = 0.0f;
+    sf::Clock loadClock;
+    while (!regionManager->IsVisibleTerrainLoaded() && loadClock.getElapsedTime().asSeconds() < maxLoadSeconds)
+    {
+        RenderView(regionManager, physics, position, direction, glm::vec3(0.0f), gameTime += frameTime, frameTime);
+    }
+
+    std::vector<glm::ivec2> tiles;
+    regionManager->ComputeVisibleTiles(regionManager->GetCurrentCenterTile(position), direction, viewDistance, &tiles);
+
+    // The lookups each visible tile makes every frame: its region and subtile, then its tile, subtile and effect slot when it's queued to simulate and to render.
+    //  The queued tiles are simulated and drawn after each frame as usual, outside of the timing.
+    TerrainManager& terrainManager = regionManager->GetTerrainManager();
+    glm::mat4 viewMatrix = glm::lookAt(position, position + glm::vec3(direction, -0.2f), glm::vec3(0, 0, 1));
+    const int frames = 200;
+    sf::Int64 usRegionTime = 0;
+    sf::Int64 usSimulateTime = 0;
+    sf::Int64 usRenderTime = 0;
+    int residentTiles = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        sf::Clock clock;
+        residentTiles = 0;
+        for (const glm::ivec2& tile : tiles)
+        {
+            residentTiles += regionManager->FindResidentSubtile(tile) != nullptr ? 1 : 0;
+        }
+
+        usRegionTime += clock.restart().asMicroseconds();
+        for (const glm::ivec2& tile : tiles)
+        {
+            glm::ivec2 region = tile / TerrainTile::Subdivisions;
+            terrainManager.QueueTileSimulation(region, tile - region * TerrainTile::Subdivisions);
+        }
+
+        usSimulateTime += clock.restart().asMicroseconds();
+        for (const glm::ivec2& tile : tiles)
+        {
+            glm::ivec2 region = tile / TerrainTile::Subdivisions;
+            terrainManager.QueueTileRender(region, tile - region * TerrainTile::Subdivisions);
+        }
+
+        usRenderTime += clock.getElapsedTime().asMicroseconds();
+        terrainManager.SimulateQueuedTiles(frameTime);
+        terrainManager.RenderQueuedTiles(Constants::PerspectiveMatrix, viewMatrix, center);
+    }
+
+    Logger::Log("Lookup benchmark at view distance ", viewDistance, " (", tiles.size(), " tiles, ", residentTiles, " resident, ", regionManager->IsVisibleTerrainLoaded() ? "loaded" : "still loading",
+        "), in us/frame: ", (float)usRegionTime / (float)frames, " finding subtiles, ", (float)usSimulateTime / (float)frames, " queueing simulations, ",
+        (float)usRenderTime / (float)frames, " queueing renders.");
+    return true;
+}
+
+bool TerrainBenchmarks::BenchmarkTileLookups(const BenchmarkContext& context)
+{
+    // The default view distance, then twice as far.
+    return LogLookupBenchmark(context.regionManager, context.physics, 10) && LogLookupBenchmark(context.regionManager, context.physics, 20);
+}
+
+bool TerrainBenchmarks::BenchmarkStreaming(const BenchmarkContext& context)
+{
+    RegionManager* regionManager = context.regionManager;
+    Physics* physics = context.physics;
+
+    // A loop two tiles out around the center of the terrain, at the speed of a fast vehicle, so tiles and regions stream in and out on every side.
+    //  Game time advances a fixed step each frame, so the path is the same however long the frames take.
+    const float frameTime = 1.0f / 60.0f;
+    const float speed = 100.0f;
+    const float maxLoadSeconds = 60.0f;
+    const glm::vec2 waypointOffsets[] = { glm::vec2(-2, -2), glm::vec2(2, -2), glm::vec2(2, 2), glm::vec2(-2, 2), glm::vec2(-2, -2) };
+    const int waypointCount = sizeof(waypointOffsets) / sizeof(waypointOffsets[0]);
+
+    glm::ivec2 centerTile = (regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2;
+    glm::vec2 center = (glm::vec2((float)centerTile.x, (float)centerTile.y) + glm::vec2(0.5f)) * (float)TerrainTile::SubtileSize;
+    std::vector<glm::vec2> waypoints;
+    for (int i = 0; i < waypointCount; i++)
+    {
+        waypoints.push_back(center + waypointOffsets[i] * (float)TerrainTile::TileSize);
+    }
+
+    // The heights come from resident terrain only, so the camera never blocks on loading a region itself.
+    auto getPosition = [regionManager](const glm::vec2& point)
+    {
+        TerrainSample sample;
+        regionManager->SampleTerrain(point, &sample);
+        return glm::vec3(point, sample.height + 2.0f);
+    };
+
+    // Start with the view around the first waypoint loaded, as when the game starts.
+    float gameTime = 0.0f;
+    glm::vec2 startDirection = glm::normalize(waypoints[1] - waypoints[0]);
+    sf::Clock loadClock;
+    do
+    {
+        RenderView(regionManager, physics, getPosition(waypoints[0]), startDirection, glm::vec3(0.0f), gameTime += frameTime, frameTime);
+    }
+    while (!regionManager->IsVisibleTerrainLoaded() && loadClock.getElapsedTime().asSeconds() < maxLoadSeconds);
+
+    std::vector<sf::Int64> usFrameTimes;
+    for (int i = 0; i + 1 < waypointCount; i++)
+    {
+        glm::vec2 segment = waypoints[i + 1] - waypoints[i];
+        glm::vec2 direction = glm::normalize(segment);
+        int frames = (int)(glm::length(segment) / (speed * frameTime));
+        for (int frame = 0; frame < frames; frame++)
+        {
+            glm::vec3 position = getPosition(waypoints[i] + direction * (speed * frameTime * (float)frame));
+
+            sf::Clock frameClock;
+            RenderView(regionManager, physics, position, direction, glm::vec3(direction * speed, 0.0f), gameTime += frameTime, frameTime);
+            usFrameTimes.push_back(frameClock.getElapsedTime().asMicroseconds());
+        }
+    }
+
+    sf::Int64 usTotalTime = 0;
+    int framesOverBudget = 0;
+    for (sf::Int64 usFrameTime : usFrameTimes)
+    {
+        usTotalTime += usFrameTime;
+        framesOverBudget += usFrameTime > (sf::Int64)(frameTime * 1e6f) ? 1 : 0;
+    }
+
+    std::sort(usFrameTimes.begin(), usFrameTimes.end());
+    size_t frameCount = usFrameTimes.size();
+    Logger::Log("Streaming benchmark over ", (int)((float)frameCount * frameTime * speed), " m at ", speed, " m/s (view distance ", regionManager->GetViewDistance(), "): ",
+        (float)usTotalTime / (1000.0f * (float)frameCount), " ms average, ", (float)usFrameTimes[frameCount / 2] / 1000.0f, " ms median, ",
+        (float)usFrameTimes[(frameCount * 99) / 100] / 1000.0f, " ms p99, ", (float)usFrameTimes.back() / 1000.0f, " ms worst frame. ", framesOverBudget, " of ",
+        frameCount, " frames over ", frameTime * 1000.0f, " ms.");
+    return true;
+}
+
+bool TerrainBenchmarks::BenchmarkTerrainPackKernels(const BenchmarkContext& context)
+{
+    const TerrainManager& terrainManager = context.regionManager->GetTerrainManager();
+    TerrainPackBuilder builder(terrainManager.GetMinTile(), terrainManager.GetMaxTile(), terrainManager.GetRootFolder());
+    return builder.LogKernelBenchmark();
+}
+
+bool TerrainBenchmarks::CompareHeightfieldRaycasts(const BenchmarkContext& context)
+{
+    const TerrainManager& terrainManager = context.regionManager->GetTerrainManager();
+    glm::ivec2 tile = (terrainManager.GetMinTile() + terrainManager.GetMaxTile()) / 2;
+    TerrainPackBuilder builder(terrainManager.GetMinTile(), terrainManager.GetMaxTile(), terrainManager.GetRootFolder());
+    std::vector<float> heightmaps;
+    if (!builder.BuildTileHeights(tile, &heightmaps))
+    {
+        Logger::LogError("Unable to build the heights of tile [", tile.x, ", ", tile.y, "] to compare.");
+        return false;
+    }
+
+    const int heightmapSize = TerrainTile::BorderedSubtileSize * TerrainTile::BorderedSubtileSize;
+    std::vector<short> quantizedHeightmaps(heightmaps.size());
+    TerrainPackBuilder::QuantizeHeights(&heightmaps[0], (int)heightmaps.size(), &quantizedHeightmaps[0]);
+
+    // Both shapes are centered on the middle of their height range, so are positioned the same way as Region::CreateHeightmap.
+    btTransform heightfieldTransform;
+    heightfieldTransform.setIdentity();
+    heightfieldTransform.setOrigin(btVector3(0.0f, 0.0f, 450.0f - 2.0f));
+
+    // Cast vertical rays through each subtile on a grid that doesn't line up with the heightmap points, so most rays hit the interior of triangles.
+    const int raysPerSide = 40;
+    const float raySpacing = (float)TerrainTile::SubtileSize / (float)raysPerSide;
+    long rays = 0;
+    long mismatchedHits = 0;
+    float maxDifference = 0.0f;
+    double totalDifference = 0.0;
+    for (int subtile = 0; subtile < TerrainTile::Subdivisions * TerrainTile::Subdivisions; subtile++)
+    {
+        // The float shape reads the normalized heights and is scaled to real units, as heightmaps were before they were stored as 16-bit values.
+        btHeightfieldTerrainShape floatShape(TerrainTile::BorderedSubtileSize, TerrainTile::BorderedSubtileSize, &heightmaps[subtile * heightmapSize], 1.0f, 0.0f, 1.0f, 2, PHY_FLOAT, false);
+        floatShape.setLocalScaling(btVector3(1.0f, 1.0f, (float)TerrainTile::MaxHeight));
+        floatShape.setMargin(2.0f);
+        btHeightfieldTerrainShape* shortShape = Region::CreateHeightfieldShape(&quantizedHeightmaps[subtile * heightmapSize]);
+
+        btCollisionObject floatObject;
+        floatObject.setCollisionShape(&floatShape);
+        floatObject.setWorldTransform(heightfieldTransform);
+        btCollisionObject shortObject;
+        shortObject.setCollisionShape(shortShape);
+        shortObject.setWorldTransform(heightfieldTransform);
+
+        for (int y = 0; y < raysPerSide; y++)
+        {
+            for (int x = 0; x < raysPerSide; x++)
+            {
+                btVector3 rayXY(((float)x + 0.37f) * raySpacing - TerrainTile::SubtileSize * 0.5f, ((float)y + 0.61f) * raySpacing - TerrainTile::SubtileSize * 0.5f, 0.0f);
+                btTransform rayFrom(btQuaternion::getIdentity(), rayXY + btVector3(0.0f, 0.0f, (float)TerrainTile::MaxHeight + 100.0f));
+                btTransform rayTo(btQuaternion::getIdentity(), rayXY - btVector3(0.0f, 0.0f, 100.0f));
+
+                btCollisionWorld::ClosestRayResultCallback floatResult(rayFrom.getOrigin(), rayTo.getOrigin());
+                btCollisionWorld::ClosestRayResultCallback shortResult(rayFrom.getOrigin(), rayTo.getOrigin());
+                btCollisionWorld::rayTestSingle(rayFrom, rayTo, &floatObject, &floatShape, heightfieldTransform, floatResult);
+                btCollisionWorld::rayTestSingle(rayFrom, rayTo, &shortObject, shortShape, heightfieldTransform, shortResult);
+
+                ++rays;
+                if (floatResult.hasHit() != shortResult.hasHit())
+                {
+                    ++mismatchedHits;
+                }
+                else if (floatResult.hasHit())
+                {
+                    float difference = std::abs(floatResult.m_hitPointWorld.z() - shortResult.m_hitPointWorld.z());
+                    maxDifference = std::max(maxDifference, difference);
+                    totalDifference += difference;
+                }
+            }
+        }
+
+        delete shortShape;
+    }
+
+    // One quantization step, which is as far as a ray against interpolated heights can move when every height moves by at most half a step.
+    const float heightStep = (float)TerrainTile::MaxHeight / (float)TerrainTile::MaxHeightValue;
+    size_t floatBytes = heightmapSize * sizeof(float);
+    size_t shortBytes = heightmapSize * sizeof(short);
+    Logger::Log("Heightfield raycasts on tile [", tile.x, ", ", tile.y, "]: ", rays, " rays, ", mismatchedHits, " mismatched hits, ",
+        maxDifference, " m max and ", (float)(totalDifference / (double)std::max(rays - mismatchedHits, 1L)), " m mean height difference (", heightStep, " m step).");
+    Logger::Log("Heightmap memory per subtile: ", floatBytes, " bytes as floats, ", shortBytes, " bytes as 16-bit values (", TerrainPack::RecordSize, " byte pack records).");
+    return mismatchedHits == 0 && maxDifference <= heightStep;
+}
+
+void TerrainBenchmarks::LogPhysicsAreaBenchmark(RegionManager* regionManager, Physics* physics, int viewDistance)
+{
+    std::vector<glm::ivec2> tiles;
+    LoadCenterTiles(regionManager, viewDistance, &tiles);
+    glm::ivec2 centerTile = (regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2;
+
+    // A player and NPCs walking around the center, and projectiles flying outwards from it.
+    const int walkerCount = 9;
+    const int projectileCount = 4;
+    glm::vec2 center = (glm::vec2((float)centerTile.x, (float)centerTile.y) + glm::vec2(0.5f)) * (float)TerrainTile::SubtileSize;
+    btSphereShape walkerShape(0.5f);
+    btSphereShape projectileShape(0.1f);
+    std::vector<btRigidBody*> bodies;
+    std::vector<btTransform> startTransforms;
+    std::vector<btVector3> startVelocities;
+    for (int i = 0; i < walkerCount + projectileCount; i++)
+    {
+        bool isProjectile = i >= walkerCount;
+        float angle = (float)i * 2.39996f;
+        glm::vec2 offset = glm::vec2(std::cos(angle), std::sin(angle)) * (isProjectile ? 20.0f : (float)(i * 6));
+        glm::vec2 position = center + offset;
+
+        btTransform transform;
+        transform.setIdentity();
+        transform.setOrigin(btVector3(position.x, position.y, regionManager->GetPointHeight(physics, position) + 2.0f));
+
+        btSphereShape* shape = isProjectile ? &projectileShape : &walkerShape;
+        btScalar mass = isProjectile ? 1.0f : 70.0f;
+        btVector3 inertia(0, 0, 0);
+        shape->calculateLocalInertia(mass, inertia);
+
+        btRigidBody* body = new btRigidBody(btRigidBody::btRigidBodyConstructionInfo(mass, new btDefaultMotionState(transform), shape, inertia));
+        body->setActivationState(DISABLE_DEACTIVATION);
+        physics->AddBody(body);
+        bodies.push_back(body);
+        startTransforms.push_back(transform);
+        startVelocities.push_back(isProjectile ? btVector3(std::cos(angle) * 100.0f, std::sin(angle) * 100.0f, 5.0f) : btVector3(0, 0, 0));
+    }
+
+    const int steps = 300;
+    const float timestep = 1.0f / 60.0f;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool useVisibleTiles = pass == 0;
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            bodies[i]->setWorldTransform(startTransforms[i]);
+            bodies[i]->getMotionState()->setWorldTransform(startTransforms[i]);
+            bodies[i]->setLinearVelocity(startVelocities[i]);
+            bodies[i]->setAngularVelocity(btVector3(0, 0, 0));
+        }
+
+        if (useVisibleTiles)
+        {
+            // As before the physics area, every visible tile has a heightfield.
+            for (const glm::ivec2& tile : tiles)
+            {
+                regionManager->EnsurePhysicsTile(tile, physics);
+            }
+        }
+
+        physics->StepImmediately(0.0f);
+
+        sf::Clock clock;
+        sf::Int64 usStepTime = 0;
+        sf::Int64 usUpdateTime = 0;
+        long overlappingPairs = 0;
+        long collisionObjects = 0;
+        for (int step = 0; step < steps; step++)
+        {
+            if (!useVisibleTiles)
+            {
+                clock.restart();
+                regionManager->UpdatePhysicsArea(physics);
+                usUpdateTime += clock.getElapsedTime().asMicroseconds();
+            }
+
+            clock.restart();
+            physics->StepImmediately(timestep);
+            usStepTime += clock.getElapsedTime().asMicroseconds();
+            overlappingPairs += physics->GetOverlappingPairCount();
+            collisionObjects += physics->GetCollisionObjectCount();
+        }
+
+        Logger::Log("Physics area benchmark at view distance ", viewDistance, " with heightfields on ", useVisibleTiles ? "every visible tile" : "the physics area", ": ",
+            (float)collisionObjects / (float)steps, " collision objects, ", (float)overlappingPairs / (float)steps, " broadphase pairs, ",
+            (float)usStepTime / (float)steps, " us/step, ", (float)usUpdateTime / (float)steps, " us/update.");
+
+        regionManager->RetirePhysicsTiles(physics, true);
+    }
+
+    for (btRigidBody* body : bodies)
+    {
+        physics->RemoveBody(body);
+        physics->DeleteBody(body, false);
+    }
+
+    physics->StepImmediately(0.0f);
+    for (btRigidBody* body : bodies)
+    {
+        delete body;
+    }
+}
+
+bool TerrainBenchmarks::BenchmarkPhysicsArea(const BenchmarkContext& context)
+{
+    // The default view distance, then twice as far.
+    LogPhysicsAreaBenchmark(context.regionManager, context.physics, 10);
+    LogPhysicsAreaBenchmark(context.regionManager, context.physics, 20);
+    return true;
+}
+
+bool TerrainBenchmarks::BenchmarkTerrainQueries(const BenchmarkContext& context)
+{
+    RegionManager* regionManager = context.regionManager;
+    int viewDistance = regionManager->GetViewDistance();
+    std::vector<glm::ivec2> tiles;
+    LoadCenterTiles(regionManager, viewDistance, &tiles);
+    glm::ivec2 centerTile = (regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2;
+
+    // Spread the points over twice the view distance, so some fall on regions that aren't loaded.
+    const int queryCount = 1000000;
+    glm::vec2 center = (glm::vec2((float)centerTile.x, (float)centerTile.y) + glm::vec2(0.5f)) * (float)TerrainTile::SubtileSize;
+    float spread = (float)(viewDistance * TerrainTile::SubtileSize);
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> offset(-spread, spread);
+    std::vector<glm::vec2> points(queryCount);
+    for (glm::vec2& point : points)
+    {
+        point = center + glm::vec2(offset(random), offset(random));
+    }
+
+    size_t regionsLoaded = regionManager->GetLoadedRegionCount();
+    std::vector<TerrainSample> singleSamples(queryCount);
+    std::vector<TerrainSample> batchSamples(queryCount);
+
+    sf::Clock clock;
+    for (int i = 0; i < queryCount; i++)
+    {
+        regionManager->SampleTerrain(points[i], &singleSamples[i]);
+    }
+
+    sf::Int64 singleUs = clock.restart().asMicroseconds();
+    int residentCount = regionManager->SampleTerrainBatch(&points[0], queryCount, &batchSamples[0]);
+    sf::Int64 batchUs = clock.getElapsedTime().asMicroseconds();
+
+    int mismatches = 0;
+    for (int i = 0; i < queryCount; i++)
+    {
+        if (singleSamples[i].height != batchSamples[i].height || singleSamples[i].type != batchSamples[i].type || singleSamples[i].isResident != batchSamples[i].isResident)
+        {
+            ++mismatches;
+        }
+    }
+
+    Logger::Log("Terrain query benchmark: ", queryCount, " queries (", residentCount, " on resident tiles), ", (float)singleUs * 1000.0f / (float)queryCount, " ns/query single, ",
+        (float)batchUs * 1000.0f / (float)queryCount, " ns/query batched, ", mismatches, " mismatches. ", regionManager->GetLoadedRegionCount() - regionsLoaded, " regions loaded by queries.");
+    return mismatches == 0 && regionManager->GetLoadedRegionCount() == regionsLoaded;
+}
+
+bool TerrainBenchmarks::BenchmarkTerrainDeformation(const BenchmarkContext& context)
+{
+    RegionManager* regionManager = context.regionManager;
+    Physics* physics = context.physics;
+
+    // Craters land over the tiles around the center, so they cross tile (and likely region) edges. The tiles start with heightfields, which are replaced once deformed.
+    const int areaRadius = 2;
+    const glm::ivec2& min = regionManager->GetMinTile();
+    const glm::ivec2& max = regionManager->GetMaxTile();
+    glm::ivec2 centerTile = (min + max) / 2;
+    std::vector<glm::ivec2> tiles;
+    for (int y = -areaRadius; y <= areaRadius; y++)
+    {
+        for (int x = -areaRadius; x <= areaRadius; x++)
+        {
+            glm::ivec2 tile = glm::min(glm::max(centerTile + glm::ivec2(x, y), min), max);
+            regionManager->LoadTileImmediately(tile);
+            regionManager->EnsurePhysicsTile(tile, physics);
+            tiles.push_back(tile);
+        }
+    }
+
+    // Bodies resting on the terrain, which fall asleep before the craters start.
+    const int bodyCount = 16;
+    glm::vec2 areaMin = glm::vec2((float)(centerTile.x - areaRadius), (float)(centerTile.y - areaRadius)) * (float)TerrainTile::SubtileSize;
+    float areaSize = (float)((areaRadius * 2 + 1) * TerrainTile::SubtileSize);
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> areaOffset(0.0f, areaSize);
+    btSphereShape bodyShape(0.5f);
+    std::vector<btRigidBody*> bodies;
+    for (int i = 0; i < bodyCount; i++)
+    {
+        glm::vec2 position = areaMin + glm::vec2(areaOffset(random), areaOffset(random));
+        btTransform transform;
+        transform.setIdentity();
+        transform.setOrigin(btVector3(position.x, position.y, regionManager->GetPointHeight(physics, position) + 0.6f));
+
+        btVector3 inertia(0, 0, 0);
+        bodyShape.calculateLocalInertia(70.0f, inertia);
+        btRigidBody* body = new btRigidBody(btRigidBody::btRigidBodyConstructionInfo(70.0f, new btDefaultMotionState(transform), &bodyShape, inertia));
+        physics->AddBody(body);
+        bodies.push_back(body);
+    }
+
+    const int framesPerSecond = 60;
+    const float timestep = 1.0f / (float)framesPerSecond;
+    sf::Clock clock;
+    for (int frame = 0; frame < framesPerSecond * 3; frame++)
+    {
+        physics->StepImmediately(timestep);
+    }
+
+    std::vector<bool> wasSleeping;
+    for (btRigidBody* body : bodies)
+    {
+        wasSleeping.push_back(!body->isActive());
+    }
+
+    clock.restart();
+    for (int frame = 0; frame < framesPerSecond; frame++)
+    {
+        physics->StepImmediately(timestep);
+    }
+
+    sf::Int64 usUndeformedStepTime = clock.getElapsedTime().asMicroseconds();
+
+    // Craters of a few meters, a thousand a second, spread evenly over the frames.
+    const int seconds = 5;
+    const int cratersPerSecond = 1000;
+    std::uniform_real_distribution<float> craterRadius(2.0f, 8.0f);
+    std::uniform_real_distribution<float> craterDepth(0.5f, 3.0f);
+    TerrainDeformationStats initialStats = regionManager->GetDeformationStats();
+    sf::Int64 usStepTime = 0;
+    for (int frame = 0; frame < framesPerSecond * seconds; frame++)
+    {
+        int craters = ((frame + 1) * cratersPerSecond) / framesPerSecond - (frame * cratersPerSecond) / framesPerSecond;
+        for (int i = 0; i < craters; i++)
+        {
+            glm::vec2 center = areaMin + glm::vec2(areaOffset(random), areaOffset(random));
+            regionManager->DeformTerrain(TerrainBrush(center, craterRadius(random), -craterDepth(random)));
+        }
+
+        regionManager->UpdateDeformedTerrain(physics);
+
+        clock.restart();
+        physics->StepImmediately(timestep);
+        usStepTime += clock.getElapsedTime().asMicroseconds();
+    }
+
+    // Every border pixel must match the pixel of the tile it's from, and the physics heights must have caught up with the deformed heights.
+    int borderMismatches = 0;
+    int physicsMismatches = 0;
+    int deformedTiles = 0;
+    const int borderedSize = TerrainTile::BorderedSubtileSize;
+    for (const glm::ivec2& tile : tiles)
+    {
+        const SubTile* subtile = regionManager->FindResidentSubtile(tile);
+        if (subtile == nullptr)
+        {
+            continue;
+        }
+
+        for (int y = 0; y < borderedSize; y++)
+        {
+            for (int x = 0; x < borderedSize; x++)
+            {
+                if (x != 0 && y != 0 && x != borderedSize - 1 && y != borderedSize - 1)
+                {
+                    continue;
+                }
+
+                glm::ivec2 pixel = tile * TerrainTile::SubtileSize + glm::ivec2(x - 1, y - 1);
+                glm::ivec2 pixelTile = RegionManager::GetPointTile(glm::vec2((float)pixel.x + 0.5f, (float)pixel.y + 0.5f));
+                const SubTile* pixelSubtile = regionManager->FindResidentSubtile(pixelTile);
+                glm::ivec2 pixelInTile = pixel - pixelTile * TerrainTile::SubtileSize + glm::ivec2(1);
+                if (pixelSubtile != nullptr && pixelSubtile->heightmap[pixelInTile.x + pixelInTile.y * borderedSize] != subtile->heightmap[x + y * borderedSize])
+                {
+                    ++borderMismatches;
+                }
+            }
+        }
+
+        if (subtile->IsDeformed())
+        {
+            ++deformedTiles;
+            physicsMismatches += (subtile->physicsHeightmap != &subtile->deformedPhysicsHeightmap[0] || subtile->deformedPhysicsHeightmap != subtile->deformedHeightmap) ? 1 : 0;
+        }
+    }
+
+    int sleepingBodies = 0;
+    int wokenBodies = 0;
+    for (size_t i = 0; i < bodies.size(); i++)
+    {
+        sleepingBodies += wasSleeping[i] ? 1 : 0;
+        wokenBodies += (wasSleeping[i] && bodies[i]->isActive()) ? 1 : 0;
+    }
+
+    // The stats are kept for the whole game, so only the change since the craters started is counted.
+    const TerrainDeformationStats& finalStats = regionManager->GetDeformationStats();
+    TerrainDeformationStats deformationStats;
+    deformationStats.brushesApplied = finalStats.brushesApplied - initialStats.brushesApplied;
+    deformationStats.heightsChanged = finalStats.heightsChanged - initialStats.heightsChanged;
+    deformationStats.usDeformTime = finalStats.usDeformTime - initialStats.usDeformTime;
+    deformationStats.heightfieldsUpdated = finalStats.heightfieldsUpdated - initialStats.heightfieldsUpdated;
+    deformationStats.heightfieldsReplaced = finalStats.heightfieldsReplaced - initialStats.heightfieldsReplaced;
+    deformationStats.usFlushTime = finalStats.usFlushTime - initialStats.usFlushTime;
+
+    float perSecond = 1.0f / ((float)seconds * 1000.0f);
+    Logger::Log("Terrain deformation benchmark: ", deformationStats.brushesApplied, " craters over ", seconds, " s changed ", deformationStats.heightsChanged, " heights in ",
+        deformedTiles, " of ", tiles.size(), " tiles, replacing ", deformationStats.heightfieldsReplaced, " heightfields. Per second: ", (float)deformationStats.usDeformTime * perSecond,
+        " ms deforming, ", (float)deformationStats.usFlushTime * perSecond, " ms queueing ", (float)deformationStats.heightfieldsUpdated / (float)seconds, " heightfield updates, ",
+        (float)usStepTime * perSecond, " ms stepping physics (", (float)usUndeformedStepTime / 1000.0f, " ms without craters). ", wokenBodies, " of ", sleepingBodies,
+        " sleeping bodies awake afterwards. ", borderMismatches, " border and ", physicsMismatches, " physics mismatches.");
+
+    for (btRigidBody* body : bodies)
+    {
+        physics->RemoveBody(body);
+        physics->DeleteBody(body, false);
+    }
+
+    regionManager->RetirePhysicsTiles(physics, true);
+    physics->StepImmediately(0.0f);
+    for (btRigidBody* body : bodies)
+    {
+        delete body;
+    }
+
+    return borderMismatches == 0 && physicsMismatches == 0;
+}
+
+bool TerrainBenchmarks::CheckTerrainCulling(const BenchmarkContext& context)
+{
+    // Random hilly terrain of 20x20 subtiles with heights every 5 m, seen from random views a little above the ground. Ten terrains, twenty views of each.
+    const int subtilesPerSide = 20;
+    const int cellsPerSubtile = 20;
+    const int pointsPerSide = subtilesPerSide * cellsPerSubtile + 1;
+    const float subtileSize = (float)TerrainTile::SubtileSize;
+    const float cellSize = subtileSize / (float)cellsPerSubtile;
+    const float terrainSize = subtileSize * (float)subtilesPerSide;
+    const int terrainCount = 10;
+    const int viewsPerTerrain = 20;
+
+    // Points of each culled subtile in the frustum are checked for a clear line of sight, marching along the ray in steps shorter than a cell.
+    const int samplesPerSide = 5;
+    const float stepSize = 1.0f;
+
+    std::vector<float> heights(pointsPerSide * pointsPerSide);
+    auto getHeight = [&](float x, float y)
+    {
+        float cellX = std::min(std::max(x / cellSize, 0.0f), (float)(pointsPerSide - 1) - 0.001f);
+        float cellY = std::min(std::max(y / cellSize, 0.0f), (float)(pointsPerSide - 1) - 0.001f);
+        int i = (int)cellX;
+        int j = (int)cellY;
+        float fx = cellX - (float)i;
+        float fy = cellY - (float)j;
+        const float* corner = &heights[i + j * pointsPerSide];
+        return (corner[0] * (1.0f - fx) + corner[1] * fx) * (1.0f - fy) + (corner[pointsPerSide] * (1.0f - fx) + corner[pointsPerSide + 1] * fx) * fy;
+    };
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    TerrainCuller culler;
+    std::vector<CullingBounds> bounds;
+    std::vector<int> visibleIndices;
+    std::vector<bool> isVisible;
+    long subtilesTested = 0;
+    long subtilesCulled = 0;
+    long pointsChecked = 0;
+    long visiblePoints = 0;
+    for (int terrain = 0; terrain < terrainCount; terrain++)
+    {
+        // Octaves of sine waves, each half the wavelength and height of the last, in random directions.
+        const int octaves = 6;
+        glm::vec2 directions[octaves];
+        float phases[octaves];
+        for (int octave = 0; octave < octaves; octave++)
+        {
+            float angle = unit(random) * 2.0f * Constants::PI;
+            directions[octave] = glm::vec2(std::cos(angle), std::sin(angle)) * (2.0f * Constants::PI / (800.0f / (float)(1 << octave)));
+            phases[octave] = unit(random) * 2.0f * Constants::PI;
+        }
+
+        for (int j = 0; j < pointsPerSide; j++)
+        {
+            for (int i = 0; i < pointsPerSide; i++)
+            {
+                glm::vec2 point = glm::vec2((float)i, (float)j) * cellSize;
+                float height = 300.0f;
+                for (int octave = 0; octave < octaves; octave++)
+                {
+                    height += (120.0f / (float)(1 << octave)) * std::sin(glm::dot(directions[octave], point) + phases[octave]);
+                }
+
+                heights[i + j * pointsPerSide] = height;
+            }
+        }
+
+        // Bilinear heights are within the range of the cell corners, so the corners give exact subtile bounds.
+        bounds.clear();
+        for (int y = 0; y < subtilesPerSide; y++)
+        {
+            for (int x = 0; x < subtilesPerSide; x++)
+            {
+                float minHeight = std::numeric_limits<float>::max();
+                float maxHeight = std::numeric_limits<float>::lowest();
+                for (int j = y * cellsPerSubtile; j <= (y + 1) * cellsPerSubtile; j++)
+                {
+                    for (int i = x * cellsPerSubtile; i <= (x + 1) * cellsPerSubtile; i++)
+                    {
+                        minHeight = std::min(minHeight, heights[i + j * pointsPerSide]);
+                        maxHeight = std::max(maxHeight, heights[i + j * pointsPerSide]);
+                    }
+                }
+
+                glm::vec2 subtileMin = glm::vec2((float)x, (float)y) * subtileSize;
+                bounds.push_back(CullingBounds(glm::vec3(subtileMin, minHeight), glm::vec3(subtileMin + glm::vec2(subtileSize), maxHeight)));
+            }
+        }
+
+        for (int view = 0; view < viewsPerTerrain; view++)
+        {
+            glm::vec2 eyeXY = glm::vec2(0.25f + unit(random) * 0.5f, 0.25f + unit(random) * 0.5f) * terrainSize;
+            glm::vec3 eye(eyeXY, getHeight(eyeXY.x, eyeXY.y) + 2.0f + unit(random) * 60.0f);
+            float yaw = unit(random) * 2.0f * Constants::PI;
+            float pitch = (unit(random) - 0.7f) * 0.6f;
+            glm::vec3 direction(std::cos(yaw) * std::cos(pitch), std::sin(yaw) * std::cos(pitch), std::sin(pitch));
+            glm::mat4 projectionView = Constants::PerspectiveMatrix * glm::lookAt(eye, eye + direction, glm::vec3(0, 0, 1));
+
+            culler.SetView(projectionView, eye);
+            culler.Cull(bounds, &visibleIndices);
+            isVisible.assign(bounds.size(), false);
+            for (int index : visibleIndices)
+            {
+                isVisible[index] = true;
+            }
+
+            subtilesTested += (long)bounds.size();
+            for (size_t index = 0; index < bounds.size(); index++)
+            {
+                if (isVisible[index])
+                {
+                    continue;
+                }
+
+                ++subtilesCulled;
+                for (int j = 0; j < samplesPerSide; j++)
+                {
+                    for (int i = 0; i < samplesPerSide; i++)
+                    {
+                        glm::vec2 pointXY = glm::vec2(bounds[index].min) + glm::vec2((float)i, (float)j) * (subtileSize / (float)(samplesPerSide - 1));
+                        glm::vec3 point(pointXY, getHeight(pointXY.x, pointXY.y));
+                        glm::vec4 clipPoint = projectionView * glm::vec4(point, 1.0f);
+                        if (std::abs(clipPoint.x) > clipPoint.w || std::abs(clipPoint.y) > clipPoint.w || std::abs(clipPoint.z) > clipPoint.w)
+                        {
+                            continue;
+                        }
+
+                        // The point is visible if no terrain is above the ray from the eye before it.
+                        ++pointsChecked;
+                        glm::vec3 toPoint = point - eye;
+                        float distance = glm::length(glm::vec2(toPoint));
+                        int steps = (int)(distance / stepSize);
+                        bool isOccluded = false;
+                        for (int step = 1; step < steps && !isOccluded; step++)
+                        {
+                            glm::vec3 rayPoint = eye + toPoint * ((float)step * stepSize / distance);
+                            isOccluded = getHeight(rayPoint.x, rayPoint.y) > rayPoint.z + 0.01f;
+                        }
+
+                        visiblePoints += isOccluded ? 0 : 1;
+                    }
+                }
+            }
+        }
+    }
+
+    Logger::Log("Terrain culling check: ", terrainCount * viewsPerTerrain, " views, ", subtilesTested, " subtiles, ", subtilesCulled, " culled (",
+        100.0f * (float)subtilesCulled / (float)subtilesTested, "%). ", pointsChecked, " points of culled subtiles in the frustum, ", visiblePoints, " of them visible.");
+    return visiblePoints == 0;
+}
+
+bool TerrainBenchmarks::BenchmarkHorizon(const BenchmarkContext& context)
+{
+    RegionManager* regionManager = context.regionManager;
+    Logger::Log("Horizon benchmark: the horizon uses ", regionManager->GetTerrainManager().GetHorizonByteSize() / 1024, " KiB.");
+
+    struct HorizonBenchmarkRun
+    {
+        const char* description;
+        int viewDistance;
+        bool isHorizonEnabled;
+    };
+
+    const HorizonBenchmarkRun runs[] =
+    {
+        { "streamed terrain only", 10, false },
+        { "streamed terrain and horizon", 10, true },
+        { "doubled view distance", 20, false },
+        { "quadrupled view distance", 40, false },
+    };
+
+    float frameRate = 60.0f;
+    int settleFrames = 120;
+    int timedFrames = 600;
+    float maxLoadSeconds = 60.0f;
+    if (!Benchmarks::ReadArgument(context, 0, &frameRate) || !Benchmarks::ReadArgument(context, 1, &settleFrames) ||
+        !Benchmarks::ReadArgument(context, 2, &timedFrames) || !Benchmarks::ReadArgument(context, 3, &maxLoadSeconds))
+    {
+        return false;
+    }
+
+    if (frameRate <= 0.0f || settleFrames < 0 || timedFrames <= 0)
+    {
+        Logger::LogError("The frame rate and timed frames must be positive, and the settle frames not negative.");
+        return false;
+    }
+
+    const float frameTime = 1.0f / frameRate;
+    Logger::Log("Horizon benchmark: ", settleFrames, " settle frames and ", timedFrames, " timed frames per run at ", frameRate, " FPS, waiting up to ",
+        maxLoadSeconds, " seconds for each view to load.");
+
+    float gameTime = 0.0f;
+    for (const HorizonBenchmarkRun& run : runs)
+    {
+        if (!regionManager->SetViewDistance(run.viewDistance))
+        {
+            return false;
+        }
+
+        regionManager->SetHorizonEnabled(run.isHorizonEnabled);
+
+        // Let the view stream in (and the unloaded terrain retire) before timing.
+        sf::Clock loadClock;
+        while (!regionManager->IsVisibleTerrainLoaded() && loadClock.getElapsedTime().asSeconds() < maxLoadSeconds)
+        {
+            context.renderFrame(gameTime += frameTime, frameTime);
+        }
+
+        for (int frame = 0; frame < settleFrames; frame++)
+        {
+            context.renderFrame(gameTime += frameTime, frameTime);
+        }
+
+        sf::Int64 usTotalTime = 0;
+        sf::Int64 usWorstFrameTime = 0;
+        for (int frame = 0; frame < timedFrames; frame++)
+        {
+            sf::Clock frameClock;
+            context.renderFrame(gameTime += frameTime, frameTime);
+
+            sf::Int64 usFrameTime = frameClock.getElapsedTime().asMicroseconds();
+            usTotalTime += usFrameTime;
+            usWorstFrameTime = std::max(usWorstFrameTime, usFrameTime);
+        }
+
+        const size_t bytesPerMiB = 1024 * 1024;
+        Logger::Log("Horizon benchmark: ", run.description, " (view distance ", run.viewDistance, ", ", regionManager->IsVisibleTerrainLoaded() ? "loaded" : "still loading",
+            "): ", (float)usTotalTime / (1000.0f * (float)timedFrames), " ms average, ", (float)usWorstFrameTime / 1000.0f, " ms worst frame over ", timedFrames,
+            " frames, ", regionManager->GetResidentBytes() / bytesPerMiB, " MiB of terrain resident.");
+    }
+
+    return true;
+}
+
+void TerrainBenchmarks::LogTypeStorageSavings(RegionManager* regionManager, int viewDistance)
+{
+    std::vector<glm::ivec2> tiles;
+    regionManager->ComputeVisibleTiles((regionManager->GetMinTile() + regionManager->GetMaxTile()) / 2, glm::vec2(1, 0), viewDistance, &tiles);
+
+    // Every subtile of a tile with a visible subtile stays mapped, while only the visible subtiles hold texture pool slots.
+    TileGrid<int> regions(regionManager->GetMinTile() / TerrainTile::Subdivisions, regionManager->GetMaxTile() / TerrainTile::Subdivisions);
+    for (const glm::ivec2& tile : tiles)
+    {
+        int* visibleSubtiles = regions.Find(tile / TerrainTile::Subdivisions);
+        regions.Set(tile / TerrainTile::Subdivisions, visibleSubtiles == nullptr ? 1 : *visibleSubtiles + 1);
+    }
+
+    // Byte types were stored as is in the pack, and uploaded to a 16-bit texture.
+    const size_t subtilePixels = TerrainTile::SubtileSize * TerrainTile::SubtileSize;
+    size_t mappedSubtiles = regions.Size() * TerrainTile::Subdivisions * TerrainTile::Subdivisions;
+    size_t packBytesSaved = mappedSubtiles * (subtilePixels - TerrainPack::TypesSize);
+    size_t textureBytesSaved = tiles.size() * (subtilePixels * 2 - TerrainTexturePool::GetTypeSlotByteSize());
+    Logger::Log("Packed types at view distance ", viewDistance, " (", tiles.size(), " visible subtiles in ", regions.Size(), " tiles): ",
+        (float)packBytesSaved / (1024.0f * 1024.0f), " MiB of mapped terrain pack and ", (float)textureBytesSaved / (1024.0f * 1024.0f), " MiB of texture pool saved.");
+}
+
+bool TerrainBenchmarks::CheckPackedTypes(const BenchmarkContext& context)
+{
+    LogTypeStorageSavings(context.regionManager, 10);
+
+    const TerrainManager& terrainManager = context.regionManager->GetTerrainManager();
+    TerrainPackBuilder builder(terrainManager.GetMinTile(), terrainManager.GetMaxTile(), terrainManager.GetRootFolder());
+    return builder.CheckPackedTypes();
+}
+
+bool TerrainBenchmarks::CheckDeferredReuse(int capacity, int retireFrames, int frames)
+{
+    SlotAllocator allocator;
+    allocator.Initialize(capacity, retireFrames);
+
+    // The frame each slot was last freed in, to check against independently of the retirement queue.
+    std::vector<int> freedFrames(capacity, -retireFrames);
+    std::vector<SlotHandle> liveHandles;
+    std::vector<SlotHandle> staleHandles;
+
+    std::mt19937 random(12345);
+    long allocations = 0;
+    long reusedTooEarly = 0;
+    long staleAccepted = 0;
+    long exhaustedFrames = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        // Subtiles leave the view in bursts as the player crosses tile boundaries.
+        int toFree = random() % 8 == 0 ? (int)(random() % (liveHandles.size() + 1)) : (int)(random() % 4);
+        for (int i = 0; i < toFree && !liveHandles.empty(); i++)
+        {
+            size_t index = random() % liveHandles.size();
+            SlotHandle handle = liveHandles[index];
+            liveHandles[index] = liveHandles.back();
+            liveHandles.pop_back();
+
+            allocator.Free(handle);
+            freedFrames[handle.slot] = frame;
+            staleHandles.push_back(handle);
+        }
+
+        // Freeing a handle twice must not retire its slot again, even after the slot was handed out to someone else.
+        for (int i = 0; i < 2 && !staleHandles.empty(); i++)
+        {
+            if (allocator.Free(staleHandles[random() % staleHandles.size()]))
+            {
+                ++staleAccepted;
+            }
+        }
+
+        int toAllocate = (int)(random() % 12);
+        for (int i = 0; i < toAllocate; i++)
+        {
+            SlotHandle handle = allocator.Allocate();
+            if (!handle.IsValid())
+            {
+                ++exhaustedFrames;
+                break;
+            }
+
+            if (frame - freedFrames[handle.slot] < retireFrames)
+            {
+                ++reusedTooEarly;
+            }
+
+            ++allocations;
+            liveHandles.push_back(handle);
+        }
+
+        if (staleHandles.size() > 1024)
+        {
+            staleHandles.erase(staleHandles.begin(), staleHandles.begin() + 512);
+        }
+
+        allocator.AdvanceFrame();
+    }
+
+    Logger::Log("Slot reuse check: ", allocations, " allocations of ", capacity, " slots over ", frames, " frames with a ", retireFrames, " frame delay. ",
+        reusedTooEarly, " slots reused while retiring, ", staleAccepted, " stale handles accepted, ", exhaustedFrames, " frames with no free slot.");
+    return reusedTooEarly == 0 && staleAccepted == 0;
+}
+
+bool TerrainBenchmarks::CheckResourceRetirement(const BenchmarkContext& context)
+{
+    const int frames = 100000;
+    bool isViewPoolValid = CheckDeferredReuse(context.regionManager->GetMaxVisibleTileCount(), TerrainConfig::RetireDelayFrames, frames);
+    bool isSmallPoolValid = CheckDeferredReuse(32, TerrainConfig::RetireDelayFrames + 2, frames);
+    return isViewPoolValid && isSmallPoolValid;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <glm\vec2.hpp>
+#include <glm\vec3.hpp>
+#include "Benchmarks.h"
+
+// Benchmarks and checks of the terrain, run through the region manager as the game uses it.
+class TerrainBenchmarks
+{
+    // Blocks until the tiles within a view distance of the center of the terrain are loaded, returning them.
+    static void LoadCenterTiles(RegionManager* regionManager, int viewDistance, std::vector<glm::ivec2>* tiles);
+
+    // Streams in, simulates and draws a frame of the terrain around a position, as the game does.
+    static void RenderView(RegionManager* regionManager, Physics* physics, const glm::vec3& position, const glm::vec2& direction, const glm::vec3& velocity, float gameTime, float frameTime);
+
+    // Returns false if the view distance couldn't be changed.
+    static bool LogLookupBenchmark(RegionManager* regionManager, Physics* physics, int viewDistance);
+    static void LogPhysicsAreaBenchmark(RegionManager* regionManager, Physics* physics, int viewDistance);
+    static void LogTypeStorageSavings(RegionManager* regionManager, int viewDistance);
+
+    // Runs a random workload of slot allocations over many frames, checking no slot is handed out while it's retiring and stale handles are rejected.
+    static bool CheckDeferredReuse(int capacity, int retireFrames, int frames);
+
+public:
+    // Logs the per-frame cost of the lookups made simulating and rendering the visible tiles, at the default view distance and twice as far.
+    static bool BenchmarkTileLookups(const BenchmarkContext& context);
+
+    // Walks a fixed loop around the center of the terrain, logging the worst and 99th percentile frame times as the terrain streams in and out.
+    static bool BenchmarkStreaming(const BenchmarkContext& context);
+
+    // Checks and times the terrain pack row kernels against the reference code.
+    static bool BenchmarkTerrainPackKernels(const BenchmarkContext& context);
+
+    // Checks raycasts against the 16-bit heightfields match the float heightfields they replaced.
+    static bool CompareHeightfieldRaycasts(const BenchmarkContext& context);
+
+    // Logs the physics cost of the terrain heightfields with and without the physics area, at the default view distance and twice as far.
+    static bool BenchmarkPhysicsArea(const BenchmarkContext& context);
+
+    // Checks and times single and batched terrain queries.
+    static bool BenchmarkTerrainQueries(const BenchmarkContext& context);
+
+    // Checks and times deforming the terrain with a thousand craters a second.
+    static bool BenchmarkTerrainDeformation(const BenchmarkContext& context);
+
+    // Checks the terrain culler never culls a subtile with a visible point, ray-marching random views of random hilly terrain.
+    static bool CheckTerrainCulling(const BenchmarkContext& context);
+
+    // Logs the frame time with the horizon drawn past the view distance, compared to increasing the view distance instead.
+    // Takes the frame rate, settle frames, timed frames and maximum load seconds of each run as optional arguments, in that order.
+    static bool BenchmarkHorizon(const BenchmarkContext& context);
+
+    // Checks the palette-packed terrain types against the terrain images and logs the memory they save.
+    static bool CheckPackedTypes(const BenchmarkContext& context);
+
+    // Checks deferred destruction never reuses a resource while frames that may use it are in flight.
+    static bool CheckResourceRetirement(const BenchmarkContext& context);
+};
@@ -0,0 +1,139 @@
+#include <cstring>
+#include <fstream>
+#include "logging\Logger.h"
+#include "TerrainPack.h"
+
+const char PackMagic[4] = { 'A', 'G', 'T', 'P' };
+
+TerrainPack::TerrainPack()
+    : file(), header(), tileOffsets()
+{
+}
+
+void TerrainPack::FillHeader(glm::ivec2 min, glm::ivec2 max, TerrainPackHeader* header)
+{
+    // Clears the padding too, so packs built from the same images are identical.
+    memset(header, 0, sizeof(TerrainPackHeader));
+    memcpy(header->magic, PackMagic, sizeof(PackMagic));
+    header->version = Version;
+    header->min = min;
+    header->max = max;
+    header->subtileSize = TerrainTile::SubtileSize;
+    header->subdivisions = TerrainTile::Subdivisions;
+    header->horizonOffset = 0;
+    header->horizonSamplesPerTile = HorizonSamplesPerTile;
+}
+
+int TerrainPack::GetSubtileIndex(const glm::ivec2& subtilePos)
+{
+    return subtilePos.x + subtilePos.y * TerrainTile::Subdivisions;
+}
+
+int TerrainPack::GetTileIndex(const glm::ivec2& tile) const
+{
+    if (tile.x < header.min.x || tile.y < header.min.y || tile.x > header.max.x || tile.y > header.max.y)
+    {
+        return -1;
+    }
+
+    return (tile.x - header.min.x) + (tile.y - header.min.y) * (header.max.x - header.min.x + 1);
+}
+
+bool TerrainPack::Open(const std::string& packFile, glm::ivec2 min, glm::ivec2 max)
+{
+    std::ifstream packStream(packFile, std::ios::in | std::ios::binary);
+    if (!packStream)
+    {
+        Logger::Log("Terrain pack '", packFile, "' does not exist.");
+        return false;
+    }
+
+    TerrainPackHeader expectedHeader;
+    FillHeader(min, max, &expectedHeader);
+
+    packStream.read((char*)&header, sizeof(TerrainPackHeader));
+    if (!packStream || memcmp(header.magic, expectedHeader.magic, sizeof(PackMagic)) != 0 || header.version != expectedHeader.version ||
+        header.min != expectedHeader.min || header.max != expectedHeader.max ||
+        header.subtileSize != expectedHeader.subtileSize || header.subdivisions != expectedHeader.subdivisions ||
+        header.horizonSamplesPerTile != expectedHeader.horizonSamplesPerTile || header.horizonOffset == 0)
+    {
+        Logger::LogWarn("Terrain pack '", packFile, "' is invalid or out-of-date.");
+        return false;
+    }
+
+    tileOffsets.resize((max.x - min.x + 1) * (max.y - min.y + 1));
+    packStream.read((char*)&tileOffsets[0], tileOffsets.size() * sizeof(unsigned long long));
+    if (!packStream)
+    {
+        Logger::LogWarn("Terrain pack '", packFile, "' has a truncated tile directory.");
+        return false;
+    }
+
+    packStream.close();
+    if (!file.Open(packFile))
+    {
+        Logger::LogError("Unable to memory-map the terrain pack '", packFile, "'.");
+        return false;
+    }
+
+    Logger::Log("Opened terrain pack '", packFile, "' (", file.GetSize() / (1024 * 1024), " MiB).");
+    return true;
+}
+
+bool TerrainPack::IsOpen() const
+{
+    return file.IsOpen();
+}
+
+bool TerrainPack::MapTile(const glm::ivec2& tile, MappedView* view) const
+{
+    int tileIndex = GetTileIndex(tile);
+    if (tileIndex == -1 || tileOffsets[tileIndex] == 0)
+    {
+        return false;
+    }
+
+    return file.MapView(tileOffsets[tileIndex], TileBlockSize, view);
+}
+
+const short* TerrainPack::GetHeightmap(const MappedView& tileView, const glm::ivec2& subtilePos)
+{
+    return (const short*)(tileView.data + GetSubtileIndex(subtilePos) * RecordSize);
+}
+
+const unsigned char* TerrainPack::GetPackedTypes(const MappedView& tileView, const glm::ivec2& subtilePos)
+{
+    return tileView.data + GetSubtileIndex(subtilePos) * RecordSize + HeightmapSize;
+}
+
+glm::ivec2 TerrainPack::GetHorizonSize(glm::ivec2 min, glm::ivec2 max)
+{
+    return (max - min + glm::ivec2(1)) * HorizonSamplesPerTile;
+}
+
+size_t TerrainPack::GetHorizonByteSize(glm::ivec2 min, glm::ivec2 max)
+{
+    glm::ivec2 size = GetHorizonSize(min, max);
+    return (size_t)(size.x * size.y) * (sizeof(short) + sizeof(unsigned char));
+}
+
+bool TerrainPack::MapHorizon(MappedView* view) const
+{
+    if (!file.IsOpen())
+    {
+        return false;
+    }
+
+    return file.MapView(header.horizonOffset, GetHorizonByteSize(header.min, header.max), view);
+}
+
+const short* TerrainPack::GetHorizonHeights(const MappedView& horizonView) const
+{
+    return (const short*)horizonView.data;
+}
+
+const unsigned char* TerrainPack::GetHorizonTypes(const MappedView& horizonView) const
+{
+    glm::ivec2 size = GetHorizonSize(header.min, header.max);
+    return horizonView.data + (size_t)(size.x * size.y) * sizeof(short);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <glm\vec2.hpp>
+#include "Data\TerrainTile.h"
+#include "Utils\MappedFile.h"
+
+// Header at the start of a terrain pack, followed by the tile directory and then the tile blocks.
+struct TerrainPackHeader
+{
+    char magic[4];
+    unsigned int version;
+    glm::ivec2 min;
+    glm::ivec2 max;
+    int subtileSize;
+    int subdivisions;
+
+    // The horizon follows the tile blocks.
+    unsigned long long horizonOffset;
+    int horizonSamplesPerTile;
+};
+
+// Pre-split terrain, with every subtile stored as a fixed-size record ready to hand to OpenGL and Bullet.
+//  The directory has one offset per tile in [min, max] (row-major, 0 if the tile could not be built).
+//  Each tile block holds Subdivisions^2 records, ordered by GetSubtileIndex.
+//  Each record holds the bordered heightmap (adjusted, BorderedSubtileSize^2 shorts in [0, TerrainTile::MaxHeightValue]) followed by the SubtileSize^2 types,
+//  packed two to a byte as TerrainTypes::Palette indices.
+//  The horizon holds a low-resolution copy of the whole terrain, HorizonSamplesPerTile^2 samples per tile in [min, max] (row-major):
+//  the average height of each sample (as in the records), then the TerrainTypes::Palette index of its most common type. Missing tiles are flat lakes.
+class TerrainPack
+{
+    MappedFile file;
+    TerrainPackHeader header;
+    std::vector<unsigned long long> tileOffsets;
+
+    int GetTileIndex(const glm::ivec2& tile) const;
+
+public:
+    static const unsigned int Version = 4;
+    static const int HorizonSamplesPerTile = 10;
+    static const size_t HeightmapSize = TerrainTile::BorderedSubtileSize * TerrainTile::BorderedSubtileSize * sizeof(short);
+    static const size_t TypesSize = TerrainTile::SubtileSize * TerrainTile::SubtileSize / 2;
+    static const size_t RecordSize = HeightmapSize + TypesSize;
+    static const size_t TileBlockSize = RecordSize * TerrainTile::Subdivisions * TerrainTile::Subdivisions;
+
+    TerrainPack();
+
+    static void FillHeader(glm::ivec2 min, glm::ivec2 max, TerrainPackHeader* header);
+    static int GetSubtileIndex(const glm::ivec2& subtilePos);
+
+    // Opens the pack, failing if it is missing or was built for different tile bounds or sizes.
+    bool Open(const std::string& packFile, glm::ivec2 min, glm::ivec2 max);
+    bool IsOpen() const;
+
+    // Maps the block of a single tile. Returns false if the tile is not in the pack.
+    bool MapTile(const glm::ivec2& tile, MappedView* view) const;
+
+    static const short* GetHeightmap(const MappedView& tileView, const glm::ivec2& subtilePos);
+    static const unsigned char* GetPackedTypes(const MappedView& tileView, const glm::ivec2& subtilePos);
+
+    // Returns the number of horizon samples across the whole terrain, in each direction.
+    static glm::ivec2 GetHorizonSize(glm::ivec2 min, glm::ivec2 max);
+    static size_t GetHorizonByteSize(glm::ivec2 min, glm::ivec2 max);
+
+    // Maps the horizon. Returns false if the pack isn't open.
+    bool MapHorizon(MappedView* view) const;
+    const short* GetHorizonHeights(const MappedView& horizonView) const;
+    const unsigned char* GetHorizonTypes(const MappedView& horizonView) const;
+};
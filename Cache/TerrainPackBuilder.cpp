@@ -0,0 +1,813 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include <SFML\System.hpp>
+#include "logging\Logger.h"
+#include "Utils\ImageUtils.h"
+#include "TerrainPack.h"
+#include "TerrainPackBuilder.h"
+#include "TerrainRasterCodec.h"
+#include "TerrainRowKernels.h"
+
+TerrainPackBuilder::TerrainPackBuilder(glm::ivec2 min, glm::ivec2 max, std::string rootFolder)
+    : min(min), max(max), rootFolder(rootFolder), rawImages(min, max), decodedImages(min, max), horizonHeights(), horizonTypes()
+{
+}
+
+std::string TerrainPackBuilder::GetTileName(const glm::ivec2& tile, const char* extension) const
+{
+    std::stringstream tileName;
+    tileName << rootFolder << "/" << tile.y << "/" << tile.x << extension;
+    return tileName.str();
+}
+
+unsigned char* TerrainPackBuilder::GetRawImage(const glm::ivec2& tile)
+{
+    unsigned char** loadedImage = rawImages.Find(tile);
+    if (loadedImage != nullptr)
+    {
+        return *loadedImage;
+    }
+
+    // Prefer the compressed raster (see ConvertRasters), which decodes faster than the PNG.
+    std::vector<unsigned char>& decodedImage = decodedImages.Set(tile, std::vector<unsigned char>());
+    if (TerrainRasterCodec::LoadFile(GetTileName(tile, ".trc"), TerrainTile::TileSize, &decodedImage))
+    {
+        return rawImages.Set(tile, &decodedImage[0]);
+    }
+
+    decodedImages.Remove(tile);
+    std::string tileName = GetTileName(tile, ".png");
+
+    int width, height;
+    unsigned char* rawImage;
+    if (!ImageUtils::GetRawImage(tileName.c_str(), &rawImage, &width, &height) || width != TerrainTile::TileSize || height != TerrainTile::TileSize)
+    {
+        Logger::Log("Failed to load tile [", tile.x, ", ", tile.y, "] because of bad image/width/height: [", width, ", ", height, ".");
+        return rawImages.Set(tile, nullptr);
+    }
+
+    return rawImages.Set(tile, rawImage);
+}
+
+void TerrainPackBuilder::ReleaseRawImagesBelow(int row)
+{
+    // Removing positions reorders them, so iterate from the end.
+    const std::vector<glm::ivec2>& positions = rawImages.GetPositions();
+    for (int i = (int)positions.size() - 1; i >= 0; i--)
+    {
+        glm::ivec2 tile = positions[i];
+        if (tile.y < row)
+        {
+            // Decoded rasters are owned by decodedImages, everything else came from ImageUtils.
+            if (decodedImages.Contains(tile))
+            {
+                decodedImages.Remove(tile);
+            }
+            else if (rawImages.Get(tile) != nullptr)
+            {
+                ImageUtils::FreeRawImage(rawImages.Get(tile));
+            }
+
+            rawImages.Remove(tile);
+        }
+    }
+}
+
+bool TerrainPackBuilder::Build(const std::string& packFile)
+{
+    std::ofstream packStream(packFile, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!packStream)
+    {
+        Logger::LogError("Unable to create the terrain pack '", packFile, "'.");
+        return false;
+    }
+
+    TerrainPackHeader header;
+    TerrainPack::FillHeader(min, max, &header);
+    packStream.write((char*)&header, sizeof(TerrainPackHeader));
+
+    // Tiles that can't be built stay flat lakes in the horizon.
+    glm::ivec2 horizonSize = TerrainPack::GetHorizonSize(min, max);
+    horizonHeights.assign(horizonSize.x * horizonSize.y, 0);
+    horizonTypes.assign(horizonSize.x * horizonSize.y, TerrainTypes::GetPaletteIndex(TerrainTypes::LAKE));
+
+    // The directory is filled in as tiles are written, then written out at the end.
+    std::vector<unsigned long long> tileOffsets((max.x - min.x + 1) * (max.y - min.y + 1), 0);
+    std::streamoff directoryOffset = packStream.tellp();
+    packStream.write((char*)&tileOffsets[0], tileOffsets.size() * sizeof(unsigned long long));
+
+    int tilesWritten = 0;
+    for (int y = min.y; y <= max.y; y++)
+    {
+        for (int x = min.x; x <= max.x; x++)
+        {
+            unsigned long long tileOffset = (unsigned long long)packStream.tellp();
+            if (WriteTile(glm::ivec2(x, y), packStream))
+            {
+                tileOffsets[(x - min.x) + (y - min.y) * (max.x - min.x + 1)] = tileOffset;
+                ++tilesWritten;
+            }
+        }
+
+        // The next row only needs this row and the rows after it.
+        ReleaseRawImagesBelow(y);
+        Logger::Log("Terrain pack: built row ", y, " of ", max.y, ".");
+    }
+
+    header.horizonOffset = (unsigned long long)packStream.tellp();
+    packStream.write((char*)&horizonHeights[0], horizonHeights.size() * sizeof(short));
+    packStream.write((char*)&horizonTypes[0], horizonTypes.size());
+
+    packStream.seekp(0);
+    packStream.write((char*)&header, sizeof(TerrainPackHeader));
+    packStream.seekp(directoryOffset);
+    packStream.write((char*)&tileOffsets[0], tileOffsets.size() * sizeof(unsigned long long));
+    packStream.close();
+    if (!packStream)
+    {
+        Logger::LogError("Failed to write the terrain pack '", packFile, "'.");
+        return false;
+    }
+
+    Logger::Log("Built terrain pack '", packFile, "' with ", tilesWritten, " of ", tileOffsets.size(), " tiles, and a ", horizonSize.x, "x", horizonSize.y, " horizon.");
+    return true;
+}
+
+bool TerrainPackBuilder::LoadNeighborImages(const glm::ivec2& start, NeighborImages* images)
+{
+    // The surrounding tiles must also be decoded so that there are no boundary artifacts in terrain generation.
+    // Out-of-bounds neighbors are never read, as the edge logic clamps to the tile itself.
+    images->center = start;
+    for (int x = -1; x <= 1; x++)
+    {
+        for (int y = -1; y <= 1; y++)
+        {
+            glm::ivec2 neighbor = glm::ivec2(std::max(min.x, std::min(max.x, start.x + x)), std::max(min.y, std::min(max.y, start.y + y)));
+            images->images[x + 1][y + 1] = GetRawImage(neighbor);
+            if (images->images[x + 1][y + 1] == nullptr)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void TerrainPackBuilder::BuildSubtile(const NeighborImages& images, int i, int j, bool useReference, float* heightmap, unsigned char* types)
+{
+    int subSize = TerrainTile::BorderedSubtileSize;
+    if (useReference)
+    {
+        ReadSubtileReference(images, i, j, subSize, heightmap, types);
+    }
+    else
+    {
+        // Populate our main image a row at a time.
+        const unsigned char* rawImage = images.Get(images.center);
+        for (int y = 0; y < TerrainTile::SubtileSize; y++)
+        {
+            const unsigned char* rawRow = rawImage + (i * TerrainTile::SubtileSize + (y + j * TerrainTile::SubtileSize) * TerrainTile::TileSize) * 4;
+            TerrainRowKernels::ExtractRow(rawRow, TerrainTile::SubtileSize, &heightmap[1 + (y + 1) * subSize], &types[1 + (y + 1) * subSize]);
+        }
+    }
+
+    // Fill in edges and corners to avoid artifacts.
+    LoadHeightmapEdges(images, i, j, subSize, heightmap, types);
+    if (useReference)
+    {
+        AdjustSubtileHeightsReference(subSize, heightmap, types);
+    }
+    else
+    {
+        AdjustSubtileHeights(subSize, heightmap, types);
+    }
+}
+
+void TerrainPackBuilder::QuantizeHeights(const float* heightmap, int count, short* quantizedHeightmap)
+{
+    // Depressions can push the lowest points slightly below zero.
+    for (int i = 0; i < count; i++)
+    {
+        float height = std::min(std::max(heightmap[i], 0.0f), 1.0f);
+        quantizedHeightmap[i] = (short)(height * (float)TerrainTile::MaxHeightValue + 0.5f);
+    }
+}
+
+void TerrainPackBuilder::BuildTileBlock(const NeighborImages& images, bool useReference, unsigned char* tileBlock)
+{
+    int subSize = TerrainTile::BorderedSubtileSize;
+    std::vector<float> heightmap(subSize * subSize);
+    std::vector<unsigned char> types(subSize * subSize);
+
+    // Records are built in GetSubtileIndex order.
+    for (int j = 0; j < TerrainTile::Subdivisions; j++)
+    {
+        for (int i = 0; i < TerrainTile::Subdivisions; i++)
+        {
+            BuildSubtile(images, i, j, useReference, &heightmap[0], &types[0]);
+
+            unsigned char* record = tileBlock + TerrainPack::GetSubtileIndex(glm::ivec2(i, j)) * TerrainPack::RecordSize;
+            QuantizeHeights(&heightmap[0], subSize * subSize, (short*)record);
+
+            // Types are only needed within the subtile itself.
+            unsigned char* packedTypes = record + TerrainPack::HeightmapSize;
+            for (int y = 0; y < TerrainTile::SubtileSize; y++)
+            {
+                TerrainTypes::PackTypes(&types[1 + (y + 1) * subSize], TerrainTile::SubtileSize, &packedTypes[y * TerrainTile::SubtileSize / 2]);
+            }
+        }
+    }
+}
+
+bool TerrainPackBuilder::WriteTile(const glm::ivec2& start, std::ofstream& packStream)
+{
+    NeighborImages images;
+    if (!LoadNeighborImages(start, &images))
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> tileBlock(TerrainPack::TileBlockSize);
+    BuildTileBlock(images, false, &tileBlock[0]);
+    packStream.write((char*)&tileBlock[0], tileBlock.size());
+    AddTileToHorizon(start, &tileBlock[0]);
+    return true;
+}
+
+void TerrainPackBuilder::AddTileToHorizon(const glm::ivec2& start, const unsigned char* tileBlock)
+{
+    const int sampleSize = TerrainTile::TileSize / TerrainPack::HorizonSamplesPerTile;
+    int horizonWidth = TerrainPack::GetHorizonSize(min, max).x;
+    glm::ivec2 horizonStart = (start - min) * TerrainPack::HorizonSamplesPerTile;
+    for (int j = 0; j < TerrainPack::HorizonSamplesPerTile; j++)
+    {
+        for (int i = 0; i < TerrainPack::HorizonSamplesPerTile; i++)
+        {
+            // Heights are averaged, as the terrain pyramid does. Types are the most common, so small features don't tint whole mountainsides.
+            long heightSum = 0;
+            int typeCounts[TerrainTypes::PaletteSize] = {};
+            for (int y = j * sampleSize; y < (j + 1) * sampleSize; y++)
+            {
+                for (int x = i * sampleSize; x < (i + 1) * sampleSize; x++)
+                {
+                    glm::ivec2 subtilePos(x / TerrainTile::SubtileSize, y / TerrainTile::SubtileSize);
+                    int innerX = x % TerrainTile::SubtileSize;
+                    int innerY = y % TerrainTile::SubtileSize;
+
+                    const unsigned char* record = tileBlock + TerrainPack::GetSubtileIndex(subtilePos) * TerrainPack::RecordSize;
+                    heightSum += ((const short*)record)[(innerX + 1) + (innerY + 1) * TerrainTile::BorderedSubtileSize];
+                    ++typeCounts[TerrainTypes::GetPaletteIndex(TerrainTypes::GetPackedType(record + TerrainPack::HeightmapSize, innerX + innerY * TerrainTile::SubtileSize))];
+                }
+            }
+
+            int commonType = 0;
+            for (int type = 1; type < TerrainTypes::PaletteSize; type++)
+            {
+                if (typeCounts[type] > typeCounts[commonType])
+                {
+                    commonType = type;
+                }
+            }
+
+            int sampleIndex = (horizonStart.x + i) + (horizonStart.y + j) * horizonWidth;
+            horizonHeights[sampleIndex] = (short)(heightSum / (sampleSize * sampleSize));
+            horizonTypes[sampleIndex] = (unsigned char)commonType;
+        }
+    }
+}
+
+void TerrainPackBuilder::AdjustSubtileHeights(int subSize, float* heightmap, unsigned char* types)
+{
+    TerrainRowKernels::NormalizeTypes(types, subSize * subSize);
+    for (int y = 0; y < subSize; y++)
+    {
+        const unsigned char* typesRowAbove = &types[std::max(0, y - 1) * subSize];
+        TerrainRowKernels::LowerDepressionsRow(&types[y * subSize], typesRowAbove, subSize, &heightmap[y * subSize]);
+    }
+}
+
+void TerrainPackBuilder::ReadSubtileReference(const NeighborImages& images, int i, int j, int subSize, float* heightmap, unsigned char* types)
+{
+    for (int x = 0; x < TerrainTile::SubtileSize; x++)
+    {
+        for (int y = 0; y < TerrainTile::SubtileSize; y++)
+        {
+            int largerTilePixelId = (x + 1) + (y + 1) * subSize;
+            ReadTilePixel(images, images.center, glm::ivec2(x + i * TerrainTile::SubtileSize, y + j * TerrainTile::SubtileSize), &heightmap[largerTilePixelId], &types[largerTilePixelId]);
+        }
+    }
+}
+
+void TerrainPackBuilder::AdjustSubtileHeightsReference(int subSize, float* heightmap, unsigned char* types)
+{
+    // Normalize lakes
+    for (int x = 0; x < subSize; x++)
+    {
+        for (int y = 0; y < subSize; y++)
+        {
+            // Perform per-tile height modifications
+            switch (types[x + y * subSize])
+            {
+            case TerrainTypes::ROADS:
+            case TerrainTypes::RIVER:
+            case TerrainTypes::CITY:
+            case TerrainTypes::DIRTLAND:
+            case TerrainTypes::GRASSLAND:
+            case TerrainTypes::ROCKS:
+            case TerrainTypes::SAND:
+            case TerrainTypes::SNOW_PEAK:
+            case TerrainTypes::TREES:
+                break;
+            default:
+                // Lake isn't guaranteed to be the last item,
+                types[x + y * subSize] = TerrainTypes::LAKE;
+                break;
+            }
+        }
+    }
+
+    for (int x = 0; x < subSize; x++)
+    {
+        for (int y = 0; y < subSize; y++)
+        {
+            int xMinus = std::max(0, --x) + y * subSize;
+            int xPlus = std::min(subSize - 1, ++x) + y * subSize;
+            int yMinus = x + std::max(0, --y) * subSize;
+            int yPlus = x + std::min(subSize - 1, ++y) * subSize;
+
+            // Perform per-tile height modifications
+            switch (types[x + y * subSize])
+            {
+            case TerrainTypes::ROADS:
+                heightmap[x + y * subSize] -= (0.50f / 900.0f);
+                break;
+            case TerrainTypes::RIVER:
+                if (types[xMinus] == TerrainTypes::RIVER &&
+                    types[xPlus] == TerrainTypes::RIVER &&
+                    types[yMinus] == TerrainTypes::RIVER &&
+                    types[yPlus] == TerrainTypes::RIVER)
+                {
+                    heightmap[x + y * subSize] -= (1.0f / 900.0f);
+                }
+                break;
+            case TerrainTypes::LAKE:
+                if (types[xMinus] == TerrainTypes::LAKE &&
+                    types[xPlus] == TerrainTypes::LAKE &&
+                    types[yMinus] == TerrainTypes::LAKE &&
+                    types[yPlus] == TerrainTypes::LAKE)
+                {
+                    heightmap[x + y * subSize] -= (2.0f / 900.0f);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void TerrainPackBuilder::LoadHeightmapEdges(const NeighborImages& images, int i, int j, int subSize, float* heightmap, unsigned char* types)
+{
+    const glm::ivec2& start = images.center;
+    auto yMinusOne = [&]()
+    {
+        if (j != 0)
+        {
+            // Still within the same major tile.
+            return (TerrainTile::SubtileSize - 1) + (j - 1) * TerrainTile::SubtileSize;
+        }
+        else if (start.y != min.y)
+        {
+            // Still within the same set of tiles.
+            return (TerrainTile::SubtileSize - 1) + (TerrainTile::Subdivisions - 1) * TerrainTile::SubtileSize;
+        }
+
+        return j * TerrainTile::SubtileSize;
+    };
+
+    auto yMinusOneTile = [&]()
+    {
+        if (j != 0)
+        {
+            return start.y;
+        }
+        else if (start.y != min.y)
+        {
+            return start.y - 1;
+        }
+
+        return start.y;
+    };
+
+    auto yPlusOne = [&]()
+    {
+        if (j != TerrainTile::Subdivisions - 1)
+        {
+            // Still within the same major tile.
+            return (j + 1) * TerrainTile::SubtileSize;
+        }
+        else if (start.y != max.y)
+        {
+            // Still within the same set of tiles.
+            return 0;
+        }
+
+        return j * TerrainTile::SubtileSize;
+    };
+
+    auto yPlusOneTile = [&]()
+    {
+        if (j != TerrainTile::Subdivisions - 1)
+        {
+            return start.y;
+        }
+        else if (start.y != max.y)
+        {
+            return start.y + 1;
+        }
+
+        return start.y;
+    };
+
+    auto xMinusOne = [&]()
+    {
+        if (i != 0)
+        {
+            // Still within the same major tile.
+            return (TerrainTile::SubtileSize - 1) + (i - 1) * TerrainTile::SubtileSize;
+        }
+        else if (start.x != min.x)
+        {
+            // Still within the same set of tiles.
+            return (TerrainTile::SubtileSize - 1) + (TerrainTile::Subdivisions - 1) * TerrainTile::SubtileSize;
+        }
+
+        return i * TerrainTile::SubtileSize;
+    };
+
+    auto xMinusOneTile = [&]()
+    {
+        if (i != 0)
+        {
+            return start.x;
+        }
+        else if (start.x != min.x)
+        {
+            return start.x - 1;
+        }
+
+        return start.x;
+    };
+
+    auto xPlusOne = [&]()
+    {
+        if (i != TerrainTile::Subdivisions - 1)
+        {
+            // Still within the same major tile.
+            return (i + 1) * TerrainTile::SubtileSize;
+        }
+        else if (start.x != max.x)
+        {
+            // Still within the same set of tiles.
+            return 0;
+        }
+
+        return i * TerrainTile::SubtileSize;
+    };
+
+    auto xPlusOneTile = [&]()
+    {
+        if (i != TerrainTile::Subdivisions - 1)
+        {
+            return start.x;
+        }
+        else if (start.x != max.x)
+        {
+            return start.x + 1;
+        }
+
+        return start.x;
+    };
+
+    // Top row.
+    int yReal = yMinusOne();
+    glm::ivec2 tile = glm::ivec2(start.x, yMinusOneTile());
+    for (int x = 1; x < subSize - 1; x++)
+    {
+        int xReal = (x - 1) + i * TerrainTile::SubtileSize;
+        ReadTilePixel(images, tile, glm::ivec2(xReal, yReal), &heightmap[x], &types[x]);
+    }
+
+    // Bottom row.
+    yReal = yPlusOne();
+    tile = glm::ivec2(start.x, yPlusOneTile());
+    for (int x = 1; x < subSize - 1; x++)
+    {
+        int xReal = (x - 1) + i * TerrainTile::SubtileSize;
+        ReadTilePixel(images, tile, glm::ivec2(xReal, yReal), &heightmap[x + (subSize - 1) * subSize], &types[x + (subSize - 1) * subSize]);
+    }
+
+    // Left column.
+    int xReal = xMinusOne();
+    tile = glm::ivec2(xMinusOneTile(), start.y);
+    for (int y = 1; y < subSize - 1; y++)
+    {
+        int yReal = (y - 1) + j * TerrainTile::SubtileSize;
+        ReadTilePixel(images, tile, glm::ivec2(xReal, yReal), &heightmap[y * subSize], &types[y * subSize]);
+    }
+
+    // Right column.
+    xReal = xPlusOne();
+    tile = glm::ivec2(xPlusOneTile(), start.y);
+    for (int y = 1; y < subSize - 1; y++)
+    {
+        int yReal = (y - 1) + j * TerrainTile::SubtileSize;
+        ReadTilePixel(images, tile, glm::ivec2(xReal, yReal), &heightmap[(subSize - 1) + y * subSize], &types[(subSize - 1) + y * subSize]);
+    }
+
+    // Corners
+    tile = glm::ivec2(xMinusOneTile(), yMinusOneTile());
+    ReadTilePixel(images, tile, glm::ivec2(xMinusOne(), yMinusOne()), &heightmap[0 + 0 * subSize], &types[0 + 0 * subSize]);
+
+    tile = glm::ivec2(xPlusOneTile(), yPlusOneTile());
+    ReadTilePixel(images, tile, glm::ivec2(xPlusOne(), yPlusOne()), &heightmap[(subSize - 1) + (subSize - 1) * subSize], &types[(subSize - 1) + (subSize - 1) * subSize]);
+
+    tile = glm::ivec2(xPlusOneTile(), yMinusOneTile());
+    ReadTilePixel(images, tile, glm::ivec2(xPlusOne(), yMinusOne()), &heightmap[(subSize - 1) + 0 * subSize], &types[(subSize - 1) + 0 * subSize]);
+
+    tile = glm::ivec2(xMinusOneTile(), yPlusOneTile());
+    ReadTilePixel(images, tile, glm::ivec2(xMinusOne(), yPlusOne()), &heightmap[0 + (subSize - 1) * subSize], &types[0 + (subSize - 1) * subSize]);
+}
+
+void TerrainPackBuilder::ReadTilePixel(const NeighborImages& images, const glm::ivec2& tile, const glm::ivec2& innerTilePos, float* heightmap, unsigned char* types)
+{
+    unsigned char* rawImage = images.Get(tile);
+    *heightmap =
+        (float)((unsigned short)rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4] +
+            (((unsigned short)rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4 + 1]) << 8))
+        / (float)std::numeric_limits<unsigned short>::max();
+
+    *types = rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4 + 2];
+}
+
+bool TerrainPackBuilder::BenchmarkTile(const NeighborImages& images, const char* description)
+{
+    const int iterations = 5;
+    std::vector<unsigned char> referenceBlock(TerrainPack::TileBlockSize);
+    std::vector<unsigned char> kernelBlock(TerrainPack::TileBlockSize);
+
+    sf::Clock clock;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        BuildTileBlock(images, true, &referenceBlock[0]);
+    }
+
+    float referenceMs = (float)clock.restart().asMicroseconds() / (1000.0f * iterations);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        BuildTileBlock(images, false, &kernelBlock[0]);
+    }
+
+    float kernelMs = (float)clock.getElapsedTime().asMicroseconds() / (1000.0f * iterations);
+    bool isIdentical = memcmp(&referenceBlock[0], &kernelBlock[0], TerrainPack::TileBlockSize) == 0;
+    Logger::Log("Terrain pack kernels (", description, "): ", referenceMs, " ms per tile with per-pixel code, ", kernelMs, " ms per tile with ",
+        TerrainRowKernels::IsVectorized() ? "SSE2" : "scalar", " row kernels. Output is ", isIdentical ? "bit-identical." : "DIFFERENT!");
+    return isIdentical;
+}
+
+bool TerrainPackBuilder::BuildTileHeights(const glm::ivec2& start, std::vector<float>* heightmaps)
+{
+    NeighborImages images;
+    if (!LoadNeighborImages(start, &images))
+    {
+        return false;
+    }
+
+    const int heightmapSize = TerrainTile::BorderedSubtileSize * TerrainTile::BorderedSubtileSize;
+    heightmaps->resize(heightmapSize * TerrainTile::Subdivisions * TerrainTile::Subdivisions);
+    std::vector<unsigned char> types(heightmapSize);
+    for (int j = 0; j < TerrainTile::Subdivisions; j++)
+    {
+        for (int i = 0; i < TerrainTile::Subdivisions; i++)
+        {
+            BuildSubtile(images, i, j, false, &(*heightmaps)[TerrainPack::GetSubtileIndex(glm::ivec2(i, j)) * heightmapSize], &types[0]);
+        }
+    }
+
+    return true;
+}
+
+bool TerrainPackBuilder::LogKernelBenchmark()
+{
+    // The synthetic tile mixes every terrain type, runs of rivers and lakes, and unknown types, with random heights.
+    std::vector<unsigned char> syntheticImage(TerrainTile::TileSize * TerrainTile::TileSize * 4);
+    const unsigned char syntheticTypes[] = { TerrainTypes::SNOW_PEAK, TerrainTypes::ROCKS, TerrainTypes::TREES, TerrainTypes::DIRTLAND, TerrainTypes::GRASSLAND,
+        TerrainTypes::ROADS, TerrainTypes::CITY, TerrainTypes::SAND, TerrainTypes::RIVER, TerrainTypes::LAKE };
+    unsigned int seed = 12345;
+    unsigned char type = TerrainTypes::LAKE;
+    for (size_t pixel = 0; pixel < syntheticImage.size() / 4; pixel++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        if ((seed >> 24) < 64)
+        {
+            type = ((seed >> 16) & 0xFF) < 32 ? (unsigned char)(seed >> 8) : syntheticTypes[(seed >> 8) % 10];
+        }
+
+        syntheticImage[pixel * 4] = (unsigned char)(seed >> 4);
+        syntheticImage[pixel * 4 + 1] = (unsigned char)(seed >> 12);
+        syntheticImage[pixel * 4 + 2] = type;
+        syntheticImage[pixel * 4 + 3] = 255;
+    }
+
+    NeighborImages images;
+    images.center = min;
+    for (int x = 0; x < 3; x++)
+    {
+        for (int y = 0; y < 3; y++)
+        {
+            images.images[x][y] = &syntheticImage[0];
+        }
+    }
+
+    bool isIdentical = BenchmarkTile(images, "synthetic tile");
+
+    glm::ivec2 centerTile = (min + max) / 2;
+    if (LoadNeighborImages(centerTile, &images))
+    {
+        isIdentical = BenchmarkTile(images, "center tile") && isIdentical;
+    }
+
+    return isIdentical;
+}
+
+bool TerrainPackBuilder::CheckPackedTypes()
+{
+    int subSize = TerrainTile::BorderedSubtileSize;
+    std::vector<float> heightmap(subSize * subSize);
+    std::vector<unsigned char> types(subSize * subSize);
+    std::vector<unsigned char> packedTypes(TerrainPack::TypesSize);
+
+    int tilesChecked = 0;
+    long pixelsChecked = 0;
+    long mismatches = 0;
+    long typeCounts[TerrainTypes::PaletteSize] = { 0 };
+    glm::ivec2 centerTile = (min + max) / 2;
+    for (int x = std::max(min.x, centerTile.x - 1); x <= std::min(max.x, centerTile.x + 1); x++)
+    {
+        for (int y = std::max(min.y, centerTile.y - 1); y <= std::min(max.y, centerTile.y + 1); y++)
+        {
+            NeighborImages images;
+            if (!LoadNeighborImages(glm::ivec2(x, y), &images))
+            {
+                Logger::LogWarn("Could not load the images of tile (", x, ", ", y, ") to check its packed types.");
+                continue;
+            }
+
+            for (int j = 0; j < TerrainTile::Subdivisions; j++)
+            {
+                for (int i = 0; i < TerrainTile::Subdivisions; i++)
+                {
+                    BuildSubtile(images, i, j, false, &heightmap[0], &types[0]);
+                    for (int row = 0; row < TerrainTile::SubtileSize; row++)
+                    {
+                        TerrainTypes::PackTypes(&types[1 + (row + 1) * subSize], TerrainTile::SubtileSize, &packedTypes[row * TerrainTile::SubtileSize / 2]);
+                    }
+
+                    int builtCounts[TerrainTypes::PaletteSize] = { 0 };
+                    for (int row = 0; row < TerrainTile::SubtileSize; row++)
+                    {
+                        for (int column = 0; column < TerrainTile::SubtileSize; column++)
+                        {
+                            int builtType = types[(column + 1) + (row + 1) * subSize];
+                            if (TerrainTypes::GetPackedType(&packedTypes[0], column + row * TerrainTile::SubtileSize) != builtType)
+                            {
+                                ++mismatches;
+                            }
+
+                            ++builtCounts[TerrainTypes::GetPaletteIndex(builtType)];
+                        }
+                    }
+
+                    TerrainTypeIndex typeIndex;
+                    typeIndex.Build(&packedTypes[0], TerrainTile::SubtileSize);
+                    for (int type = 0; type < TerrainTypes::PaletteSize; type++)
+                    {
+                        if (typeIndex.GetPixelCount(TerrainTypes::Palette[type]) != builtCounts[type])
+                        {
+                            ++mismatches;
+                        }
+
+                        typeCounts[type] += builtCounts[type];
+                    }
+
+                    pixelsChecked += TerrainTile::SubtileSize * TerrainTile::SubtileSize;
+                }
+            }
+
+            ++tilesChecked;
+        }
+    }
+
+    std::stringstream typeSummary;
+    for (int type = 0; type < TerrainTypes::PaletteSize; type++)
+    {
+        typeSummary << (type == 0 ? "" : ", ") << (int)TerrainTypes::Palette[type] << ": " << typeCounts[type];
+    }
+
+    Logger::Log("Packed type check: ", tilesChecked, " tiles, ", pixelsChecked, " pixels (", typeSummary.str(), "), ", mismatches, " mismatches. ",
+        TerrainPack::TypesSize, " bytes of types per subtile, down from ", TerrainTile::SubtileSize * TerrainTile::SubtileSize, ".");
+    return tilesChecked != 0 && mismatches == 0;
+}
+
+bool TerrainPackBuilder::ConvertRasters()
+{
+    long long pngBytes = 0;
+    long long encodedBytes = 0;
+    long long usPngDecodeTime = 0;
+    long long usCodecDecodeTime = 0;
+    int tilesConverted = 0;
+
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> decoded(TerrainTile::TileSize * TerrainTile::TileSize * 4);
+    for (int y = min.y; y <= max.y; y++)
+    {
+        for (int x = min.x; x <= max.x; x++)
+        {
+            glm::ivec2 tile(x, y);
+            std::string pngName = GetTileName(tile, ".png");
+            std::ifstream pngStream(pngName, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!pngStream)
+            {
+                continue;
+            }
+
+            long long pngSize = (long long)pngStream.tellg();
+            pngStream.close();
+
+            sf::Clock clock;
+            int width, height;
+            unsigned char* rawImage;
+            if (!ImageUtils::GetRawImage(pngName.c_str(), &rawImage, &width, &height))
+            {
+                Logger::LogWarn("Unable to decode '", pngName, "', skipping it.");
+                continue;
+            }
+
+            long long usPngTime = (long long)clock.getElapsedTime().asMicroseconds();
+            if (width != TerrainTile::TileSize || height != TerrainTile::TileSize)
+            {
+                Logger::LogWarn("Skipping '", pngName, "' because it is ", width, "x", height, ".");
+                ImageUtils::FreeRawImage(rawImage);
+                continue;
+            }
+
+            bool isEncoded = TerrainRasterCodec::Encode(rawImage, TerrainTile::TileSize, &encoded);
+            if (!isEncoded)
+            {
+                Logger::LogWarn("Unable to losslessly compress '", pngName, "', leaving it as a PNG.");
+                ImageUtils::FreeRawImage(rawImage);
+                continue;
+            }
+
+            clock.restart();
+            bool isDecoded = TerrainRasterCodec::Decode(&encoded[0], encoded.size(), &decoded[0], TerrainTile::TileSize);
+            long long usCodecTime = (long long)clock.getElapsedTime().asMicroseconds();
+
+            bool isIdentical = isDecoded && std::memcmp(rawImage, &decoded[0], decoded.size()) == 0;
+            ImageUtils::FreeRawImage(rawImage);
+            if (!isIdentical)
+            {
+                Logger::LogError("Compressed raster of '", pngName, "' does not decode to the original image.");
+                return false;
+            }
+
+            if (!TerrainRasterCodec::SaveFile(GetTileName(tile, ".trc"), encoded))
+            {
+                return false;
+            }
+
+            pngBytes += pngSize;
+            encodedBytes += (long long)encoded.size();
+            usPngDecodeTime += usPngTime;
+            usCodecDecodeTime += usCodecTime;
+            ++tilesConverted;
+        }
+
+        Logger::Log("Raster conversion: converted row ", y, " of ", max.y, ".");
+    }
+
+    float tiles = (float)std::max(tilesConverted, 1);
+    Logger::Log("Converted ", tilesConverted, " terrain rasters: ", (float)pngBytes / (1024.0f * 1024.0f), " MiB as PNG and ", (float)encodedBytes / (1024.0f * 1024.0f),
+        " MiB compressed (", (float)encodedBytes * 8.0f / (tiles * TerrainTile::TileSize * TerrainTile::TileSize), " bits per pixel).");
+    Logger::Log("Raster decoding: ", (float)usPngDecodeTime / (tiles * 1000.0f), " ms per tile as PNG and ", (float)usCodecDecodeTime / (tiles * 1000.0f), " ms per tile compressed.");
+    return true;
+}
+
+TerrainPackBuilder::~TerrainPackBuilder()
+{
+    ReleaseRawImagesBelow(max.y + 1);
+}
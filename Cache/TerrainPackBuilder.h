@@ -0,0 +1,92 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glm\vec2.hpp>
+#include "Data\TerrainTile.h"
+#include "Data\TileGrid.h"
+
+// The raw images of a tile and its eight neighbors, resolved once per tile.
+struct NeighborImages
+{
+    glm::ivec2 center;
+    unsigned char* images[3][3];
+
+    unsigned char* Get(const glm::ivec2& tile) const
+    {
+        return images[tile.x - center.x + 1][tile.y - center.y + 1];
+    }
+};
+
+// Builds the terrain pack from the rasterized tile images. This is slow (every image is decoded), so it is done once offline.
+class TerrainPackBuilder
+{
+    glm::ivec2 min;
+    glm::ivec2 max;
+    std::string rootFolder;
+
+    // Holds nullptr for tiles whose images failed to load, so they aren't loaded again.
+    TileGrid<unsigned char*> rawImages;
+
+    // Images decoded from compressed rasters, which rawImages points into.
+    TileGrid<std::vector<unsigned char>> decodedImages;
+
+    // The low-resolution terrain written after the tiles, filled in as each tile is built.
+    std::vector<short> horizonHeights;
+    std::vector<unsigned char> horizonTypes;
+
+    std::string GetTileName(const glm::ivec2& tile, const char* extension) const;
+    unsigned char* GetRawImage(const glm::ivec2& tile);
+    void ReleaseRawImagesBelow(int row);
+
+    // Returns false if the tile or its neighbors could not be decoded.
+    bool LoadNeighborImages(const glm::ivec2& start, NeighborImages* images);
+
+    void LoadHeightmapEdges(const NeighborImages& images, int i, int j, int subSize, float* heightmap, unsigned char* types);
+    void ReadTilePixel(const NeighborImages& images, const glm::ivec2& tile, const glm::ivec2& innerTilePos, float* heightmap, unsigned char* types);
+    void AdjustSubtileHeights(int subSize, float* heightmap, unsigned char* types);
+
+    // The original pixel-at-a-time extraction and height adjustments, kept as the reference the row kernels are checked against.
+    void ReadSubtileReference(const NeighborImages& images, int i, int j, int subSize, float* heightmap, unsigned char* types);
+    void AdjustSubtileHeightsReference(int subSize, float* heightmap, unsigned char* types);
+
+    // Builds the bordered, normalized heightmap and types of a single subtile.
+    void BuildSubtile(const NeighborImages& images, int i, int j, bool useReference, float* heightmap, unsigned char* types);
+
+    // Builds the records of all the subtiles of a tile into a TerrainPack::TileBlockSize block.
+    void BuildTileBlock(const NeighborImages& images, bool useReference, unsigned char* tileBlock);
+
+    // Downsamples a built tile block into its horizon samples.
+    void AddTileToHorizon(const glm::ivec2& start, const unsigned char* tileBlock);
+
+    // Writes the records of all the subtiles of a tile, adding it to the horizon. Returns false if the tile or its neighbors could not be decoded.
+    bool WriteTile(const glm::ivec2& start, std::ofstream& packStream);
+
+    // Times building a tile both ways, returning false if the results differ.
+    bool BenchmarkTile(const NeighborImages& images, const char* description);
+
+public:
+    TerrainPackBuilder(glm::ivec2 min, glm::ivec2 max, std::string rootFolder);
+
+    bool Build(const std::string& packFile);
+
+    // Converts normalized heights into the 16-bit heights stored in the pack.
+    static void QuantizeHeights(const float* heightmap, int count, short* quantizedHeightmap);
+
+    // Builds the normalized heightmaps of all the subtiles of a tile, before they're quantized for the pack. Heightmaps are in TerrainPack::GetSubtileIndex order.
+    bool BuildTileHeights(const glm::ivec2& start, std::vector<float>* heightmaps);
+
+    // Logs the time to build a tile with the row kernels compared to the reference code, checking they are bit-identical.
+    //  Uses a synthetic tile covering all terrain types, and the center tile of the terrain if its images can be loaded.
+    bool LogKernelBenchmark();
+
+    // Builds the subtiles of the tiles around the center of the terrain from their images, checking every packed type reads back as the type it was built from,
+    //  and that the type index counts match. Returns false on any difference, or if none of the tiles could be loaded.
+    bool CheckPackedTypes();
+
+    // Writes a compressed raster (.trc) next to each tile image, checking it decodes back to the identical image.
+    //  Logs the sizes and decode times of both formats. Building the pack then reads the compressed rasters instead.
+    bool ConvertRasters();
+
+    virtual ~TerrainPackBuilder();
+};
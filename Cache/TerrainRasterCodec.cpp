@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "TerrainRasterCodec.h"
+
+const char RasterMagic[4] = { 'A', 'G', 'T', 'R' };
+
+// Rice codes with a quotient this large are escaped, storing the value directly instead.
+const unsigned int EscapeQuotient = 24;
+const int HeightBits = 16;
+const int RunLengthBits = 32;
+
+// Returns the number of bits needed to hold the value (0 for 0).
+static int GetBitLength(unsigned int value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse(&index, value) ? (int)index + 1 : 0;
+#else
+    return value == 0 ? 0 : 32 - __builtin_clz(value);
+#endif
+}
+
+// Reads 8 bytes as a big-endian value.
+static unsigned long long LoadBigEndian64(const unsigned char* data)
+{
+    unsigned long long value;
+    memcpy(&value, data, sizeof(value));
+#ifdef _MSC_VER
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// Picks the Rice parameter from the average of the recent values, halving the history periodically so it adapts.
+struct RiceContext
+{
+    unsigned int valueSum;
+    unsigned int count;
+
+    RiceContext()
+        : valueSum(4), count(1)
+    {
+    }
+
+    // The smallest parameter where count << parameter >= valueSum, which is within one of the difference in their bit lengths.
+    int GetParameter() const
+    {
+        int parameter = std::max(GetBitLength(valueSum) - GetBitLength(count), 0);
+        return (count << parameter) < valueSum ? parameter + 1 : parameter;
+    }
+
+    void Update(unsigned int value)
+    {
+        valueSum += value;
+        if (++count == 64)
+        {
+            valueSum >>= 1;
+            count >>= 1;
+        }
+    }
+};
+
+// Writes bits most-significant first.
+class RasterBitWriter
+{
+    std::vector<unsigned char>* output;
+    unsigned long long buffer;
+    int bitCount;
+
+public:
+    RasterBitWriter(std::vector<unsigned char>* output)
+        : output(output), buffer(0), bitCount(0)
+    {
+    }
+
+    // Writes the low bits of the value, up to 32 bits.
+    void WriteBits(unsigned int value, int bits)
+    {
+        buffer = (buffer << bits) | value;
+        bitCount += bits;
+        while (bitCount >= 8)
+        {
+            bitCount -= 8;
+            output->push_back((unsigned char)(buffer >> bitCount));
+        }
+    }
+
+    // Writes the quotient in unary (zeros ended by a one), then the remainder.
+    void WriteRice(unsigned int value, int parameter, int escapeBits)
+    {
+        unsigned int quotient = value >> parameter;
+        if (quotient < EscapeQuotient)
+        {
+            WriteBits(1, quotient + 1);
+            if (parameter != 0)
+            {
+                WriteBits(value & ((1u << parameter) - 1), parameter);
+            }
+        }
+        else
+        {
+            WriteBits(0, EscapeQuotient);
+            WriteBits(value, escapeBits);
+        }
+    }
+
+    void Flush()
+    {
+        if (bitCount > 0)
+        {
+            WriteBits(0, 8 - bitCount);
+        }
+    }
+};
+
+// Reads bits written by RasterBitWriter. Reading past the end reads zeros, which IsValid detects.
+class RasterBitReader
+{
+    const unsigned char* data;
+    const unsigned char* end;
+    unsigned long long buffer;
+    int bitCount;
+    int paddingBytes;
+
+    void Refill()
+    {
+        // Away from the end, top up the buffer with whole bytes in one load.
+        if (end - data >= 8)
+        {
+            buffer |= LoadBigEndian64(data) >> bitCount;
+            data += (63 - bitCount) >> 3;
+            bitCount |= 56;
+            return;
+        }
+
+        while (bitCount <= 56)
+        {
+            unsigned long long next = 0;
+            if (data < end)
+            {
+                next = *data++;
+            }
+            else
+            {
+                ++paddingBytes;
+            }
+
+            buffer |= next << (56 - bitCount);
+            bitCount += 8;
+        }
+    }
+
+public:
+    RasterBitReader(const unsigned char* data, size_t size)
+        : data(data), end(data + size), buffer(0), bitCount(0), paddingBytes(0)
+    {
+        Refill();
+    }
+
+    // Reads up to 32 bits.
+    unsigned int ReadBits(int bits)
+    {
+        if (bitCount < bits)
+        {
+            Refill();
+        }
+
+        // Shifting twice reads no bits (instead of shifting by 64) when there are none to read.
+        unsigned int value = (unsigned int)((buffer >> 1) >> (63 - bits));
+        buffer <<= bits;
+        bitCount -= bits;
+        return value;
+    }
+
+    unsigned int ReadRice(int parameter, int escapeBits)
+    {
+        Refill();
+        unsigned int highBits = (unsigned int)(buffer >> 32);
+        unsigned int quotient = highBits != 0 ? 32 - GetBitLength(highBits) : 64 - GetBitLength((unsigned int)buffer);
+        if (quotient >= EscapeQuotient)
+        {
+            buffer <<= EscapeQuotient;
+            bitCount -= EscapeQuotient;
+            return ReadBits(escapeBits);
+        }
+
+        // Skip the zeros and the one ending them.
+        buffer <<= quotient + 1;
+        bitCount -= quotient + 1;
+        return (quotient << parameter) | ReadBits(parameter);
+    }
+
+    // Returns false if more bits were read than there were.
+    bool IsValid() const
+    {
+        return paddingBytes * 8 <= bitCount;
+    }
+};
+
+// The LOCO-I median predictor, which picks the left or upper neighbor across an edge and the plane through all three neighbors otherwise.
+//  This is the median of the left, upper, and planar predictions, written without branches as they are unpredictable on rough terrain.
+static int PredictHeight(int left, int up, int upLeft)
+{
+    return std::max(std::min(left, up), std::min(std::max(left, up), left + up - upLeft));
+}
+
+// Picks the context from how rough the terrain around the pixel is, which is roughly the log2 of the neighbor differences.
+static int GetHeightContext(int left, int up, int upLeft, int upRight, int contextCount)
+{
+    int activity = std::abs(left - upLeft) + std::abs(up - upLeft) + std::abs(upRight - up);
+    return std::min(GetBitLength((unsigned int)activity), contextCount - 1);
+}
+
+// Gets the neighbors of a pixel from the current and previous rows. Missing neighbors are copied from those that exist.
+static void GetNeighbors(const unsigned short* row, const unsigned short* previousRow, int x, int y, int size, int* left, int* up, int* upLeft, int* upRight)
+{
+    if (y == 0)
+    {
+        *left = x == 0 ? 0 : row[x - 1];
+        *up = *left;
+        *upLeft = *left;
+        *upRight = *left;
+        return;
+    }
+
+    *up = previousRow[x];
+    *upLeft = x == 0 ? *up : previousRow[x - 1];
+    *left = x == 0 ? *up : row[x - 1];
+    *upRight = x == size - 1 ? *up : previousRow[x + 1];
+}
+
+bool TerrainRasterCodec::Encode(const unsigned char* rgbaImage, int size, std::vector<unsigned char>* encoded)
+{
+    int pixelCount = size * size;
+    for (int i = 0; i < pixelCount; i++)
+    {
+        if (rgbaImage[i * 4 + 3] != 255)
+        {
+            return false;
+        }
+    }
+
+    std::vector<unsigned char> heightStream;
+    RasterBitWriter heightWriter(&heightStream);
+    RiceContext heightContexts[ContextCount];
+    std::vector<unsigned short> rows[2] = { std::vector<unsigned short>(size), std::vector<unsigned short>(size) };
+    for (int y = 0; y < size; y++)
+    {
+        unsigned short* row = &rows[y % 2][0];
+        const unsigned short* previousRow = &rows[(y + 1) % 2][0];
+        const unsigned char* pixel = rgbaImage + y * size * 4;
+        for (int x = 0; x < size; x++, pixel += 4)
+        {
+            row[x] = (unsigned short)(pixel[0] + (pixel[1] << 8));
+
+            int left, up, upLeft, upRight;
+            GetNeighbors(row, previousRow, x, y, size, &left, &up, &upLeft, &upRight);
+
+            // Residuals wrap around, so they always fit in 16 bits. Zigzag them so small negatives stay small.
+            short residual = (short)(row[x] - PredictHeight(left, up, upLeft));
+            unsigned int value = residual >= 0 ? (unsigned int)residual * 2 : (unsigned int)(-(residual + 1)) * 2 + 1;
+
+            RiceContext& context = heightContexts[GetHeightContext(left, up, upLeft, upRight, ContextCount)];
+            heightWriter.WriteRice(value, context.GetParameter(), HeightBits);
+            context.Update(value);
+        }
+    }
+
+    heightWriter.Flush();
+
+    std::vector<unsigned char> typeStream;
+    RasterBitWriter typeWriter(&typeStream);
+    RiceContext runContext;
+    for (int runStart = 0; runStart < pixelCount;)
+    {
+        unsigned char type = rgbaImage[runStart * 4 + 2];
+        int runEnd = runStart + 1;
+        while (runEnd < pixelCount && rgbaImage[runEnd * 4 + 2] == type)
+        {
+            ++runEnd;
+        }
+
+        unsigned int runLength = (unsigned int)(runEnd - runStart - 1);
+        typeWriter.WriteBits(type, 8);
+        typeWriter.WriteRice(runLength, runContext.GetParameter(), RunLengthBits);
+        runContext.Update(runLength);
+        runStart = runEnd;
+    }
+
+    typeWriter.Flush();
+
+    TerrainRasterHeader header;
+    memcpy(header.magic, RasterMagic, sizeof(RasterMagic));
+    header.version = Version;
+    header.size = (unsigned int)size;
+    header.heightStreamSize = (unsigned int)heightStream.size();
+    header.typeStreamSize = (unsigned int)typeStream.size();
+
+    encoded->resize(sizeof(TerrainRasterHeader) + heightStream.size() + typeStream.size());
+    memcpy(&(*encoded)[0], &header, sizeof(TerrainRasterHeader));
+    memcpy(&(*encoded)[sizeof(TerrainRasterHeader)], &heightStream[0], heightStream.size());
+    memcpy(&(*encoded)[sizeof(TerrainRasterHeader) + heightStream.size()], &typeStream[0], typeStream.size());
+    return true;
+}
+
+bool TerrainRasterCodec::Decode(const unsigned char* encoded, size_t encodedSize, unsigned char* rgbaImage, int size)
+{
+    TerrainRasterHeader header;
+    if (encodedSize < sizeof(TerrainRasterHeader))
+    {
+        return false;
+    }
+
+    memcpy(&header, encoded, sizeof(TerrainRasterHeader));
+    if (memcmp(header.magic, RasterMagic, sizeof(RasterMagic)) != 0 || header.version != Version || header.size != (unsigned int)size ||
+        (size_t)header.heightStreamSize + (size_t)header.typeStreamSize != encodedSize - sizeof(TerrainRasterHeader))
+    {
+        return false;
+    }
+
+    RasterBitReader heightReader(encoded + sizeof(TerrainRasterHeader), header.heightStreamSize);
+    RiceContext heightContexts[ContextCount];
+    std::vector<unsigned short> rows[2] = { std::vector<unsigned short>(size), std::vector<unsigned short>(size) };
+    for (int y = 0; y < size; y++)
+    {
+        unsigned short* row = &rows[y % 2][0];
+        const unsigned short* previousRow = &rows[(y + 1) % 2][0];
+        unsigned char* pixel = rgbaImage + y * size * 4;
+        for (int x = 0; x < size; x++, pixel += 4)
+        {
+            int left, up, upLeft, upRight;
+            GetNeighbors(row, previousRow, x, y, size, &left, &up, &upLeft, &upRight);
+
+            RiceContext& context = heightContexts[GetHeightContext(left, up, upLeft, upRight, ContextCount)];
+            unsigned int value = heightReader.ReadRice(context.GetParameter(), HeightBits);
+            context.Update(value);
+
+            int residual = (value & 1) != 0 ? -(int)(value >> 1) - 1 : (int)(value >> 1);
+            row[x] = (unsigned short)(PredictHeight(left, up, upLeft) + residual);
+            pixel[0] = (unsigned char)(row[x] & 0xFF);
+            pixel[1] = (unsigned char)(row[x] >> 8);
+            pixel[3] = 255;
+        }
+    }
+
+    RasterBitReader typeReader(encoded + sizeof(TerrainRasterHeader) + header.heightStreamSize, header.typeStreamSize);
+    RiceContext runContext;
+    int pixelCount = size * size;
+    for (int runStart = 0; runStart < pixelCount;)
+    {
+        unsigned char type = (unsigned char)typeReader.ReadBits(8);
+        unsigned int runLength = typeReader.ReadRice(runContext.GetParameter(), RunLengthBits);
+        runContext.Update(runLength);
+        if (runLength >= (unsigned int)(pixelCount - runStart) || !typeReader.IsValid())
+        {
+            return false;
+        }
+
+        int runEnd = runStart + (int)runLength + 1;
+        for (int i = runStart; i < runEnd; i++)
+        {
+            rgbaImage[i * 4 + 2] = type;
+        }
+
+        runStart = runEnd;
+    }
+
+    return heightReader.IsValid() && typeReader.IsValid();
+}
+
+bool TerrainRasterCodec::LoadFile(const std::string& filename, int size, std::vector<unsigned char>* rgbaImage)
+{
+    std::ifstream stream(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!stream)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> encoded((size_t)stream.tellg());
+    stream.seekg(0);
+    if (encoded.empty() || !stream.read((char*)&encoded[0], encoded.size()))
+    {
+        return false;
+    }
+
+    rgbaImage->resize(size * size * 4);
+    return Decode(&encoded[0], encoded.size(), &(*rgbaImage)[0], size);
+}
+
+bool TerrainRasterCodec::SaveFile(const std::string& filename, const std::vector<unsigned char>& encoded)
+{
+    std::ofstream stream(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    stream.write((const char*)&encoded[0], encoded.size());
+    stream.close();
+    return !stream.fail();
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct TerrainRasterHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int size;
+    unsigned int heightStreamSize;
+    unsigned int typeStreamSize;
+};
+
+// Losslessly compresses the rasterized RGBA tile images, which hold a 16-bit height in R + G << 8 and the terrain type in B (alpha is always 255).
+//  Heights are predicted from their left, upper and upper-left neighbors (the LOCO-I median predictor), and the residuals are Rice coded.
+//  The Rice parameter adapts to the recent residuals in one of several contexts chosen by how rough the surrounding terrain is.
+//  Types are stored as runs (in row-major order), with Rice-coded run lengths.
+class TerrainRasterCodec
+{
+    static const int ContextCount = 12;
+
+public:
+    static const unsigned int Version = 1;
+
+    // Encodes a size x size RGBA image. Returns false if the image can't be stored losslessly (alpha isn't always 255).
+    static bool Encode(const unsigned char* rgbaImage, int size, std::vector<unsigned char>* encoded);
+
+    // Decodes into a size x size RGBA image. Returns false if the data is corrupt or isn't an image of that size.
+    static bool Decode(const unsigned char* encoded, size_t encodedSize, unsigned char* rgbaImage, int size);
+
+    // Reads and decodes an encoded file into a size x size RGBA image. Returns false (without logging) if the file doesn't exist.
+    static bool LoadFile(const std::string& filename, int size, std::vector<unsigned char>* rgbaImage);
+    static bool SaveFile(const std::string& filename, const std::vector<unsigned char>& encoded);
+};
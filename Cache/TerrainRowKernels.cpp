@@ -0,0 +1,173 @@
+#include <limits>
+#include "Data\TerrainTile.h"
+#include "TerrainRowKernels.h"
+
+#ifdef TERRAIN_ROW_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+const float MaxRawHeight = (float)std::numeric_limits<unsigned short>::max();
+
+static bool IsKnownType(unsigned char type)
+{
+    switch (type)
+    {
+    case TerrainTypes::ROADS:
+    case TerrainTypes::RIVER:
+    case TerrainTypes::CITY:
+    case TerrainTypes::DIRTLAND:
+    case TerrainTypes::GRASSLAND:
+    case TerrainTypes::ROCKS:
+    case TerrainTypes::SAND:
+    case TerrainTypes::SNOW_PEAK:
+    case TerrainTypes::TREES:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void LowerDepressionPixel(const unsigned char* typesRow, const unsigned char* typesRowAbove, int x, float* heightsRow)
+{
+    unsigned char type = typesRow[x];
+    unsigned char left = typesRow[x == 0 ? 0 : x - 1];
+    unsigned char above = typesRowAbove[x];
+    if (type == TerrainTypes::ROADS)
+    {
+        heightsRow[x] -= RoadDepression;
+    }
+    else if (type == TerrainTypes::RIVER && left == TerrainTypes::RIVER && above == TerrainTypes::RIVER)
+    {
+        heightsRow[x] -= RiverDepression;
+    }
+    else if (type == TerrainTypes::LAKE && left == TerrainTypes::LAKE && above == TerrainTypes::LAKE)
+    {
+        heightsRow[x] -= LakeDepression;
+    }
+}
+
+bool TerrainRowKernels::IsVectorized()
+{
+#ifdef TERRAIN_ROW_KERNELS_SSE2
+    return true;
+#else
+    return false;
+#endif
+}
+
+void TerrainRowKernels::ExtractRow(const unsigned char* rgbaPixels, int count, float* heights, unsigned char* types)
+{
+    int i = 0;
+#ifdef TERRAIN_ROW_KERNELS_SSE2
+    // Four pixels at a time. Division (not a reciprocal multiply) keeps the heights identical to the scalar code.
+    const __m128i lowWordMask = _mm_set1_epi32(0xFFFF);
+    const __m128i lowByteMask = _mm_set1_epi32(0xFF);
+    const __m128 maxHeight = _mm_set1_ps(MaxRawHeight);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(rgbaPixels + i * 4));
+        __m128 height = _mm_cvtepi32_ps(_mm_and_si128(pixels, lowWordMask));
+        _mm_storeu_ps(heights + i, _mm_div_ps(height, maxHeight));
+
+        __m128i type = _mm_and_si128(_mm_srli_epi32(pixels, 16), lowByteMask);
+        type = _mm_packs_epi32(type, type);
+        type = _mm_packus_epi16(type, type);
+        int packedTypes = _mm_cvtsi128_si32(type);
+        types[i] = (unsigned char)(packedTypes & 0xFF);
+        types[i + 1] = (unsigned char)((packedTypes >> 8) & 0xFF);
+        types[i + 2] = (unsigned char)((packedTypes >> 16) & 0xFF);
+        types[i + 3] = (unsigned char)((packedTypes >> 24) & 0xFF);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const unsigned char* pixel = rgbaPixels + i * 4;
+        heights[i] = (float)((unsigned short)pixel[0] + (((unsigned short)pixel[1]) << 8)) / MaxRawHeight;
+        types[i] = pixel[2];
+    }
+}
+
+void TerrainRowKernels::NormalizeTypes(unsigned char* types, int count)
+{
+    int i = 0;
+#ifdef TERRAIN_ROW_KERNELS_SSE2
+    const unsigned char knownTypes[] = { TerrainTypes::ROADS, TerrainTypes::RIVER, TerrainTypes::CITY, TerrainTypes::DIRTLAND, TerrainTypes::GRASSLAND,
+        TerrainTypes::ROCKS, TerrainTypes::SAND, TerrainTypes::SNOW_PEAK, TerrainTypes::TREES };
+    const __m128i lake = _mm_set1_epi8((char)TerrainTypes::LAKE);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i type = _mm_loadu_si128((const __m128i*)(types + i));
+        __m128i isKnown = _mm_setzero_si128();
+        for (unsigned char knownType : knownTypes)
+        {
+            isKnown = _mm_or_si128(isKnown, _mm_cmpeq_epi8(type, _mm_set1_epi8((char)knownType)));
+        }
+
+        type = _mm_or_si128(_mm_and_si128(isKnown, type), _mm_andnot_si128(isKnown, lake));
+        _mm_storeu_si128((__m128i*)(types + i), type);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if (!IsKnownType(types[i]))
+        {
+            types[i] = TerrainTypes::LAKE;
+        }
+    }
+}
+
+void TerrainRowKernels::LowerDepressionsRow(const unsigned char* typesRow, const unsigned char* typesRowAbove, int count, float* heightsRow)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // The first pixel has no left neighbor, so is handled separately.
+    LowerDepressionPixel(typesRow, typesRowAbove, 0, heightsRow);
+
+    int x = 1;
+#ifdef TERRAIN_ROW_KERNELS_SSE2
+    // Sixteen types at a time, expanded to four lanes of four heights. Unaffected heights subtract zero, which doesn't change them.
+    const __m128i roads = _mm_set1_epi8((char)TerrainTypes::ROADS);
+    const __m128i river = _mm_set1_epi8((char)TerrainTypes::RIVER);
+    const __m128i lake = _mm_set1_epi8((char)TerrainTypes::LAKE);
+    const __m128 roadDepression = _mm_set1_ps(RoadDepression);
+    const __m128 riverDepression = _mm_set1_ps(RiverDepression);
+    const __m128 lakeDepression = _mm_set1_ps(LakeDepression);
+    for (; x + 16 <= count; x += 16)
+    {
+        __m128i type = _mm_loadu_si128((const __m128i*)(typesRow + x));
+        __m128i left = _mm_loadu_si128((const __m128i*)(typesRow + x - 1));
+        __m128i above = _mm_loadu_si128((const __m128i*)(typesRowAbove + x));
+
+        __m128i isRoad = _mm_cmpeq_epi8(type, roads);
+        __m128i isRiver = _mm_and_si128(_mm_cmpeq_epi8(type, river), _mm_and_si128(_mm_cmpeq_epi8(left, river), _mm_cmpeq_epi8(above, river)));
+        __m128i isLake = _mm_and_si128(_mm_cmpeq_epi8(type, lake), _mm_and_si128(_mm_cmpeq_epi8(left, lake), _mm_cmpeq_epi8(above, lake)));
+
+        __m128i roadWords[2] = { _mm_unpacklo_epi8(isRoad, isRoad), _mm_unpackhi_epi8(isRoad, isRoad) };
+        __m128i riverWords[2] = { _mm_unpacklo_epi8(isRiver, isRiver), _mm_unpackhi_epi8(isRiver, isRiver) };
+        __m128i lakeWords[2] = { _mm_unpacklo_epi8(isLake, isLake), _mm_unpackhi_epi8(isLake, isLake) };
+        for (int lane = 0; lane < 4; lane++)
+        {
+            int half = lane / 2;
+            __m128i roadMask = (lane % 2 == 0) ? _mm_unpacklo_epi16(roadWords[half], roadWords[half]) : _mm_unpackhi_epi16(roadWords[half], roadWords[half]);
+            __m128i riverMask = (lane % 2 == 0) ? _mm_unpacklo_epi16(riverWords[half], riverWords[half]) : _mm_unpackhi_epi16(riverWords[half], riverWords[half]);
+            __m128i lakeMask = (lane % 2 == 0) ? _mm_unpacklo_epi16(lakeWords[half], lakeWords[half]) : _mm_unpackhi_epi16(lakeWords[half], lakeWords[half]);
+
+            __m128 depression = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(roadMask), roadDepression),
+                _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(riverMask), riverDepression), _mm_and_ps(_mm_castsi128_ps(lakeMask), lakeDepression)));
+
+            float* heights = heightsRow + x + lane * 4;
+            _mm_storeu_ps(heights, _mm_sub_ps(_mm_loadu_ps(heights), depression));
+        }
+    }
+#endif
+
+    for (; x < count; x++)
+    {
+        LowerDepressionPixel(typesRow, typesRowAbove, x, heightsRow);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "Data\TerrainTypes.h"
+
+// Uses SSE2 when the compiler targets it (always on x64, and on x86 with /arch:SSE2, the MSVC default), otherwise falls back to scalar code.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TERRAIN_ROW_KERNELS_SSE2
+#endif
+
+// Must match the per-pixel constants exactly to stay bit-identical.
+const float RoadDepression = 0.50f / 900.0f;
+const float RiverDepression = 1.0f / 900.0f;
+const float LakeDepression = 2.0f / 900.0f;
+
+// Row-at-a-time kernels used to build terrain pack records from the rasterized RGBA tile images.
+// All kernels give bit-identical results to the per-pixel code they replace.
+class TerrainRowKernels
+{
+public:
+    static bool IsVectorized();
+
+    // Converts RGBA pixels into normalized heights (from R + G << 8) and raw types (from B).
+    static void ExtractRow(const unsigned char* rgbaPixels, int count, float* heights, unsigned char* types);
+
+    // Replaces unknown terrain types with lakes.
+    static void NormalizeTypes(unsigned char* types, int count);
+
+    // Lowers roads, and rivers and lakes surrounded by the same type.
+    // The surrounding test only checks the pixel to the left and the pixel above (clamped to the row itself on the edges), matching the original depression pass.
+    static void LowerDepressionsRow(const unsigned char* typesRow, const unsigned char* typesRowAbove, int count, float* heightsRow);
+
+    // Lowers depressions a pixel at a time over a whole subtile stored in any SubtileLayout, giving the same heights as LowerDepressionsRow.
+    //  Used to compare layouts; the pack builder uses the row kernel.
+    template <typename Layout>
+    static void LowerDepressions(const Layout& layout, const unsigned char* types, float* heights)
+    {
+        layout.ForEachPixel([&](int x, int y, int index)
+        {
+            unsigned char type = types[index];
+            unsigned char left = types[x == 0 ? index : layout.GetLeft(index)];
+            unsigned char above = types[y == 0 ? index : layout.GetUp(index)];
+            if (type == TerrainTypes::ROADS)
+            {
+                heights[index] -= RoadDepression;
+            }
+            else if (type == TerrainTypes::RIVER && left == TerrainTypes::RIVER && above == TerrainTypes::RIVER)
+            {
+                heights[index] -= RiverDepression;
+            }
+            else if (type == TerrainTypes::LAKE && left == TerrainTypes::LAKE && above == TerrainTypes::LAKE)
+            {
+                heights[index] -= LakeDepression;
+            }
+        });
+    }
+};
@@ -0,0 +1,70 @@
+#include "logging\Logger.h"
+#include "TerrainConfig.h"
+
+int TerrainConfig::LoaderThreads;
+float TerrainConfig::UploadBudgetMs;
+float TerrainConfig::ActivationBudgetMs;
+float TerrainConfig::PrefetchSeconds;
+float TerrainConfig::MinPrefetchSpeed;
+int TerrainConfig::RegionCacheBudgetMiB;
+float TerrainConfig::RegionCacheHysteresis;
+float TerrainConfig::LodFullDetailDistance;
+float TerrainConfig::CullingHeightMargin;
+float TerrainConfig::PhysicsRadius;
+float TerrainConfig::PhysicsLookaheadSeconds;
+int TerrainConfig::PhysicsRetireFrames;
+int TerrainConfig::RetireDelayFrames;
+float TerrainConfig::RetireBudgetMs;
+bool TerrainConfig::HorizonEnabled;
+int TerrainConfig::EffectBuildThreads;
+float TerrainConfig::GrassFullDensityDistance;
+float TerrainConfig::GrassMaxDistance;
+
+bool TerrainConfig::LoadConfigValues(std::vector<std::string>& configFileLines)
+{
+    return (ReadInt(configFileLines, LoaderThreads, "Error decoding the terrain loader thread count!") &&
+        ReadFloat(configFileLines, UploadBudgetMs, "Error reading in the terrain upload budget!") &&
+        ReadFloat(configFileLines, ActivationBudgetMs, "Error reading in the terrain activation budget!") &&
+        ReadFloat(configFileLines, PrefetchSeconds, "Error reading in the terrain prefetch time!") &&
+        ReadFloat(configFileLines, MinPrefetchSpeed, "Error reading in the terrain minimum prefetch speed!") &&
+        ReadInt(configFileLines, RegionCacheBudgetMiB, "Error decoding the region cache budget!") &&
+        ReadFloat(configFileLines, RegionCacheHysteresis, "Error reading in the region cache hysteresis!") &&
+        ReadFloat(configFileLines, LodFullDetailDistance, "Error reading in the terrain full detail distance!") &&
+        ReadFloat(configFileLines, CullingHeightMargin, "Error reading in the terrain culling height margin!") &&
+        ReadFloat(configFileLines, PhysicsRadius, "Error reading in the terrain physics radius!") &&
+        ReadFloat(configFileLines, PhysicsLookaheadSeconds, "Error reading in the terrain physics lookahead time!") &&
+        ReadInt(configFileLines, PhysicsRetireFrames, "Error decoding the terrain physics retire frame count!") &&
+        ReadInt(configFileLines, RetireDelayFrames, "Error decoding the terrain retire delay frame count!") &&
+        ReadFloat(configFileLines, RetireBudgetMs, "Error reading in the terrain retire budget!") &&
+        ReadBool(configFileLines, HorizonEnabled, "Error decoding the horizon toggle!") &&
+        ReadInt(configFileLines, EffectBuildThreads, "Error decoding the terrain effect build thread count!") &&
+        ReadFloat(configFileLines, GrassFullDensityDistance, "Error reading in the grass full density distance!") &&
+        ReadFloat(configFileLines, GrassMaxDistance, "Error reading in the grass max distance!"));
+}
+
+void TerrainConfig::WriteConfigValues()
+{
+    WriteInt("LoaderThreads", LoaderThreads);
+    WriteFloat("UploadBudgetMs", UploadBudgetMs);
+    WriteFloat("ActivationBudgetMs", ActivationBudgetMs);
+    WriteFloat("PrefetchSeconds", PrefetchSeconds);
+    WriteFloat("MinPrefetchSpeed", MinPrefetchSpeed);
+    WriteInt("RegionCacheBudgetMiB", RegionCacheBudgetMiB);
+    WriteFloat("RegionCacheHysteresis", RegionCacheHysteresis);
+    WriteFloat("LodFullDetailDistance", LodFullDetailDistance);
+    WriteFloat("CullingHeightMargin", CullingHeightMargin);
+    WriteFloat("PhysicsRadius", PhysicsRadius);
+    WriteFloat("PhysicsLookaheadSeconds", PhysicsLookaheadSeconds);
+    WriteInt("PhysicsRetireFrames", PhysicsRetireFrames);
+    WriteInt("RetireDelayFrames", RetireDelayFrames);
+    WriteFloat("RetireBudgetMs", RetireBudgetMs);
+    WriteBool("HorizonEnabled", HorizonEnabled);
+    WriteInt("EffectBuildThreads", EffectBuildThreads);
+    WriteFloat("GrassFullDensityDistance", GrassFullDensityDistance);
+    WriteFloat("GrassMaxDistance", GrassMaxDistance);
+}
+
+TerrainConfig::TerrainConfig(const char* configName)
+    : ConfigManager(configName)
+{
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Managers\ConfigManager.h"
+
+class TerrainConfig : public ConfigManager
+{
+    virtual bool LoadConfigValues(std::vector<std::string>& lines);
+    virtual void WriteConfigValues();
+public:
+    static int LoaderThreads;
+    static float UploadBudgetMs;
+    static float ActivationBudgetMs;
+    static float PrefetchSeconds;
+    static float MinPrefetchSpeed;
+    static int RegionCacheBudgetMiB;
+    static float RegionCacheHysteresis;
+    static float LodFullDetailDistance;
+    static float CullingHeightMargin;
+    static float PhysicsRadius;
+    static float PhysicsLookaheadSeconds;
+    static int PhysicsRetireFrames;
+    static int RetireDelayFrames;
+    static float RetireBudgetMs;
+    static bool HorizonEnabled;
+    static int EffectBuildThreads;
+    static float GrassFullDensityDistance;
+    static float GrassMaxDistance;
+
+    TerrainConfig(const char* configName);
+};
+
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <glm\vec2.hpp>
+
+// Holds one type of terrain effect for every resident subtile that has it, in parallel arrays.
+//  Entries are packed at the front of each array, so passes over all of the effects stream through memory instead of chasing per-subtile allocations.
+//  Subtiles are identified by a small slot number, with the slot to entry mapping kept separately so removal stays O(1).
+template <typename T>
+class EffectPool
+{
+    std::vector<glm::ivec2> subtileIds;
+    std::vector<int> entrySlots;
+    std::vector<T> effects;
+
+    // Index of each slot's entry, or -1 if the slot's subtile doesn't have this effect.
+    std::vector<int> slotEntries;
+
+    // How many times the arrays have had to grow.
+    long allocations;
+
+public:
+    EffectPool()
+        : subtileIds(), entrySlots(), effects(), slotEntries(), allocations(0)
+    {
+    }
+
+    // Adds the effect of a subtile, returning the effect in its new home. *The slot must not already have an effect.*
+    T& Add(int slot, const glm::ivec2& subtileId, T&& effect)
+    {
+        if (slot >= (int)slotEntries.size())
+        {
+            slotEntries.resize(slot + 1, -1);
+            ++allocations;
+        }
+
+        if (effects.size() == effects.capacity())
+        {
+            allocations += 3;
+        }
+
+        slotEntries[slot] = (int)effects.size();
+        subtileIds.push_back(subtileId);
+        entrySlots.push_back(slot);
+        effects.push_back(std::move(effect));
+        return effects.back();
+    }
+
+    // Removes the effect of a slot, returning whether there was one. The effect is moved into removedEffect.
+    bool Remove(int slot, T* removedEffect)
+    {
+        if (slot >= (int)slotEntries.size() || slotEntries[slot] == -1)
+        {
+            return false;
+        }
+
+        // Move the last entry into the removed entry's place to keep the arrays packed.
+        int entry = slotEntries[slot];
+        int lastEntry = (int)effects.size() - 1;
+        *removedEffect = std::move(effects[entry]);
+        if (entry != lastEntry)
+        {
+            subtileIds[entry] = subtileIds[lastEntry];
+            entrySlots[entry] = entrySlots[lastEntry];
+            effects[entry] = std::move(effects[lastEntry]);
+            slotEntries[entrySlots[entry]] = entry;
+        }
+
+        subtileIds.pop_back();
+        entrySlots.pop_back();
+        effects.pop_back();
+        slotEntries[slot] = -1;
+        return true;
+    }
+
+    // Returns the effect of a slot, or nullptr if its subtile doesn't have this effect.
+    const T* Find(int slot) const
+    {
+        return slot < (int)slotEntries.size() && slotEntries[slot] != -1 ? &effects[slotEntries[slot]] : nullptr;
+    }
+
+    // Entries are indexed from 0 to Size() - 1. Invalidated by Add and Remove.
+    size_t Size() const
+    {
+        return effects.size();
+    }
+
+    const glm::ivec2& GetSubtileId(int entry) const
+    {
+        return subtileIds[entry];
+    }
+
+    int GetSlot(int entry) const
+    {
+        return entrySlots[entry];
+    }
+
+    T& GetEffect(int entry)
+    {
+        return effects[entry];
+    }
+
+    long GetAllocationCount() const
+    {
+        return allocations;
+    }
+
+    // Returns the bytes used by the arrays themselves, not counting anything the effects allocate.
+    size_t GetByteSize() const
+    {
+        return subtileIds.capacity() * sizeof(glm::ivec2) + entrySlots.capacity() * sizeof(int) + effects.capacity() * sizeof(T) + slotEntries.capacity() * sizeof(int);
+    }
+
+    // Moves every effect out of the pool, in entry order.
+    void Clear(std::vector<T>* removedEffects)
+    {
+        for (T& effect : effects)
+        {
+            removedEffects->push_back(std::move(effect));
+        }
+
+        subtileIds.clear();
+        entrySlots.clear();
+        effects.clear();
+        slotEntries.assign(slotEntries.size(), -1);
+    }
+};
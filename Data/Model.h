@@ -32,6 +32,9 @@ struct TextureModel
 
 struct Model
 {
+    // Approximate memory used by the physical body of a model instance (the collision shape is normally shared).
+    static const size_t PhysicsBodySize = sizeof(btRigidBody) + sizeof(btDefaultMotionState);
+
     // Used internally to speed up drawing operations.
     int internalId;
     long frameId;
@@ -0,0 +1,122 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <utility>
+
+// Holds resources that are no longer used until the frames that may still reference them have finished.
+//  Each resource is stamped with the frame it was retired in, and comes back out (in retirement order) once enough frames have passed.
+template <typename T>
+class RetirementQueue
+{
+    struct RetiredItem
+    {
+        T item;
+        long frame;
+
+        RetiredItem(const T& item, long frame)
+            : item(item), frame(frame)
+        {
+        }
+
+        RetiredItem(T&& item, long frame)
+            : item(std::move(item)), frame(frame)
+        {
+        }
+    };
+
+    std::deque<RetiredItem> items;
+    long frame;
+    int delayFrames;
+
+public:
+    RetirementQueue(int delayFrames)
+        : items(), frame(0), delayFrames(delayFrames)
+    {
+    }
+
+    void SetDelayFrames(int delayFrames)
+    {
+        this->delayFrames = delayFrames;
+    }
+
+    void Retire(const T& item)
+    {
+        items.push_back(RetiredItem(item, frame));
+    }
+
+    // Retires an item that owns its resources, such as a pooled effect, without copying them.
+    void Retire(T&& item)
+    {
+        items.push_back(RetiredItem(std::move(item), frame));
+    }
+
+    void AdvanceFrame()
+    {
+        ++frame;
+    }
+
+    long GetFrame() const
+    {
+        return frame;
+    }
+
+    // Pops the oldest item if it was retired at least the delay frames ago.
+    bool TryPopExpired(T* item)
+    {
+        if (items.empty() || frame - items.front().frame < delayFrames)
+        {
+            return false;
+        }
+
+        *item = std::move(items.front().item);
+        items.pop_front();
+        return true;
+    }
+
+    // Returns the oldest item if it was retired at least the delay frames ago, without popping it, or nullptr.
+    const T* PeekExpired() const
+    {
+        if (items.empty() || frame - items.front().frame < delayFrames)
+        {
+            return nullptr;
+        }
+
+        return &items.front().item;
+    }
+
+    // Pops the oldest item regardless of when it was retired. Only safe once nothing is in flight, such as on shutdown.
+    bool TryPop(T* item)
+    {
+        if (items.empty())
+        {
+            return false;
+        }
+
+        *item = std::move(items.front().item);
+        items.pop_front();
+        return true;
+    }
+
+    bool Contains(const T& item) const
+    {
+        for (const RetiredItem& retiredItem : items)
+        {
+            if (retiredItem.item == item)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool IsEmpty() const
+    {
+        return items.empty();
+    }
+
+    size_t Size() const
+    {
+        return items.size();
+    }
+};
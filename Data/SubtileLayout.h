@@ -0,0 +1,184 @@
+#pragma once
+#include "Data\TerrainTypes.h"
+
+// Maps the pixels of a square subtile array to storage indices, one row after another. This is how the terrain pack, OpenGL and Bullet store subtiles.
+class RowMajorLayout
+{
+    int size;
+
+public:
+    explicit RowMajorLayout(int size)
+        : size(size)
+    {
+    }
+
+    int GetSize() const
+    {
+        return size;
+    }
+
+    int GetStorageSize() const
+    {
+        return size * size;
+    }
+
+    int GetIndex(int x, int y) const
+    {
+        return x + y * size;
+    }
+
+    // Neighbors of a pixel. The caller keeps them within the subtile.
+    int GetLeft(int index) const
+    {
+        return index - 1;
+    }
+
+    int GetRight(int index) const
+    {
+        return index + 1;
+    }
+
+    int GetUp(int index) const
+    {
+        return index - size;
+    }
+
+    int GetDown(int index) const
+    {
+        return index + size;
+    }
+
+    // Calls visit(x, y, index) for each pixel, in storage order.
+    template <typename Visitor>
+    void ForEachPixel(Visitor visit) const
+    {
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                visit(x, y, x + y * size);
+            }
+        }
+    }
+};
+
+// Maps the pixels of a square subtile array to storage indices along a Z-order (Morton) curve, so vertical neighbors are usually close by.
+//  Storage is padded up to the next power of two in size, and supports subtiles up to 256 pixels across.
+class MortonLayout
+{
+    static const unsigned int XMask = 0x55555555;
+    static const unsigned int YMask = 0xAAAAAAAA;
+
+    int size;
+    int paddedSize;
+
+public:
+    explicit MortonLayout(int size)
+        : size(size), paddedSize(1)
+    {
+        while (paddedSize < size)
+        {
+            paddedSize *= 2;
+        }
+    }
+
+    // Spreads the low 16 bits of a value out to the even bits.
+    static unsigned int Dilate(unsigned int value)
+    {
+        value &= 0x0000FFFF;
+        value = (value | (value << 8)) & 0x00FF00FF;
+        value = (value | (value << 4)) & 0x0F0F0F0F;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    }
+
+    // Gathers the even bits of a value back into the low 16 bits.
+    static unsigned int Contract(unsigned int value)
+    {
+        value &= 0x55555555;
+        value = (value | (value >> 1)) & 0x33333333;
+        value = (value | (value >> 2)) & 0x0F0F0F0F;
+        value = (value | (value >> 4)) & 0x00FF00FF;
+        value = (value | (value >> 8)) & 0x0000FFFF;
+        return value;
+    }
+
+    int GetSize() const
+    {
+        return size;
+    }
+
+    int GetStorageSize() const
+    {
+        return paddedSize * paddedSize;
+    }
+
+    int GetIndex(int x, int y) const
+    {
+        return (int)(Dilate((unsigned int)x) | (Dilate((unsigned int)y) << 1));
+    }
+
+    void GetPosition(int index, int* x, int* y) const
+    {
+        *x = (int)Contract((unsigned int)index);
+        *y = (int)Contract((unsigned int)index >> 1);
+    }
+
+    // Neighbors of a pixel, stepping one coordinate while the other's bits are masked out. The caller keeps them within the subtile.
+    int GetLeft(int index) const
+    {
+        return (int)(((((unsigned int)index & XMask) - 1) & XMask) | ((unsigned int)index & YMask));
+    }
+
+    int GetRight(int index) const
+    {
+        return (int)(((((unsigned int)index | YMask) + 1) & XMask) | ((unsigned int)index & YMask));
+    }
+
+    int GetUp(int index) const
+    {
+        return (int)(((((unsigned int)index & YMask) - 2) & YMask) | ((unsigned int)index & XMask));
+    }
+
+    int GetDown(int index) const
+    {
+        return (int)(((((unsigned int)index | XMask) + 2) & YMask) | ((unsigned int)index & XMask));
+    }
+
+    // Calls visit(x, y, index) for each pixel, in storage order. Padding is skipped.
+    template <typename Visitor>
+    void ForEachPixel(Visitor visit) const
+    {
+        int storageSize = GetStorageSize();
+        for (int index = 0; index < storageSize; index++)
+        {
+            int x, y;
+            GetPosition(index, &x, &y);
+            if (x < size && y < size)
+            {
+                visit(x, y, index);
+            }
+        }
+    }
+};
+
+// Copies a subtile array between layouts. The destination must hold the storage size of its layout; padding is left as is.
+template <typename SourceLayout, typename DestinationLayout, typename T>
+void ConvertLayout(const SourceLayout& sourceLayout, const T* source, const DestinationLayout& destinationLayout, T* destination)
+{
+    sourceLayout.ForEachPixel([&](int x, int y, int index)
+    {
+        destination[destinationLayout.GetIndex(x, y)] = source[index];
+    });
+}
+
+// Copies palette-packed types between layouts. The destination must hold half the storage size of its layout.
+template <typename SourceLayout, typename DestinationLayout>
+void ConvertPackedTypeLayout(const SourceLayout& sourceLayout, const unsigned char* sourcePackedTypes, const DestinationLayout& destinationLayout, unsigned char* destinationPackedTypes)
+{
+    sourceLayout.ForEachPixel([&](int x, int y, int index)
+    {
+        TerrainTypes::SetPackedType(destinationPackedTypes, destinationLayout.GetIndex(x, y), TerrainTypes::GetPackedType(sourcePackedTypes, index));
+    });
+}
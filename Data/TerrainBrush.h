@@ -0,0 +1,33 @@
+#pragma once
+#include <glm\vec2.hpp>
+
+// A round change to the terrain height, strongest at its center and blending smoothly into the surrounding terrain at its radius.
+struct TerrainBrush
+{
+    glm::vec2 center;
+    float radius;
+
+    // In real units at the center. Negative lowers the terrain, digging a crater.
+    float heightChange;
+
+    TerrainBrush(glm::vec2 center, float radius, float heightChange)
+        : center(center), radius(radius), heightChange(heightChange)
+    {
+    }
+
+    // Returns the height change at a point, in real units.
+    float GetHeightChange(const glm::vec2& point) const
+    {
+        glm::vec2 offset = point - center;
+        float distanceSquared = offset.x * offset.x + offset.y * offset.y;
+        float radiusSquared = radius * radius;
+        if (distanceSquared >= radiusSquared)
+        {
+            return 0.0f;
+        }
+
+        // Squared, so the slope is also zero at the radius.
+        float falloff = 1.0f - distanceSquared / radiusSquared;
+        return heightChange * falloff * falloff;
+    }
+};
@@ -1,34 +1,15 @@
 #pragma once
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <GL/glew.h>
 #include <glm\vec2.hpp>
 #include <glm\vec3.hpp>
-
-// TODO make a new 'math utils' class and put this there.
-struct iVec2Comparer
-{
-    bool operator()(const glm::ivec2& lhs, const glm::ivec2& rhs) const
-    {
-        // TODO this is really wrong (assuming max voxel size), but also right (anything that big wouldn't run.
-        const int maxSize = 10000;
-        return (lhs.x + lhs.y * maxSize) > (rhs.x + rhs.y * maxSize);
-    }
-};
-
-// Copied from PaletteWindow.cpp, MapEditor.
-namespace TerrainTypes
-{
-    const int SNOW_PEAK = 0;
-    const int ROCKS = 25;
-    const int TREES = 50;
-    const int DIRTLAND = 75;
-    const int GRASSLAND = 100;
-    const int ROADS = 125;
-    const int CITY = 150;
-    const int SAND = 175;
-    const int RIVER = 200;
-    const int LAKE = 225;
-}
+#include "Data\TerrainTypeIndex.h"
+#include "Data\TerrainTypes.h"
+#include "Data\TileGrid.h"
+#include "Utils\MappedFile.h"
+#include "Utils\SlotAllocator.h"
 
 // Forward declare for use in TerrainTile.
 struct SubTile;
@@ -39,11 +20,39 @@ struct TerrainTile
     static const int TileSize = 1000;
     static const int SubtileSize = 100;
     static const int Subdivisions = TileSize / SubtileSize;
+    static const int BorderedSubtileSize = SubtileSize + 2;
+    static const int MaxHeight = 900;
 
-    unsigned char* rawImage;
+    // Heights are stored as 16-bit values in [0, MaxHeightValue] (~3 cm steps), shared by OpenGL and Bullet. Bullet only reads signed shorts, so the top bit is unused.
+    static const int MaxHeightValue = 32767;
+
+    // True once all subtiles have been uploaded. Until then, subtiles are added as they are streamed in.
     bool loadedSubtiles;
 
-    std::map<glm::ivec2, SubTile*, iVec2Comparer> subtiles;
+    // True if streaming the tile failed. It is queued again the next time it's requested.
+    bool isLoadFailed;
+
+    TileGrid<SubTile*> subtiles;
+
+    // The terrain pack blocks the subtile data points into. Normally one, but more if a streamed tile was also loaded synchronously.
+    std::vector<MappedView> packViews;
+
+    TerrainTile()
+        : loadedSubtiles(false), isLoadFailed(false), subtiles(glm::ivec2(0, 0), glm::ivec2(Subdivisions - 1, Subdivisions - 1)), packViews()
+    {
+    }
+
+    bool IsSubtileLoaded(const glm::ivec2& subtilePos) const
+    {
+        return subtiles.Contains(subtilePos);
+    }
+
+    // Returns the subtile, or nullptr if it hasn't been uploaded yet.
+    SubTile* GetSubtile(const glm::ivec2& subtilePos) const
+    {
+        SubTile* const* subtile = subtiles.Find(subtilePos);
+        return subtile == nullptr ? nullptr : *subtile;
+    }
 
     // Returns the real position of the pixel (lower X, lower Y)
     static glm::vec2 GetRealPosition(glm::ivec2 subtileId, glm::ivec2 subtilePixel)
@@ -52,21 +61,152 @@ struct TerrainTile
     }
 };
 
+// An inclusive rectangle of bordered heightmap pixels, empty until a pixel is added.
+struct HeightmapRect
+{
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+
+    HeightmapRect()
+        : minX(TerrainTile::BorderedSubtileSize), minY(TerrainTile::BorderedSubtileSize), maxX(-1), maxY(-1)
+    {
+    }
+
+    bool IsEmpty() const
+    {
+        return maxX < minX;
+    }
+
+    int GetWidth() const
+    {
+        return maxX - minX + 1;
+    }
+
+    int GetHeight() const
+    {
+        return maxY - minY + 1;
+    }
+
+    void Add(int x, int y)
+    {
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+    }
+};
+
 struct SubTile
 {
-    GLuint heightmapTextureId;
-    float* heightmap;
+    // Bordered (BorderedSubtileSize^2), pointing into the terrain pack, or to the deformed heights once the subtile has been deformed.
+    const short* heightmap;
+
+    // The heights Bullet physics reads, on its own thread. The same as the heightmap until deformed, after which changes are copied in between physics steps.
+    const short* physicsHeightmap;
+
+    // SubtileSize^2 palette-packed types (see TerrainTypes::Palette), pointing into the terrain pack. Read with GetPixelType.
+    const unsigned char* packedTypes;
+
+    // Range of the heightmap (including the border), in real units.
+    float minHeight;
+    float maxHeight;
+
+    // Layer of the terrain texture pool holding the heightmap and types, invalid if the subtile isn't active.
+    SlotHandle textureSlot;
+
+    // Where each type is, built by the loader so effects don't scan every pixel.
+    TerrainTypeIndex typeIndex;
+
+    // Copies of the heightmap for rendering and physics, made the first time the subtile is deformed, as the terrain pack is read-only.
+    std::vector<short> deformedHeightmap;
+    std::vector<short> deformedPhysicsHeightmap;
+
+    // True when physicsHeightmap has moved to the deformed copy, so a heightfield created before then needs replacing.
+    bool isPhysicsHeightmapMoved;
 
-    GLuint typeTextureId;
-    unsigned char* type;
+    // Pixels deformed since the texture and physics heightfield were last updated.
+    HeightmapRect deformedRect;
 
-    SubTile(GLuint heightmapTextureId, float* heightmap, GLuint typeTextureId, unsigned char* type)
-        : heightmapTextureId(heightmapTextureId), heightmap(heightmap), typeTextureId(typeTextureId), type(type)
+    SubTile(const short* heightmap, const unsigned char* packedTypes, float minHeight, float maxHeight)
+        : heightmap(heightmap), physicsHeightmap(heightmap), packedTypes(packedTypes), minHeight(minHeight), maxHeight(maxHeight), textureSlot(), typeIndex(),
+          deformedHeightmap(), deformedPhysicsHeightmap(), isPhysicsHeightmapMoved(false), deformedRect()
     {
     }
 
-    int GetPixelId(const glm::ivec2& pos)
+    bool IsDeformed() const
+    {
+        return !deformedHeightmap.empty();
+    }
+
+    // Returns the heightmap to deform, copying it out of the terrain pack the first time.
+    short* GetDeformableHeightmap()
+    {
+        if (deformedHeightmap.empty())
+        {
+            deformedHeightmap.assign(heightmap, heightmap + TerrainTile::BorderedSubtileSize * TerrainTile::BorderedSubtileSize);
+            deformedPhysicsHeightmap = deformedHeightmap;
+            heightmap = &deformedHeightmap[0];
+            physicsHeightmap = &deformedPhysicsHeightmap[0];
+            isPhysicsHeightmapMoved = true;
+        }
+
+        return &deformedHeightmap[0];
+    }
+
+    size_t GetDeformedByteSize() const
+    {
+        return (deformedHeightmap.capacity() + deformedPhysicsHeightmap.capacity()) * sizeof(short);
+    }
+
+    int GetPixelId(const glm::ivec2& pos) const
     {
         return pos.x + pos.y * TerrainTile::SubtileSize;
     }
+
+    // Returns the height of a pixel within the subtile, in real units.
+    float GetHeight(const glm::ivec2& pos) const
+    {
+        return (float)heightmap[(pos.x + 1) + (pos.y + 1) * TerrainTile::BorderedSubtileSize] * ((float)TerrainTile::MaxHeight / (float)TerrainTile::MaxHeightValue);
+    }
+
+    // Returns the height at a point within the subtile (each coordinate in [0, SubtileSize)), in real units.
+    //  Pixels are centered half a meter in, as in the terrain shader and physics heightfield, and heights are bilinearly interpolated between them.
+    float GetInterpolatedHeight(float x, float y) const
+    {
+        // The border supplies the neighbors of the pixels along the edges.
+        float u = x + 0.5f;
+        float v = y + 0.5f;
+        int i = (int)u;
+        int j = (int)v;
+        float xFraction = u - (float)i;
+        float yFraction = v - (float)j;
+
+        const short* lowerRow = heightmap + i + j * TerrainTile::BorderedSubtileSize;
+        const short* upperRow = lowerRow + TerrainTile::BorderedSubtileSize;
+        float lower = (float)lowerRow[0] + (float)(lowerRow[1] - lowerRow[0]) * xFraction;
+        float upper = (float)upperRow[0] + (float)(upperRow[1] - upperRow[0]) * xFraction;
+        return (lower + (upper - lower) * yFraction) * ((float)TerrainTile::MaxHeight / (float)TerrainTile::MaxHeightValue);
+    }
+
+    // Interpolates the heights of many points within the subtile. Coordinates are passed separately so the loop has no branches.
+    void GetInterpolatedHeights(const float* xs, const float* ys, int count, float* heights) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            heights[i] = GetInterpolatedHeight(xs[i], ys[i]);
+        }
+    }
+
+    // Returns the type of the pixel containing a point within the subtile.
+    int GetType(float x, float y) const
+    {
+        return GetPixelType((int)x + (int)y * TerrainTile::SubtileSize);
+    }
+
+    int GetPixelType(int pixelId) const
+    {
+        return TerrainTypes::GetPackedType(packedTypes, pixelId);
+    }
 };
\ No newline at end of file
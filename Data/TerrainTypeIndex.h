@@ -0,0 +1,200 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "Data\TerrainTypes.h"
+
+// A vertical run of pixels of the same terrain type within a subtile.
+struct TypeRun
+{
+    unsigned char x;
+    unsigned char y;
+    unsigned char length;
+    unsigned char unused;
+};
+
+// Lists where each terrain type is within a subtile, so effects only visit the pixels they place things on.
+//  Pixels are stored as runs down each column, in the same order (x, then y) the effects have always scanned in,
+//  so their counters and random numbers line up with a full scan.
+class TerrainTypeIndex
+{
+public:
+    // One entry per TerrainTypes value.
+    static const int TypeCount = 10;
+    static const int TypeSpacing = 25;
+
+    // Subtiles with more runs than this (noisy type maps) keep their counts, but are scanned instead. Bounds the index to 8 KiB.
+    static const int MaxRuns = 2048;
+
+private:
+    int size;
+    int pixelCounts[TypeCount];
+    int runStarts[TypeCount + 1];
+    std::vector<TypeRun> runs;
+    bool isIndexed;
+
+    // Returns the index entry of a type, or -1 if it isn't one of the TerrainTypes.
+    static int GetTypeSlot(int type)
+    {
+        if (type < 0 || type % TypeSpacing != 0 || type / TypeSpacing >= TypeCount)
+        {
+            return -1;
+        }
+
+        return type / TypeSpacing;
+    }
+
+public:
+    TerrainTypeIndex()
+        : size(0), runs(), isIndexed(false)
+    {
+        for (int i = 0; i < TypeCount; i++)
+        {
+            pixelCounts[i] = 0;
+            runStarts[i] = 0;
+        }
+
+        runStarts[TypeCount] = 0;
+    }
+
+    // Builds the index from a size x size palette-packed type map, with pixel (x, y) at x + y * size.
+    void Build(const unsigned char* packedTypes, int size)
+    {
+        this->size = size;
+        int runCounts[TypeCount];
+        for (int i = 0; i < TypeCount; i++)
+        {
+            pixelCounts[i] = 0;
+            runCounts[i] = 0;
+        }
+
+        // Counting pass, so the runs of each type can be stored contiguously.
+        int totalRuns = 0;
+        for (int i = 0; i < size; i++)
+        {
+            int lastSlot = -1;
+            for (int j = 0; j < size; j++)
+            {
+                int slot = GetTypeSlot(TerrainTypes::GetPackedType(packedTypes, i + j * size));
+                if (slot != -1)
+                {
+                    ++pixelCounts[slot];
+                    if (slot != lastSlot)
+                    {
+                        ++runCounts[slot];
+                        ++totalRuns;
+                    }
+                }
+
+                lastSlot = slot;
+            }
+        }
+
+        runStarts[0] = 0;
+        for (int i = 0; i < TypeCount; i++)
+        {
+            runStarts[i + 1] = runStarts[i] + runCounts[i];
+        }
+
+        isIndexed = totalRuns <= MaxRuns && size <= 256;
+        runs.clear();
+        if (!isIndexed)
+        {
+            runs.shrink_to_fit();
+            return;
+        }
+
+        runs.resize(totalRuns);
+        int nextRuns[TypeCount];
+        for (int i = 0; i < TypeCount; i++)
+        {
+            nextRuns[i] = runStarts[i];
+        }
+
+        for (int i = 0; i < size; i++)
+        {
+            int lastSlot = -1;
+            TypeRun* run = nullptr;
+            for (int j = 0; j < size; j++)
+            {
+                int slot = GetTypeSlot(TerrainTypes::GetPackedType(packedTypes, i + j * size));
+                if (slot != -1 && slot == lastSlot)
+                {
+                    ++run->length;
+                }
+                else if (slot != -1)
+                {
+                    run = &runs[nextRuns[slot]++];
+                    run->x = (unsigned char)i;
+                    run->y = (unsigned char)j;
+                    run->length = 1;
+                    run->unused = 0;
+                }
+
+                lastSlot = slot;
+            }
+        }
+
+        runs.shrink_to_fit();
+    }
+
+    // Returns the number of pixels of a type in constant time.
+    int GetPixelCount(int type) const
+    {
+        int slot = GetTypeSlot(type);
+        return slot == -1 ? 0 : pixelCounts[slot];
+    }
+
+    int GetRunCount(int type) const
+    {
+        int slot = GetTypeSlot(type);
+        return (slot == -1 || !isIndexed) ? 0 : runStarts[slot + 1] - runStarts[slot];
+    }
+
+    bool IsIndexed() const
+    {
+        return isIndexed;
+    }
+
+    // Heap memory used by the runs.
+    size_t GetByteSize() const
+    {
+        return runs.capacity() * sizeof(TypeRun);
+    }
+
+    // Calls visit(x, y) for each pixel of a type, in x-then-y order. Falls back to scanning the type map if the subtile isn't indexed.
+    template <typename Visitor>
+    void ForEachPixel(const unsigned char* packedTypes, int type, Visitor visit) const
+    {
+        int slot = GetTypeSlot(type);
+        if (slot != -1 && pixelCounts[slot] == 0)
+        {
+            return;
+        }
+
+        if (slot == -1 || !isIndexed)
+        {
+            for (int i = 0; i < size; i++)
+            {
+                for (int j = 0; j < size; j++)
+                {
+                    if (TerrainTypes::GetPackedType(packedTypes, i + j * size) == type)
+                    {
+                        visit(i, j);
+                    }
+                }
+            }
+
+            return;
+        }
+
+        for (int r = runStarts[slot]; r < runStarts[slot + 1]; r++)
+        {
+            const TypeRun& run = runs[r];
+            int i = (int)run.x;
+            for (int j = (int)run.y; j < (int)run.y + (int)run.length; j++)
+            {
+                visit(i, j);
+            }
+        }
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+// Copied from PaletteWindow.cpp, MapEditor.
+namespace TerrainTypes
+{
+    const int SNOW_PEAK = 0;
+    const int ROCKS = 25;
+    const int TREES = 50;
+    const int DIRTLAND = 75;
+    const int GRASSLAND = 100;
+    const int ROADS = 125;
+    const int CITY = 150;
+    const int SAND = 175;
+    const int RIVER = 200;
+    const int LAKE = 225;
+
+    // Loaded types are stored as 4-bit indices into this palette, two pixels per byte (the even pixel in the low bits).
+    //  Unused indices are lakes, as unknown types become lakes when the terrain pack is built. Must match terrainRender.fs.
+    const int PaletteSize = 10;
+    const unsigned char Palette[16] = { SNOW_PEAK, ROCKS, TREES, DIRTLAND, GRASSLAND, ROADS, CITY, SAND, RIVER, LAKE, LAKE, LAKE, LAKE, LAKE, LAKE, LAKE };
+
+    // Returns the palette index of a type. Unknown types are lakes.
+    inline unsigned char GetPaletteIndex(int type)
+    {
+        return (type % 25 == 0 && type >= 0 && type <= LAKE) ? (unsigned char)(type / 25) : (unsigned char)(LAKE / 25);
+    }
+
+    // Packs an even number of types into count / 2 bytes.
+    inline void PackTypes(const unsigned char* types, int count, unsigned char* packedTypes)
+    {
+        for (int i = 0; i < count; i += 2)
+        {
+            packedTypes[i / 2] = (unsigned char)(GetPaletteIndex(types[i]) | (GetPaletteIndex(types[i + 1]) << 4));
+        }
+    }
+
+    inline int GetPackedType(const unsigned char* packedTypes, int pixelId)
+    {
+        return (int)Palette[(packedTypes[pixelId >> 1] >> ((pixelId & 1) << 2)) & 0x0F];
+    }
+
+    inline void SetPackedType(unsigned char* packedTypes, int pixelId, int type)
+    {
+        int shift = (pixelId & 1) << 2;
+        packedTypes[pixelId >> 1] = (unsigned char)((packedTypes[pixelId >> 1] & ~(0x0F << shift)) | (GetPaletteIndex(type) << shift));
+    }
+}
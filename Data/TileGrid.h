@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <glm\vec2.hpp>
+
+// A dense grid of slots covering [min, max] (inclusive), indexed by tile or subtile position.
+// Lookups are O(1) and slots never move, so pointers to stored values stay valid for the lifetime of the grid.
+// Occupied positions are tracked separately so iteration only visits stored values.
+template <typename T>
+class TileGrid
+{
+    glm::ivec2 min;
+    glm::ivec2 max;
+    int width;
+
+    std::vector<T> slots;
+
+    // Index of each slot's position in 'positions', or -1 if the slot is empty.
+    std::vector<int> positionIndices;
+    std::vector<glm::ivec2> positions;
+
+public:
+    TileGrid(glm::ivec2 min, glm::ivec2 max)
+        : min(min), max(max), width(max.x - min.x + 1),
+          slots(width * (max.y - min.y + 1)), positionIndices(slots.size(), -1), positions()
+    {
+    }
+
+    bool IsInBounds(const glm::ivec2& pos) const
+    {
+        return pos.x >= min.x && pos.y >= min.y && pos.x <= max.x && pos.y <= max.y;
+    }
+
+    // Returns a handle to the slot of a position, which remains the same for the lifetime of the grid.
+    int GetSlotIndex(const glm::ivec2& pos) const
+    {
+        return (pos.x - min.x) + (pos.y - min.y) * width;
+    }
+
+    bool Contains(const glm::ivec2& pos) const
+    {
+        return IsInBounds(pos) && positionIndices[GetSlotIndex(pos)] != -1;
+    }
+
+    // Returns the value at a position. *The position must be in bounds.*
+    T& Get(const glm::ivec2& pos)
+    {
+        return slots[GetSlotIndex(pos)];
+    }
+
+    const T& Get(const glm::ivec2& pos) const
+    {
+        return slots[GetSlotIndex(pos)];
+    }
+
+    T& GetBySlot(int slotIndex)
+    {
+        return slots[slotIndex];
+    }
+
+    // Returns the value at a position, or nullptr if nothing is stored there.
+    T* Find(const glm::ivec2& pos)
+    {
+        return Contains(pos) ? &slots[GetSlotIndex(pos)] : nullptr;
+    }
+
+    const T* Find(const glm::ivec2& pos) const
+    {
+        return Contains(pos) ? &slots[GetSlotIndex(pos)] : nullptr;
+    }
+
+    // Stores a value, replacing anything already stored. *The position must be in bounds.*
+    T& Set(const glm::ivec2& pos, const T& value)
+    {
+        int slotIndex = GetSlotIndex(pos);
+        if (positionIndices[slotIndex] == -1)
+        {
+            positionIndices[slotIndex] = (int)positions.size();
+            positions.push_back(pos);
+        }
+
+        slots[slotIndex] = value;
+        return slots[slotIndex];
+    }
+
+    void Remove(const glm::ivec2& pos)
+    {
+        if (!Contains(pos))
+        {
+            return;
+        }
+
+        // Move the last position into the removed position's place to keep removal O(1).
+        int slotIndex = GetSlotIndex(pos);
+        int positionIndex = positionIndices[slotIndex];
+        glm::ivec2 lastPosition = positions.back();
+        positions[positionIndex] = lastPosition;
+        positionIndices[GetSlotIndex(lastPosition)] = positionIndex;
+        positions.pop_back();
+
+        positionIndices[slotIndex] = -1;
+        slots[slotIndex] = T();
+    }
+
+    // Returns the occupied positions, in no particular order. Invalidated by Set and Remove.
+    const std::vector<glm::ivec2>& GetPositions() const
+    {
+        return positions;
+    }
+
+    size_t Size() const
+    {
+        return positions.size();
+    }
+
+    void Clear()
+    {
+        for (const glm::ivec2& pos : positions)
+        {
+            int slotIndex = GetSlotIndex(pos);
+            positionIndices[slotIndex] = -1;
+            slots[slotIndex] = T();
+        }
+
+        positions.clear();
+    }
+};
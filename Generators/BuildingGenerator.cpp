@@ -1,5 +1,4 @@
 #include <Bullet\btBulletDynamicsCommon.h>
-#include <glm\gtc\random.hpp>
 #include "logging\Logger.h"
 #include "strings\StringUtils.h"
 #include "PhysicsGenerator.h"
@@ -43,13 +42,13 @@ BuildingDecisionData BuildingGenerator::DeserializeBuildingRule(std::string line
     return data;
 }
 
-DecisionTree<BuildingDecisionData>::Choice BuildingGenerator::RandomWalkEvaluator(BuildingDecisionData decisionData, bool isValidSegment, bool yesNodeNotNull, bool noNodeNotNull)
+DecisionTree<BuildingDecisionData>::Choice BuildingGenerator::RandomWalkEvaluator(EffectRandom* random, BuildingDecisionData decisionData, bool isValidSegment, bool yesNodeNotNull, bool noNodeNotNull)
 {
     // We're randomly walking so we don't need any of the decision or validation data.
     if (yesNodeNotNull && noNodeNotNull)
     {
         // Both aren't null. Randomly choose.
-        if (glm::linearRand(0.0f, 1.0f) > 0.50f)
+        if (random->Float() > 0.50f)
         {
             return DecisionTree<BuildingDecisionData>::Choice::YES_ITEM;
         }
@@ -130,7 +129,7 @@ void BuildingGenerator::GetScaledModelPoints(std::vector<glm::vec3>& points, glm
     }
 }
 
-std::vector<Model> BuildingGenerator::GetRandomBuilding(DecisionTree<BuildingDecisionData>& builder, const glm::vec3& offset, float* separationRadius, float* height)
+std::vector<Model> BuildingGenerator::GetRandomBuilding(EffectRandom* random, DecisionTree<BuildingDecisionData>& builder, const glm::vec3& offset, float* separationRadius, float* height)
 {
     std::vector<Model> resultingSegments;
 
@@ -138,15 +137,19 @@ std::vector<Model> BuildingGenerator::GetRandomBuilding(DecisionTree<BuildingDec
 
     *height = 0.0f;
 
-    std::vector<BuildingDecisionData> buildingSegmentRules = builder.EvaluateTreeSequence(BuildingGenerator::RandomWalkEvaluator);
+    std::vector<BuildingDecisionData> buildingSegmentRules = builder.EvaluateTreeSequence(
+        [random](BuildingDecisionData decisionData, bool isValidSegment, bool yesNodeNotNull, bool noNodeNotNull)
+        {
+            return BuildingGenerator::RandomWalkEvaluator(random, decisionData, isValidSegment, yesNodeNotNull, noNodeNotNull);
+        });
     for (unsigned int i = 0; i < buildingSegmentRules.size(); i++)
     {
         const BuildingDecisionData& buildingRule = buildingSegmentRules[i];
-        int layers = glm::linearRand(buildingRule.minLayers, buildingRule.maxLayers);
+        int layers = random->Int(buildingRule.minLayers, buildingRule.maxLayers);
         while (layers > 0)
         {
             // For each segment, scale the model according to randomness and z-factors.
-            float scaleFactor = glm::linearRand(buildingRule.minScaleFactor, buildingRule.maxScaleFactor);
+            float scaleFactor = random->Float(buildingRule.minScaleFactor, buildingRule.maxScaleFactor);
             overallScale *= glm::vec3(scaleFactor);
 
             Model model = Model();
@@ -190,13 +193,13 @@ std::vector<Model> BuildingGenerator::GetRandomBuilding(DecisionTree<BuildingDec
 }
 
 // Same as the low-density, but with a high-density building.
-std::vector<Model> BuildingGenerator::GetRandomHighDensityBuilding(glm::vec3 offset, float* buildingFootprintSize, float* height)
+std::vector<Model> BuildingGenerator::GetRandomHighDensityBuilding(EffectRandom* random, glm::vec3 offset, float* buildingFootprintSize, float* height)
 {
-    return GetRandomBuilding(highDensityBuildingBuilder, offset, buildingFootprintSize, height);
+    return GetRandomBuilding(random, highDensityBuildingBuilder, offset, buildingFootprintSize, height);
 }
 
 // Returns a random low density building centered (XY) on the origin starting at Z == 0.
-std::vector<Model> BuildingGenerator::GetRandomLowDensityBuilding(glm::vec3 offset, float* buildingFootprintSize, float* height)
+std::vector<Model> BuildingGenerator::GetRandomLowDensityBuilding(EffectRandom* random, glm::vec3 offset, float* buildingFootprintSize, float* height)
 {
-    return GetRandomBuilding(lowDensityBuildingBuilder, offset, buildingFootprintSize, height);
+    return GetRandomBuilding(random, lowDensityBuildingBuilder, offset, buildingFootprintSize, height);
 }
\ No newline at end of file
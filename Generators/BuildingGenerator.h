@@ -6,6 +6,7 @@
 #include "AI\DecisionTree.h"
 #include "Data\Model.h"
 #include "Managers\ModelManager.h"
+#include "Math\EffectRandom.h"
 #include "Physics.h"
 
 struct BuildingDecisionData
@@ -26,22 +27,23 @@ class BuildingGenerator
     static DecisionTree<BuildingDecisionData> highDensityBuildingBuilder;
 
     static BuildingDecisionData DeserializeBuildingRule(std::string line, bool* success);
-    static DecisionTree<BuildingDecisionData>::Choice RandomWalkEvaluator(BuildingDecisionData decisionData, bool isValidSegment, bool yesNodeNull, bool noNodeNull);
+    static DecisionTree<BuildingDecisionData>::Choice RandomWalkEvaluator(EffectRandom* random, BuildingDecisionData decisionData, bool isValidSegment, bool yesNodeNull, bool noNodeNull);
 
     ModelManager* modelManager;
     Physics* physics;
     void GetScaledModelPoints(std::vector<glm::vec3>& points, glm::vec3 scaleFactor, unsigned int modelId);
 
-    std::vector<Model> GetRandomBuilding(DecisionTree<BuildingDecisionData>& builder, const glm::vec3& offset, float* buildingFootprintSize, float* height);
+    std::vector<Model> GetRandomBuilding(EffectRandom* random, DecisionTree<BuildingDecisionData>& builder, const glm::vec3& offset, float* buildingFootprintSize, float* height);
 public:
     BuildingGenerator(ModelManager* modelManager, Physics* physics);
     static bool LoadBuildingModels(ModelManager* modelManager);
     static bool LoadBuilder(std::string lowDensityFile, std::string highDensityFile);
 
     // Returns a random low density building centered (XY) on the origin starting at Z == 0.
-    std::vector<Model> GetRandomLowDensityBuilding(glm::vec3 offset, float* buildingFootprintSize, float* height);
+    //  Every choice is drawn from the given generator, so the same seed always gives the same building.
+    std::vector<Model> GetRandomLowDensityBuilding(EffectRandom* random, glm::vec3 offset, float* buildingFootprintSize, float* height);
 
     // Same as the low-density, but with a high-density building.
-    std::vector<Model> GetRandomHighDensityBuilding(glm::vec3 offset, float* buildingFootprintSize, float* height);
+    std::vector<Model> GetRandomHighDensityBuilding(EffectRandom* random, glm::vec3 offset, float* buildingFootprintSize, float* height);
 };
 
@@ -14,22 +14,24 @@ glm::vec4 ColorGenerator::GetGrassColor()
     return glm::vec4(1.0f);
 }
 
-glm::vec3 ColorGenerator::GetTravellerColor()
+glm::vec3 ColorGenerator::GetTravellerColor(EffectRandom* random)
 {
     const glm::vec3 low(22, 85, 148);
     const glm::vec3 high(182, 213, 243);
-    float shadingFactor = glm::linearRand(0.0f, 1.0f);
+    float shadingFactor = random->Float();
     return (low + (high - low) * shadingFactor) / 255.0f;
 }
 
-glm::vec3 ColorGenerator::GetTreeBranchColor()
+glm::vec3 ColorGenerator::GetTreeBranchColor(EffectRandom* random)
 {
-    return glm::vec3(0.57f, 0.20f + glm::linearRand(0.0f, 0.30f), 0.10f + glm::linearRand(0.0f, 0.40f));
+    float green = 0.20f + random->Float(0.0f, 0.30f);
+    return glm::vec3(0.57f, green, 0.10f + random->Float(0.0f, 0.40f));
 }
 
-glm::vec3 ColorGenerator::GetTreeLeafColor()
+glm::vec3 ColorGenerator::GetTreeLeafColor(EffectRandom* random)
 {
-    return glm::vec3(0.1f, 0.70f + glm::linearRand(0.0f, 0.30f), glm::linearRand(0.0f, 0.20f));
+    float green = 0.70f + random->Float(0.0f, 0.30f);
+    return glm::vec3(0.1f, green, random->Float(0.0f, 0.20f));
 }
 
 glm::vec4 ColorGenerator::GetAllyColor()
@@ -53,20 +55,20 @@ glm::vec4 ColorGenerator::GetEnemyColor()
     return glm::vec4(0.70f + glm::linearRand(0.0f, 0.30f), greenAndBlue, greenAndBlue, 1.0f);
 }
 
-glm::vec4 ColorGenerator::GetBuildingColor()
+glm::vec4 ColorGenerator::GetBuildingColor(EffectRandom* random)
 {
-    float alpha = 0.70f + glm::linearRand(0.0f, 0.20f);
+    float alpha = 0.70f + random->Float(0.0f, 0.20f);
 
     // Buildings are silver and gold. 
-    bool isSilver = glm::linearRand(0.0f, 1.0f) > 0.40f;
+    bool isSilver = random->Float() > 0.40f;
     if (isSilver)
     {
-        float shadingColor = glm::linearRand(0.55f, 0.85f);
+        float shadingColor = random->Float(0.55f, 0.85f);
         return glm::vec4(shadingColor, shadingColor, shadingColor, alpha);
     }
     else
     {
-        float scale = glm::linearRand(0.0f, 1.0f);
+        float scale = random->Float();
         return glm::vec4(0.52f + scale * 0.292f, 0.607f + scale * 0.13f, 0.263f + scale * 0.349f, alpha);
     }
 }
\ No newline at end of file
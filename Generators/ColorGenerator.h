@@ -1,6 +1,7 @@
 #pragma once
 #include <glm\vec3.hpp>
 #include <glm\vec4.hpp>
+#include "Math\EffectRandom.h"
 
 // Generates random colors that fit the overall color theme.
 class ColorGenerator
@@ -9,12 +10,13 @@ public:
     // Effects
     static glm::vec4 GetRockColor();
     static glm::vec4 GetGrassColor();
-    static glm::vec3 GetTravellerColor();
+    // Effect colors are drawn from the effect's generator, so they don't change when a subtile reloads.
+    static glm::vec3 GetTravellerColor(EffectRandom* random);
 
-    static glm::vec3 GetTreeBranchColor();
-    static glm::vec3 GetTreeLeafColor();
+    static glm::vec3 GetTreeBranchColor(EffectRandom* random);
+    static glm::vec3 GetTreeLeafColor(EffectRandom* random);
 
-    static glm::vec4 GetBuildingColor();
+    static glm::vec4 GetBuildingColor(EffectRandom* random);
 
     // NPCs
     static glm::vec4 GetAllyColor();
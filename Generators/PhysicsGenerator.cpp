@@ -61,7 +61,7 @@ btRigidBody* PhysicsGenerator::GetStaticBody(const CShape shape, const btVector3
     pos.setOrigin(origin);
 
     btDefaultMotionState *motionState = new btDefaultMotionState(pos);
-    btRigidBody::btRigidBodyConstructionInfo bodyInfo(0.0f, motionState, CollisionShapes[shape]);
+    btRigidBody::btRigidBodyConstructionInfo bodyInfo(0.0f, motionState, CollisionShapes.at(shape));
     btRigidBody* body = new btRigidBody(bodyInfo);
     body->setUserPointer(nullptr);
     return body;
@@ -86,10 +86,12 @@ btRigidBody* PhysicsGenerator::GetDynamicBody(const CShape shape, const btVector
     pos.setIdentity();
     pos.setOrigin(origin);
 
+    // Terrain effects are built on several threads at once, so the shapes are only ever looked up, never inserted.
+    btCollisionShape* collisionShape = CollisionShapes.at(shape);
     btVector3 localInertia;
-    CollisionShapes[shape]->calculateLocalInertia(mass, localInertia);
+    collisionShape->calculateLocalInertia(mass, localInertia);
     btDefaultMotionState *motionState = new btDefaultMotionState(pos);
-    btRigidBody::btRigidBodyConstructionInfo object(mass, motionState, CollisionShapes[shape], localInertia);
+    btRigidBody::btRigidBodyConstructionInfo object(mass, motionState, collisionShape, localInertia);
     btRigidBody* newBody = new btRigidBody(object);
     newBody->setFriction(0.50f); // TODO configurable.
     newBody->setUserPointer(nullptr);
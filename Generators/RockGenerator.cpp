@@ -92,3 +92,10 @@ void RockGenerator::GetRandomRockModel(unsigned int* modelId, PhysicsGenerator::
     *modelId = rockInternal.modelId;
     *shape = rockInternal.shape;
 }
+
+void RockGenerator::GetRandomRockModel(EffectRandom* random, unsigned int* modelId, PhysicsGenerator::CShape* shape) const
+{
+    const RockInternal& rockInternal = rockArchetypes[random->Int(0, (int)rockArchetypes.size() - 1)];
+    *modelId = rockInternal.modelId;
+    *shape = rockInternal.shape;
+}
\ No newline at end of file
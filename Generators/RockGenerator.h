@@ -3,6 +3,7 @@
 #include <vector>
 #include <glm\vec3.hpp>
 #include "Managers\ModelManager.h"
+#include "Math\EffectRandom.h"
 #include "PhysicsGenerator.h"
 #include "Physics.h"
 
@@ -29,5 +30,8 @@ public:
     std::map<PhysicsGenerator::CShape, const std::vector<glm::vec3>*> GetModelPoints(ModelManager* modelManager);
 
     void GetRandomRockModel(unsigned int* modelId, PhysicsGenerator::CShape* shape) const;
+
+    // Picks the rock model from an effect's generator, so placed rocks don't change when their subtile reloads.
+    void GetRandomRockModel(EffectRandom* random, unsigned int* modelId, PhysicsGenerator::CShape* shape) const;
 };
 
@@ -1,4 +1,3 @@
-#include <glm/gtc/random.hpp>
 #include "SignGenerator.h"
 
 std::vector<SignInternal> SignGenerator::signArchetypes;
@@ -31,9 +30,9 @@ std::map<PhysicsGenerator::CShape, const std::vector<glm::vec3>*> SignGenerator:
     return modelPoints;
 }
 
-void SignGenerator::GetRandomSignModel(unsigned int* modelId, PhysicsGenerator::CShape* shape) const
+void SignGenerator::GetRandomSignModel(EffectRandom* random, unsigned int* modelId, PhysicsGenerator::CShape* shape) const
 {
-    const SignInternal& signInternal = signArchetypes[glm::linearRand(0, (int)signArchetypes.size() - 1)];
+    const SignInternal& signInternal = signArchetypes[random->Int(0, (int)signArchetypes.size() - 1)];
     *modelId = signInternal.modelId;
     *shape = signInternal.shape;
 }
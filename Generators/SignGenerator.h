@@ -3,6 +3,7 @@
 #include <vector>
 #include <glm\vec3.hpp>
 #include "Managers\ModelManager.h"
+#include "Math\EffectRandom.h"
 #include "Physics.h"
 #include "PhysicsGenerator.h"
 
@@ -28,6 +29,6 @@ public:
     // Returns the model points so that physics can properly work on these models.
     std::map<PhysicsGenerator::CShape, const std::vector<glm::vec3>*> GetModelPoints(ModelManager* modelManager);
 
-    void GetRandomSignModel(unsigned int* modelId, PhysicsGenerator::CShape* shape) const;
+    void GetRandomSignModel(EffectRandom* random, unsigned int* modelId, PhysicsGenerator::CShape* shape) const;
 };
 
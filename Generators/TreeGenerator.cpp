@@ -1,7 +1,6 @@
 #include <algorithm>
 #include <chrono>
 #include <limits>
-#include <glm/gtc/random.hpp>
 #include "logging\Logger.h"
 #include "TreeGenerator.h"
 
@@ -51,10 +50,10 @@ bool TreeGenerator::IsPointWithinShape(TreeType type, const glm::vec3& pos)
     }
 }
 
-void TreeGenerator::GenerateAttractionPoints(TreeType type, float radius, float height, std::vector<glm::vec3>* points)
+void TreeGenerator::GenerateAttractionPoints(EffectRandom* random, TreeType type, float radius, float height, std::vector<glm::vec3>* points)
 {
     // TODO configurable. All attraction points are above the trunk height.
-    float trunkHeight = (0.11f + glm::linearRand(0.0f, 1.0f) * 0.22f) * height;
+    float trunkHeight = (0.11f + random->Float() * 0.22f) * height;
     float shapeHeight = height - trunkHeight; // Guaranteed to be positive.
 
     unsigned int pointCount = IsDenseType(type) ? 2000 : 1000;
@@ -62,7 +61,7 @@ void TreeGenerator::GenerateAttractionPoints(TreeType type, float radius, float
     for (unsigned int i = 0; points->size() <= pointCount && i < maxIterations; i++)
     {
         // Potentially generate a random point within the vincinity of the shape (cube of [-radius, -radius, 0], [radius, radius, shapeHeight])
-        glm::vec3 point = glm::linearRand(glm::vec3(-1.0f), glm::vec3(1.0f));
+        glm::vec3 point = random->Vec3(glm::vec3(-1.0f), glm::vec3(1.0f));
         if (IsPointWithinShape(type, point))
         {
             points->push_back(point * glm::vec3(radius * 2.0f - radius, radius * 2.0f - radius, shapeHeight) + glm::vec3(0, 0, trunkHeight));
@@ -145,19 +144,19 @@ void TreeGenerator::InvertBranchSizes(std::vector<unsigned int>* branchSizes)
 }
 
 // Generates a random tree.
-GenerationResults TreeGenerator::GenerateTree(std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints)
+GenerationResults TreeGenerator::GenerateTree(EffectRandom* random, std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints)
 {
-    TreeType type = (TreeType)glm::linearRand(0, (int)TreeType::COUNT - 1);
+    TreeType type = (TreeType)random->Int(0, (int)TreeType::COUNT - 1);
     
     // TODO configurable
-    float radius = 2.0f + glm::linearRand(0.0f, 4.0f);
-    float height = std::min(10.0f, radius + glm::linearRand(-1.0f, 8.0f));
+    float radius = 2.0f + random->Float(0.0f, 4.0f);
+    float height = std::min(10.0f, radius + random->Float(-1.0f, 8.0f));
 
-    return GenerateTree(type, radius, height, trunkLines, trunkSizes, leafPoints);
+    return GenerateTree(random, type, radius, height, trunkLines, trunkSizes, leafPoints);
 }
 
 // Generates a tree of the specified type.
-GenerationResults TreeGenerator::GenerateTree(TreeType type, float radius, float height,
+GenerationResults TreeGenerator::GenerateTree(EffectRandom* random, TreeType type, float radius, float height,
     std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints)
 {
     // TODO support trunk sizes by determining max parent height of branches.
@@ -165,7 +164,7 @@ GenerationResults TreeGenerator::GenerateTree(TreeType type, float radius, float
 
     // Generate the tree at the origin
     std::vector<glm::vec3> attractionPoints;
-    GenerateAttractionPoints(type, radius, height, &attractionPoints);
+    GenerateAttractionPoints(random, type, radius, height, &attractionPoints);
 
     // TODO configurable
     float minDistance = 0.60f;
@@ -211,7 +210,7 @@ GenerationResults TreeGenerator::GenerateTree(TreeType type, float radius, float
                 if (distance < minDistance)
                 {
                     // The leaf is too close, so we remove it and add it to the known leaf points.
-                    leafPoints->push_back(branches[j].pos + glm::linearRand(0.0f, 1.0f) * (branches[j].end() - leaves[i].pos));
+                    leafPoints->push_back(branches[j].pos + random->Float() * (branches[j].end() - leaves[i].pos));
                     leavesToRemove.push_back(i);
                     ++leavesAdded;
                     leafRemoved = true;
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <glm\vec3.hpp>
+#include "Math\EffectRandom.h"
 
 struct Branch
 {
@@ -73,7 +74,7 @@ class TreeGenerator
     // Checks if the point is within a shape (0 to 1 in all dimensions).
     bool IsPointWithinShape(TreeType type, const glm::vec3& pos);
 
-    void GenerateAttractionPoints(TreeType type, float radius, float height, std::vector<glm::vec3>* points);
+    void GenerateAttractionPoints(EffectRandom* random, TreeType type, float radius, float height, std::vector<glm::vec3>* points);
 
     float GetMinLeafDistance(glm::vec3 point, std::vector<Leaf>* leafs);
     void GrowTrunk(std::vector<Branch>* branches, std::vector<Leaf>* leafs, float branchLength, float leafDetectionDistance, float maxHeight);
@@ -86,11 +87,11 @@ class TreeGenerator
 public:
     TreeGenerator();
 
-    // Generates a random tree.
-    GenerationResults GenerateTree(std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints);
+    // Generates a random tree. Every choice is drawn from the given generator, so the same seed always gives the same tree.
+    GenerationResults GenerateTree(EffectRandom* random, std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints);
 
     // Generates a tree of the specified type.
-    GenerationResults GenerateTree(TreeType type, float radius, float height,
+    GenerationResults GenerateTree(EffectRandom* random, TreeType type, float radius, float height,
         std::vector<glm::vec3>* trunkLines, std::vector<unsigned int>* trunkSizes, std::vector<glm::vec3>* leafPoints);
 };
 
@@ -0,0 +1,172 @@
+#include <SFML\System.hpp>
+#include "logging\Logger.h"
+#include "GlResourcePool.h"
+
+GlResourcePool::GlResourcePool(int retireFrames)
+    : retiredBuffers(retireFrames), retiredVertexArrays(retireFrames), pooledBuffers(), freeBuffers(), nextPoolOrder(0), stats()
+{
+}
+
+void GlResourcePool::SetRetireFrames(int retireFrames)
+{
+    retiredBuffers.SetDelayFrames(retireFrames);
+    retiredVertexArrays.SetDelayFrames(retireFrames);
+}
+
+GLsizeiptr GlResourcePool::GetBucketSize(GLsizeiptr byteSize)
+{
+    GLsizeiptr bucketSize = 1;
+    while (bucketSize < byteSize)
+    {
+        bucketSize *= 2;
+    }
+
+    return bucketSize;
+}
+
+GLuint GlResourcePool::AcquireBuffer(GLsizeiptr byteSize)
+{
+    // Buckets list their buffers in pool order, so this takes the most recently pooled one.
+    auto iter = freeBuffers.upper_bound(GetBucketSize(byteSize));
+    if (iter != freeBuffers.begin() && (--iter)->first == GetBucketSize(byteSize))
+    {
+        GLuint bufferId = pooledBuffers[iter->second].id;
+        pooledBuffers.erase(iter->second);
+        freeBuffers.erase(iter);
+        ++stats.buffersRecycled;
+        return bufferId;
+    }
+
+    GLuint bufferId;
+    glGenBuffers(1, &bufferId);
+    ++stats.buffersCreated;
+    return bufferId;
+}
+
+GLuint GlResourcePool::AcquireVertexArray()
+{
+    // Vertex arrays aren't recycled, as they would keep the attribute layout of their last effect.
+    GLuint vertexArrayId;
+    glGenVertexArrays(1, &vertexArrayId);
+    return vertexArrayId;
+}
+
+void GlResourcePool::SetBufferData(GLuint bufferId, GLsizeiptr byteSize, const void* data, GLenum usage)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, bufferId);
+    glBufferData(GL_ARRAY_BUFFER, GetBucketSize(byteSize), nullptr, usage);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, byteSize, data);
+}
+
+void GlResourcePool::RetireBuffer(GLuint bufferId, GLsizeiptr byteSize)
+{
+    retiredBuffers.Retire(PooledBuffer(bufferId, GetBucketSize(byteSize)));
+}
+
+void GlResourcePool::RetireVertexArray(GLuint vertexArrayId)
+{
+    retiredVertexArrays.Retire(vertexArrayId);
+}
+
+int GlResourcePool::PoolBuffer(const PooledBuffer& buffer)
+{
+    int buffersDeleted = 0;
+    if ((int)pooledBuffers.size() >= MaxPooledBuffers)
+    {
+        // The buffer pooled the longest ago is the least likely to be asked for again.
+        auto oldest = pooledBuffers.begin();
+        auto bucket = freeBuffers.equal_range(oldest->second.byteSize);
+        for (auto iter = bucket.first; iter != bucket.second; iter++)
+        {
+            if (iter->second == oldest->first)
+            {
+                freeBuffers.erase(iter);
+                break;
+            }
+        }
+
+        glDeleteBuffers(1, &oldest->second.id);
+        pooledBuffers.erase(oldest);
+        ++stats.buffersEvicted;
+        ++buffersDeleted;
+    }
+
+    pooledBuffers[nextPoolOrder] = buffer;
+    freeBuffers.insert(std::make_pair(buffer.byteSize, nextPoolOrder));
+    ++nextPoolOrder;
+    return buffersDeleted;
+}
+
+int GlResourcePool::ProcessRetiredObjects(float budgetMs)
+{
+    sf::Clock clock;
+    sf::Int64 budgetUs = (sf::Int64)(budgetMs * 1000.0f);
+    retiredBuffers.AdvanceFrame();
+    retiredVertexArrays.AdvanceFrame();
+
+    // Always handle at least one object per frame, so the queues keep draining.
+    int objectsHandled = 0;
+    int objectsDeleted = 0;
+    PooledBuffer buffer;
+    while ((objectsHandled == 0 || clock.getElapsedTime().asMicroseconds() < budgetUs) && retiredBuffers.TryPopExpired(&buffer))
+    {
+        objectsDeleted += PoolBuffer(buffer);
+        ++objectsHandled;
+    }
+
+    GLuint vertexArrayId;
+    while ((objectsHandled == 0 || clock.getElapsedTime().asMicroseconds() < budgetUs) && retiredVertexArrays.TryPopExpired(&vertexArrayId))
+    {
+        glDeleteVertexArrays(1, &vertexArrayId);
+        ++stats.vertexArraysDeleted;
+        ++objectsHandled;
+        ++objectsDeleted;
+    }
+
+    return objectsDeleted;
+}
+
+int GlResourcePool::GetRetiringCount() const
+{
+    return (int)(retiredBuffers.Size() + retiredVertexArrays.Size());
+}
+
+int GlResourcePool::GetPooledBufferCount() const
+{
+    return (int)pooledBuffers.size();
+}
+
+void GlResourcePool::LogStats()
+{
+    Logger::Log("GL Resource Pool: ", stats.buffersCreated, " buffers created, ", stats.buffersRecycled, " recycled, ", stats.buffersEvicted, " evicted from the pool, ",
+        stats.vertexArraysDeleted, " vertex arrays deleted. ", GetRetiringCount(), " objects retiring, ", GetPooledBufferCount(), " buffers pooled.");
+    stats.Reset();
+}
+
+void GlResourcePool::Cleanup()
+{
+    PooledBuffer buffer;
+    while (retiredBuffers.TryPop(&buffer))
+    {
+        glDeleteBuffers(1, &buffer.id);
+    }
+
+    GLuint vertexArrayId;
+    while (retiredVertexArrays.TryPop(&vertexArrayId))
+    {
+        glDeleteVertexArrays(1, &vertexArrayId);
+    }
+
+    for (auto iter = pooledBuffers.begin(); iter != pooledBuffers.end(); iter++)
+    {
+        glDeleteBuffers(1, &iter->second.id);
+    }
+
+    pooledBuffers.clear();
+    freeBuffers.clear();
+}
+
+GlResourcePool::~GlResourcePool()
+{
+    Cleanup();
+}
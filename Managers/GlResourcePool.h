@@ -0,0 +1,95 @@
+#pragma once
+#include <map>
+#include <GL/glew.h>
+#include "Data\RetirementQueue.h"
+
+// Tracks how much OpenGL object churn the pool absorbed.
+struct GlResourcePoolStats
+{
+    long buffersCreated;
+    long buffersRecycled;
+    long buffersEvicted;
+    long vertexArraysDeleted;
+
+    GlResourcePoolStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        buffersCreated = 0;
+        buffersRecycled = 0;
+        buffersEvicted = 0;
+        vertexArraysDeleted = 0;
+    }
+};
+
+// Defers deleting the buffers and vertex arrays of unloaded effects until the frames drawing them have finished, then recycles buffers into a pool by size.
+//  Buffer sizes are rounded up to a power of two, so an effect that's reloaded with slightly different data (such as when walking back and forth across a
+//  region border) still gets back a buffer it fits in, and re-specifying its data reuses the existing storage instead of the driver allocating more.
+class GlResourcePool
+{
+    // Once this many buffers are pooled, the buffer pooled the longest ago is deleted to make room.
+    static const int MaxPooledBuffers = 512;
+
+    struct PooledBuffer
+    {
+        GLuint id;
+        GLsizeiptr byteSize;
+
+        PooledBuffer()
+            : id(0), byteSize(0)
+        {
+        }
+
+        PooledBuffer(GLuint id, GLsizeiptr byteSize)
+            : id(id), byteSize(byteSize)
+        {
+        }
+    };
+
+    RetirementQueue<PooledBuffer> retiredBuffers;
+    RetirementQueue<GLuint> retiredVertexArrays;
+
+    // Pooled buffers by the order they were pooled in, and the pool order of the buffers of each bucket size.
+    std::map<unsigned long, PooledBuffer> pooledBuffers;
+    std::multimap<GLsizeiptr, unsigned long> freeBuffers;
+    unsigned long nextPoolOrder;
+    GlResourcePoolStats stats;
+
+    // Pools a buffer that finished retiring, deleting the oldest pooled buffer if the pool is full. Returns the number of buffers deleted.
+    int PoolBuffer(const PooledBuffer& buffer);
+
+public:
+    GlResourcePool(int retireFrames);
+    void SetRetireFrames(int retireFrames);
+
+    // Returns the size of the storage of buffers holding this many bytes, which is the next power of two.
+    static GLsizeiptr GetBucketSize(GLsizeiptr byteSize);
+
+    // Returns a pooled buffer of the size's bucket if one is free, or a new buffer. Give it its data with SetBufferData.
+    GLuint AcquireBuffer(GLsizeiptr byteSize);
+    GLuint AcquireVertexArray();
+
+    // Binds the buffer to GL_ARRAY_BUFFER and uploads its data, sizing its storage to the bucket so it can be reused for any size in the bucket.
+    void SetBufferData(GLuint bufferId, GLsizeiptr byteSize, const void* data, GLenum usage);
+
+    // Retires objects that are no longer used. The buffer size is the size of its data, as last given to SetBufferData.
+    void RetireBuffer(GLuint bufferId, GLsizeiptr byteSize);
+    void RetireVertexArray(GLuint vertexArrayId);
+
+    // Advances a frame, then pools the buffers and deletes the vertex arrays that finished retiring until the time budget is exhausted.
+    //  Returns the number of objects deleted.
+    int ProcessRetiredObjects(float budgetMs);
+
+    // Objects retired that haven't been pooled or deleted yet.
+    int GetRetiringCount() const;
+    int GetPooledBufferCount() const;
+
+    void LogStats();
+
+    // Deletes everything, including objects still retiring. Only safe when nothing is in flight.
+    void Cleanup();
+    virtual ~GlResourcePool();
+};
@@ -1,9 +1,19 @@
+#include <algorithm>
+#include <cmath>
+#include <SFML\System.hpp>
+#include <glm\gtc\matrix_transform.hpp>
+#include "Config\TerrainConfig.h"
 #include "logging\Logger.h"
 #include "RegionManager.h"
 
 RegionManager::RegionManager(ShaderFactory* shaderManager, ModelManager* modelManager, Physics* physics, std::string terrainRootFolder, glm::ivec2 min, glm::ivec2 max, int tileViewDistance)
     : terrainManager(min, max, shaderManager, modelManager, physics, terrainRootFolder),
-      loadedRegions(), visibleTiles(), tileViewDistance(tileViewDistance)
+      loadedRegions(min, max), visibleTiles(min * TerrainTile::Subdivisions, max * TerrainTile::Subdivisions), visibleRegions(min, max), visibleRegionTileCounts(min, max),
+      viewRowHalfWidths(ComputeViewRowHalfWidths(tileViewDistance / 2)), pendingActivations(), activationStats(),
+      culler(), cullingBounds(), cullingTiles(), unculledIndices(), prefetchedRegions(), prefetchStats(),
+      regionLastVisible(min, max), visibilityUpdate(0), residentBytes(0), isEvicting(false), cacheStats(),
+      physicsTiles(min * TerrainTile::Subdivisions, max * TerrainTile::Subdivisions), physicsAreaUpdate(0), physicsAreaStats(),
+      deformedSubtiles(), deformationStats(), batchKeys(), batchXs(), batchYs(), batchHeights(), tileViewDistance(tileViewDistance), isHorizonEnabled(false)
 {
     this->min = min * TerrainTile::Subdivisions;
     this->max = max * TerrainTile::Subdivisions;
@@ -12,7 +22,73 @@ RegionManager::RegionManager(ShaderFactory* shaderManager, ModelManager* modelMa
 
 bool RegionManager::InitializeGraphics()
 {
-    return terrainManager.LoadBasics();
+    isHorizonEnabled = TerrainConfig::HorizonEnabled;
+    return terrainManager.LoadBasics(GetMaxVisibleTileCount());
+}
+
+bool RegionManager::SetViewDistance(int tileViewDistance)
+{
+    // Removal moves the last position into the removed one, so iterate backwards.
+    const std::vector<glm::ivec2>& visiblePositions = visibleTiles.GetPositions();
+    for (int i = (int)visiblePositions.size() - 1; i >= 0; i--)
+    {
+        RemoveVisibleTile(visiblePositions[i]);
+    }
+
+    pendingActivations.clear();
+
+    this->tileViewDistance = tileViewDistance;
+    viewRowHalfWidths = ComputeViewRowHalfWidths(tileViewDistance / 2);
+
+    // Outside the extents, so the next update always rebuilds the view.
+    lastCenterTile = min - glm::ivec2(1);
+    return terrainManager.ResizeTexturePool(GetMaxVisibleTileCount());
+}
+
+void RegionManager::SetHorizonEnabled(bool isEnabled)
+{
+    isHorizonEnabled = isEnabled;
+}
+
+bool RegionManager::IsVisibleTerrainLoaded() const
+{
+    return pendingActivations.empty() && lastCenterTile != min - glm::ivec2(1);
+}
+
+size_t RegionManager::GetResidentBytes()
+{
+    TerrainMemoryUsage memoryUsage;
+    for (const glm::ivec2& region : loadedRegions.GetPositions())
+    {
+        loadedRegions.Get(region)->AddMemoryUsage(&terrainManager, &memoryUsage);
+    }
+
+    return memoryUsage.GetTotalBytes();
+}
+
+const glm::ivec2& RegionManager::GetMinTile() const
+{
+    return min;
+}
+
+const glm::ivec2& RegionManager::GetMaxTile() const
+{
+    return max;
+}
+
+int RegionManager::GetViewDistance() const
+{
+    return tileViewDistance;
+}
+
+void RegionManager::LoadTileImmediately(const glm::ivec2& tile)
+{
+    GetOrCreateRegion(tile / TerrainTile::Subdivisions, 0.0f)->EnsureTileLoaded(&terrainManager);
+}
+
+size_t RegionManager::GetLoadedRegionCount() const
+{
+    return loadedRegions.Size();
 }
 
 TerrainManager& RegionManager::GetTerrainManager()
@@ -22,43 +98,193 @@ TerrainManager& RegionManager::GetTerrainManager()
 
 float RegionManager::GetPointHeight(Physics* physics, const glm::vec2 point)
 {
-    glm::ivec2 region = glm::ivec2((int)point.x, (int)point.y) / TerrainTile::TileSize;
-    glm::ivec2 subtileRegion = glm::ivec2((int)point.x, (int)point.y) / TerrainTile::SubtileSize;
+    glm::ivec2 subtileRegion = GetPointTile(point);
     if (subtileRegion.x < min.x || subtileRegion.x > max.x || subtileRegion.y < min.y || subtileRegion.y > max.y)
     {
-        Logger::LogWarn("Attempted to get the height of a point outside the subtile boundaries: [", region.x, ", ", region.y, "].");
+        Logger::LogWarn("Attempted to get the height of a point outside the subtile boundaries: [", subtileRegion.x, ", ", subtileRegion.y, "].");
         return 0;
     }
 
     // Load the region if it hasn't been loaded already.
-    if (loadedRegions.find(region) == loadedRegions.end())
+    TerrainSample sample;
+    if (!SampleTerrain(point, &sample))
     {
-        loadedRegions[region] = new Region(region, &terrainManager);
+        GetOrCreateRegion(subtileRegion / TerrainTile::Subdivisions, 0.0f)->EnsureTileLoaded(&terrainManager);
+        SampleTerrain(point, &sample);
     }
 
-    std::vector<glm::ivec2> tileMap;
-    tileMap.push_back(subtileRegion);
-    loadedRegions[region]->EnsureHeightmapsLoaded(physics, &tileMap);
-    return loadedRegions[region]->GetPointHeight(tileMap[0], glm::ivec2((int)point.x, (int)point.y));
+    // Bodies are usually placed at the height just looked up, so make sure it can be collided with before they are first simulated.
+    EnsurePhysicsTile(subtileRegion, physics);
+    return sample.height;
 }
 
 int RegionManager::GetPointTerrainType(Physics* physics, const glm::vec2 point)
 {
-    glm::ivec2 region = glm::ivec2((int)point.x, (int)point.y) / TerrainTile::TileSize;
-    glm::ivec2 subtileRegion = glm::ivec2((int)point.x, (int)point.y) / TerrainTile::SubtileSize;
+    glm::ivec2 subtileRegion = GetPointTile(point);
     if (subtileRegion.x < min.x || subtileRegion.x > max.x || subtileRegion.y < min.y || subtileRegion.y  > max.y)
     {
-        Logger::LogWarn("Attempted to get the terrain type of a point outside the subtile boundaries: [", region.x, ", ", region.y, "].");
+        Logger::LogWarn("Attempted to get the terrain type of a point outside the subtile boundaries: [", subtileRegion.x, ", ", subtileRegion.y, "].");
         return TerrainTypes::LAKE;
     }
 
     // Load the region if it hasn't been loaded already.
-    if (loadedRegions.find(region) == loadedRegions.end())
+    TerrainSample sample;
+    if (!SampleTerrain(point, &sample))
+    {
+        GetOrCreateRegion(subtileRegion / TerrainTile::Subdivisions, 0.0f)->EnsureTileLoaded(&terrainManager);
+        SampleTerrain(point, &sample);
+    }
+
+    return sample.type;
+}
+
+glm::ivec2 RegionManager::GetPointTile(const glm::vec2& point)
+{
+    return glm::ivec2((int)std::floor(point.x / (float)TerrainTile::SubtileSize), (int)std::floor(point.y / (float)TerrainTile::SubtileSize));
+}
+
+const SubTile* RegionManager::FindResidentSubtile(const glm::ivec2& tile) const
+{
+    if (tile.x < min.x || tile.x > max.x || tile.y < min.y || tile.y > max.y)
     {
-        loadedRegions[region] = new Region(region, &terrainManager);
+        return nullptr;
     }
 
-    return loadedRegions[region]->GetPointType(subtileRegion, glm::ivec2((int)point.x, (int)point.y));
+    Region* const* region = loadedRegions.Find(tile / TerrainTile::Subdivisions);
+    return region == nullptr ? nullptr : (*region)->GetSubtile(tile);
+}
+
+bool RegionManager::SampleTerrain(const glm::vec2& point, TerrainSample* sample) const
+{
+    glm::ivec2 tile = GetPointTile(point);
+    const SubTile* subtile = FindResidentSubtile(tile);
+    if (subtile == nullptr)
+    {
+        sample->height = 0.0f;
+        sample->type = TerrainTypes::LAKE;
+        sample->isResident = false;
+        return false;
+    }
+
+    // Clamp in case rounding put the point just outside the tile.
+    const float maxOffset = (float)TerrainTile::SubtileSize - 0.001f;
+    float x = std::min(std::max(point.x - (float)(tile.x * TerrainTile::SubtileSize), 0.0f), maxOffset);
+    float y = std::min(std::max(point.y - (float)(tile.y * TerrainTile::SubtileSize), 0.0f), maxOffset);
+    sample->height = subtile->GetInterpolatedHeight(x, y);
+    sample->type = subtile->GetType(x, y);
+    sample->isResident = true;
+    return true;
+}
+
+int RegionManager::SampleTerrainBatch(const glm::vec2* points, int count, TerrainSample* samples)
+{
+    // Sort the points by tile (keeping their order within a tile), so each tile is looked up once and its points are interpolated in one tight loop.
+    int width = max.x - min.x + 1;
+    batchKeys.clear();
+    for (int i = 0; i < count; i++)
+    {
+        glm::ivec2 tile = GetPointTile(points[i]);
+        if (tile.x < min.x || tile.x > max.x || tile.y < min.y || tile.y > max.y)
+        {
+            samples[i].height = 0.0f;
+            samples[i].type = TerrainTypes::LAKE;
+            samples[i].isResident = false;
+            continue;
+        }
+
+        unsigned long long tileIndex = (unsigned long long)((tile.x - min.x) + (tile.y - min.y) * width);
+        batchKeys.push_back((tileIndex << 32) | (unsigned long long)i);
+    }
+
+    std::sort(batchKeys.begin(), batchKeys.end());
+
+    const float maxOffset = (float)TerrainTile::SubtileSize - 0.001f;
+    int residentCount = 0;
+    size_t runStart = 0;
+    while (runStart < batchKeys.size())
+    {
+        unsigned long long tileIndex = batchKeys[runStart] >> 32;
+        size_t runEnd = runStart + 1;
+        while (runEnd < batchKeys.size() && (batchKeys[runEnd] >> 32) == tileIndex)
+        {
+            ++runEnd;
+        }
+
+        int runCount = (int)(runEnd - runStart);
+        glm::ivec2 tile = min + glm::ivec2((int)(tileIndex % width), (int)(tileIndex / width));
+        const SubTile* subtile = FindResidentSubtile(tile);
+        if (subtile == nullptr)
+        {
+            for (size_t key = runStart; key < runEnd; key++)
+            {
+                TerrainSample& sample = samples[batchKeys[key] & 0xFFFFFFFF];
+                sample.height = 0.0f;
+                sample.type = TerrainTypes::LAKE;
+                sample.isResident = false;
+            }
+        }
+        else
+        {
+            batchXs.resize(runCount);
+            batchYs.resize(runCount);
+            batchHeights.resize(runCount);
+            glm::vec2 tileOrigin = glm::vec2((float)tile.x, (float)tile.y) * (float)TerrainTile::SubtileSize;
+            for (int i = 0; i < runCount; i++)
+            {
+                const glm::vec2& point = points[batchKeys[runStart + i] & 0xFFFFFFFF];
+                batchXs[i] = std::min(std::max(point.x - tileOrigin.x, 0.0f), maxOffset);
+                batchYs[i] = std::min(std::max(point.y - tileOrigin.y, 0.0f), maxOffset);
+            }
+
+            subtile->GetInterpolatedHeights(&batchXs[0], &batchYs[0], runCount, &batchHeights[0]);
+            for (int i = 0; i < runCount; i++)
+            {
+                TerrainSample& sample = samples[batchKeys[runStart + i] & 0xFFFFFFFF];
+                sample.height = batchHeights[i];
+                sample.type = subtile->GetType(batchXs[i], batchYs[i]);
+                sample.isResident = true;
+            }
+
+            residentCount += runCount;
+        }
+
+        runStart = runEnd;
+    }
+
+    return residentCount;
+}
+
+Region* RegionManager::GetOrCreateRegion(const glm::ivec2& region, float priority)
+{
+    Region** loadedRegion = loadedRegions.Find(region);
+    if (loadedRegion != nullptr)
+    {
+        // Update the priority if still streaming in.
+        terrainManager.RequestTerrainTile(region, priority);
+        return *loadedRegion;
+    }
+
+    regionLastVisible.Set(region, visibilityUpdate);
+    return loadedRegions.Set(region, new Region(region, &terrainManager, priority));
+}
+
+void RegionManager::UnloadRegion(const glm::ivec2& region, Physics* physics)
+{
+    Region* loadedRegion = loadedRegions.Get(region);
+    loadedRegion->CleanupRegion(&terrainManager, physics);
+    delete loadedRegion;
+    loadedRegions.Remove(region);
+
+    // The region removed its heightfields, so stop tracking them.
+    const std::vector<glm::ivec2>& physicsPositions = physicsTiles.GetPositions();
+    for (int i = (int)physicsPositions.size() - 1; i >= 0; i--)
+    {
+        if (physicsPositions[i] / TerrainTile::Subdivisions == region)
+        {
+            physicsTiles.Remove(physicsPositions[i]);
+        }
+    }
+    regionLastVisible.Remove(region);
 }
 
 glm::ivec2 RegionManager::GetCurrentCenterTile(const glm::vec3& position) const
@@ -67,31 +293,367 @@ glm::ivec2 RegionManager::GetCurrentCenterTile(const glm::vec3& position) const
     return glm::ivec2((int)position.x, (int)position.y) / TerrainTile::SubtileSize;
 }
 
-void RegionManager::ComputeVisibleTiles(const glm::ivec2& centerTile, const glm::vec2& playerOrientation, std::vector<glm::ivec2>* visibleTiles) const
+std::vector<int> RegionManager::ComputeViewRowHalfWidths(int viewRadius)
 {
     // Visible tiles are defined as those within the *radius* of the center tile, given the view distance.
-    int minX = std::max(min.x, centerTile.x - tileViewDistance / 2);
-    int minY = std::max(min.y, centerTile.y - tileViewDistance / 2);
-    int maxX = std::min(max.x, centerTile.x + tileViewDistance / 2);
-    int maxY = std::min(max.y, centerTile.y + tileViewDistance / 2);
-    for (int i = minX; i < maxX; i++)
-    {
-        for (int j = minY; j < maxY; j++)
-        {
-            bool isForwards = true;
-            // bool isForwards = (i == centerTile.x && j == centerTile.y) || 
-            //     glm::dot(playerOrientation, glm::normalize(glm::vec2((float)i, (float)j) - glm::vec2((float)centerTile.x, (float)centerTile.y))) > -0.5f;
-            bool isInViewCircle = std::pow(i - centerTile.x, 2) + std::pow(j - centerTile.y, 2) < std::pow(tileViewDistance / 2, 2);
-            if (isForwards && isInViewCircle)
+    std::vector<int> rowHalfWidths;
+    for (int rowOffset = -viewRadius; rowOffset < viewRadius; rowOffset++)
+    {
+        int halfWidth = -1;
+        while ((halfWidth + 1) * (halfWidth + 1) + rowOffset * rowOffset < viewRadius * viewRadius)
+        {
+            ++halfWidth;
+        }
+
+        rowHalfWidths.push_back(halfWidth);
+    }
+
+    return rowHalfWidths;
+}
+
+int RegionManager::GetMaxVisibleTileCount() const
+{
+    // Rows span [-halfWidth, min(halfWidth, radius - 1)] around the center, which is the most that can be visible at once.
+    int viewRadius = (int)viewRowHalfWidths.size() / 2;
+    int tileCount = 0;
+    for (int halfWidth : viewRowHalfWidths)
+    {
+        if (halfWidth != -1)
+        {
+            tileCount += halfWidth + std::min(halfWidth, viewRadius - 1) + 1;
+        }
+    }
+
+    return tileCount;
+}
+
+void RegionManager::GetViewRowSpan(const glm::ivec2& centerTile, const std::vector<int>& rowHalfWidths, int row, int* spanMin, int* spanMax) const
+{
+    *spanMin = 0;
+    *spanMax = 0;
+
+    int viewRadius = (int)rowHalfWidths.size() / 2;
+    int rowIndex = row - centerTile.y + viewRadius;
+    if (row < min.y || row >= max.y || rowIndex < 0 || rowIndex >= (int)rowHalfWidths.size() || rowHalfWidths[rowIndex] == -1)
+    {
+        return;
+    }
+
+    // The view circle covers [-radius, radius) in each axis.
+    int halfWidth = rowHalfWidths[rowIndex];
+    *spanMin = std::max(min.x, centerTile.x - halfWidth);
+    *spanMax = std::min(max.x, centerTile.x + std::min(halfWidth, viewRadius - 1) + 1);
+}
+
+void RegionManager::ComputeVisibleTiles(const glm::ivec2& centerTile, const glm::vec2& playerOrientation, int viewDistance, std::vector<glm::ivec2>* visibleTiles) const
+{
+    std::vector<int> rowHalfWidths = ComputeViewRowHalfWidths(viewDistance / 2);
+    for (int j = centerTile.y - viewDistance / 2; j < centerTile.y + viewDistance / 2; j++)
+    {
+        int spanMin, spanMax;
+        GetViewRowSpan(centerTile, rowHalfWidths, j, &spanMin, &spanMax);
+        for (int i = spanMin; i < spanMax; i++)
+        {
+            visibleTiles->push_back(glm::ivec2(i, j));
+        }
+    }
+}
+
+// Adds the tiles of a row in [spanMin, spanMax) that are not in [excludedMin, excludedMax).
+static void AddSpanDifference(int row, int spanMin, int spanMax, int excludedMin, int excludedMax, std::vector<glm::ivec2>* tiles)
+{
+    if (excludedMin >= excludedMax)
+    {
+        excludedMin = spanMax;
+        excludedMax = spanMax;
+    }
+
+    for (int i = spanMin; i < std::min(spanMax, excludedMin); i++)
+    {
+        tiles->push_back(glm::ivec2(i, row));
+    }
+
+    for (int i = std::max(spanMin, excludedMax); i < spanMax; i++)
+    {
+        tiles->push_back(glm::ivec2(i, row));
+    }
+}
+
+void RegionManager::DiffVisibleTiles(const glm::ivec2& previousCenterTile, bool hadPreviousView, const glm::ivec2& centerTile, std::vector<glm::ivec2>* enteringTiles, std::vector<glm::ivec2>* leavingTiles) const
+{
+    // Each row of the view circle is a single span, so only the ends of each row can change.
+    int viewRadius = tileViewDistance / 2;
+    int firstRow = hadPreviousView ? std::min(previousCenterTile.y, centerTile.y) - viewRadius : centerTile.y - viewRadius;
+    int lastRow = hadPreviousView ? std::max(previousCenterTile.y, centerTile.y) + viewRadius : centerTile.y + viewRadius;
+    for (int j = std::max(firstRow, min.y); j < std::min(lastRow, max.y); j++)
+    {
+        int previousMin = 0, previousMax = 0;
+        if (hadPreviousView)
+        {
+            GetViewRowSpan(previousCenterTile, viewRowHalfWidths, j, &previousMin, &previousMax);
+        }
+
+        int currentMin, currentMax;
+        GetViewRowSpan(centerTile, viewRowHalfWidths, j, &currentMin, &currentMax);
+
+        AddSpanDifference(j, currentMin, currentMax, previousMin, previousMax, enteringTiles);
+        AddSpanDifference(j, previousMin, previousMax, currentMin, currentMax, leavingTiles);
+    }
+}
+
+void RegionManager::AddVisibleTile(const glm::ivec2& tile)
+{
+    glm::ivec2 region = tile / TerrainTile::Subdivisions;
+    if (!visibleRegions.Contains(region))
+    {
+        bool isPrefetched = std::find(prefetchedRegions.begin(), prefetchedRegions.end(), region) != prefetchedRegions.end();
+        if (!isPrefetched && loadedRegions.Contains(region))
+        {
+            ++cacheStats.regionsReused;
+        }
+
+        visibleRegions.Set(region, GetOrCreateRegion(region, 0.0f));
+        visibleRegionTileCounts.Set(region, 0);
+    }
+
+    ++visibleRegionTileCounts.Get(region);
+    regionLastVisible.Set(region, visibilityUpdate);
+    visibleTiles.Set(tile, visibleRegions.Get(region));
+}
+
+void RegionManager::RemoveVisibleTile(const glm::ivec2& tile)
+{
+    // The region stays loaded in the region cache after its last tile leaves the view.
+    glm::ivec2 region = tile / TerrainTile::Subdivisions;
+    visibleTiles.Get(tile)->DeactivateSubtile(&terrainManager, tile);
+    regionLastVisible.Set(region, visibilityUpdate);
+    if (--visibleRegionTileCounts.Get(region) == 0)
+    {
+        visibleRegions.Remove(region);
+        visibleRegionTileCounts.Remove(region);
+    }
+
+    visibleTiles.Remove(tile);
+}
+
+void RegionManager::ActivatePendingTiles()
+{
+    sf::Clock clock;
+    sf::Int64 budgetUs = (sf::Int64)(TerrainConfig::ActivationBudgetMs * 1000.0f);
+
+    // Tiles still streaming in are skipped until they're uploaded. Always activate at least one tile per frame so activation makes progress.
+    //  The effects of the activated tiles are loaded together afterwards, so their estimated cost counts against the budget.
+    TerrainEffectManager& effectManager = terrainManager.GetEffectManager();
+    int subtilesActivated = 0;
+    for (int i = (int)pendingActivations.size() - 1; i >= 0; i--)
+    {
+        if (subtilesActivated != 0 && (float)clock.getElapsedTime().asMicroseconds() + effectManager.EstimateQueuedLoadUs() > (float)budgetUs)
+        {
+            break;
+        }
+
+        const glm::ivec2 tile = pendingActivations[i];
+        if (visibleTiles.Get(tile)->ActivateSubtile(&terrainManager, tile))
+        {
+            pendingActivations.erase(pendingActivations.begin() + i);
+            ++subtilesActivated;
+        }
+    }
+
+    effectManager.LoadQueuedEffects();
+    if (subtilesActivated != 0)
+    {
+        long activationTime = (long)clock.getElapsedTime().asMicroseconds();
+        activationStats.subtilesActivated += subtilesActivated;
+        activationStats.framesActivating++;
+        activationStats.usActivationTime += activationTime;
+        activationStats.usWorstFrameActivationTime = std::max(activationStats.usWorstFrameActivationTime, activationTime);
+    }
+}
+
+void RegionManager::LogActivationStats()
+{
+    Logger::Log("Terrain Activation: ", activationStats.visibleSetUpdates, " visible set updates in ", activationStats.usVisibleSetTime, " us, ",
+        activationStats.subtilesActivated, " subtiles activated in ", activationStats.framesActivating, " frames, ", activationStats.usActivationTime, " us total, ",
+        activationStats.usWorstFrameActivationTime, " us worst frame, ", pendingActivations.size(), " subtiles pending.");
+    activationStats.Reset();
+}
+
+void RegionManager::PrefetchRegions(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, const glm::vec3& playerVelocity, Physics* physics)
+{
+    glm::vec2 position = glm::vec2(playerPosition.x, playerPosition.y);
+    glm::vec2 velocity = glm::vec2(playerVelocity.x, playerVelocity.y);
+    float speed = glm::length(velocity);
+
+    // Follow the player's path forwards. At each point, the leading edge of the view circle (straight ahead and to either side) becomes visible.
+    std::vector<glm::ivec2> predictedRegions;
+    if (speed > TerrainConfig::MinPrefetchSpeed)
+    {
+        glm::vec2 direction = velocity / speed;
+        glm::vec2 side = glm::vec2(-direction.y, direction.x);
+        float viewRadius = (float)((tileViewDistance / 2) * TerrainTile::SubtileSize);
+        float lookahead = speed * TerrainConfig::PrefetchSeconds;
+
+        const float sampleSpacing = (float)TerrainTile::SubtileSize;
+        for (float distance = sampleSpacing; distance <= lookahead; distance += sampleSpacing)
+        {
+            glm::vec2 pathPoint = position + direction * distance;
+            glm::vec2 leadingEdges[3] = { pathPoint + direction * viewRadius, pathPoint + (direction + side) * (viewRadius * 0.7071f), pathPoint + (direction - side) * (viewRadius * 0.7071f) };
+            for (const glm::vec2& leadingEdge : leadingEdges)
+            {
+                glm::ivec2 leadingTile = glm::ivec2((int)leadingEdge.x, (int)leadingEdge.y) / TerrainTile::SubtileSize;
+                if (leadingEdge.x < 0 || leadingEdge.y < 0 || leadingTile.x < min.x || leadingTile.y < min.y || leadingTile.x > max.x || leadingTile.y > max.y)
+                {
+                    continue;
+                }
+
+                glm::ivec2 region = leadingTile / TerrainTile::Subdivisions;
+                if (!visibleRegions.Contains(region) && std::find(predictedRegions.begin(), predictedRegions.end(), region) == predictedRegions.end())
+                {
+                    // Samples are in path order, so the first time a region is seen is the soonest it will be needed.
+                    predictedRegions.push_back(region);
+                    if (!loadedRegions.Contains(region))
+                    {
+                        ++prefetchStats.regionsPrefetched;
+                    }
+
+                    GetOrCreateRegion(region, distance / speed);
+                }
+            }
+        }
+    }
+
+    // Cancel prefetched regions the player has turned away from. Those off to the side are kept, in case the player only swerved.
+    glm::vec2 heading = speed > TerrainConfig::MinPrefetchSpeed ? velocity / speed : playerOrientation;
+    for (const glm::ivec2& region : prefetchedRegions)
+    {
+        bool isPredicted = std::find(predictedRegions.begin(), predictedRegions.end(), region) != predictedRegions.end();
+        if (isPredicted || visibleRegions.Contains(region) || !loadedRegions.Contains(region))
+        {
+            continue;
+        }
+
+        // Fully-loaded regions are left to the region cache instead.
+        glm::vec2 regionCenter = (glm::vec2((float)region.x, (float)region.y) + glm::vec2(0.5f, 0.5f)) * (float)TerrainTile::TileSize;
+        if (glm::dot(regionCenter - position, heading) < 0)
+        {
+            if (!loadedRegions.Get(region)->IsTileLoaded())
             {
-                visibleTiles->push_back(glm::ivec2(i, j));
+                UnloadRegion(region, physics);
+                ++prefetchStats.regionsCancelled;
             }
         }
+        else
+        {
+            predictedRegions.push_back(region);
+        }
+    }
+
+    prefetchedRegions = predictedRegions;
+}
+
+void RegionManager::RecordPrefetchHits(const std::vector<glm::ivec2>& enteringTiles)
+{
+    for (const glm::ivec2& enteringTile : enteringTiles)
+    {
+        ++prefetchStats.subtilesEntered;
+
+        Region** region = loadedRegions.Find(enteringTile / TerrainTile::Subdivisions);
+        if (region != nullptr && (*region)->IsSubtileLoaded(enteringTile))
+        {
+            ++prefetchStats.subtilesEnteredLoaded;
+        }
+    }
+
+    float hitRate = prefetchStats.subtilesEntered == 0 ? 100.0f : 100.0f * (float)prefetchStats.subtilesEnteredLoaded / (float)prefetchStats.subtilesEntered;
+    Logger::Log("Terrain Prefetch: ", prefetchStats.subtilesEnteredLoaded, " of ", prefetchStats.subtilesEntered, " subtiles were loaded when they came into view (",
+        hitRate, "% hit rate), ", prefetchStats.regionsPrefetched, " regions prefetched, ", prefetchStats.regionsCancelled, " cancelled.");
+    prefetchStats.Reset();
+}
+
+void RegionManager::UpdateResidentMemory()
+{
+    TerrainMemoryUsage memoryUsage;
+    for (const glm::ivec2& region : loadedRegions.GetPositions())
+    {
+        loadedRegions.Get(region)->AddMemoryUsage(&terrainManager, &memoryUsage);
+    }
+
+    residentBytes = memoryUsage.GetTotalBytes();
+
+    size_t budgetBytes = (size_t)TerrainConfig::RegionCacheBudgetMiB * 1024 * 1024;
+    if (residentBytes > budgetBytes)
+    {
+        isEvicting = true;
     }
+
+    const size_t bytesPerMiB = 1024 * 1024;
+    Logger::Log("Terrain Memory: ", residentBytes / bytesPerMiB, " of ", TerrainConfig::RegionCacheBudgetMiB, " MiB resident in ", loadedRegions.Size(), " regions (",
+        visibleRegions.Size(), " visible). Raw images: ", memoryUsage.rawImageBytes / bytesPerMiB, " MiB, heightmaps: ", memoryUsage.heightmapBytes / bytesPerMiB,
+        " MiB, effects: ", memoryUsage.effectBytes / bytesPerMiB, " MiB, physics: ", memoryUsage.physicsBytes / bytesPerMiB, " MiB. ",
+        cacheStats.regionsReused, " regions reused from the cache, ", cacheStats.regionsEvicted, " evicted.");
+    cacheStats.Reset();
 }
 
-void RegionManager::UpdateVisibleRegion(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, Physics* physics)
+void RegionManager::EvictCachedRegions(Physics* physics)
 {
+    if (!isEvicting)
+    {
+        return;
+    }
+
+    size_t targetBytes = (size_t)((float)TerrainConfig::RegionCacheBudgetMiB * (1.0f - TerrainConfig::RegionCacheHysteresis) * 1024 * 1024);
+    if (residentBytes <= targetBytes)
+    {
+        isEvicting = false;
+        return;
+    }
+
+    // Find the least-recently visible region that we don't expect to need soon.
+    bool foundRegion = false;
+    glm::ivec2 evictedRegion;
+    for (const glm::ivec2& region : loadedRegions.GetPositions())
+    {
+        bool isPrefetched = std::find(prefetchedRegions.begin(), prefetchedRegions.end(), region) != prefetchedRegions.end();
+        if (visibleRegions.Contains(region) || isPrefetched)
+        {
+            continue;
+        }
+
+        if (!foundRegion || regionLastVisible.Get(region) < regionLastVisible.Get(evictedRegion))
+        {
+            evictedRegion = region;
+            foundRegion = true;
+        }
+    }
+
+    if (!foundRegion)
+    {
+        Logger::LogWarn("Unable to evict enough regions to drop below the region cache budget, as all loaded regions are in use.");
+        isEvicting = false;
+        return;
+    }
+
+    TerrainMemoryUsage memoryUsage;
+    loadedRegions.Get(evictedRegion)->AddMemoryUsage(&terrainManager, &memoryUsage);
+    residentBytes -= std::min(residentBytes, memoryUsage.GetTotalBytes());
+
+    UnloadRegion(evictedRegion, physics);
+    ++cacheStats.regionsEvicted;
+}
+
+void RegionManager::UpdateVisibleRegion(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, const glm::vec3& playerVelocity, Physics* physics)
+{
+    // Upload any subtiles that finished streaming in, then activate those that are visible.
+    terrainManager.ProcessStreamedTiles(TerrainConfig::UploadBudgetMs);
+    terrainManager.ProcessRetiredResources(TerrainConfig::RetireBudgetMs);
+    ActivatePendingTiles();
+    UpdatePhysicsArea(physics);
+    UpdateDeformedTerrain(physics);
+
+    PrefetchRegions(playerPosition, playerOrientation, playerVelocity, physics);
+    EvictCachedRegions(physics);
+
     // Update what's visible, skipping if we haven't changed center tiles.
     glm::ivec2 centerTile = GetCurrentCenterTile(playerPosition);
     if (centerTile.x == lastCenterTile.x && centerTile.y == lastCenterTile.y)
@@ -99,66 +661,240 @@ void RegionManager::UpdateVisibleRegion(const glm::vec3& playerPosition, const g
         return;
     }
 
+    sf::Clock clock;
+    glm::ivec2 previousCenterTile = lastCenterTile;
     lastCenterTile = centerTile;
+    terrainManager.LogStreamingStats();
+    terrainManager.LogRetirementStats();
+    terrainManager.LogRenderStats();
+    terrainManager.GetEffectManager().LogLoadStats();
+    terrainManager.GetEffectManager().LogFrameStats();
+    culler.LogStats();
+    LogActivationStats();
+    LogPhysicsAreaStats();
+    LogDeformationStats();
 
-    visibleTiles.clear();
-    ComputeVisibleTiles(centerTile, playerOrientation, &visibleTiles);
+    // Only the tiles on the edges of the view circle change.
+    std::vector<glm::ivec2> enteringTiles;
+    std::vector<glm::ivec2> leavingTiles;
+    DiffVisibleTiles(previousCenterTile, visibleTiles.Size() != 0, centerTile, &enteringTiles, &leavingTiles);
+    RecordPrefetchHits(enteringTiles);
 
     // Load regions we have not loaded yet.
-    std::set<glm::ivec2, iVec2Comparer> visibleRegions;
-    for (const glm::ivec2& visibleTile : visibleTiles)
+    ++visibilityUpdate;
+    for (const glm::ivec2& leavingTile : leavingTiles)
+    {
+        RemoveVisibleTile(leavingTile);
+    }
+
+    for (const glm::ivec2& enteringTile : enteringTiles)
+    {
+        AddVisibleTile(enteringTile);
+        pendingActivations.push_back(enteringTile);
+    }
+
+    // Drop activations for tiles that left before they were activated and activate the rest nearest-first.
+    pendingActivations.erase(std::remove_if(pendingActivations.begin(), pendingActivations.end(),
+        [this](const glm::ivec2& tile) { return !visibleTiles.Contains(tile); }), pendingActivations.end());
+    std::sort(pendingActivations.begin(), pendingActivations.end(), [centerTile](const glm::ivec2& lhs, const glm::ivec2& rhs)
+    {
+        glm::ivec2 lhsOffset = lhs - centerTile;
+        glm::ivec2 rhsOffset = rhs - centerTile;
+        return lhsOffset.x * lhsOffset.x + lhsOffset.y * lhsOffset.y > rhsOffset.x * rhsOffset.x + rhsOffset.y * rhsOffset.y;
+    });
+
+    activationStats.visibleSetUpdates++;
+    activationStats.usVisibleSetTime += (long)clock.getElapsedTime().asMicroseconds();
+
+    Logger::Log("Center (", centerTile.x, ", ", centerTile.y, "): visible tile results: ", enteringTiles.size(), " tiles entered and ", leavingTiles.size(), " left, for a total of ",
+        visibleTiles.Size(), " tiles in ", visibleRegions.Size(), " regions.");
+
+    // Regions that are no longer visible stay loaded, as they're very resource intensive to recreate. They're evicted once over budget.
+    UpdateResidentMemory();
+}
+
+bool RegionManager::EnsurePhysicsTile(const glm::ivec2& tile, Physics* physics)
+{
+    unsigned int* lastNearUpdate = physicsTiles.Find(tile);
+    if (lastNearUpdate != nullptr)
     {
-        visibleRegions.insert(visibleTile / TerrainTile::Subdivisions);
+        *lastNearUpdate = physicsAreaUpdate;
+        return true;
     }
 
-    Logger::Log("Center (", centerTile.x, ", ", centerTile.y, "): visible tile results: found a total of ", visibleTiles.size(), " tiles in ", visibleRegions.size(), " regions.");
-    for (const glm::ivec2 visibleRegion : visibleRegions)
+    Region** region = loadedRegions.Find(tile / TerrainTile::Subdivisions);
+    if (region == nullptr || !(*region)->EnsureHeightmapLoaded(physics, tile))
     {
-        if (loadedRegions.find(visibleRegion) == loadedRegions.end())
+        return false;
+    }
+
+    physicsTiles.Set(tile, physicsAreaUpdate);
+    ++physicsAreaStats.heightfieldsCreated;
+    return true;
+}
+
+void RegionManager::UpdatePhysicsArea(Physics* physics)
+{
+    sf::Clock clock;
+    ++physicsAreaUpdate;
+
+    // Tiles are tested by their center, so add half a diagonal to cover every tile touching the radius.
+    const float tileHalfDiagonal = (float)TerrainTile::SubtileSize * 0.7072f;
+    float radius = TerrainConfig::PhysicsRadius + tileHalfDiagonal;
+    for (const DynamicBodyState& body : physics->GetDynamicBodyStates())
+    {
+        // Cover the path the body will take over the lookahead time, not just where it is now.
+        glm::vec2 pathStart(body.position.x, body.position.y);
+        glm::vec2 pathOffset = glm::vec2(body.velocity.x, body.velocity.y) * TerrainConfig::PhysicsLookaheadSeconds;
+        float pathLengthSquared = glm::dot(pathOffset, pathOffset);
+
+        glm::vec2 areaMin = glm::min(pathStart, pathStart + pathOffset) - glm::vec2(radius);
+        glm::vec2 areaMax = glm::max(pathStart, pathStart + pathOffset) + glm::vec2(radius);
+        glm::ivec2 tileMin = glm::max(glm::ivec2((int)std::floor(areaMin.x / TerrainTile::SubtileSize), (int)std::floor(areaMin.y / TerrainTile::SubtileSize)), min);
+        glm::ivec2 tileMax = glm::min(glm::ivec2((int)std::floor(areaMax.x / TerrainTile::SubtileSize), (int)std::floor(areaMax.y / TerrainTile::SubtileSize)), max);
+        for (int y = tileMin.y; y <= tileMax.y; y++)
         {
-            loadedRegions[visibleRegion] = new Region(visibleRegion, &terrainManager);
+            for (int x = tileMin.x; x <= tileMax.x; x++)
+            {
+                glm::vec2 tileCenter = (glm::vec2((float)x, (float)y) + glm::vec2(0.5f)) * (float)TerrainTile::SubtileSize;
+                float pathFraction = pathLengthSquared == 0.0f ? 0.0f : std::min(std::max(glm::dot(tileCenter - pathStart, pathOffset) / pathLengthSquared, 0.0f), 1.0f);
+                if (glm::length(tileCenter - (pathStart + pathOffset * pathFraction)) <= radius)
+                {
+                    EnsurePhysicsTile(glm::ivec2(x, y), physics);
+                }
+            }
         }
-
-        loadedRegions[visibleRegion]->EnsureHeightmapsLoaded(physics, &visibleTiles);
     }
 
-    // Remove regions we no longer need to keep in memory as they're very resource intensive objects.
-    std::vector<glm::ivec2> regionsToRemove;
-    for (std::pair<const glm::ivec2, Region*>& region : loadedRegions)
+    RetirePhysicsTiles(physics, false);
+
+    physicsAreaStats.updates++;
+    physicsAreaStats.peakHeightfields = std::max(physicsAreaStats.peakHeightfields, (long)physicsTiles.Size());
+    physicsAreaStats.usUpdateTime += (long)clock.getElapsedTime().asMicroseconds();
+}
+
+void RegionManager::RetirePhysicsTiles(Physics* physics, bool retireAll)
+{
+    // Removal moves the last position into the removed one, so iterate backwards.
+    const std::vector<glm::ivec2>& physicsPositions = physicsTiles.GetPositions();
+    for (int i = (int)physicsPositions.size() - 1; i >= 0; i--)
     {
-        if (visibleRegions.find(region.first) == visibleRegions.end())
+        glm::ivec2 tile = physicsPositions[i];
+        if (retireAll || physicsAreaUpdate - physicsTiles.Get(tile) > (unsigned int)TerrainConfig::PhysicsRetireFrames)
         {
-            region.second->CleanupRegion(&terrainManager, physics);
-            delete region.second;
-            regionsToRemove.push_back(region.first);
+            loadedRegions.Get(tile / TerrainTile::Subdivisions)->RemoveHeightmap(physics, tile);
+            physicsTiles.Remove(tile);
+            ++physicsAreaStats.heightfieldsRetired;
         }
     }
+}
+
+void RegionManager::LogPhysicsAreaStats()
+{
+    Logger::Log("Terrain Physics: ", physicsTiles.Size(), " heightfields (", physicsAreaStats.peakHeightfields, " peak), ", physicsAreaStats.heightfieldsCreated, " created and ",
+        physicsAreaStats.heightfieldsRetired, " retired over ", physicsAreaStats.updates, " updates, in ", physicsAreaStats.usUpdateTime, " us total.");
+    physicsAreaStats.Reset();
+}
+
+int RegionManager::DeformTerrain(const TerrainBrush& brush)
+{
+    sf::Clock clock;
+    int heightsChanged = terrainManager.DeformTerrain(brush);
 
-    for (const glm::ivec2 cleanedRegion : regionsToRemove)
+    deformationStats.brushesApplied++;
+    deformationStats.heightsChanged += heightsChanged;
+    deformationStats.usDeformTime += (long)clock.getElapsedTime().asMicroseconds();
+    return heightsChanged;
+}
+
+void RegionManager::UpdateDeformedTerrain(Physics* physics)
+{
+    sf::Clock clock;
+    deformationStats.texelsUploaded += terrainManager.FlushDeformedSubtiles(&deformedSubtiles);
+    if (deformedSubtiles.empty())
     {
-        loadedRegions.erase(cleanedRegion);
+        return;
+    }
+
+    for (const DeformedSubtile& deformedSubtile : deformedSubtiles)
+    {
+        // Heights are copied into every deformed tile's physics heights, even without a heightfield, so one created later starts out up to date.
+        bool replacedHeightfield;
+        Region** region = loadedRegions.Find(deformedSubtile.tile / TerrainTile::Subdivisions);
+        if (region != nullptr && (*region)->UpdateDeformedHeightmap(physics, deformedSubtile.tile, deformedSubtile.deformedRect, &replacedHeightfield))
+        {
+            deformationStats.heightfieldsUpdated++;
+            deformationStats.heightfieldsReplaced += replacedHeightfield ? 1 : 0;
+        }
     }
+
+    deformationStats.subtilesFlushed += (long)deformedSubtiles.size();
+    deformationStats.usFlushTime += (long)clock.getElapsedTime().asMicroseconds();
+}
+
+const TerrainDeformationStats& RegionManager::GetDeformationStats() const
+{
+    return deformationStats;
+}
+
+void RegionManager::LogDeformationStats()
+{
+    Logger::Log("Terrain Deformation: ", deformationStats.brushesApplied, " brushes changed ", deformationStats.heightsChanged, " heights in ", deformationStats.usDeformTime, " us. ",
+        deformationStats.subtilesFlushed, " subtiles flushed, uploading ", deformationStats.texelsUploaded, " texels and queueing ", deformationStats.heightfieldsUpdated,
+        " heightfield updates (", deformationStats.heightfieldsReplaced, " heightfields replaced), in ", deformationStats.usFlushTime, " us total.");
+    deformationStats.Reset();
 }
 
 void RegionManager::SimulateVisibleRegions(float gameTime, float elapsedSeconds)
 {
     terrainManager.Update(gameTime);
 
-    for (const glm::ivec2& visibleTile : visibleTiles)
+    for (const glm::ivec2& visibleTile : visibleTiles.GetPositions())
     {
-        glm::ivec2 region = visibleTile / TerrainTile::Subdivisions;
-        loadedRegions[region]->Simulate(&terrainManager, visibleTile, elapsedSeconds);
+        visibleTiles.Get(visibleTile)->QueueSimulation(&terrainManager, visibleTile);
     }
+
+    terrainManager.SimulateQueuedTiles(elapsedSeconds);
 }
 
 void RegionManager::RenderRegions(const glm::mat4& perspectiveMatrix, const glm::vec3& playerPosition, const glm::vec2& playerDirection, const glm::mat4& viewMatrix)
 {
-    for (const glm::ivec2& visibleTile : visibleTiles)
+    if (isHorizonEnabled)
+    {
+        // The view circle is centered on the corner of the center tile. The ring overlaps the visible tiles by a tile, covering the stepped edge of the circle.
+        glm::vec2 ringCenter = glm::vec2((float)lastCenterTile.x, (float)lastCenterTile.y) * (float)TerrainTile::SubtileSize;
+        float ringInnerRadius = (float)((tileViewDistance / 2 - 1) * TerrainTile::SubtileSize);
+        terrainManager.RenderHorizon(viewMatrix, ringCenter, ringInnerRadius);
+    }
+
+    cullingBounds.clear();
+    cullingTiles.clear();
+    for (const glm::ivec2& visibleTile : visibleTiles.GetPositions())
     {
-        glm::ivec2 region = visibleTile / TerrainTile::Subdivisions;
-        loadedRegions[region]->RenderRegion(visibleTile, playerPosition, playerDirection, &terrainManager, perspectiveMatrix, viewMatrix);
+        float minHeight, maxHeight;
+        if (visibleTiles.Get(visibleTile)->GetSubtileHeightRange(visibleTile, &minHeight, &maxHeight))
+        {
+            // Terrain vertices are on cell centers, so extend half a cell past the subtile edges. The heights there are within the bordered height range.
+            //  Trees and buildings stand above the terrain, so the top is raised by the culling margin.
+            glm::vec2 tileMin = glm::vec2((float)visibleTile.x, (float)visibleTile.y) * (float)TerrainTile::SubtileSize - glm::vec2(0.5f);
+            glm::vec2 tileMax = tileMin + glm::vec2((float)TerrainTile::SubtileSize + 1.0f);
+            cullingBounds.push_back(CullingBounds(glm::vec3(tileMin, minHeight), glm::vec3(tileMax, maxHeight + TerrainConfig::CullingHeightMargin)));
+            cullingTiles.push_back(visibleTile);
+        }
     }
 
+    // The eye is the translation of the inverse view matrix.
+    glm::vec3 eyePosition = glm::vec3(glm::inverse(viewMatrix)[3]);
+    culler.SetView(perspectiveMatrix * viewMatrix, eyePosition);
+    culler.Cull(cullingBounds, &unculledIndices);
+
+    for (int index : unculledIndices)
+    {
+        visibleTiles.Get(cullingTiles[index])->RenderRegion(cullingTiles[index], &terrainManager);
+    }
+
+    terrainManager.RenderQueuedTiles(perspectiveMatrix, viewMatrix, glm::vec2(playerPosition.x, playerPosition.y));
+
     // Emits per-frame performance data, as effects are the most heavy graphical effects in this game.
     // terrainManager.GetEffectManager().LogEffectInformation();
     // FYI, turns out that bullet physics really needs to be on a separate thread.
@@ -166,10 +902,11 @@ void RegionManager::RenderRegions(const glm::mat4& perspectiveMatrix, const glm:
 
 void RegionManager::CleanupPhysics(Physics* physics)
 {
-    for (std::pair<const glm::ivec2, Region*>& region : loadedRegions)
+    physicsTiles.Clear();
+    for (const glm::ivec2& region : loadedRegions.GetPositions())
     {
-        region.second->CleanupRegion(&terrainManager, physics);
-        delete region.second;
+        loadedRegions.Get(region)->CleanupRegion(&terrainManager, physics);
+        delete loadedRegions.Get(region);
     }
 }
 
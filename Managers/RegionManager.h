@@ -5,48 +5,315 @@
 #include <GL/glew.h>
 #include <Bullet\btBulletDynamicsCommon.h>
 #include "shaders\ShaderFactory.h"
+#include "Data\TileGrid.h"
 #include "Managers\TerrainManager.h"
+#include "Math\TerrainCuller.h"
 #include <glm\vec3.hpp>
 #include <glm\vec2.hpp>
 #include "Physics.h"
 #include "Region.h"
 
+// Tracks how well terrain is prefetched ahead of the player.
+struct PrefetchStats
+{
+    long subtilesEntered;
+    long subtilesEnteredLoaded;
+    long regionsPrefetched;
+    long regionsCancelled;
+
+    PrefetchStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        subtilesEntered = 0;
+        subtilesEnteredLoaded = 0;
+        regionsPrefetched = 0;
+        regionsCancelled = 0;
+    }
+};
+
+// Tracks the per-frame cost of updating the visible set and activating the subtiles that entered it.
+struct ActivationStats
+{
+    long visibleSetUpdates;
+    long usVisibleSetTime;
+
+    long subtilesActivated;
+    long framesActivating;
+    long usActivationTime;
+    long usWorstFrameActivationTime;
+
+    ActivationStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        visibleSetUpdates = 0;
+        usVisibleSetTime = 0;
+        subtilesActivated = 0;
+        framesActivating = 0;
+        usActivationTime = 0;
+        usWorstFrameActivationTime = 0;
+    }
+};
+
+// Tracks how often regions that left the view are reused from the cache.
+struct RegionCacheStats
+{
+    long regionsReused;
+    long regionsEvicted;
+
+    RegionCacheStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        regionsReused = 0;
+        regionsEvicted = 0;
+    }
+};
+
+// Tracks how many physics heightfields are kept around the moving bodies.
+struct PhysicsAreaStats
+{
+    long updates;
+    long heightfieldsCreated;
+    long heightfieldsRetired;
+    long peakHeightfields;
+    long usUpdateTime;
+
+    PhysicsAreaStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        updates = 0;
+        heightfieldsCreated = 0;
+        heightfieldsRetired = 0;
+        peakHeightfields = 0;
+        usUpdateTime = 0;
+    }
+};
+
+// Tracks the cost of deforming the terrain, and of keeping the textures and physics heightfields up to date.
+struct TerrainDeformationStats
+{
+    long brushesApplied;
+    long heightsChanged;
+    long usDeformTime;
+
+    long subtilesFlushed;
+    long texelsUploaded;
+    long heightfieldsUpdated;
+    long heightfieldsReplaced;
+    long usFlushTime;
+
+    TerrainDeformationStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        brushesApplied = 0;
+        heightsChanged = 0;
+        usDeformTime = 0;
+        subtilesFlushed = 0;
+        texelsUploaded = 0;
+        heightfieldsUpdated = 0;
+        heightfieldsReplaced = 0;
+        usFlushTime = 0;
+    }
+};
+
+// The terrain at a point. Points on tiles that aren't resident (streamed in) are at height 0 on a LAKE.
+struct TerrainSample
+{
+    float height;
+    int type;
+    bool isResident;
+};
+
 class RegionManager
 {
     TerrainManager terrainManager;
-    std::map<glm::ivec2, Region*, iVec2Comparer> loadedRegions;
+    TileGrid<Region*> loadedRegions;
+
+    // Each region is subdivided into 100 tiles. Visible tiles are stored with their region.
+    TileGrid<Region*> visibleTiles;
+    TileGrid<Region*> visibleRegions;
+    TileGrid<int> visibleRegionTileCounts;
+
+    // The half-width of each row of the view circle, from the top row (-radius) to the bottom row (radius - 1). -1 if the row is empty.
+    std::vector<int> viewRowHalfWidths;
+
+    // Visible tiles still needing their heightmaps and effects, sorted furthest to nearest.
+    std::vector<glm::ivec2> pendingActivations;
+    ActivationStats activationStats;
+
+    // Visible tiles are culled each frame before rendering. Every loaded visible tile is passed to the culler, as they also act as occluders.
+    TerrainCuller culler;
+    std::vector<CullingBounds> cullingBounds;
+    std::vector<glm::ivec2> cullingTiles;
+    std::vector<int> unculledIndices;
 
-    // Each region is subdivided into 100 tiles.
-    std::vector<glm::ivec2> visibleTiles;
+    // Regions loaded ahead of the player that aren't visible yet.
+    std::vector<glm::ivec2> prefetchedRegions;
+    PrefetchStats prefetchStats;
+
+    // Regions that leave the view are kept until over the memory budget, then evicted in least-recently-visible order.
+    TileGrid<unsigned int> regionLastVisible;
+    unsigned int visibilityUpdate;
+    size_t residentBytes;
+    bool isEvicting;
+    RegionCacheStats cacheStats;
+
+    // Tiles with physics heightfields, and the last physics area update that a moving body was near each of them.
+    //  Only the terrain around moving bodies can be collided with, so this is much smaller than the visible set.
+    TileGrid<unsigned int> physicsTiles;
+    unsigned int physicsAreaUpdate;
+    PhysicsAreaStats physicsAreaStats;
+
+    std::vector<DeformedSubtile> deformedSubtiles;
+    TerrainDeformationStats deformationStats;
+
+    // Scratch space for batched terrain queries, as (tile index, point index) keys and the coordinates of a tile's points.
+    std::vector<unsigned long long> batchKeys;
+    std::vector<float> batchXs;
+    std::vector<float> batchYs;
+    std::vector<float> batchHeights;
 
     // Extents we can actually transverse in the tiles.
     glm::ivec2 min;
     glm::ivec2 max;
     int tileViewDistance;
+    bool isHorizonEnabled;
 
     glm::ivec2 lastCenterTile;
-    void ComputeVisibleTiles(const glm::ivec2& centerTile, const glm::vec2& playerOrientation, std::vector<glm::ivec2>* visibleTiles) const;
+
+    static std::vector<int> ComputeViewRowHalfWidths(int viewRadius);
+
+    // Returns the visible tiles [spanMin, spanMax) of a row of the view circle, clamped to the extents. The span is empty if the row isn't visible.
+    void GetViewRowSpan(const glm::ivec2& centerTile, const std::vector<int>& rowHalfWidths, int row, int* spanMin, int* spanMax) const;
+
+    // Finds the tiles that enter and leave the view circle when moving between center tiles, without recomputing the whole circle.
+    void DiffVisibleTiles(const glm::ivec2& previousCenterTile, bool hadPreviousView, const glm::ivec2& centerTile, std::vector<glm::ivec2>* enteringTiles, std::vector<glm::ivec2>* leavingTiles) const;
+
+    void AddVisibleTile(const glm::ivec2& tile);
+    void RemoveVisibleTile(const glm::ivec2& tile);
+
+    // Creates the textures and effects of entering tiles, nearest first, until the per-frame budget is exhausted.
+    void ActivatePendingTiles();
+    void LogActivationStats();
+
+    void LogPhysicsAreaStats();
+    void LogDeformationStats();
+
+    // Returns the region, creating it (and starting to stream in its tile) if needed. Priority is as per TerrainManager::RequestTerrainTile.
+    Region* GetOrCreateRegion(const glm::ivec2& region, float priority);
+    void UnloadRegion(const glm::ivec2& region, Physics* physics);
+
+    // Projects the player forwards and streams in the regions that will become visible, cancelling those the player turned away from.
+    void PrefetchRegions(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, const glm::vec3& playerVelocity, Physics* physics);
+
+    // Records how many of the subtiles that just became visible were already loaded.
+    void RecordPrefetchHits(const std::vector<glm::ivec2>& enteringTiles);
+
+    // Recomputes the resident memory of all loaded regions, starting eviction if over budget.
+    void UpdateResidentMemory();
+
+    // Evicts the least-recently visible region each frame while evicting, spreading the cleanup cost across frames.
+    void EvictCachedRegions(Physics* physics);
 
 public:
     RegionManager(ShaderFactory* shaderManager, ModelManager* modelManager, Physics* physics, std::string terrainRootFolder, glm::ivec2 min, glm::ivec2 max, int tileViewDistance);
     bool InitializeGraphics();
+
+    // Changes how many tiles across the view circle is, deactivating every visible tile and resizing the texture pool to match.
+    //  The view is rebuilt around the player on the next UpdateVisibleRegion.
+    bool SetViewDistance(int tileViewDistance);
+
+    // Toggles drawing the horizon past the view distance. Defaults to TerrainConfig::HorizonEnabled.
+    void SetHorizonEnabled(bool isEnabled);
+
+    // Returns true once every visible tile is streamed in and activated.
+    bool IsVisibleTerrainLoaded() const;
+
+    // The extents of the tiles, from min up to (but not including) max.
+    const glm::ivec2& GetMinTile() const;
+    const glm::ivec2& GetMaxTile() const;
+    int GetViewDistance() const;
+
+    // Lists the tiles within the view circle around a center tile, clamped to the extents.
+    void ComputeVisibleTiles(const glm::ivec2& centerTile, const glm::vec2& playerOrientation, int viewDistance, std::vector<glm::ivec2>* visibleTiles) const;
+
+    // The most tiles that can be visible at once at the current view distance.
+    int GetMaxVisibleTileCount() const;
+
+    // Blocks until a tile (and its region) is loaded, without making it visible.
+    void LoadTileImmediately(const glm::ivec2& tile);
+    size_t GetLoadedRegionCount() const;
+
+    // Returns the tile containing a point, which may be outside the extents.
+    static glm::ivec2 GetPointTile(const glm::vec2& point);
+
+    // Returns the data of a tile, or nullptr if its region isn't loaded or the tile hasn't streamed in yet. Never loads anything.
+    const SubTile* FindResidentSubtile(const glm::ivec2& tile) const;
+
+    // Returns the memory used by all the loaded regions, as the region cache budget counts it.
+    size_t GetResidentBytes();
     
     TerrainManager& GetTerrainManager();
 
     // Returns the sector the user is currently in.
     glm::ivec2 GetCurrentCenterTile(const glm::vec3& position) const;
 
-    // Returns the height of the point, in real units. If the point is out-of-bounds, returns 0 (min height).
+    // Returns the height of the point, in real units, loading its region if needed. If the point is out-of-bounds, returns 0 (min height).
     float GetPointHeight(Physics* physics, const glm::vec2 point);
 
-    // Returns the terrain type at the specified point. Returns LAKE if out of bounds.
+    // Returns the terrain type at the specified point, loading its region if needed. Returns LAKE if out of bounds.
     int GetPointTerrainType(Physics* physics, const glm::vec2 point);
 
-    void UpdateVisibleRegion(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, Physics* physics);
+    // Samples the terrain at a point in constant time, with bilinearly-interpolated heights. Returns false (and a non-resident sample) if the tile isn't resident.
+    //  Unlike GetPointHeight, never loads anything, so is suitable for frequent queries.
+    bool SampleTerrain(const glm::vec2& point, TerrainSample* sample) const;
+
+    // Samples the terrain at many points, as per SampleTerrain. Points are grouped by tile, so each tile is looked up once and its points are interpolated together.
+    //  Returns the number of points on resident tiles.
+    int SampleTerrainBatch(const glm::vec2* points, int count, TerrainSample* samples);
+
+    // Lowers (or raises) the resident terrain under a brush, returning the number of heights changed. Terrain samples see the change right away,
+    //  while textures and physics heightfields are updated once a frame by UpdateVisibleRegion. Changes are lost if the terrain is unloaded.
+    int DeformTerrain(const TerrainBrush& brush);
+
+    // Uploads the deformed parts of the active tiles' textures, and queues the updates of the deformed tiles' physics heightfields. Done by UpdateVisibleRegion.
+    void UpdateDeformedTerrain(Physics* physics);
+    const TerrainDeformationStats& GetDeformationStats() const;
+
+    // Creates the physics heightfield of a tile if needed, marking it as near a body. Returns false if the tile isn't loaded.
+    bool EnsurePhysicsTile(const glm::ivec2& tile, Physics* physics);
+
+    // Creates heightfields around (and ahead of) each moving body, and retires those no body has been near for a while. Done by UpdateVisibleRegion.
+    void UpdatePhysicsArea(Physics* physics);
+
+    // Retires the heightfields no body has been near for a while, or all of them.
+    void RetirePhysicsTiles(Physics* physics, bool retireAll);
+
+    void UpdateVisibleRegion(const glm::vec3& playerPosition, const glm::vec2& playerOrientation, const glm::vec3& playerVelocity, Physics* physics);
     void SimulateVisibleRegions(float gameTime, float elapsedSeconds);
     void RenderRegions(const glm::mat4& perspectiveMatrix, const glm::vec3& playerPosition, const glm::vec2& playerDirection, const glm::mat4& viewMatrix);
 
     void CleanupPhysics(Physics* physics);
+
     virtual ~RegionManager();
 };
 
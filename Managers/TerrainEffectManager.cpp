@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <sstream>
+#include <SFML\System.hpp>
 #include <stb\stb_image.h>
 #include "TerrainManager.h"
 #include "TerrainEffects\CityEffect.h"
@@ -13,20 +15,23 @@
 #include "Utils\ImageUtils.h"
 
 
-TerrainEffectManager::TerrainEffectManager(ShaderFactory* shaderManager, ModelManager* modelManager, Physics* Physics)
-    : shaderManager(shaderManager), modelManager(modelManager), physics(Physics)
+TerrainEffectManager::TerrainEffectManager(glm::ivec2 min, glm::ivec2 max, ShaderFactory* shaderManager, ModelManager* modelManager, Physics* Physics, GlResourcePool* resourcePool, const TerrainTexturePool* texturePool)
+    : shaderManager(shaderManager), modelManager(modelManager), physics(Physics),
+      subtileSlots(min * TerrainTile::Subdivisions, max * TerrainTile::Subdivisions + glm::ivec2(TerrainTile::Subdivisions - 1)), freeSlots(), slotCount(0),
+      simulatePasses(), renderPasses(), simulatePass(0), renderPass(0), queuedSubtiles(), buildThreads(), isBuildPoolRunning(false), isBatchOpen(false), buildBatch(0),
+      busyBuildThreads(0), nextBuild(0), builds(), usPerSubtileEstimate(0.0f), loadStats(), frameStats(), lastAllocationCount(0)
 {
-    effects.push_back((TerrainEffect*)new GrassEffect());
+    effects.push_back((TerrainEffect*)new GrassEffect(texturePool));
     effects.push_back((TerrainEffect*)new RockEffect(modelManager, physics));
-    effects.push_back((TerrainEffect*)new RoadEffect());
+    effects.push_back((TerrainEffect*)new RoadEffect(resourcePool));
     effects.push_back((TerrainEffect*)new SignEffect(modelManager, physics));
     // 
     // // TODO configurable
-    effects.push_back((TerrainEffect*)new TreeEffect("cache/trees"));
+    effects.push_back((TerrainEffect*)new TreeEffect(resourcePool, "cache/trees"));
     effects.push_back((TerrainEffect*)new CityEffect(modelManager, physics, "cache/buildings"));
 }
 
-bool TerrainEffectManager::LoadBasics()
+bool TerrainEffectManager::LoadBasics(int retireFrames)
 {
     for (auto iter = effects.begin(); iter != effects.end(); iter++)
     {
@@ -34,59 +39,282 @@ bool TerrainEffectManager::LoadBasics()
         {
             return false;
         }
+
+        (*iter)->SetRetireFrames(retireFrames);
     }
 
     return true;
 }
 
-bool TerrainEffectManager::LoadSubTileEffects(glm::ivec2 start, SubTile* tile)
+void TerrainEffectManager::SetBuildThreadCount(int threadCount)
 {
-    if (subtileEffectData.find(start) != subtileEffectData.end())
+    StopBuildThreads();
+    if (threadCount <= 0)
     {
-        // Already in cache.
-        return true;
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
     }
 
-    std::vector<TerrainEffectData*> tileEffects;
-    for (auto iter = effects.begin(); iter != effects.end(); iter++)
+    // The main thread builds too, so doesn't need a thread of its own.
+    isBuildPoolRunning = true;
+    for (int i = 1; i < threadCount; i++)
+    {
+        buildThreads.push_back(std::thread(&TerrainEffectManager::BuildThread, this, i));
+    }
+
+    Logger::Log("Building terrain effects on ", threadCount, " threads.");
+}
+
+int TerrainEffectManager::GetBuildThreadCount() const
+{
+    return (int)buildThreads.size() + 1;
+}
+
+void TerrainEffectManager::StopBuildThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(buildMutex);
+        isBuildPoolRunning = false;
+    }
+
+    buildCondition.notify_all();
+    for (std::thread& buildThread : buildThreads)
+    {
+        buildThread.join();
+    }
+
+    buildThreads.clear();
+}
+
+void TerrainEffectManager::BuildThread(int threadIndex)
+{
+    int lastBatch = 0;
+    std::unique_lock<std::mutex> lock(buildMutex);
+    while (true)
     {
-        void* effectData;
-        if ((*iter)->LoadEffect(start, &effectData, tile))
+        buildCondition.wait(lock, [&]() { return !isBuildPoolRunning || (isBatchOpen && buildBatch != lastBatch); });
+        if (!isBuildPoolRunning)
+        {
+            return;
+        }
+
+        lastBatch = buildBatch;
+        ++busyBuildThreads;
+        lock.unlock();
+
+        RunBuilds();
+
+        lock.lock();
+        if (--busyBuildThreads == 0)
         {
-            tileEffects.push_back(new TerrainEffectData(*iter, effectData));
+            buildFinishedCondition.notify_one();
         }
     }
+}
 
-    subtileEffectData[start] = tileEffects;
-    return true;
+void TerrainEffectManager::RunBuilds()
+{
+    int buildCount = (int)builds.size();
+    for (int i = nextBuild++; i < buildCount; i = nextBuild++)
+    {
+        TerrainEffectBuild& build = builds[i];
+        build.hasEffect = build.effect->Build(build.build, build.subtileId, build.tile);
+    }
 }
 
-void TerrainEffectManager::Simulate(const glm::ivec2 start, float elapsedSeconds)
+void TerrainEffectManager::BuildBatch()
 {
-    if (subtileEffectData.find(start) == subtileEffectData.end())
     {
-        Logger::LogWarn("Attempted to simulate terrain effects not loaded with [", start.x, ", ", start.y, "].");
-        return;
+        std::lock_guard<std::mutex> lock(buildMutex);
+        nextBuild = 0;
+        ++buildBatch;
+        isBatchOpen = true;
     }
 
-    for (auto iter = subtileEffectData[start].begin(); iter != subtileEffectData[start].end(); iter++)
+    buildCondition.notify_all();
+    RunBuilds();
+
+    // Every build has been claimed once the main thread runs out, so threads that haven't woken up yet are kept out of the batch. Wait for the rest to finish.
+    std::unique_lock<std::mutex> lock(buildMutex);
+    isBatchOpen = false;
+    buildFinishedCondition.wait(lock, [&]() { return busyBuildThreads == 0; });
+}
+
+int TerrainEffectManager::AllocateSlot()
+{
+    if (!freeSlots.empty())
     {
-        (*iter)->effect->Simulate(start, (*iter)->effectData, elapsedSeconds);
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
     }
+
+    simulatePasses.push_back(-1);
+    renderPasses.push_back(-1);
+    return slotCount++;
 }
 
-void TerrainEffectManager::RenderSubTileEffects(const glm::ivec2 start, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void TerrainEffectManager::FreeSlot(int slot)
 {
-    if (subtileEffectData.find(start) == subtileEffectData.end())
+    simulatePasses[slot] = -1;
+    renderPasses[slot] = -1;
+    freeSlots.push_back(slot);
+}
+
+long TerrainEffectManager::GetAllocationCount() const
+{
+    long allocations = 0;
+    for (const TerrainEffect* effect : effects)
+    {
+        allocations += effect->GetAllocationCount();
+    }
+
+    return allocations;
+}
+
+void TerrainEffectManager::QueueSubTileEffects(glm::ivec2 start, const SubTile* tile)
+{
+    if (subtileSlots.Contains(start))
     {
-        Logger::LogWarn("Attempted to render terrain effects not loaded with [", start.x, ", ", start.y, "].");
+        // Already in cache.
         return;
     }
 
-    for (auto iter = subtileEffectData[start].begin(); iter != subtileEffectData[start].end(); iter++)
+    for (const std::pair<glm::ivec2, const SubTile*>& queuedSubtile : queuedSubtiles)
     {
-        (*iter)->effect->Render((*iter)->effectData, perspectiveMatrix, viewMatrix, modelMatrix);
+        if (queuedSubtile.first == start)
+        {
+            return;
+        }
     }
+
+    queuedSubtiles.push_back(std::make_pair(start, tile));
+}
+
+int TerrainEffectManager::LoadQueuedEffects()
+{
+    if (queuedSubtiles.empty())
+    {
+        return 0;
+    }
+
+    sf::Clock clock;
+    int subtilesLoaded = (int)queuedSubtiles.size();
+    for (TerrainEffect* effect : effects)
+    {
+        effect->PrepareBuilds(subtilesLoaded);
+    }
+
+    builds.clear();
+    for (int i = 0; i < subtilesLoaded; i++)
+    {
+        for (TerrainEffect* effect : effects)
+        {
+            builds.push_back(TerrainEffectBuild(queuedSubtiles[i].first, queuedSubtiles[i].second, effect, i));
+        }
+    }
+
+    BuildBatch();
+    long buildTime = (long)clock.restart().asMicroseconds();
+
+    // The builds of each subtile are next to each other, in the order of the effects. Subtiles without any effects still get a slot, so they aren't loaded again.
+    int effectsLoaded = 0;
+    for (unsigned int i = 0; i < builds.size(); i += effects.size())
+    {
+        int slot = AllocateSlot();
+        for (unsigned int j = i; j < i + effects.size(); j++)
+        {
+            if (builds[j].hasEffect)
+            {
+                builds[j].effect->UploadBuild(builds[j].build, builds[j].subtileId, slot);
+                ++effectsLoaded;
+            }
+        }
+
+        subtileSlots.Set(builds[i].subtileId, slot);
+    }
+
+    long uploadTime = (long)clock.getElapsedTime().asMicroseconds();
+    loadStats.subtilesLoaded += subtilesLoaded;
+    loadStats.effectsLoaded += effectsLoaded;
+    loadStats.batches++;
+    loadStats.usBuildTime += buildTime;
+    loadStats.usUploadTime += uploadTime;
+
+    // The cost per subtile depends on the terrain, so recent batches count the most.
+    float usPerSubtile = (float)(buildTime + uploadTime) / (float)subtilesLoaded;
+    usPerSubtileEstimate = usPerSubtileEstimate == 0.0f ? usPerSubtile : usPerSubtileEstimate * 0.75f + usPerSubtile * 0.25f;
+
+    queuedSubtiles.clear();
+    builds.clear();
+    return subtilesLoaded;
+}
+
+float TerrainEffectManager::EstimateQueuedLoadUs() const
+{
+    return usPerSubtileEstimate * (float)queuedSubtiles.size();
+}
+
+void TerrainEffectManager::LogLoadStats()
+{
+    // Each effect used to be two allocations (and each subtile another), which is what the pools are compared against.
+    long allocationCount = GetAllocationCount();
+    loadStats.allocations = allocationCount - lastAllocationCount;
+    lastAllocationCount = allocationCount;
+    Logger::Log("Terrain Effect Loading: ", loadStats.subtilesLoaded, " subtiles with ", loadStats.effectsLoaded, " effects in ", loadStats.batches, " batches on ",
+        GetBuildThreadCount(), " threads, ", loadStats.usBuildTime, " us building, ", loadStats.usUploadTime, " us uploading, ", loadStats.allocations,
+        " storage allocations (", loadStats.effectsLoaded * 2 + loadStats.subtilesLoaded, " with an allocation per effect).");
+    loadStats.Reset();
+}
+
+void TerrainEffectManager::LogFrameStats()
+{
+    float frames = (float)std::max(frameStats.frames, 1L);
+    Logger::Log("Terrain Effect Frames: ", frameStats.frames, " frames, ", (float)frameStats.usSimulateTime / frames, " us simulating ", (float)frameStats.effectsSimulated / frames,
+        " effects and ", (float)frameStats.usRenderTime / frames, " us rendering ", (float)frameStats.effectsRendered / frames, " effects per frame.");
+    frameStats.Reset();
+}
+
+void TerrainEffectManager::QueueSubTileSimulation(const glm::ivec2 start)
+{
+    int* slot = subtileSlots.Find(start);
+    if (slot != nullptr)
+    {
+        simulatePasses[*slot] = simulatePass;
+    }
+}
+
+void TerrainEffectManager::SimulateQueuedEffects(float elapsedSeconds)
+{
+    sf::Clock clock;
+    for (TerrainEffect* effect : effects)
+    {
+        frameStats.effectsSimulated += effect->SimulateEffects(simulatePasses, simulatePass, elapsedSeconds);
+    }
+
+    ++simulatePass;
+    frameStats.usSimulateTime += (long)clock.getElapsedTime().asMicroseconds();
+}
+
+void TerrainEffectManager::QueueSubTileRender(const glm::ivec2 start)
+{
+    int* slot = subtileSlots.Find(start);
+    if (slot != nullptr)
+    {
+        renderPasses[*slot] = renderPass;
+    }
+}
+
+void TerrainEffectManager::RenderQueuedEffects(const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix)
+{
+    sf::Clock clock;
+    for (TerrainEffect* effect : effects)
+    {
+        frameStats.effectsRendered += effect->RenderEffects(renderPasses, renderPass, perspectiveMatrix, viewMatrix);
+    }
+
+    ++renderPass;
+    frameStats.frames++;
+    frameStats.usRenderTime += (long)clock.getElapsedTime().asMicroseconds();
 }
 
 void TerrainEffectManager::LogEffectInformation()
@@ -97,37 +325,134 @@ void TerrainEffectManager::LogEffectInformation()
     }
 }
 
-void TerrainEffectManager::CleanupSubTileEffects(glm::ivec2 start, bool log)
+size_t TerrainEffectManager::GetSubTileMemoryUsage(const glm::ivec2 start) const
 {
-    for (auto iter = subtileEffectData[start].begin(); iter != subtileEffectData[start].end(); iter++)
+    const int* slot = subtileSlots.Find(start);
+    if (slot == nullptr)
     {
-        (*iter)->effect->UnloadEffect((*iter)->effectData);
-        delete (*iter);
+        return 0;
     }
 
-    if (log)
+    size_t bytes = 0;
+    for (const TerrainEffect* effect : effects)
     {
-        Logger::Log("Unloaded effects ", start.x, ", ", start.y, ".");
+        bytes += effect->GetSubtileMemoryUsage(*slot);
     }
+
+    return bytes;
 }
 
 void TerrainEffectManager::UnloadSubTileEffects(glm::ivec2 start)
 {
-    CleanupSubTileEffects(start, true);
-    subtileEffectData.erase(start);
+    // Effects that haven't been built yet are simply never built.
+    queuedSubtiles.erase(std::remove_if(queuedSubtiles.begin(), queuedSubtiles.end(),
+        [start](const std::pair<glm::ivec2, const SubTile*>& queuedSubtile) { return queuedSubtile.first == start; }), queuedSubtiles.end());
+
+    int* slot = subtileSlots.Find(start);
+    if (slot == nullptr)
+    {
+        // Never became visible.
+        return;
+    }
+
+    // The last frames drawing these effects may still be in flight, so they're unloaded later.
+    for (TerrainEffect* effect : effects)
+    {
+        effect->RetireEffect(*slot);
+    }
+
+    FreeSlot(*slot);
+    subtileSlots.Remove(start);
+}
+
+int TerrainEffectManager::UnloadRetiredEffects(float budgetMs)
+{
+    sf::Clock clock;
+    sf::Int64 budgetUs = (sf::Int64)(budgetMs * 1000.0f);
+    for (TerrainEffect* effect : effects)
+    {
+        effect->AdvanceRetirementFrame();
+    }
+
+    // Always unload at least one effect per frame, so the queues keep draining. Each effect type takes a turn, so none of them fall behind.
+    int effectsUnloaded = 0;
+    bool isDraining = true;
+    while (isDraining)
+    {
+        isDraining = false;
+        for (TerrainEffect* effect : effects)
+        {
+            if ((effectsUnloaded == 0 || clock.getElapsedTime().asMicroseconds() < budgetUs) && effect->UnloadRetiredEffect())
+            {
+                ++effectsUnloaded;
+                isDraining = true;
+            }
+        }
+    }
+
+    return effectsUnloaded;
 }
 
-TerrainEffectManager::~TerrainEffectManager()
+int TerrainEffectManager::GetRetiringEffectCount() const
 {
-    // Cleanup any allocated effects 
-    for (auto iter = subtileEffectData.begin(); iter != subtileEffectData.end(); iter++)
+    int retiringEffects = 0;
+    for (const TerrainEffect* effect : effects)
     {
-        CleanupSubTileEffects(iter->first, false);
+        retiringEffects += effect->GetRetiringEffectCount();
     }
 
-    // Cleanup the classes running the effects themselves.
+    return retiringEffects;
+}
+
+int TerrainEffectManager::BuildAndDiscardEffects(const std::vector<std::pair<glm::ivec2, const SubTile*>>& subtiles, int threadCount, unsigned int* placementChecksum)
+{
+    int previousThreadCount = GetBuildThreadCount();
+    SetBuildThreadCount(threadCount);
+
+    for (TerrainEffect* effect : effects)
+    {
+        effect->PrepareBuilds((int)subtiles.size());
+    }
+
+    builds.clear();
+    for (int i = 0; i < (int)subtiles.size(); i++)
+    {
+        for (TerrainEffect* effect : effects)
+        {
+            builds.push_back(TerrainEffectBuild(subtiles[i].first, subtiles[i].second, effect, i));
+        }
+    }
+
+    BuildBatch();
+
+    // Builds are always listed in the same order, whichever thread built them.
+    int effectsBuilt = 0;
+    *placementChecksum = 0;
+    for (const TerrainEffectBuild& build : builds)
+    {
+        effectsBuilt += build.hasEffect ? 1 : 0;
+        *placementChecksum = *placementChecksum * 31 + build.effect->GetBuildChecksum(build.build);
+    }
+
+    for (TerrainEffect* effect : effects)
+    {
+        effect->DiscardBuilds();
+    }
+
+    builds.clear();
+    SetBuildThreadCount(previousThreadCount);
+    return effectsBuilt;
+}
+
+TerrainEffectManager::~TerrainEffectManager()
+{
+    StopBuildThreads();
+
+    // Cleanup any allocated effects. Nothing is drawn anymore, so retired effects don't need to wait.
+    //  Then cleanup the classes running the effects themselves.
     for (auto iter = effects.begin(); iter != effects.end(); iter++)
     {
+        (*iter)->UnloadAllEffects();
         delete *iter;
     }
 }
@@ -1,28 +1,97 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <set>
 #include <map>
+#include <thread>
+#include <vector>
 #include <GL/glew.h>
 #include "Data\Model.h"
 #include "Data\TerrainTile.h"
+#include "Data\TileGrid.h"
 #include "shaders\ShaderFactory.h"
+#include "Managers\GlResourcePool.h"
 #include "Managers\ModelManager.h"
+#include "Managers\TerrainTexturePool.h"
 #include <glm\vec3.hpp>
 #include "TerrainEffects\TerrainEffect.h"
 #include "Utils\Vertex.h"
 #include "Physics.h"
 
-struct TerrainEffectData
+// A single effect of a subtile, built on the effect build threads and then uploaded on the main thread.
+struct TerrainEffectBuild
 {
+    glm::ivec2 subtileId;
+    const SubTile* tile;
     TerrainEffect* effect;
-    void* effectData;
 
-    TerrainEffectData(TerrainEffect* effect, void* effectData)
-        : effect(effect), effectData(effectData)
+    // Where the effect keeps the build until it's uploaded.
+    int build;
+    bool hasEffect;
+
+    TerrainEffectBuild(glm::ivec2 subtileId, const SubTile* tile, TerrainEffect* effect, int build)
+        : subtileId(subtileId), tile(tile), effect(effect), build(build), hasEffect(false)
     {
     }
 };
 
+struct TerrainEffectLoadStats
+{
+    long subtilesLoaded;
+    long effectsLoaded;
+    long batches;
+
+    long usBuildTime;
+    long usUploadTime;
+
+    // Allocations made for effect storage, which only happen when the effect pools grow.
+    long allocations;
+
+    TerrainEffectLoadStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        subtilesLoaded = 0;
+        effectsLoaded = 0;
+        batches = 0;
+
+        usBuildTime = 0;
+        usUploadTime = 0;
+
+        allocations = 0;
+    }
+};
+
+struct TerrainEffectFrameStats
+{
+    long frames;
+    long effectsSimulated;
+    long effectsRendered;
+
+    long usSimulateTime;
+    long usRenderTime;
+
+    TerrainEffectFrameStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        frames = 0;
+        effectsSimulated = 0;
+        effectsRendered = 0;
+
+        usSimulateTime = 0;
+        usRenderTime = 0;
+    }
+};
+
 // Defines effects for each sub tile of terrain.
 class TerrainEffectManager
 {
@@ -30,29 +99,109 @@ class TerrainEffectManager
     ModelManager* modelManager;
     Physics* physics;
 
+    // Each effect keeps its data for all the loaded subtiles, by subtile slot.
     std::vector<TerrainEffect*> effects;
-    std::map<glm::ivec2, std::vector<TerrainEffectData*>, iVec2Comparer> subtileEffectData;
 
-    void CleanupSubTileEffects(glm::ivec2 start, bool log);
+    // The slot of each subtile with loaded effects, covering all subtiles of the tiles within the terrain extents.
+    //  Slots are reused once a subtile's effects are unloaded, so they stay about as few as the loaded subtiles.
+    TileGrid<int> subtileSlots;
+    std::vector<int> freeSlots;
+    int slotCount;
+
+    // Slots are stamped with the pass that simulates or renders them, so each effect can stream over all of its subtiles at once.
+    std::vector<long> simulatePasses;
+    std::vector<long> renderPasses;
+    long simulatePass;
+    long renderPass;
+
+    // Subtiles whose effects are loaded by the next LoadQueuedEffects.
+    std::vector<std::pair<glm::ivec2, const SubTile*>> queuedSubtiles;
+
+    // Effects are built a batch at a time by the build threads and the main thread, which waits for the batch to finish.
+    //  Each thread takes the next unclaimed build, as most subtiles only have a few cheap effects.
+    std::vector<std::thread> buildThreads;
+    std::mutex buildMutex;
+    std::condition_variable buildCondition;
+    std::condition_variable buildFinishedCondition;
+    bool isBuildPoolRunning;
+    bool isBatchOpen;
+    int buildBatch;
+    int busyBuildThreads;
+    std::atomic<int> nextBuild;
+    std::vector<TerrainEffectBuild> builds;
+
+    // Wall time per subtile of the recent batches, used to estimate the cost of the queued subtiles.
+    float usPerSubtileEstimate;
+    TerrainEffectLoadStats loadStats;
+    TerrainEffectFrameStats frameStats;
+    long lastAllocationCount;
+
+    int AllocateSlot();
+    void FreeSlot(int slot);
+
+    // Returns the total allocations the effects have made for their storage.
+    long GetAllocationCount() const;
+
+    void BuildThread(int threadIndex);
+
+    // Builds unclaimed effects of the current batch until none are left.
+    void RunBuilds();
+
+    // Builds every effect in the builds list, returning once all are built. The effects must have prepared for the builds.
+    void BuildBatch();
+
+    void StopBuildThreads();
 
 public:
-    TerrainEffectManager(ShaderFactory* shaderManager, ModelManager* modelManager, Physics* Physics);
+    // Grass is drawn from the terrain textures of the subtiles, so needs the texture pool they're in.
+    TerrainEffectManager(glm::ivec2 min, glm::ivec2 max, ShaderFactory* shaderManager, ModelManager* modelManager, Physics* Physics, GlResourcePool* resourcePool, const TerrainTexturePool* texturePool);
 
-    // Loads generic OpenGL functionality needed.
-    bool LoadBasics();
-    
-    // Loads a single tile.
-    bool LoadSubTileEffects(glm::ivec2 start, SubTile* tile);
+    // Loads generic OpenGL functionality needed. Unloaded effects are kept for the given number of frames, until they're no longer drawn.
+    bool LoadBasics(int retireFrames);
+
+    // Sets how many threads build effects, including the main thread, restarting the build threads. 0 uses one per hardware thread.
+    void SetBuildThreadCount(int threadCount);
+    int GetBuildThreadCount() const;
+
+    // Queues the effects of a subtile to be loaded by LoadQueuedEffects. Does nothing if they're already loaded or queued.
+    //  The tile must stay resident and unchanged until they're loaded.
+    void QueueSubTileEffects(glm::ivec2 start, const SubTile* tile);
+
+    // Builds the effects of the queued subtiles across the build threads, then uploads them on the main thread. Returns the number of subtiles loaded.
+    int LoadQueuedEffects();
+
+    // Estimates how long LoadQueuedEffects will take, from the time recent batches took per subtile.
+    float EstimateQueuedLoadUs() const;
+    void LogLoadStats();
+    void LogFrameStats();
     
-    // Simulates the effects for the loaded tile.
-    void Simulate(const glm::ivec2 start, float elapsedSeconds);
+    // Queues the effects of a subtile to be simulated by SimulateQueuedEffects. Does nothing if they're still loading.
+    void QueueSubTileSimulation(const glm::ivec2 start);
+    void SimulateQueuedEffects(float elapsedSeconds);
 
-    // Renders a tile's effects *The tile must have been loaded ahead-of-time.*
-    void RenderSubTileEffects(const glm::ivec2 start, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix);
+    // Queues the effects of a subtile to be drawn by RenderQueuedEffects. Does nothing if they're still loading.
+    void QueueSubTileRender(const glm::ivec2 start);
+
+    // Renders the queued effects, one effect type at a time.
+    void RenderQueuedEffects(const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix);
 
     void LogEffectInformation();
 
+    // Returns the approximate bytes used by the effects of a subtile, or 0 if it has none loaded.
+    size_t GetSubTileMemoryUsage(const glm::ivec2 start) const;
+
+    // Stops drawing and simulating the effects of a subtile. They're unloaded by UnloadRetiredEffects once enough frames have passed.
     void UnloadSubTileEffects(glm::ivec2 start);
+
+    // Advances a frame, then unloads retired effects until the time budget is exhausted. Returns the number of effects unloaded.
+    int UnloadRetiredEffects(float budgetMs);
+    int GetRetiringEffectCount() const;
+
+    // Builds and then discards the effects of the given subtiles on the given number of threads, returning the number of effects built.
+    //  Also returns a checksum of every effect's placement, which must not change with the thread count.
+    //  Nothing is uploaded, so this doesn't use OpenGL or the physics world, but the effect generators must have loaded their models.
+    int BuildAndDiscardEffects(const std::vector<std::pair<glm::ivec2, const SubTile*>>& subtiles, int threadCount, unsigned int* placementChecksum);
+
     virtual ~TerrainEffectManager();
 };
 
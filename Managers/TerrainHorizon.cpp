@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <glm\gtc\matrix_transform.hpp>
+#include "logging\Logger.h"
+#include "Utils\Constants.h"
+#include "TerrainHorizon.h"
+
+TerrainHorizon::TerrainHorizon()
+    : programId(0), vao(0), heightTextureId(0), typeTextureId(0), sampleCount(0, 0), origin(0, 0), farDistance(0)
+{
+}
+
+bool TerrainHorizon::Initialize(ShaderFactory* shaderManager, const TerrainPack& pack, glm::ivec2 min, glm::ivec2 max)
+{
+    Cleanup();
+
+    if (!shaderManager->CreateShaderProgram("horizonRender", &programId))
+    {
+        Logger::LogError("Failed to load the horizon rendering shader.");
+        return false;
+    }
+
+    heightsLocation = glGetUniformLocation(programId, "horizonHeights");
+    typesLocation = glGetUniformLocation(programId, "horizonTypes");
+    originLocation = glGetUniformLocation(programId, "origin");
+    sampleSpacingLocation = glGetUniformLocation(programId, "sampleSpacing");
+    ringCenterLocation = glGetUniformLocation(programId, "ringCenter");
+    ringInnerRadiusLocation = glGetUniformLocation(programId, "ringInnerRadius");
+    projMatrixLocation = glGetUniformLocation(programId, "projMatrix");
+    viewMatrixLocation = glGetUniformLocation(programId, "viewMatrix");
+
+    MappedView horizonView;
+    if (!pack.MapHorizon(&horizonView))
+    {
+        Logger::LogError("Failed to map the horizon from the terrain pack.");
+        return false;
+    }
+
+    // Samples are the average of the terrain around them, so sit at the center of the area they cover.
+    const float sampleSpacing = (float)TerrainTile::TileSize / (float)TerrainPack::HorizonSamplesPerTile;
+    sampleCount = TerrainPack::GetHorizonSize(min, max);
+    origin = glm::vec2((float)min.x, (float)min.y) * (float)TerrainTile::TileSize + glm::vec2(sampleSpacing * 0.5f);
+    farDistance = std::sqrt((float)(sampleCount.x * sampleCount.x + sampleCount.y * sampleCount.y)) * sampleSpacing + (float)TerrainTile::MaxHeight;
+
+    // The horizon is drawn without any vertex data, but a VAO still has to be bound.
+    glGenVertexArrays(1, &vao);
+
+    // Heights are uploaded straight from the pack, as the terrain texture pool does.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &heightTextureId);
+    glBindTexture(GL_TEXTURE_2D, heightTextureId);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16_SNORM, sampleCount.x, sampleCount.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sampleCount.x, sampleCount.y, GL_RED, GL_SHORT, pack.GetHorizonHeights(horizonView));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &typeTextureId);
+    glBindTexture(GL_TEXTURE_2D, typeTextureId);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8UI, sampleCount.x, sampleCount.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, sampleCount.x, sampleCount.y, GL_RED_INTEGER, GL_UNSIGNED_BYTE, pack.GetHorizonTypes(horizonView));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    MappedFile::UnmapView(&horizonView);
+    if (glGetError() != GL_NO_ERROR)
+    {
+        Logger::LogError("Failed to upload the horizon.");
+        return false;
+    }
+
+    Logger::Log("Loaded a ", sampleCount.x, "x", sampleCount.y, " horizon (", GetByteSize() / 1024, " KiB) with ", sampleSpacing, "m between samples.");
+    return true;
+}
+
+void TerrainHorizon::Render(const glm::mat4& viewMatrix, const glm::vec2& ringCenter, float ringInnerRadius)
+{
+    if (programId == 0)
+    {
+        return;
+    }
+
+    // Everything drawn is outside the inner radius, so the near plane can be pushed out to keep the depth precision for the distant terrain.
+    float nearDistance = std::max(ringInnerRadius * 0.5f, 1.0f);
+    glm::mat4 projectionMatrix = glm::perspective(glm::radians(Constants::FOV_Y), Constants::ASPECT, nearDistance, farDistance);
+
+    glUseProgram(programId);
+    glBindVertexArray(vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, heightTextureId);
+    glUniform1i(heightsLocation, 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, typeTextureId);
+    glUniform1i(typesLocation, 1);
+
+    glUniform2f(originLocation, origin.x, origin.y);
+    glUniform1f(sampleSpacingLocation, (float)TerrainTile::TileSize / (float)TerrainPack::HorizonSamplesPerTile);
+    glUniform2f(ringCenterLocation, ringCenter.x, ringCenter.y);
+    glUniform1f(ringInnerRadiusLocation, ringInnerRadius);
+    glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE, &projectionMatrix[0][0]);
+    glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, &viewMatrix[0][0]);
+
+    // Each instance is a strip between two rows of samples.
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, sampleCount.x * 2, sampleCount.y - 1);
+
+    const GLfloat one = 1.0f;
+    glClearBufferfv(GL_DEPTH, 0, &one);
+}
+
+size_t TerrainHorizon::GetByteSize() const
+{
+    return (size_t)(sampleCount.x * sampleCount.y) * (sizeof(short) + sizeof(unsigned char));
+}
+
+void TerrainHorizon::Cleanup()
+{
+    if (programId != 0)
+    {
+        glDeleteProgram(programId);
+        glDeleteVertexArrays(1, &vao);
+        glDeleteTextures(1, &heightTextureId);
+        glDeleteTextures(1, &typeTextureId);
+        programId = 0;
+        vao = 0;
+        heightTextureId = 0;
+        typeTextureId = 0;
+    }
+}
+
+TerrainHorizon::~TerrainHorizon()
+{
+    Cleanup();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm\vec2.hpp>
+#include <glm\mat4x4.hpp>
+#include "Cache\TerrainPack.h"
+#include "shaders\ShaderFactory.h"
+
+// Draws the whole terrain at low resolution as a ring around the streamed terrain, so distant mountains are visible past the view distance.
+//  The ring is a single grid over the terrain pack's horizon samples, drawn as one instanced strip per row without any vertex data.
+class TerrainHorizon
+{
+    GLuint programId;
+    GLuint heightsLocation;
+    GLuint typesLocation;
+    GLuint originLocation;
+    GLuint sampleSpacingLocation;
+    GLuint ringCenterLocation;
+    GLuint ringInnerRadiusLocation;
+    GLuint projMatrixLocation;
+    GLuint viewMatrixLocation;
+
+    GLuint vao;
+    GLuint heightTextureId;
+    GLuint typeTextureId;
+
+    // The world position of the first sample, and the furthest any sample can be from a point on the terrain.
+    glm::ivec2 sampleCount;
+    glm::vec2 origin;
+    float farDistance;
+
+public:
+    TerrainHorizon();
+
+    // Uploads the horizon of an open terrain pack.
+    bool Initialize(ShaderFactory* shaderManager, const TerrainPack& pack, glm::ivec2 min, glm::ivec2 max);
+
+    // Draws the horizon outside the inner radius of the ring, then clears the depth buffer so the streamed terrain is always drawn over it.
+    //  Uses its own projection, as the horizon is well past the far plane of the rest of the scene.
+    void Render(const glm::mat4& viewMatrix, const glm::vec2& ringCenter, float ringInnerRadius);
+
+    // OpenGL memory used by the horizon samples.
+    size_t GetByteSize() const;
+
+    void Cleanup();
+    virtual ~TerrainHorizon();
+};
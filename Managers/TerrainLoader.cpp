@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <utility>
+#include "logging\Logger.h"
+#include "TerrainLoader.h"
+
+TerrainLoader::TerrainLoader(glm::ivec2 min, glm::ivec2 max, std::string packFile)
+    : min(min), max(max), packFile(packFile), pack(), running(false), activeTiles(min, max)
+{
+}
+
+bool TerrainLoader::Start(int threadCount)
+{
+    if (!pack.Open(packFile, min, max))
+    {
+        return false;
+    }
+
+    running = true;
+    for (int i = 0; i < std::max(1, threadCount); i++)
+    {
+        workers.push_back(std::thread(&TerrainLoader::WorkerThread, this));
+    }
+
+    Logger::Log("Started ", workers.size(), " terrain loader threads.");
+    return true;
+}
+
+void TerrainLoader::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        running = false;
+    }
+
+    jobCondition.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    workers.clear();
+}
+
+void TerrainLoader::WorkerThread()
+{
+    while (true)
+    {
+        glm::ivec2 start;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobCondition.wait(lock, [&]() { return !running || !pendingTiles.empty(); });
+            if (!running)
+            {
+                return;
+            }
+
+            // The queue is short (a few dozen tiles at most), so a linear search for the most urgent tile is fine.
+            auto nextTile = std::min_element(pendingTiles.begin(), pendingTiles.end(),
+                [](const PendingTile& lhs, const PendingTile& rhs) { return lhs.priority < rhs.priority; });
+            start = nextTile->pos;
+            pendingTiles.erase(nextTile);
+        }
+
+        LoadedTile* tile = LoadTile(start);
+        {
+            std::lock_guard<std::mutex> lock(completedMutex);
+            completedTiles.push_back(tile);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            activeTiles.Remove(start);
+        }
+    }
+}
+
+int TerrainLoader::FindPendingTile(const glm::ivec2& start) const
+{
+    for (unsigned int i = 0; i < pendingTiles.size(); i++)
+    {
+        if (pendingTiles[i].pos == start)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+void TerrainLoader::QueueTile(const glm::ivec2& start, float priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (activeTiles.Contains(start))
+        {
+            return;
+        }
+
+        activeTiles.Set(start, 1);
+        pendingTiles.push_back(PendingTile(start, priority));
+    }
+
+    jobCondition.notify_one();
+}
+
+void TerrainLoader::PrioritizeTile(const glm::ivec2& start, float priority)
+{
+    std::lock_guard<std::mutex> lock(jobMutex);
+    int pendingIndex = FindPendingTile(start);
+    if (pendingIndex != -1)
+    {
+        pendingTiles[pendingIndex].priority = priority;
+    }
+}
+
+bool TerrainLoader::CancelTile(const glm::ivec2& start)
+{
+    std::lock_guard<std::mutex> lock(jobMutex);
+    int pendingIndex = FindPendingTile(start);
+    if (pendingIndex == -1)
+    {
+        return false;
+    }
+
+    pendingTiles.erase(pendingTiles.begin() + pendingIndex);
+    activeTiles.Remove(start);
+    return true;
+}
+
+LoadedTile* TerrainLoader::LoadTileImmediately(const glm::ivec2& start)
+{
+    {
+        // If this tile is waiting to be loaded, take over the job. If it's in progress, we load it anyways and the duplicate is discarded on completion.
+        std::lock_guard<std::mutex> lock(jobMutex);
+        int pendingIndex = FindPendingTile(start);
+        if (pendingIndex != -1)
+        {
+            pendingTiles.erase(pendingTiles.begin() + pendingIndex);
+            activeTiles.Remove(start);
+        }
+    }
+
+    return LoadTile(start);
+}
+
+bool TerrainLoader::TryGetCompletedTile(LoadedTile** tile)
+{
+    std::lock_guard<std::mutex> lock(completedMutex);
+    if (completedTiles.empty())
+    {
+        return false;
+    }
+
+    *tile = completedTiles.front();
+    completedTiles.pop_front();
+    return true;
+}
+
+int TerrainLoader::GetPendingTileCount()
+{
+    std::lock_guard<std::mutex> lock(jobMutex);
+    return (int)activeTiles.Size();
+}
+
+const TerrainPack& TerrainLoader::GetPack() const
+{
+    return pack;
+}
+
+void TerrainLoader::FreeLoadedTile(LoadedTile* tile)
+{
+    MappedFile::UnmapView(&tile->packView);
+    delete tile;
+}
+
+LoadedTile* TerrainLoader::LoadTile(const glm::ivec2& start)
+{
+    LoadedTile* tile = new LoadedTile();
+    tile->pos = start;
+    tile->succeeded = false;
+    if (!pack.MapTile(start, &tile->packView))
+    {
+        Logger::Log("Tile [", start.x, ", ", start.y, "] is not in the terrain pack.");
+        return tile;
+    }
+
+    // Touch every page so that the disk reads happen here instead of during upload on the main thread.
+    const size_t pageSize = 4096;
+    unsigned char pageSum = 0;
+    for (size_t i = 0; i < tile->packView.size; i += pageSize)
+    {
+        pageSum += ((volatile const unsigned char*)tile->packView.data)[i];
+    }
+
+    for (int j = 0; j < TerrainTile::Subdivisions; j++)
+    {
+        for (int i = 0; i < TerrainTile::Subdivisions; i++)
+        {
+            SubTileData subtile;
+            subtile.subtilePos = glm::ivec2(i, j);
+            subtile.heightmap = TerrainPack::GetHeightmap(tile->packView, subtile.subtilePos);
+            subtile.packedTypes = TerrainPack::GetPackedTypes(tile->packView, subtile.subtilePos);
+
+            const short* heightmapEnd = subtile.heightmap + TerrainTile::BorderedSubtileSize * TerrainTile::BorderedSubtileSize;
+            subtile.minHeight = (float)*std::min_element(subtile.heightmap, heightmapEnd) / (float)TerrainTile::MaxHeightValue;
+            subtile.maxHeight = (float)*std::max_element(subtile.heightmap, heightmapEnd) / (float)TerrainTile::MaxHeightValue;
+            subtile.typeIndex.Build(subtile.packedTypes, TerrainTile::SubtileSize);
+            tile->subtiles.push_back(std::move(subtile));
+        }
+    }
+
+    tile->succeeded = true;
+    return tile;
+}
+
+TerrainLoader::~TerrainLoader()
+{
+    if (running)
+    {
+        Stop();
+    }
+
+    LoadedTile* tile;
+    while (TryGetCompletedTile(&tile))
+    {
+        FreeLoadedTile(tile);
+    }
+}
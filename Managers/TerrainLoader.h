@@ -0,0 +1,114 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm\vec2.hpp>
+#include "Cache\TerrainPack.h"
+#include "Data\TerrainTile.h"
+#include "Data\TileGrid.h"
+
+// A single subtile waiting for upload on the main thread. Points into the terrain pack.
+struct SubTileData
+{
+    glm::ivec2 subtilePos;
+
+    // The heightmap includes a one-pixel border, so is BorderedSubtileSize^2 in size. The types do not, and are palette-packed.
+    const short* heightmap;
+    const unsigned char* packedTypes;
+
+    // Normalized range of the heightmap, including the border.
+    float minHeight;
+    float maxHeight;
+
+    // Built here so the effects of the subtile don't have to scan its types on the main thread.
+    TerrainTypeIndex typeIndex;
+};
+
+// A fully-mapped tile, ready for OpenGL upload.
+struct LoadedTile
+{
+    glm::ivec2 pos;
+    bool succeeded;
+
+    // Owned by the tile until its first subtile is uploaded, then owned by the TerrainTile.
+    MappedView packView;
+    std::vector<SubTileData> subtiles;
+};
+
+// A tile waiting to be loaded. Lower priorities are loaded first.
+struct PendingTile
+{
+    glm::ivec2 pos;
+    float priority;
+
+    PendingTile(glm::ivec2 pos, float priority)
+        : pos(pos), priority(priority)
+    {
+    }
+};
+
+// Maps terrain tiles from the terrain pack and pages them in on background threads.
+// Only CPU work happens here -- OpenGL resources are created by the TerrainManager on the main thread.
+class TerrainLoader
+{
+    glm::ivec2 min;
+    glm::ivec2 max;
+    std::string packFile;
+    TerrainPack pack;
+
+    bool running;
+    std::vector<std::thread> workers;
+
+    // Tiles waiting to be loaded, and tiles either waiting or in-progress (so we don't double-queue).
+    //  Only the positions of the active tiles are used. Their values are chars, as a vector of bools can't hand out references.
+    std::mutex jobMutex;
+    std::condition_variable jobCondition;
+    std::vector<PendingTile> pendingTiles;
+    TileGrid<char> activeTiles;
+
+    std::mutex completedMutex;
+    std::deque<LoadedTile*> completedTiles;
+
+    void WorkerThread();
+
+    // Returns the index of the tile in the pending list, or -1 if it isn't pending. Requires the job lock.
+    int FindPendingTile(const glm::ivec2& start) const;
+
+    // Performs the full CPU load of a tile. Thread-safe.
+    LoadedTile* LoadTile(const glm::ivec2& start);
+
+public:
+    TerrainLoader(glm::ivec2 min, glm::ivec2 max, std::string packFile);
+
+    // Opens the terrain pack and starts the loader threads. Fails if the pack is missing or out-of-date.
+    bool Start(int threadCount);
+    void Stop();
+
+    // Queues a tile for background loading. Does nothing if the tile is already queued.
+    //  Priority is the estimated time in seconds until the tile is needed, so 0 is needed now.
+    void QueueTile(const glm::ivec2& start, float priority);
+
+    // Changes the priority of a tile still waiting to be loaded.
+    void PrioritizeTile(const glm::ivec2& start, float priority);
+
+    // Removes a tile from the queue if it hasn't started loading. Returns true if it was removed.
+    bool CancelTile(const glm::ivec2& start);
+
+    // Loads a tile on the calling thread, removing it from the queue if it was waiting.
+    LoadedTile* LoadTileImmediately(const glm::ivec2& start);
+
+    // Returns the next completed tile, if any. The caller owns the returned tile.
+    bool TryGetCompletedTile(LoadedTile** tile);
+    int GetPendingTileCount();
+
+    // The terrain pack, which also holds the horizon. Tiles should be loaded through the loader instead.
+    const TerrainPack& GetPack() const;
+
+    // Frees a loaded tile, unmapping its pack data if no subtile was uploaded from it.
+    static void FreeLoadedTile(LoadedTile* tile);
+
+    virtual ~TerrainLoader();
+};
@@ -1,13 +1,19 @@
+#include <cmath>
 #include <iostream>
 #include <limits>
 #include <sstream>
-#include <stb\stb_image.h>
+#include <utility>
+#include <SFML\System.hpp>
+#include <glm\gtc\matrix_transform.hpp>
+#include "Cache\TerrainPackBuilder.h"
+#include "Config\TerrainConfig.h"
 #include "TerrainManager.h"
 #include "logging\Logger.h"
-#include "Utils\ImageUtils.h"
 
-TerrainManager::TerrainManager(glm::ivec2 min, glm::ivec2 max, ShaderFactory* shaderManager, ModelManager* modelManager, Physics* Physics, std::string terrainRootFolder)
-    : min(min), max(max), shaderManager(shaderManager), rootFolder(terrainRootFolder), terrainEffects(shaderManager, modelManager, Physics), terrainRenderProgram(0)
+TerrainManager::TerrainManager(glm::ivec2 min, glm::ivec2 max, ShaderFactory* shaderManager, ModelManager* modelManager, Physics* physics, std::string terrainRootFolder)
+    : min(min), max(max), shaderManager(shaderManager), physics(physics), rootFolder(terrainRootFolder), resourcePool(0), terrainEffects(min, max, shaderManager, modelManager, physics, &resourcePool, &texturePool),
+      terrainRenderProgram(0), terrainTiles(min, max), texturePool(), subtileDataBufferId(0), subtileDataTextureId(0), queuedSubtileData(), renderStats(),
+      horizon(), terrainLoader(min, max, "cache/terrain.pack"), uploadQueue(), uploadQueueSubtile(0), uploadQueueTile(nullptr), streamingStats(), retiredTiles(0), retirementStats(), deformedTiles()
 {
 }
 
@@ -16,22 +22,111 @@ TerrainEffectManager& TerrainManager::GetEffectManager()
     return terrainEffects;
 }
 
-bool TerrainManager::LoadBasics()
+bool TerrainManager::LoadBasics(int maxActiveSubtiles)
 {
     if (!ReloadTerrainShader())
     {
         return false;
     }
 
-    if (!terrainEffects.LoadBasics())
+    resourcePool.SetRetireFrames(TerrainConfig::RetireDelayFrames);
+    if (!texturePool.Initialize(maxActiveSubtiles, TerrainConfig::RetireDelayFrames) || !CreateSubtileDataBuffer(maxActiveSubtiles))
+    {
+        Logger::LogError("Failed to create the terrain texture pool; cannot continue.");
+        return false;
+    }
+
+    if (!terrainEffects.LoadBasics(TerrainConfig::RetireDelayFrames))
     {
         Logger::LogError("Failed to load the terrain effects initial setup; cannot continue.");
         return false;
     }
 
+    terrainEffects.SetBuildThreadCount(TerrainConfig::EffectBuildThreads);
+
+    if (!StartStreaming())
+    {
+        return false;
+    }
+
+    if (!horizon.Initialize(shaderManager, terrainLoader.GetPack(), min, max))
+    {
+        Logger::LogError("Failed to load the terrain horizon; cannot continue.");
+        return false;
+    }
+
     return true;
 }
 
+bool TerrainManager::StartStreaming()
+{
+    retiredTiles.SetDelayFrames(TerrainConfig::RetireDelayFrames);
+    if (!terrainLoader.Start(TerrainConfig::LoaderThreads))
+    {
+        // The pack only needs to be built once, but that takes a while.
+        Logger::Log("Building the terrain pack from '", rootFolder, "'. This may take some time...");
+        if (!BuildTerrainPack() || !terrainLoader.Start(TerrainConfig::LoaderThreads))
+        {
+            Logger::LogError("Failed to load the terrain pack; cannot continue.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TerrainManager::ResizeTexturePool(int maxActiveSubtiles)
+{
+    if (texturePool.GetCapacity() == 0)
+    {
+        return true;
+    }
+
+    // Retiring slots aren't in use by any subtile, and the frames drawing from them keep the old textures alive until they finish.
+    if (texturePool.GetUsedSlotCount() != texturePool.GetRetiringSlotCount())
+    {
+        Logger::LogError("Unable to resize the terrain texture pool while ", texturePool.GetUsedSlotCount() - texturePool.GetRetiringSlotCount(), " subtiles are active.");
+        return false;
+    }
+
+    glDeleteTextures(1, &subtileDataTextureId);
+    glDeleteBuffers(1, &subtileDataBufferId);
+    if (!texturePool.Initialize(maxActiveSubtiles, TerrainConfig::RetireDelayFrames) || !CreateSubtileDataBuffer(maxActiveSubtiles))
+    {
+        Logger::LogError("Failed to resize the terrain texture pool to ", maxActiveSubtiles, " subtiles.");
+        return false;
+    }
+
+    return true;
+}
+
+const glm::ivec2& TerrainManager::GetMinTile() const
+{
+    return min;
+}
+
+const glm::ivec2& TerrainManager::GetMaxTile() const
+{
+    return max;
+}
+
+const std::string& TerrainManager::GetRootFolder() const
+{
+    return rootFolder;
+}
+
+bool TerrainManager::BuildTerrainPack()
+{
+    TerrainPackBuilder builder(min, max, rootFolder);
+    return builder.Build("cache/terrain.pack");
+}
+
+bool TerrainManager::ConvertTerrainRasters()
+{
+    TerrainPackBuilder builder(min, max, rootFolder);
+    return builder.ConvertRasters();
+}
+
 bool TerrainManager::ReloadTerrainShader()
 {
     GLuint shaderProgram;
@@ -51,503 +146,634 @@ bool TerrainManager::ReloadTerrainShader()
     terrainRenderProgram = shaderProgram;
     terrainTexLocation = glGetUniformLocation(terrainRenderProgram, "terrainTexture");
     terrainTypeTexLocation = glGetUniformLocation(terrainRenderProgram, "terrainType");
+    subtileDataLocation = glGetUniformLocation(terrainRenderProgram, "subtileData");
+    lodCenterLocation = glGetUniformLocation(terrainRenderProgram, "lodCenter");
+    lodFullDetailDistanceLocation = glGetUniformLocation(terrainRenderProgram, "lodFullDetailDistance");
     gameTimeLocation = glGetUniformLocation(terrainRenderProgram, "gameTime");
     projLocation = glGetUniformLocation(terrainRenderProgram, "projMatrix");
-    mvLocation = glGetUniformLocation(terrainRenderProgram, "mvMatrix");
+    viewLocation = glGetUniformLocation(terrainRenderProgram, "viewMatrix");
 
     return true;
 }
 
-GLuint TerrainManager::CreateTileTexture(GLenum activeTexture, int subSize, float* heightmap)
+bool TerrainManager::CreateSubtileDataBuffer(int capacity)
 {
-    GLuint newTextureId;
-    glGenTextures(1, &newTextureId);
+    // One (origin x, origin y, pool layer, unused) entry per drawn subtile, read in the vertex shader with texelFetch.
+    glGenBuffers(1, &subtileDataBufferId);
+    glBindBuffer(GL_TEXTURE_BUFFER, subtileDataBufferId);
+    glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
 
-    glActiveTexture(activeTexture);
-    glBindTexture(GL_TEXTURE_2D, newTextureId);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16, subSize, subSize);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, subSize, subSize, GL_RED, GL_FLOAT, heightmap);
+    glGenTextures(1, &subtileDataTextureId);
+    glBindTexture(GL_TEXTURE_BUFFER, subtileDataTextureId);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, subtileDataBufferId);
 
-    // Ensure we clamp to the edges to avoid border problems.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    return newTextureId;
+    queuedSubtileData.reserve(capacity);
+    return glGetError() == GL_NO_ERROR;
 }
 
-GLuint TerrainManager::CreateTileTexture(GLenum activeTexture, int subSize, unsigned char* heightmap)
+void TerrainManager::UploadSubTile(LoadedTile* loadedTile, SubTileData& subtileData)
 {
-    GLuint newTextureId;
-    glGenTextures(1, &newTextureId);
-
-    glActiveTexture(activeTexture);
-    glBindTexture(GL_TEXTURE_2D, newTextureId);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16, subSize, subSize);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, subSize, subSize, GL_RED, GL_UNSIGNED_BYTE, heightmap);
+    glm::ivec2 start = loadedTile->pos;
+    TerrainTile* terrainTile = terrainTiles.Get(start);
+    if (loadedTile->packView.base != nullptr)
+    {
+        // Subtiles point into the pack, so the tile now keeps the pack data mapped.
+        terrainTile->packViews.push_back(loadedTile->packView);
+        loadedTile->packView = MappedView();
+    }
 
-    // Ensure we clamp to the edges to avoid border problems.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glm::ivec2 subTilePos = subtileData.subtilePos;
+    SubTile* subtile = new SubTile(subtileData.heightmap, subtileData.packedTypes,
+        subtileData.minHeight * (float)TerrainTile::MaxHeight, subtileData.maxHeight * (float)TerrainTile::MaxHeight);
+    std::swap(subtile->typeIndex, subtileData.typeIndex);
+    terrainTile->subtiles.Set(subTilePos, subtile);
+    SyncDeformedBorders(start * TerrainTile::Subdivisions + subTilePos);
+}
 
-    return newTextureId;
+SubTile* TerrainManager::FindSubtile(const glm::ivec2& tile) const
+{
+    glm::ivec2 start((int)std::floor((float)tile.x / (float)TerrainTile::Subdivisions), (int)std::floor((float)tile.y / (float)TerrainTile::Subdivisions));
+    TerrainTile* const* terrainTile = terrainTiles.Find(start);
+    return terrainTile == nullptr ? nullptr : (*terrainTile)->GetSubtile(tile - start * TerrainTile::Subdivisions);
 }
 
-bool TerrainManager::LoadTileToCache(glm::ivec2 start, bool loadSubtiles)
+void TerrainManager::SetDeformedHeight(SubTile* subtile, const glm::ivec2& tile, int x, int y, short height)
 {
-    bool loadedImage = false;
-    if (terrainTiles.find(start) != terrainTiles.end())
-    {
-        // Tile is already in the cache -- but if we want subtiles to be loaded and they haven't been, continue.
-        loadedImage = true;
-        if (terrainTiles[start]->loadedSubtiles || terrainTiles[start]->loadedSubtiles == loadSubtiles)
-        {
-            return true;
-        }
-    }
-    else
+    if (subtile->deformedRect.IsEmpty())
     {
-        terrainTiles[start] = new TerrainTile();
-        terrainTiles[start]->loadedSubtiles = false;
+        deformedTiles.push_back(tile);
     }
 
-    if (!loadedImage)
-    {
-        std::stringstream tileName;
-        tileName << rootFolder << "/" << start.y << "/" << start.x << ".png";
+    subtile->GetDeformableHeightmap()[x + y * TerrainTile::BorderedSubtileSize] = height;
+    subtile->deformedRect.Add(x, y);
+
+    // The range only grows, which keeps culling correct without rescanning the heightmap.
+    float realHeight = (float)height * ((float)TerrainTile::MaxHeight / (float)TerrainTile::MaxHeightValue);
+    subtile->minHeight = std::min(subtile->minHeight, realHeight);
+    subtile->maxHeight = std::max(subtile->maxHeight, realHeight);
+}
 
-        int width, height;
-        if (!ImageUtils::GetRawImage(tileName.str().c_str(), &terrainTiles[start]->rawImage, &width, &height) || width != TerrainTile::TileSize || height != TerrainTile::TileSize)
+void TerrainManager::CopySharedHeights(const SubTile* source, const glm::ivec2& sourceTile, SubTile* destination, const glm::ivec2& destinationTile)
+{
+    // Work in the destination's bordered pixels, limited to the source's unbordered pixels.
+    glm::ivec2 sourceOffset = (sourceTile - destinationTile) * TerrainTile::SubtileSize;
+    glm::ivec2 pixelMin = glm::max(sourceOffset + glm::ivec2(1), glm::ivec2(0));
+    glm::ivec2 pixelMax = glm::min(sourceOffset + glm::ivec2(TerrainTile::SubtileSize), glm::ivec2(TerrainTile::BorderedSubtileSize - 1));
+    for (int y = pixelMin.y; y <= pixelMax.y; y++)
+    {
+        for (int x = pixelMin.x; x <= pixelMax.x; x++)
         {
-            Logger::Log("Failed to load tile [", start.x, ", ", start.y, "] because of bad image/width/height: [", width, ", ", height, ".");
-            return false;
+            short height = source->heightmap[(x - sourceOffset.x) + (y - sourceOffset.y) * TerrainTile::BorderedSubtileSize];
+            if (destination->heightmap[x + y * TerrainTile::BorderedSubtileSize] != height)
+            {
+                SetDeformedHeight(destination, destinationTile, x, y, height);
+            }
         }
     }
+}
 
-    if (loadSubtiles && !terrainTiles[start]->loadedSubtiles)
+void TerrainManager::SyncDeformedBorders(const glm::ivec2& tile)
+{
+    SubTile* subtile = FindSubtile(tile);
+    for (int y = -1; y <= 1; y++)
     {
-        int subSize = TerrainTile::SubtileSize + 2;
-        for (int i = 0; i < TerrainTile::Subdivisions; i++)
+        for (int x = -1; x <= 1; x++)
         {
-            for (int j = 0; j < TerrainTile::Subdivisions; j++)
+            glm::ivec2 neighborTile = tile + glm::ivec2(x, y);
+            SubTile* neighbor = FindSubtile(neighborTile);
+            if ((x == 0 && y == 0) || neighbor == nullptr || !neighbor->IsDeformed())
             {
-                // Populate our main image
-                float* heightmap = new float[subSize * subSize];
-                unsigned char* types = new unsigned char[subSize * subSize];
-                for (int x = 0; x < TerrainTile::SubtileSize; x++)
-                {
-                    for (int y = 0; y < TerrainTile::SubtileSize; y++)
-                    {   
-                        int largerTilePixelId = (x + 1) + (y + 1) * subSize;
-                        ReadTilePixel(start, glm::ivec2(x + i * TerrainTile::SubtileSize, y + j * TerrainTile::SubtileSize), &heightmap[largerTilePixelId], &types[largerTilePixelId]);
-                    }
-                }
-
-                // Fill in edges and corners to avoid artifacts.
-                LoadHeightmapEdges(start, i, j, subSize, heightmap, types);
-
-                // Normalize lakes
-                for (int x = 0; x < subSize; x++)
-                {
-                    for (int y = 0; y < subSize; y++)
-                    {
-                        // Perform per-tile height modifications
-                        switch (types[x + y * subSize])
-                        {
-                        case TerrainTypes::ROADS:
-                        case TerrainTypes::RIVER:
-                        case TerrainTypes::CITY:
-                        case TerrainTypes::DIRTLAND:
-                        case TerrainTypes::GRASSLAND:
-                        case TerrainTypes::ROCKS:
-                        case TerrainTypes::SAND:
-                        case TerrainTypes::SNOW_PEAK:
-                        case TerrainTypes::TREES:
-                            break;
-                        default:
-                            // Lake isn't guaranteed to be the last item, 
-                            types[x + y * subSize] = TerrainTypes::LAKE;
-                            break;
-                        }
-                    }
-                }
-
-                for (int x = 0; x < subSize; x++)
-                {
-                    for (int y = 0; y < subSize; y++)
-                    {
-                        int xMinus = std::max(0, --x) + y * subSize;
-                        int xPlus = std::min(subSize - 1, ++x) + y * subSize;
-                        int yMinus = x + std::max(0, --y) * subSize;
-                        int yPlus = x + std::min(subSize - 1, ++y) * subSize;
-
-                        // Perform per-tile height modifications
-                        switch (types[x + y * subSize])
-                        {
-                        case TerrainTypes::ROADS:
-                            heightmap[x + y * subSize] -= (0.50f / 900.0f);
-                            break;
-                        case TerrainTypes::RIVER:
-                            if (types[xMinus] == TerrainTypes::RIVER &&
-                                types[xPlus] == TerrainTypes::RIVER &&
-                                types[yMinus] == TerrainTypes::RIVER &&
-                                types[yPlus] == TerrainTypes::RIVER)
-                            {
-                                heightmap[x + y * subSize] -= (1.0f / 900.0f);
-                            }
-                            break;
-                        case TerrainTypes::LAKE:
-                            if (types[xMinus] == TerrainTypes::LAKE &&
-                                types[xPlus] == TerrainTypes::LAKE &&
-                                types[yMinus] == TerrainTypes::LAKE &&
-                                types[yPlus] == TerrainTypes::LAKE)
-                            {
-                                heightmap[x + y * subSize] -= (2.0f / 900.0f);
-                            }
-                            break;
-                        default:
-                            break;
-                        }
-                    }
-                }
-
-                // Send heightmap to OpenGL with buffer space.
-                GLuint heightmapTextureId = CreateTileTexture(GL_TEXTURE0, subSize, heightmap);
-
-                // After saving to OpenGL, scale accordingly for Bullet physics to properly deal with the terrain (heightmap only) and remove the extra layer (heightmap and type).
-                float* realHeightmap = new float[TerrainTile::SubtileSize * TerrainTile::SubtileSize];
-                unsigned char* realTypes = new unsigned char[TerrainTile::SubtileSize * TerrainTile::SubtileSize];
-                const float scale = 900.0f;
-                for (int x = 0; x < TerrainTile::SubtileSize; x++)
-                {
-                    for (int y = 0; y < TerrainTile::SubtileSize; y++)
-                    {
-                        int id = x + y * TerrainTile::SubtileSize;
-                        int largerId = (x + 1) + (y + 1) * subSize;
-                        realHeightmap[id] = scale * heightmap[largerId];
-                        realTypes[id] = types[largerId];
-                    }
-                }
+                continue;
+            }
 
-                // Send types to OpenGL with *no* buffer space.
-                GLuint typeTextureId = CreateTileTexture(GL_TEXTURE1, TerrainTile::SubtileSize, realTypes);
+            CopySharedHeights(neighbor, neighborTile, subtile, tile);
+            CopySharedHeights(subtile, tile, neighbor, neighborTile);
+        }
+    }
+}
 
-                // We no longer need the data as it is now in the GPU.
-                delete[] heightmap;
-                delete[] types;
+bool TerrainManager::UploadLoadedTile(LoadedTile* loadedTile)
+{
+    glm::ivec2 start = loadedTile->pos;
+    if (!loadedTile->succeeded)
+    {
+        Logger::Log("Loading region tile (", start.x, ", ", start.y, ") failed.");
+        TerrainLoader::FreeLoadedTile(loadedTile);
+        return false;
+    }
 
-                glm::ivec2 subTilePos = glm::ivec2(i, j);
-                terrainTiles[start]->subtiles[subTilePos] = new SubTile(heightmapTextureId, realHeightmap, typeTextureId, realTypes);
-                terrainEffects.LoadSubTileEffects(subTilePos + start * TerrainTile::Subdivisions, terrainTiles[start]->subtiles[subTilePos]);
-            }
+    TerrainTile* terrainTile = terrainTiles.Get(start);
+    for (SubTileData& subtile : loadedTile->subtiles)
+    {
+        if (!terrainTile->IsSubtileLoaded(subtile.subtilePos))
+        {
+            UploadSubTile(loadedTile, subtile);
         }
-
-        terrainTiles[start]->loadedSubtiles = true;
     }
 
+    terrainTile->loadedSubtiles = true;
+    TerrainLoader::FreeLoadedTile(loadedTile);
+
     Logger::Log("Loading region tile (", start.x, ", ", start.y, ") succeeded.");
     return true;
 }
 
-void TerrainManager::LoadHeightmapEdges(const glm::ivec2& start, int i, int j, int subSize, float* heightmap, unsigned char* types)
+bool TerrainManager::LoadTerrainTile(glm::ivec2 start, TerrainTile** tile)
 {
-    auto yMinusOne = [&]()
+    TerrainTile* terrainTile = RequestTerrainTile(start, 0.0f);
+    if (!terrainTile->loadedSubtiles)
     {
-        if (j != 0)
-        {
-            // Still within the same major tile.
-            return (TerrainTile::SubtileSize - 1) + (j - 1) * TerrainTile::SubtileSize;
-        }
-        else if (start.y != min.y)
+        // Something needs this tile right now, so we cannot wait for streaming to finish.
+        if (!UploadLoadedTile(terrainLoader.LoadTileImmediately(start)))
         {
-            // Still within the same set of tiles.
-            return (TerrainTile::SubtileSize - 1) + (TerrainTile::Subdivisions - 1) * TerrainTile::SubtileSize;
+            return false;
         }
-        
-        return j * TerrainTile::SubtileSize;
-    };
+    }
+
+    *tile = terrainTile;
+    return true;
+}
 
-    auto yMinusOneTile = [&]()
+TerrainTile* TerrainManager::RequestTerrainTile(glm::ivec2 start, float priority)
+{
+    TerrainTile** terrainTile = terrainTiles.Find(start);
+    if (terrainTile != nullptr)
     {
-        if (j != 0)
+        if ((*terrainTile)->isLoadFailed)
         {
-            return start.y;
+            (*terrainTile)->isLoadFailed = false;
+            terrainLoader.QueueTile(start, priority);
         }
-        else if (start.y != min.y)
+        else if (!(*terrainTile)->loadedSubtiles)
         {
-            return start.y - 1;
+            terrainLoader.PrioritizeTile(start, priority);
         }
 
-        return start.y;
-    };
+        return *terrainTile;
+    }
 
-    auto yPlusOne = [&]()
-    {
-        if (j != TerrainTile::Subdivisions - 1)
-        {
-            // Still within the same major tile.
-            return (j + 1) * TerrainTile::SubtileSize;
-        }
-        else if (start.y != max.y)
-        {
-            // Still within the same set of tiles.
-            return 0;
-        }
+    terrainLoader.QueueTile(start, priority);
+    return terrainTiles.Set(start, new TerrainTile());
+}
 
-        return j * TerrainTile::SubtileSize;
-    };
+int TerrainManager::ProcessStreamedTiles(float budgetMs)
+{
+    sf::Clock clock;
+    sf::Int64 budgetUs = (sf::Int64)(budgetMs * 1000.0f);
 
-    auto yPlusOneTile = [&]()
+    LoadedTile* loadedTile;
+    while (terrainLoader.TryGetCompletedTile(&loadedTile))
     {
-        if (j != TerrainTile::Subdivisions - 1)
-        {
-            return start.y;
-        }
-        else if (start.y != max.y)
-        {
-            return start.y + 1;
-        }
-
-        return start.y;
-    };
+        uploadQueue.push_back(loadedTile);
+    }
 
-    auto xMinusOne = [&]()
+    int subtilesUploaded = 0;
+    while (!uploadQueue.empty())
     {
-        if (i != 0)
+        // Always upload at least one subtile per frame, so loading continues to make progress.
+        if (subtilesUploaded != 0 && clock.getElapsedTime().asMicroseconds() > budgetUs)
         {
-            // Still within the same major tile.
-            return (TerrainTile::SubtileSize - 1) + (i - 1) * TerrainTile::SubtileSize;
+            break;
         }
-        else if (start.x != min.x)
+
+        loadedTile = uploadQueue.front();
+        glm::ivec2 start = loadedTile->pos;
+        TerrainTile** terrainTile = terrainTiles.Find(start);
+        bool isWanted = terrainTile != nullptr && !(*terrainTile)->loadedSubtiles && (uploadQueueTile == nullptr || uploadQueueTile == *terrainTile);
+        if (!isWanted || !loadedTile->succeeded)
         {
-            // Still within the same set of tiles.
-            return (TerrainTile::SubtileSize - 1) + (TerrainTile::Subdivisions - 1) * TerrainTile::SubtileSize;
-        }
+            // The tile was unloaded or synchronously loaded while streaming, or failed to load. The loader no longer tracks a failed tile, so it's retried on the next request.
+            if (!loadedTile->succeeded)
+            {
+                Logger::Log("Loading region tile (", start.x, ", ", start.y, ") failed.");
+                if (terrainTile != nullptr && !(*terrainTile)->loadedSubtiles)
+                {
+                    (*terrainTile)->isLoadFailed = true;
+                }
+            }
 
-        return i * TerrainTile::SubtileSize;
-    };
+            PopUploadQueue();
+            continue;
+        }
 
-    auto xMinusOneTile = [&]()
-    {
-        if (i != 0)
+        uploadQueueTile = *terrainTile;
+        SubTileData& subtile = loadedTile->subtiles[uploadQueueSubtile];
+        if (!uploadQueueTile->IsSubtileLoaded(subtile.subtilePos))
         {
-            return start.x;
+            UploadSubTile(loadedTile, subtile);
+            ++subtilesUploaded;
         }
-        else if (start.x != min.x)
+
+        ++uploadQueueSubtile;
+        if (uploadQueueSubtile == loadedTile->subtiles.size())
         {
-            return start.x - 1;
+            // Every subtile went into this same tile, so it's complete.
+            uploadQueueTile->loadedSubtiles = true;
+            Logger::Log("Streaming region tile (", start.x, ", ", start.y, ") succeeded.");
+            PopUploadQueue();
         }
+    }
 
-        return start.x;
-    };
+    if (subtilesUploaded != 0)
+    {
+        long uploadTime = (long)clock.getElapsedTime().asMicroseconds();
+        streamingStats.subtilesUploaded += subtilesUploaded;
+        streamingStats.framesUploading++;
+        streamingStats.usUploadTime += uploadTime;
+        streamingStats.usWorstFrameUploadTime = std::max(streamingStats.usWorstFrameUploadTime, uploadTime);
+    }
+
+    return subtilesUploaded;
+}
 
-    auto xPlusOne = [&]()
+void TerrainManager::PopUploadQueue()
+{
+    TerrainLoader::FreeLoadedTile(uploadQueue.front());
+    uploadQueue.pop_front();
+    uploadQueueSubtile = 0;
+    uploadQueueTile = nullptr;
+}
+
+void TerrainManager::LogStreamingStats()
+{
+    Logger::Log("Terrain Streaming: ", streamingStats.subtilesUploaded, " subtiles in ", streamingStats.framesUploading, " frames, ",
+        streamingStats.usUploadTime, " us total, ", streamingStats.usWorstFrameUploadTime, " us worst frame, ", terrainLoader.GetPendingTileCount(), " tiles pending.");
+    streamingStats.Reset();
+}
+
+void TerrainManager::ActivateSubTile(const glm::ivec2 start, const glm::ivec2 subPos)
+{
+    SubTile* subtile = terrainTiles.Get(start)->GetSubtile(subPos);
+    if (!subtile->textureSlot.IsValid())
     {
-        if (i != TerrainTile::Subdivisions - 1)
+        subtile->textureSlot = texturePool.AllocateSlot();
+        if (!subtile->textureSlot.IsValid())
         {
-            // Still within the same major tile.
-            return (i + 1) * TerrainTile::SubtileSize;
+            Logger::LogWarn("The terrain texture pool is full, so subtile [", subPos.x, ", ", subPos.y, "] of tile [", start.x, ", ", start.y, "] will not be drawn.");
         }
-        else if (start.x != max.x)
+        else
         {
-            // Still within the same set of tiles.
-            return 0;
+            texturePool.UploadSlot(subtile->textureSlot.slot, subtile->heightmap, subtile->packedTypes);
         }
+    }
 
-        return i * TerrainTile::SubtileSize;
-    };
+    terrainEffects.QueueSubTileEffects(subPos + start * TerrainTile::Subdivisions, subtile);
+}
 
-    auto xPlusOneTile = [&]()
+void TerrainManager::DeactivateSubTile(const glm::ivec2 start, const glm::ivec2 subPos)
+{
+    SubTile* subtile = terrainTiles.Get(start)->GetSubtile(subPos);
+    if (subtile != nullptr && subtile->textureSlot.IsValid())
     {
-        if (i != TerrainTile::Subdivisions - 1)
-        {
-            return start.x;
-        }
-        else if (start.x != max.x)
+        texturePool.FreeSlot(subtile->textureSlot);
+        subtile->textureSlot = SlotHandle();
+    }
+}
+
+int TerrainManager::BuildAndDiscardEffects(const std::vector<glm::ivec2>& tiles, int threadCount, unsigned int* placementChecksum)
+{
+    std::vector<std::pair<glm::ivec2, const SubTile*>> subtiles;
+    for (const glm::ivec2& tile : tiles)
+    {
+        const SubTile* subtile = FindSubtile(tile);
+        if (subtile != nullptr)
         {
-            return start.x + 1;
+            subtiles.push_back(std::make_pair(tile, subtile));
         }
+    }
 
-        return start.x;
-    };
+    return terrainEffects.BuildAndDiscardEffects(subtiles, threadCount, placementChecksum);
+}
 
-    // Top row.
-    int yReal = yMinusOne();
-    glm::ivec2 tile = glm::ivec2(start.x, yMinusOneTile());
-    for (int x = 1; x < subSize - 1; x++)
+void TerrainManager::Update(float gameTime)
+{
+    lastGameTime = gameTime;
+}
+
+void TerrainManager::QueueTileSimulation(const glm::ivec2 start, const glm::ivec2 subPos)
+{
+    TerrainTile** terrainTile = terrainTiles.Find(start);
+    if (terrainTile == nullptr)
     {
-        int xReal = (x - 1) + i * TerrainTile::SubtileSize;
-        ReadTilePixel(tile, glm::ivec2(xReal, yReal), &heightmap[x], &types[x]);
+        Logger::LogWarn("Attempted to simulate a terrain tile not loaded with [", start.x, ", ", start.y, "].");
+        return;
     }
-    
-    // Bottom row.
-    yReal = yPlusOne();
-    tile = glm::ivec2(start.x, yPlusOneTile());
-    for (int x = 1; x < subSize - 1; x++)
+    else if (!(*terrainTile)->IsSubtileLoaded(subPos))
     {
-        int xReal = (x - 1) + i * TerrainTile::SubtileSize;
-        ReadTilePixel(tile, glm::ivec2(xReal, yReal), &heightmap[x + (subSize - 1) * subSize], &types[x + (subSize - 1) * subSize]);
+        // Still streaming in.
+        return;
     }
 
-    // Left column.
-    int xReal = xMinusOne();
-    tile = glm::ivec2(xMinusOneTile(), start.y);
-    for (int y = 1; y < subSize - 1; y++)
+    terrainEffects.QueueSubTileSimulation(subPos + start * TerrainTile::Subdivisions);
+}
+
+void TerrainManager::SimulateQueuedTiles(float elapsedSeconds)
+{
+    terrainEffects.SimulateQueuedEffects(elapsedSeconds);
+}
+
+void TerrainManager::QueueTileRender(const glm::ivec2 start, const glm::ivec2 subPos)
+{
+    TerrainTile** terrainTile = terrainTiles.Find(start);
+    if (terrainTile == nullptr)
     {
-        int yReal = (y - 1) + j * TerrainTile::SubtileSize;
-        ReadTilePixel(tile, glm::ivec2(xReal, yReal), &heightmap[y * subSize], &types[y * subSize]);
+        Logger::LogWarn("Attempted to render a terrain tile not loaded with [", start.x, ", ", start.y, "].");
+        return; 
     }
 
-    // Right column.
-    xReal = xPlusOne();
-    tile = glm::ivec2(xPlusOneTile(), start.y);
-    for (int y = 1; y < subSize - 1; y++)
+    SubTile* subtile = (*terrainTile)->GetSubtile(subPos);
+    if (subtile == nullptr || !subtile->textureSlot.IsValid())
     {
-        int yReal = (y - 1) + j * TerrainTile::SubtileSize;
-        ReadTilePixel(tile, glm::ivec2(xReal, yReal), &heightmap[(subSize - 1) + y * subSize], &types[(subSize - 1) + y * subSize]);
+        // Still streaming in or waiting to be activated.
+        return;
     }
 
-    // Corners
-    tile = glm::ivec2(xMinusOneTile(), yMinusOneTile());
-    ReadTilePixel(tile, glm::ivec2(xMinusOne(), yMinusOne()), &heightmap[0 + 0 * subSize], &types[0 + 0 * subSize]);
-    
-    tile = glm::ivec2(xPlusOneTile(), yPlusOneTile());
-    ReadTilePixel(tile, glm::ivec2(xPlusOne(), yPlusOne()), &heightmap[(subSize - 1) + (subSize - 1) * subSize], &types[(subSize - 1) + (subSize - 1) * subSize]);
-
-    tile = glm::ivec2(xPlusOneTile(), yMinusOneTile());
-    ReadTilePixel(tile, glm::ivec2(xPlusOne(), yMinusOne()), &heightmap[(subSize - 1) + 0 * subSize], &types[(subSize - 1) + 0 * subSize]);
-
-    tile = glm::ivec2(xMinusOneTile(), yPlusOneTile());
-    ReadTilePixel(tile, glm::ivec2(xMinusOne(), yPlusOne()), &heightmap[0 + (subSize - 1) * subSize], &types[0 + (subSize - 1) * subSize]);
+    glm::ivec2 tilePos = subPos + start * TerrainTile::Subdivisions;
+    queuedSubtileData.push_back(glm::vec4((float)(tilePos.x * TerrainTile::SubtileSize), (float)(tilePos.y * TerrainTile::SubtileSize), (float)subtile->textureSlot.slot, 0.0f));
+    terrainEffects.QueueSubTileRender(tilePos);
 }
 
-void TerrainManager::ReadTilePixel(const glm::ivec2& tile, const glm::ivec2& innerTilePos, float* heightmap, unsigned char* types)
+void TerrainManager::RenderHorizon(const glm::mat4& viewMatrix, const glm::vec2& ringCenter, float ringInnerRadius)
 {
-    *heightmap =
-        (float)((unsigned short)terrainTiles[tile]->rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4] +
-            (((unsigned short)terrainTiles[tile]->rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4 + 1]) << 8))
-        / (float)std::numeric_limits<unsigned short>::max();
+    horizon.Render(viewMatrix, ringCenter, ringInnerRadius);
+}
 
-    *types = terrainTiles[tile]->rawImage[(innerTilePos.x + innerTilePos.y * TerrainTile::TileSize) * 4 + 2];
+size_t TerrainManager::GetHorizonByteSize() const
+{
+    return horizon.GetByteSize();
 }
 
-bool TerrainManager::LoadTerrainTile(glm::ivec2 start, TerrainTile** tile)
+// TODO go everywhere else and cleanup projection / perspective / model / mv / view to all be correct.
+void TerrainManager::RenderQueuedTiles(const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::vec2& lodCenter)
 {
-    // The surrounding tiles must also be loaded to cache so that there are no boundary artifacts in terrain generation.
-    if (!LoadTileToCache(glm::ivec2(std::min(start.x + 1, max.x), std::min(start.y + 1, max.y)), false) ||
-        !LoadTileToCache(glm::ivec2(std::max(start.x - 1, min.x), std::max(start.y - 1, min.y)), false) ||
-        !LoadTileToCache(glm::ivec2(std::max(start.x - 1, min.x), std::min(start.y + 1, max.y)), false) ||
-        !LoadTileToCache(glm::ivec2(std::min(start.x + 1, max.x), std::max(start.y - 1, min.y)), false) ||
-        !LoadTileToCache(glm::ivec2(std::min(start.x + 1, max.x), start.y), false) ||
-        !LoadTileToCache(glm::ivec2(std::max(start.x - 1, min.x), start.y), false) ||
-        !LoadTileToCache(glm::ivec2(start.x, std::min(start.y + 1, max.y)), false) ||
-        !LoadTileToCache(glm::ivec2(start.x, std::max(start.y - 1, min.y)), false) ||
-        !LoadTileToCache(start, true))
+    renderStats.frames++;
+    if (!queuedSubtileData.empty())
     {
-        return false;
+        // Render all the tiles at once. Each instance is a single patch of a subtile.
+        glUseProgram(terrainRenderProgram);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texturePool.GetHeightmapTextureId());
+        glUniform1i(terrainTexLocation, 0);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texturePool.GetTypeTextureId());
+        glUniform1i(terrainTypeTexLocation, 1);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, subtileDataBufferId);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, queuedSubtileData.size() * sizeof(glm::vec4), &queuedSubtileData[0]);
+
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, subtileDataTextureId);
+        glUniform1i(subtileDataLocation, 2);
+
+        glUniformMatrix4fv(projLocation, 1, GL_FALSE, &perspectiveMatrix[0][0]);
+        glUniformMatrix4fv(viewLocation, 1, GL_FALSE, &viewMatrix[0][0]);
+
+        glUniform2f(lodCenterLocation, lodCenter.x, lodCenter.y);
+        glUniform1f(lodFullDetailDistanceLocation, TerrainConfig::LodFullDetailDistance);
+
+        glUniform1f(gameTimeLocation, lastGameTime);
+
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        glDrawArraysInstanced(GL_PATCHES, 0, 4, PatchesPerSubtile * (GLsizei)queuedSubtileData.size());
+
+        renderStats.drawCalls++;
+        renderStats.programChanges++;
+        renderStats.textureBinds += 3;
+        renderStats.bufferUploads++;
+        renderStats.subtilesDrawn += (long)queuedSubtileData.size();
+        renderStats.patchesDrawn += PatchesPerSubtile * (long)queuedSubtileData.size();
     }
 
-    *tile = terrainTiles[start];
-    return true;
+    // Render tile SFX. These are drawn after all the terrain, so their transparency blends over it.
+    terrainEffects.RenderQueuedEffects(perspectiveMatrix, viewMatrix);
+    queuedSubtileData.clear();
 }
 
-void TerrainManager::Update(float gameTime)
+void TerrainManager::LogRenderStats()
 {
-    lastGameTime = gameTime;
+    float frames = (float)std::max(renderStats.frames, 1L);
+    Logger::Log("Terrain Rendering: ", renderStats.frames, " frames, ", (float)renderStats.drawCalls / frames, " draw calls, ", (float)renderStats.programChanges / frames,
+        " program changes, ", (float)renderStats.textureBinds / frames, " texture binds and ", (float)renderStats.bufferUploads / frames, " buffer uploads per frame for ",
+        (float)renderStats.subtilesDrawn / frames, " subtiles (", (float)renderStats.patchesDrawn / frames, " patches). ", texturePool.GetUsedSlotCount(), " of ", texturePool.GetCapacity(), " texture pool slots used.");
+    renderStats.Reset();
 }
 
-void TerrainManager::Simulate(const glm::ivec2 start, const glm::ivec2 subPos, float elapsedSeconds)
+void TerrainManager::CleanupTerrainTile(TerrainTile* terrainTile)
 {
-    if (terrainTiles.find(start) == terrainTiles.end())
+    // We need to delete all of the subtiles and then the tile itself.
+    for (const glm::ivec2& subtilePos : terrainTile->subtiles.GetPositions())
     {
-        Logger::LogWarn("Attempted to simulate a terrain tile not loaded with [", start.x, ", ", start.y, "].");
-        return;
+        delete terrainTile->subtiles.Get(subtilePos);
     }
-    else if (terrainTiles[start]->subtiles.find(subPos) == terrainTiles[start]->subtiles.end())
+
+    for (MappedView& packView : terrainTile->packViews)
     {
-        Logger::LogWarn("Attempted to simulate a subtile that is invalid on [", start.x, ", ", start.y, "], subtile [", subPos.x, ", ", subPos.y, "].");
-        return;
+        MappedFile::UnmapView(&packView);
     }
 
-    terrainEffects.Simulate(subPos + start * TerrainTile::Subdivisions, elapsedSeconds);
+    delete terrainTile;
 }
 
-// TODO go everywhere else and cleanup projection / perspective / model / mv / view to all be correct.
-void TerrainManager::RenderTile(const glm::ivec2 start, const glm::ivec2 subPos, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+int TerrainManager::DeformTerrain(const TerrainBrush& brush)
 {
-    if (terrainTiles.find(start) == terrainTiles.end())
-    {
-        Logger::LogWarn("Attempted to render a terrain tile not loaded with [", start.x, ", ", start.y, "].");
-        return; 
-    }
-    else if (terrainTiles[start]->subtiles.find(subPos) == terrainTiles[start]->subtiles.end())
+    // Pixels are centered half a meter in. Each subtile also has the pixels one past each of its edges in its border.
+    const float heightScale = (float)TerrainTile::MaxHeightValue / (float)TerrainTile::MaxHeight;
+    glm::ivec2 pixelMin((int)std::floor(brush.center.x - brush.radius), (int)std::floor(brush.center.y - brush.radius));
+    glm::ivec2 pixelMax((int)std::floor(brush.center.x + brush.radius), (int)std::floor(brush.center.y + brush.radius));
+    glm::ivec2 tileMin((int)std::floor((float)(pixelMin.x - 1) / (float)TerrainTile::SubtileSize), (int)std::floor((float)(pixelMin.y - 1) / (float)TerrainTile::SubtileSize));
+    glm::ivec2 tileMax((int)std::floor((float)(pixelMax.x + 1) / (float)TerrainTile::SubtileSize), (int)std::floor((float)(pixelMax.y + 1) / (float)TerrainTile::SubtileSize));
+
+    int heightsChanged = 0;
+    for (int tileY = tileMin.y; tileY <= tileMax.y; tileY++)
     {
-        Logger::LogWarn("Attempted to render a subtile that is invalid on [", start.x, ", ", start.y, "], subtile [", subPos.x, ", ", subPos.y, "].");
-        return;
-    }
+        for (int tileX = tileMin.x; tileX <= tileMax.x; tileX++)
+        {
+            glm::ivec2 tile(tileX, tileY);
+            SubTile* subtile = FindSubtile(tile);
+            if (subtile == nullptr)
+            {
+                continue;
+            }
 
-    // Render the tile.
-    glUseProgram(terrainRenderProgram);
+            // Every subtile computes the same new height for a pixel they share, as they start from the same height.
+            glm::ivec2 borderOrigin = tile * TerrainTile::SubtileSize - glm::ivec2(1);
+            glm::ivec2 borderedMin = glm::max(pixelMin - borderOrigin, glm::ivec2(0));
+            glm::ivec2 borderedMax = glm::min(pixelMax - borderOrigin, glm::ivec2(TerrainTile::BorderedSubtileSize - 1));
+            for (int y = borderedMin.y; y <= borderedMax.y; y++)
+            {
+                for (int x = borderedMin.x; x <= borderedMax.x; x++)
+                {
+                    glm::vec2 point((float)(borderOrigin.x + x) + 0.5f, (float)(borderOrigin.y + y) + 0.5f);
+                    float heightChange = brush.GetHeightChange(point) * heightScale;
+                    if (heightChange == 0.0f)
+                    {
+                        continue;
+                    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, terrainTiles[start]->subtiles[subPos]->heightmapTextureId);
-    glUniform1i(terrainTexLocation, 0);
+                    short height = subtile->heightmap[x + y * TerrainTile::BorderedSubtileSize];
+                    short newHeight = (short)std::min(std::max((int)std::floor((float)height + heightChange + 0.5f), 0), (int)TerrainTile::MaxHeightValue);
+                    if (newHeight != height)
+                    {
+                        SetDeformedHeight(subtile, tile, x, y, newHeight);
+                        ++heightsChanged;
+                    }
+                }
+            }
+        }
+    }
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, terrainTiles[start]->subtiles[subPos]->typeTextureId);
-    glUniform1i(terrainTypeTexLocation, 1);
+    return heightsChanged;
+}
 
-    glUniformMatrix4fv(projLocation, 1, GL_FALSE, &perspectiveMatrix[0][0]);
-    glUniformMatrix4fv(mvLocation, 1, GL_FALSE, &(viewMatrix * modelMatrix)[0][0]);
+int TerrainManager::FlushDeformedSubtiles(std::vector<DeformedSubtile>* deformedSubtiles)
+{
+    deformedSubtiles->clear();
+    int texelsUploaded = 0;
+    for (const glm::ivec2& tile : deformedTiles)
+    {
+        // Subtiles unloaded since being deformed are skipped, as are those reloaded since (which aren't deformed).
+        SubTile* subtile = FindSubtile(tile);
+        if (subtile == nullptr || subtile->deformedRect.IsEmpty())
+        {
+            continue;
+        }
 
-    glUniform1f(gameTimeLocation, lastGameTime);
+        // Inactive subtiles upload their whole heightmap once activated.
+        if (subtile->textureSlot.IsValid())
+        {
+            texelsUploaded += texturePool.UpdateSlotHeightmap(subtile->textureSlot.slot, subtile->heightmap, subtile->deformedRect);
+        }
 
-    glPatchParameteri(GL_PATCH_VERTICES, 4);
-    glDrawArraysInstanced(GL_PATCHES, 0, 4, TerrainTile::SubtileSize * TerrainTile::SubtileSize);
+        deformedSubtiles->push_back(DeformedSubtile(tile, subtile->deformedRect));
+        subtile->deformedRect = HeightmapRect();
+    }
 
-    // Render tile SFX.
-    terrainEffects.RenderSubTileEffects(subPos + start * TerrainTile::Subdivisions, perspectiveMatrix, viewMatrix, modelMatrix);
+    deformedTiles.clear();
+    return texelsUploaded;
 }
 
-void TerrainManager::CleanupTerrainTile(glm::ivec2 start, bool log)
+void TerrainManager::AddTileMemoryUsage(const glm::ivec2 start, TerrainMemoryUsage* memoryUsage) const
 {
-    // We need to delete all of the subtiles and then the tile itself.
-    for (std::pair<const glm::ivec2, SubTile*> subTile : terrainTiles[start]->subtiles)
+    TerrainTile* const* terrainTile = terrainTiles.Find(start);
+    if (terrainTile == nullptr)
     {
-        glDeleteTextures(1, &subTile.second->heightmapTextureId);
-        delete[] subTile.second->heightmap;
-        glDeleteTextures(1, &subTile.second->typeTextureId);
-        delete[] subTile.second->type;
+        return;
+    }
 
-        delete subTile.second;
+    for (const MappedView& packView : (*terrainTile)->packViews)
+    {
+        memoryUsage->rawImageBytes += packView.size;
     }
-    
-    ImageUtils::FreeRawImage(terrainTiles[start]->rawImage);
-    delete terrainTiles[start];
 
-    if (log)
+    const size_t subtileTextureBytes = TerrainTexturePool::GetSlotByteSize();
+    for (const glm::ivec2& subtilePos : (*terrainTile)->subtiles.GetPositions())
     {
-        Logger::Log("Unloaded tile ", start.x, ", ", start.y, ".");
+        const SubTile* subtile = (*terrainTile)->subtiles.Get(subtilePos);
+        bool isActive = subtile->textureSlot.IsValid();
+        memoryUsage->heightmapBytes += sizeof(SubTile) + subtile->typeIndex.GetByteSize() + subtile->GetDeformedByteSize() + (isActive ? subtileTextureBytes : 0);
+        memoryUsage->effectBytes += terrainEffects.GetSubTileMemoryUsage(start * TerrainTile::Subdivisions + subtilePos);
     }
 }
 
 void TerrainManager::UnloadTerrainTile(glm::ivec2 start)
 {
-    for (std::pair<const glm::ivec2, SubTile*> subTile : terrainTiles[start]->subtiles)
+    // Texture slots and effects are also retired, so nothing drawn in the frames still in flight is destroyed or overwritten.
+    TerrainTile* terrainTile = terrainTiles.Get(start);
+    for (const glm::ivec2& subtilePos : terrainTile->subtiles.GetPositions())
+    {
+        SubTile* subTile = terrainTile->subtiles.Get(subtilePos);
+        if (subTile->textureSlot.IsValid())
+        {
+            texturePool.FreeSlot(subTile->textureSlot);
+            subTile->textureSlot = SlotHandle();
+        }
+
+        terrainEffects.UnloadSubTileEffects(start * TerrainTile::Subdivisions + subtilePos);
+    }
+
+    // Don't bother loading the tile if it hasn't started yet. Otherwise, streamed data is discarded when it finishes loading.
+    //  A partial upload is dropped too, as its pack mapping now belongs to the retired tile. Requesting the tile again streams it from the start.
+    terrainLoader.CancelTile(start);
+    if (uploadQueueTile == terrainTile)
+    {
+        PopUploadQueue();
+    }
+
+    // The tile's heightfield removals must already be queued, so they're applied in this generation.
+    retiredTiles.Retire(RetiredTerrainTile(terrainTile, physics->GetQueuedGeneration()));
+    terrainTiles.Remove(start);
+    Logger::Log("Unloaded tile ", start.x, ", ", start.y, ".");
+}
+
+int TerrainManager::ProcessRetiredResources(float budgetMs)
+{
+    sf::Clock clock;
+    sf::Int64 budgetUs = (sf::Int64)(budgetMs * 1000.0f);
+    texturePool.AdvanceFrame();
+    retiredTiles.AdvanceFrame();
+
+    // Effects hold most of the OpenGL objects, so they go first. Their objects are then deleted or pooled once they finish retiring, in what's left of the budget.
+    int effectsUnloaded = terrainEffects.UnloadRetiredEffects(budgetMs);
+    int glObjectsDeleted = resourcePool.ProcessRetiredObjects(budgetMs - (float)clock.getElapsedTime().asMicroseconds() / 1000.0f);
+
+    // Tiles are retired in generation order, so one still waiting on physics holds back those after it.
+    int tilesDeleted = 0;
+    const RetiredTerrainTile* expiredTile;
+    while ((tilesDeleted == 0 || clock.getElapsedTime().asMicroseconds() < budgetUs) && (expiredTile = retiredTiles.PeekExpired()) != nullptr &&
+        physics->GetAppliedGeneration() >= expiredTile->physicsGeneration)
     {
-        terrainEffects.UnloadSubTileEffects(start * TerrainTile::Subdivisions + subTile.first);
+        RetiredTerrainTile retiredTile;
+        retiredTiles.TryPopExpired(&retiredTile);
+        CleanupTerrainTile(retiredTile.tile);
+        ++tilesDeleted;
     }
 
-    CleanupTerrainTile(start, true);
-    terrainTiles.erase(start);
+    if (effectsUnloaded != 0 || glObjectsDeleted != 0 || tilesDeleted != 0)
+    {
+        long retireTime = (long)clock.getElapsedTime().asMicroseconds();
+        retirementStats.tilesDeleted += tilesDeleted;
+        retirementStats.effectsUnloaded += effectsUnloaded;
+        retirementStats.glObjectsDeleted += glObjectsDeleted;
+        retirementStats.framesRetiring++;
+        retirementStats.usRetireTime += retireTime;
+        retirementStats.usWorstFrameRetireTime = std::max(retirementStats.usWorstFrameRetireTime, retireTime);
+    }
+
+    return tilesDeleted + effectsUnloaded;
+}
+
+void TerrainManager::LogRetirementStats()
+{
+    Logger::Log("Terrain Retirement: ", retirementStats.tilesDeleted, " tiles, ", retirementStats.effectsUnloaded, " effects and ", retirementStats.glObjectsDeleted,
+        " OpenGL objects destroyed in ", retirementStats.framesRetiring, " frames, ", retirementStats.usRetireTime, " us total, ", retirementStats.usWorstFrameRetireTime,
+        " us worst frame. ", retiredTiles.Size(), " tiles, ", terrainEffects.GetRetiringEffectCount(), " effects and ", texturePool.GetRetiringSlotCount(), " texture slots retiring.");
+    resourcePool.LogStats();
+    retirementStats.Reset();
 }
 
 TerrainManager::~TerrainManager()
 {
+    terrainLoader.Stop();
+    for (LoadedTile* loadedTile : uploadQueue)
+    {
+        TerrainLoader::FreeLoadedTile(loadedTile);
+    }
+
     glDeleteProgram(terrainRenderProgram);
+    glDeleteTextures(1, &subtileDataTextureId);
+    glDeleteBuffers(1, &subtileDataBufferId);
+
+    // Cleanup any allocated terrain tiles. Nothing is drawn anymore, so retired tiles don't need to wait.
+    for (const glm::ivec2& tilePos : terrainTiles.GetPositions())
+    {
+        CleanupTerrainTile(terrainTiles.Get(tilePos));
+    }
 
-    // Cleanup any allocated terrain tiles.
-    for (auto iter = terrainTiles.begin(); iter != terrainTiles.end(); iter++)
+    RetiredTerrainTile retiredTile;
+    while (retiredTiles.TryPop(&retiredTile))
     {
-        CleanupTerrainTile(iter->first, false);
+        CleanupTerrainTile(retiredTile.tile);
     }
 }
@@ -1,14 +1,168 @@
 #pragma once
 #include <string>
 #include <set>
+#include <deque>
 #include <map>
 #include <GL/glew.h>
+#include "Data\RetirementQueue.h"
+#include "Data\TerrainBrush.h"
 #include "Data\TerrainTile.h"
+#include "Data\TileGrid.h"
+#include "Managers\TerrainLoader.h"
 #include "shaders\ShaderFactory.h"
+#include "Managers\GlResourcePool.h"
 #include "Managers\TerrainEffectManager.h"
+#include "Managers\TerrainHorizon.h"
+#include "Managers\TerrainTexturePool.h"
 #include <glm\vec3.hpp>
+#include <glm\vec4.hpp>
 #include "Physics.h"
 
+// Approximate resident memory of loaded terrain, by category.
+struct TerrainMemoryUsage
+{
+    // Mapped terrain pack blocks.
+    size_t rawImageBytes;
+
+    // Subtiles, and the texture pool slots of the active ones.
+    size_t heightmapBytes;
+    size_t effectBytes;
+
+    // Heightfield bodies. Their heights are read from the terrain pack, so aren't counted again.
+    size_t physicsBytes;
+
+    TerrainMemoryUsage()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        rawImageBytes = 0;
+        heightmapBytes = 0;
+        effectBytes = 0;
+        physicsBytes = 0;
+    }
+
+    size_t GetTotalBytes() const
+    {
+        return rawImageBytes + heightmapBytes + effectBytes + physicsBytes;
+    }
+
+    void Add(const TerrainMemoryUsage& other)
+    {
+        rawImageBytes += other.rawImageBytes;
+        heightmapBytes += other.heightmapBytes;
+        effectBytes += other.effectBytes;
+        physicsBytes += other.physicsBytes;
+    }
+};
+
+// Tracks how smoothly terrain is streaming in, as uploads occur on the main thread.
+struct TerrainStreamingStats
+{
+    long subtilesUploaded;
+    long framesUploading;
+    long usUploadTime;
+    long usWorstFrameUploadTime;
+
+    TerrainStreamingStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        subtilesUploaded = 0;
+        framesUploading = 0;
+        usUploadTime = 0;
+        usWorstFrameUploadTime = 0;
+    }
+};
+
+// Tracks how unloaded tiles and effects are destroyed, which is spread across frames.
+struct TerrainRetirementStats
+{
+    long tilesDeleted;
+    long effectsUnloaded;
+    long glObjectsDeleted;
+    long framesRetiring;
+    long usRetireTime;
+    long usWorstFrameRetireTime;
+
+    TerrainRetirementStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        tilesDeleted = 0;
+        effectsUnloaded = 0;
+        glObjectsDeleted = 0;
+        framesRetiring = 0;
+        usRetireTime = 0;
+        usWorstFrameRetireTime = 0;
+    }
+};
+
+// Counts the OpenGL work done to draw the terrain (excluding effects), to verify all visible subtiles are drawn at once.
+struct TerrainRenderStats
+{
+    long frames;
+    long drawCalls;
+    long programChanges;
+    long textureBinds;
+    long bufferUploads;
+    long subtilesDrawn;
+    long patchesDrawn;
+
+    TerrainRenderStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        frames = 0;
+        drawCalls = 0;
+        programChanges = 0;
+        textureBinds = 0;
+        bufferUploads = 0;
+        subtilesDrawn = 0;
+        patchesDrawn = 0;
+    }
+};
+
+// A subtile deformed since the last flush, and the bordered pixels that changed.
+struct DeformedSubtile
+{
+    glm::ivec2 tile;
+    HeightmapRect deformedRect;
+
+    DeformedSubtile(glm::ivec2 tile, HeightmapRect deformedRect)
+        : tile(tile), deformedRect(deformedRect)
+    {
+    }
+};
+
+// An unloaded tile, and the physics generation that removes its heightfields and copies its last deformed heights.
+struct RetiredTerrainTile
+{
+    TerrainTile* tile;
+    long physicsGeneration;
+
+    RetiredTerrainTile()
+        : tile(nullptr), physicsGeneration(0)
+    {
+    }
+
+    RetiredTerrainTile(TerrainTile* tile, long physicsGeneration)
+        : tile(tile), physicsGeneration(physicsGeneration)
+    {
+    }
+};
+
 // Defines loading and displaying a single unit of terrain.
 class TerrainManager
 {
@@ -16,51 +170,175 @@ class TerrainManager
     glm::ivec2 max;
 
     ShaderFactory* shaderManager;
+    Physics* physics;
     std::string rootFolder;
 
     GLuint terrainRenderProgram;
 
     GLuint terrainTexLocation;
     GLuint terrainTypeTexLocation;
+    GLuint subtileDataLocation;
+    GLuint lodCenterLocation;
+    GLuint lodFullDetailDistanceLocation;
     GLuint gameTimeLocation;
-    GLuint mvLocation;
+    GLuint viewLocation;
     GLuint projLocation;
 
     float lastGameTime;
 
+    // Must outlive the effects, which return their buffers to it.
+    GlResourcePool resourcePool;
     TerrainEffectManager terrainEffects;
-    std::map<glm::ivec2, TerrainTile*, iVec2Comparer> terrainTiles;
+    TileGrid<TerrainTile*> terrainTiles;
+
+    // Each instance draws a patch of PatchSize^2 cells, tessellated based on its distance from the player. Must match terrainRender.vs.
+    static const int PatchSize = 10;
+    static const int PatchesPerSubtile = (TerrainTile::SubtileSize / PatchSize) * (TerrainTile::SubtileSize / PatchSize);
+
+    // Active subtiles keep their heightmap and types in the pool. Each frame, the queued subtiles are drawn with a single instanced draw,
+    //  reading their origin and pool layer from the subtile data buffer.
+    TerrainTexturePool texturePool;
+    GLuint subtileDataBufferId;
+    GLuint subtileDataTextureId;
+    std::vector<glm::vec4> queuedSubtileData;
+    TerrainRenderStats renderStats;
+
+    // The whole terrain at low resolution, drawn past the visible subtiles.
+    TerrainHorizon horizon;
+
+    // Tiles are decoded on loader threads, then uploaded a few subtiles at a time on the main thread.
+    TerrainLoader terrainLoader;
+    std::deque<LoadedTile*> uploadQueue;
+    unsigned int uploadQueueSubtile;
+
+    // The tile the head of the upload queue is being uploaded into, or nullptr if it hasn't started. The head's pack mapping has moved into this tile,
+    //  so if it's unloaded partway through, the rest of the head can't be uploaded into a tile requested again later.
+    TerrainTile* uploadQueueTile;
+    TerrainStreamingStats streamingStats;
+
+    // Unloaded tiles are deleted once no in-flight frame can read their heightmaps, and physics has applied what was queued for them.
+    //  The physics step runs over as many frames as it takes, so that isn't a number of frames.
+    RetirementQueue<RetiredTerrainTile> retiredTiles;
+    TerrainRetirementStats retirementStats;
+
+    // Subtiles (by their position in all the subtiles, not within their tile) deformed since the last flush.
+    std::vector<glm::ivec2> deformedTiles;
 
-    // Given a terrain tile, creates an appropriate heightmap texture for it.
-    GLuint CreateTileTexture(GLenum activeTexture, int subSize, float* heightmap);
-    GLuint CreateTileTexture(GLenum activeTexture, int subSize, unsigned char* heightmap);
-    bool LoadTileToCache(glm::ivec2 start, bool loadSubtiles);
-    void LoadHeightmapEdges(const glm::ivec2& start, int i, int j, int subSize, float* heightmap, unsigned char* types);
-    void ReadTilePixel(const glm::ivec2& tile, const glm::ivec2& innerTilePos, float* heightmap, unsigned char* types);
+    // Returns a subtile by its position in all the subtiles, or nullptr if it isn't resident.
+    SubTile* FindSubtile(const glm::ivec2& tile) const;
 
-    void CleanupTerrainTile(glm::ivec2 start, bool log);
+    // Changes a bordered heightmap pixel of a resident subtile, queueing the subtile to be flushed.
+    void SetDeformedHeight(SubTile* subtile, const glm::ivec2& tile, int x, int y, short height);
+
+    // Copies the heights a subtile shares with a neighbor into the neighbor's border, where they differ.
+    void CopySharedHeights(const SubTile* source, const glm::ivec2& sourceTile, SubTile* destination, const glm::ivec2& destinationTile);
+
+    // Brings the borders of a newly uploaded subtile and its deformed neighbors back in line. Deformations of subtiles that weren't resident are lost,
+    //  so the new subtile's own heights win.
+    void SyncDeformedBorders(const glm::ivec2& tile);
+
+    bool CreateSubtileDataBuffer(int capacity);
+
+    // Adds a single loaded subtile to its terrain tile, which takes over the pack mapping of the loaded tile and the type index of the subtile.
+    //  OpenGL uploads are deferred until the subtile is activated.
+    void UploadSubTile(LoadedTile* loadedTile, SubTileData& subtileData);
+    bool UploadLoadedTile(LoadedTile* loadedTile);
+
+    // Frees the head of the upload queue, so the next tile's upload starts from its first subtile.
+    void PopUploadQueue();
+
+    // Deletes the subtiles of a tile and unmaps its pack data.
+    void CleanupTerrainTile(TerrainTile* terrainTile);
 
 public:
     TerrainManager(glm::ivec2 min, glm::ivec2 max, ShaderFactory* shaderManager, ModelManager* modelManager, Physics* physics, std::string terrainRootFolder);
 
     TerrainEffectManager& GetEffectManager();
 
-    // Loads generic OpenGL functionality needed.
-    bool LoadBasics();
+    // Loads generic OpenGL functionality needed, with room for the given number of active subtiles. Builds the terrain pack if it is missing or out-of-date.
+    //  Also sets how many frames unloaded resources are kept before they're destroyed or reused.
+    bool LoadBasics(int maxActiveSubtiles);
+
+    // Opens the terrain pack (building it if needed) and starts streaming tiles in. Does not need OpenGL, so is also used when benchmarking.
+    bool StartStreaming();
+
+    // Recreates the texture pool with room for a different number of active subtiles. Fails if any subtile is still active.
+    //  Does nothing before LoadBasics, which sizes the pool itself.
+    bool ResizeTexturePool(int maxActiveSubtiles);
+
+    // The extents of the tiles, from min up to (but not including) max, and the folder of the terrain images they're built from.
+    const glm::ivec2& GetMinTile() const;
+    const glm::ivec2& GetMaxTile() const;
+    const std::string& GetRootFolder() const;
+
+    // Rebuilds the terrain pack from the terrain images. Does not need OpenGL.
+    bool BuildTerrainPack();
+
+    // Compresses the terrain images into the faster-to-decode raster format the pack builder prefers. Does not need OpenGL.
+    bool ConvertTerrainRasters();
 
     // Reloads the terrain shader. Useful for fast iterative improvements.
     bool ReloadTerrainShader();
     
-    // Loads a single tile.
+    // Loads a single tile, blocking until it is fully loaded.
     bool LoadTerrainTile(glm::ivec2 start, TerrainTile** tile);
+
+    // Requests a tile be streamed in the background. The returned tile fills in its subtiles as they are uploaded.
+    //  Priority is the estimated time in seconds until the tile is needed. Re-requesting a tile updates its priority.
+    TerrainTile* RequestTerrainTile(glm::ivec2 start, float priority);
+
+    // Uploads streamed subtiles until the per-frame budget is exhausted. Returns the number of subtiles uploaded.
+    int ProcessStreamedTiles(float budgetMs);
+    void LogStreamingStats();
+
+    // Advances a frame, then destroys the retired tiles, effects and OpenGL objects that are no longer in flight until the per-frame budget is exhausted.
+    //  Returns the number of tiles and effects destroyed.
+    int ProcessRetiredResources(float budgetMs);
+    void LogRetirementStats();
     
+    // Uploads the textures of a visible subtile to the texture pool and queues its effects, if not already done. Effects are only loaded once the subtile becomes visible, as they're expensive.
+    //  Queued effects are loaded together by the effect manager's LoadQueuedEffects, so they can be built in parallel.
+    void ActivateSubTile(const glm::ivec2 start, const glm::ivec2 subPos);
+
+    // Returns the texture pool slot of a subtile that is no longer visible. Its effects stay loaded until the tile is unloaded.
+    void DeactivateSubTile(const glm::ivec2 start, const glm::ivec2 subPos);
+
+    // Builds and then discards the effects of the given resident subtiles on the given number of threads, returning the number of effects built.
+    //  Also returns a checksum of the effect placements. Doesn't use OpenGL, but the effect generators must have loaded their models.
+    int BuildAndDiscardEffects(const std::vector<glm::ivec2>& tiles, int threadCount, unsigned int* placementChecksum);
+
     // Runs simulations on a loaded tile.
     void Update(float gameTime);
-    void Simulate(const glm::ivec2 start, const glm::ivec2 subPos, float elapsedSeconds);
 
-    // Renders a tile. *The tile must have been loaded ahead-of-time.*
-    void RenderTile(const glm::ivec2 start, const glm::ivec2 subPos, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix);
+    // Queues a tile's effects to be simulated this update. Tiles that are still streaming in are skipped.
+    void QueueTileSimulation(const glm::ivec2 start, const glm::ivec2 subPos);
+
+    // Simulates the effects of the queued tiles, one effect type at a time.
+    void SimulateQueuedTiles(float elapsedSeconds);
+
+    // Queues a tile to be rendered this frame. Tiles that aren't active yet are skipped. *The tile must have been loaded ahead-of-time.*
+    void QueueTileRender(const glm::ivec2 start, const glm::ivec2 subPos);
+
+    // Renders the horizon outside a ring around the visible subtiles. Must be rendered before the subtiles, which are drawn over it.
+    void RenderHorizon(const glm::mat4& viewMatrix, const glm::vec2& ringCenter, float ringInnerRadius);
+    size_t GetHorizonByteSize() const;
+
+    // Renders the queued tiles with one draw call, then their effects. Terrain detail decreases with distance from the LOD center.
+    void RenderQueuedTiles(const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::vec2& lodCenter);
+    void LogRenderStats();
+
+    // Applies a brush to every resident subtile it touches, including those it only touches through their borders, so shared edges stay the same.
+    //  Heights change right away, while deformed subtiles are queued until FlushDeformedSubtiles. Returns the number of heights changed.
+    int DeformTerrain(const TerrainBrush& brush);
+
+    // Uploads the deformed texels of the active subtiles, and returns the subtiles deformed since the last flush so their physics heightfields can be updated.
+    //  Returns the number of texels uploaded.
+    int FlushDeformedSubtiles(std::vector<DeformedSubtile>* deformedSubtiles);
+
+    // Adds the memory used by a tile and the effects of its subtiles. Does nothing if the tile isn't loaded.
+    void AddTileMemoryUsage(const glm::ivec2 start, TerrainMemoryUsage* memoryUsage) const;
 
+    // Stops drawing a tile and retires its resources. They're destroyed by ProcessRetiredResources.
     void UnloadTerrainTile(glm::ivec2 start);
     virtual ~TerrainManager();
 };
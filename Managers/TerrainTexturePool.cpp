@@ -0,0 +1,237 @@
+#include <algorithm>
+#include "Data\TerrainTile.h"
+#include "logging\Logger.h"
+#include "TerrainTexturePool.h"
+
+TerrainTexturePool::TerrainTexturePool()
+    : heightmapTextureId(0), typeTextureId(0), slots(), paddedHeightmap(), heightmapLevels()
+{
+}
+
+GLuint TerrainTexturePool::CreateTextureArray(GLenum activeTexture, GLenum internalFormat, int width, int height, int layers, int levels)
+{
+    GLuint newTextureId;
+    glGenTextures(1, &newTextureId);
+
+    glActiveTexture(activeTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, newTextureId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, width, height, layers);
+
+    // Ensure we clamp to the edges to avoid border problems.
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, levels == 1 ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+
+    return newTextureId;
+}
+
+bool TerrainTexturePool::Initialize(int slotCount, int retireFrames)
+{
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if (slotCount > maxLayers)
+    {
+        Logger::LogError("The terrain texture pool needs ", slotCount, " layers, but only ", maxLayers, " are supported. Reduce the view distance.");
+        return false;
+    }
+
+    Cleanup();
+
+    // Heights are uploaded straight from the pack, so a signed normalized format maps them back to 0-1 (as they are never negative).
+    heightmapTextureId = CreateTextureArray(GL_TEXTURE0, GL_R16_SNORM, PaddedHeightmapSize, PaddedHeightmapSize, slotCount, HeightmapLevels);
+
+    // Types are uploaded still packed, two palette indices to a byte, so each texel covers two pixels in x. Integer textures can't be filtered.
+    typeTextureId = CreateTextureArray(GL_TEXTURE1, GL_R8UI, TerrainTile::SubtileSize / 2, TerrainTile::SubtileSize, slotCount, 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    slots.Initialize(slotCount, retireFrames);
+
+    Logger::Log("Created a terrain texture pool with ", slotCount, " subtile slots.");
+    return true;
+}
+
+SlotHandle TerrainTexturePool::AllocateSlot()
+{
+    return slots.Allocate();
+}
+
+void TerrainTexturePool::FreeSlot(const SlotHandle& slot)
+{
+    if (!slots.Free(slot))
+    {
+        Logger::LogWarn("Terrain texture pool slot ", slot.slot, " was freed twice.");
+    }
+}
+
+void TerrainTexturePool::AdvanceFrame()
+{
+    slots.AdvanceFrame();
+}
+
+void TerrainTexturePool::PadHeightmap(const short* heightmap, std::vector<short>* destination)
+{
+    const int size = TerrainTile::BorderedSubtileSize;
+    destination->resize(PaddedHeightmapSize * PaddedHeightmapSize);
+    for (int y = 0; y < PaddedHeightmapSize; y++)
+    {
+        const short* sourceRow = heightmap + std::min(y, size - 1) * size;
+        short* destinationRow = &(*destination)[y * PaddedHeightmapSize];
+        std::copy(sourceRow, sourceRow + size, destinationRow);
+        std::fill(destinationRow + size, destinationRow + PaddedHeightmapSize, sourceRow[size - 1]);
+    }
+}
+
+void TerrainTexturePool::DownsampleHeightmap(const short* source, int sourceSize, std::vector<short>* destination)
+{
+    int size = sourceSize / 2;
+    destination->resize(size * size);
+    for (int y = 0; y < size; y++)
+    {
+        const short* sourceRow = source + (y * 2) * sourceSize;
+        for (int x = 0; x < size; x++)
+        {
+            (*destination)[x + y * size] = (short)((sourceRow[x * 2] + sourceRow[x * 2 + 1] + sourceRow[x * 2 + sourceSize] + sourceRow[x * 2 + 1 + sourceSize] + 2) / 4);
+        }
+    }
+}
+
+void TerrainTexturePool::UploadSlot(int slot, const short* heightmap, const unsigned char* packedTypes)
+{
+    // The pack stores both ready for upload: heightmap with buffer space, and types with *no* buffer space.
+    //  Neither the packed type rows nor the smaller heightmap levels are a multiple of four bytes wide.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTextureId);
+    PadHeightmap(heightmap, &paddedHeightmap);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, PaddedHeightmapSize, PaddedHeightmapSize, 1, GL_RED, GL_SHORT, &paddedHeightmap[0]);
+
+    // Far terrain samples the smaller levels, which are small enough to build here instead of storing them in the terrain pack.
+    const short* level = &paddedHeightmap[0];
+    int levelSize = PaddedHeightmapSize;
+    for (int i = 1; i < HeightmapLevels; i++)
+    {
+        std::vector<short>& nextLevel = heightmapLevels[i % 2];
+        DownsampleHeightmap(level, levelSize, &nextLevel);
+
+        level = &nextLevel[0];
+        levelSize /= 2;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, slot, levelSize, levelSize, 1, GL_RED, GL_SHORT, level);
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, typeTextureId);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, TerrainTile::SubtileSize / 2, TerrainTile::SubtileSize, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, packedTypes);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+int TerrainTexturePool::UpdateSlotHeightmap(int slot, const short* heightmap, const HeightmapRect& deformedRect)
+{
+    // Rows are read straight out of the padded heightmap and levels, so the row length is the full width.
+    //  Deforming the last row or column also changes the padding repeating it.
+    HeightmapRect levelRect = deformedRect;
+    if (levelRect.maxX == TerrainTile::BorderedSubtileSize - 1)
+    {
+        levelRect.maxX = PaddedHeightmapSize - 1;
+    }
+
+    if (levelRect.maxY == TerrainTile::BorderedSubtileSize - 1)
+    {
+        levelRect.maxY = PaddedHeightmapSize - 1;
+    }
+
+    PadHeightmap(heightmap, &paddedHeightmap);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, PaddedHeightmapSize);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTextureId);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, levelRect.minX, levelRect.minY, slot, levelRect.GetWidth(), levelRect.GetHeight(), 1, GL_RED, GL_SHORT,
+        &paddedHeightmap[levelRect.minX + levelRect.minY * PaddedHeightmapSize]);
+    int texelsUploaded = levelRect.GetWidth() * levelRect.GetHeight();
+
+    // Rebuilding the small levels is cheaper than tracking which of their texels changed, but only the texels covering the deformation are uploaded.
+    const short* level = &paddedHeightmap[0];
+    int levelSize = PaddedHeightmapSize;
+    for (int i = 1; i < HeightmapLevels; i++)
+    {
+        std::vector<short>& nextLevel = heightmapLevels[i % 2];
+        DownsampleHeightmap(level, levelSize, &nextLevel);
+
+        level = &nextLevel[0];
+        levelSize /= 2;
+        levelRect.minX /= 2;
+        levelRect.minY /= 2;
+        levelRect.maxX /= 2;
+        levelRect.maxY /= 2;
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, levelSize);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, levelRect.minX, levelRect.minY, slot, levelRect.GetWidth(), levelRect.GetHeight(), 1, GL_RED, GL_SHORT,
+            level + levelRect.minX + levelRect.minY * levelSize);
+        texelsUploaded += levelRect.GetWidth() * levelRect.GetHeight();
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return texelsUploaded;
+}
+
+size_t TerrainTexturePool::GetSlotByteSize()
+{
+    // The heightmap is 16-bit, while the types are packed to 4 bits.
+    size_t heightmapTexels = 0;
+    for (int i = 0, levelSize = PaddedHeightmapSize; i < HeightmapLevels; i++, levelSize /= 2)
+    {
+        heightmapTexels += levelSize * levelSize;
+    }
+
+    return heightmapTexels * 2 + GetTypeSlotByteSize();
+}
+
+size_t TerrainTexturePool::GetTypeSlotByteSize()
+{
+    return TerrainTile::SubtileSize * TerrainTile::SubtileSize / 2;
+}
+
+GLuint TerrainTexturePool::GetHeightmapTextureId() const
+{
+    return heightmapTextureId;
+}
+
+GLuint TerrainTexturePool::GetTypeTextureId() const
+{
+    return typeTextureId;
+}
+
+int TerrainTexturePool::GetCapacity() const
+{
+    return slots.GetCapacity();
+}
+
+int TerrainTexturePool::GetUsedSlotCount() const
+{
+    return slots.GetUsedCount();
+}
+
+int TerrainTexturePool::GetRetiringSlotCount() const
+{
+    return slots.GetRetiringCount();
+}
+
+void TerrainTexturePool::Cleanup()
+{
+    if (heightmapTextureId != 0)
+    {
+        glDeleteTextures(1, &heightmapTextureId);
+        glDeleteTextures(1, &typeTextureId);
+        heightmapTextureId = 0;
+        typeTextureId = 0;
+    }
+
+    slots.Initialize(0, 0);
+}
+
+TerrainTexturePool::~TerrainTexturePool()
+{
+    Cleanup();
+}
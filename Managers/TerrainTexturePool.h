@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <GL/glew.h>
+#include "Data\TerrainTile.h"
+#include "Utils\SlotAllocator.h"
+
+// Holds the heightmaps and types of the active subtiles in the layers of two texture arrays, so all visible terrain can be drawn at once.
+class TerrainTexturePool
+{
+    GLuint heightmapTextureId;
+    GLuint typeTextureId;
+
+    // Freed slots aren't reused until the frames drawing from them have finished, so uploads never wait on the GPU.
+    SlotAllocator slots;
+
+    // Holds the padded heightmap and its downsampled levels while uploading a slot.
+    std::vector<short> paddedHeightmap;
+    std::vector<short> heightmapLevels[2];
+
+    static GLuint CreateTextureArray(GLenum activeTexture, GLenum internalFormat, int width, int height, int layers, int levels);
+
+    // Copies the bordered heightmap into the destination, repeating its last row and column out to the padded size.
+    static void PadHeightmap(const short* heightmap, std::vector<short>* destination);
+
+    // Averages each 2x2 block of the source heightmap into the destination, which is half the size.
+    static void DownsampleHeightmap(const short* source, int sourceSize, std::vector<short>* destination);
+
+public:
+    // The heightmap pyramid goes down to 13x13 texels, past the coarsest terrain level of detail (5m cells).
+    static const int HeightmapLevels = 4;
+
+    // The bordered heightmap is padded to a size that halves evenly down the pyramid, so each level covers the same area of the subtile.
+    //  Shaders sampling with normalized coordinates scale them by BorderedSubtileSize / PaddedHeightmapSize.
+    static const int PaddedHeightmapSize = 104;
+
+    TerrainTexturePool();
+
+    // Creates the texture arrays with the given number of slots. Fails if the OpenGL implementation can't hold that many layers.
+    //  Freed slots are reused after the given number of frames.
+    bool Initialize(int slotCount, int retireFrames);
+
+    // Returns a free slot, or an invalid handle if the pool is full.
+    SlotHandle AllocateSlot();
+    void FreeSlot(const SlotHandle& slot);
+
+    // Makes the slots freed long enough ago available again. Called once per frame.
+    void AdvanceFrame();
+
+    // Copies the bordered heightmap and palette-packed types of a subtile into a slot, generating the heightmap pyramid.
+    //  The types stay packed on the GPU, two to a texel, and are decoded by the terrain shader.
+    void UploadSlot(int slot, const short* heightmap, const unsigned char* packedTypes);
+
+    // Re-uploads the deformed part of a slot's bordered heightmap, and the texels of the smaller levels it covers. Returns the number of texels uploaded.
+    int UpdateSlotHeightmap(int slot, const short* heightmap, const HeightmapRect& deformedRect);
+    static size_t GetSlotByteSize();
+    static size_t GetTypeSlotByteSize();
+
+    GLuint GetHeightmapTextureId() const;
+    GLuint GetTypeTextureId() const;
+    int GetCapacity() const;
+    int GetUsedSlotCount() const;
+    int GetRetiringSlotCount() const;
+
+    void Cleanup();
+    virtual ~TerrainTexturePool();
+};
@@ -0,0 +1,77 @@
+#include "EffectRandom.h"
+
+// Spreads a seed over the state, so nearby subtiles don't start with similar states (and the state is never all zero).
+static uint64_t SplitMix64(uint64_t* seed)
+{
+    uint64_t value = (*seed += 0x9E3779B97F4A7C15ull);
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+EffectRandom::EffectRandom(glm::ivec2 subtileId, Stream stream)
+    : EffectRandom((((uint64_t)(uint32_t)subtileId.x << 32) | (uint64_t)(uint32_t)subtileId.y) ^ ((uint64_t)stream * 0xD1B54A32D192ED03ull))
+{
+}
+
+EffectRandom::EffectRandom(uint64_t seed)
+{
+    uint64_t low = SplitMix64(&seed);
+    uint64_t high = SplitMix64(&seed);
+    state[0] = (uint32_t)low;
+    state[1] = (uint32_t)(low >> 32);
+    state[2] = (uint32_t)high;
+    state[3] = (uint32_t)(high >> 32);
+}
+
+// Steps the generator held in s0-s3, storing the output in result.
+#define EFFECT_RANDOM_STEP(result) \
+    { \
+        result = RotateLeft(s1 * 5, 7) * 9; \
+        uint32_t shifted = s1 << 9; \
+        s2 ^= s0; \
+        s3 ^= s1; \
+        s1 ^= s2; \
+        s0 ^= s3; \
+        s2 ^= shifted; \
+        s3 = RotateLeft(s3, 11); \
+    }
+
+void EffectRandom::Fill(float* values, int count, float min, float max)
+{
+    uint32_t s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3];
+    float range = max - min;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t result;
+        EFFECT_RANDOM_STEP(result);
+        values[i] = min + range * ToUnitFloat(result);
+    }
+
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+}
+
+void EffectRandom::Fill(glm::vec2* values, int count, const glm::vec2& min, const glm::vec2& max)
+{
+    Fill(&values[0].x, count * 2, 0.0f, 1.0f);
+
+    glm::vec2 range = max - min;
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = min + range * values[i];
+    }
+}
+
+void EffectRandom::Fill(glm::vec3* values, int count, const glm::vec3& min, const glm::vec3& max)
+{
+    Fill(&values[0].x, count * 3, 0.0f, 1.0f);
+
+    glm::vec3 range = max - min;
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = min + range * values[i];
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <glm\vec2.hpp>
+#include <glm\vec3.hpp>
+
+// A small, fast random number generator (xoshiro128**) for generating terrain effects.
+//  Seeded from a subtile and the effect generating it, so a subtile gets the same effects every time it's loaded, on whichever thread builds it.
+class EffectRandom
+{
+    uint32_t state[4];
+
+    static uint32_t RotateLeft(uint32_t value, int bits)
+    {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    // Uses the top 24 bits, which is all a float in [0, 1) can hold.
+    static float ToUnitFloat(uint32_t value)
+    {
+        return (float)(value >> 8) * (1.0f / 16777216.0f);
+    }
+
+public:
+    // Separates the numbers each effect draws for the same subtile. Changing these changes every placement.
+    enum Stream
+    {
+        GRASS = 1,
+        ROCKS = 2,
+        ROADS = 3,
+        SIGNS = 4,
+        TREES = 5,
+        CITY = 6,
+
+        // Seeded from the tree cache ID instead of a subtile.
+        TREE_ARCHETYPES = 7,
+    };
+
+    EffectRandom(glm::ivec2 subtileId, Stream stream);
+    EffectRandom(uint64_t seed);
+
+    uint32_t Next()
+    {
+        uint32_t result = RotateLeft(state[1] * 5, 7) * 9;
+        uint32_t shifted = state[1] << 9;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= shifted;
+        state[3] = RotateLeft(state[3], 11);
+        return result;
+    }
+
+    // Returns a float in [0, 1).
+    float Float()
+    {
+        return ToUnitFloat(Next());
+    }
+
+    float Float(float min, float max)
+    {
+        return min + (max - min) * Float();
+    }
+
+    // Returns an int in [min, max], like glm::linearRand.
+    int Int(int min, int max)
+    {
+        return min + (int)(((uint64_t)Next() * (uint64_t)(max - min + 1)) >> 32);
+    }
+
+    // Components are drawn in order, x first.
+    glm::vec2 Vec2(const glm::vec2& min, const glm::vec2& max)
+    {
+        float x = Float(min.x, max.x);
+        return glm::vec2(x, Float(min.y, max.y));
+    }
+
+    glm::vec3 Vec3(const glm::vec3& min, const glm::vec3& max)
+    {
+        float x = Float(min.x, max.x);
+        float y = Float(min.y, max.y);
+        return glm::vec3(x, y, Float(min.z, max.z));
+    }
+
+    // Fill buffers with the same numbers as calling Float, Vec2 or Vec3 for each element, keeping the state in registers throughout.
+    void Fill(float* values, int count, float min, float max);
+    void Fill(glm::vec2* values, int count, const glm::vec2& min, const glm::vec2& max);
+    void Fill(glm::vec3* values, int count, const glm::vec3& min, const glm::vec3& max);
+};
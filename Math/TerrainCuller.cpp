@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <SFML\System.hpp>
+#include "logging\Logger.h"
+#include "TerrainCuller.h"
+
+const float Pi = 3.14159265358979f;
+
+TerrainCuller::TerrainCuller()
+    : eyePosition(0.0f), horizon(HorizonBins), entries(), occluders(), stats()
+{
+    for (int i = 0; i < 6; i++)
+    {
+        frustumPlanes[i] = glm::vec4(0.0f);
+    }
+}
+
+void TerrainCuller::SetView(const glm::mat4& projectionViewMatrix, const glm::vec3& eyePosition)
+{
+    this->eyePosition = eyePosition;
+
+    // Each plane is the last row of the matrix plus or minus one of the other rows (Gribb & Hartmann).
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(projectionViewMatrix[0][i], projectionViewMatrix[1][i], projectionViewMatrix[2][i], projectionViewMatrix[3][i]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        frustumPlanes[i * 2] = rows[3] + rows[i];
+        frustumPlanes[i * 2 + 1] = rows[3] - rows[i];
+    }
+}
+
+bool TerrainCuller::IsInFrustum(const CullingBounds& bounds) const
+{
+    for (const glm::vec4& plane : frustumPlanes)
+    {
+        // Test the corner furthest along the plane normal. If even that is outside, the whole box is.
+        glm::vec3 corner(plane.x >= 0 ? bounds.max.x : bounds.min.x, plane.y >= 0 ? bounds.max.y : bounds.min.y, plane.z >= 0 ? bounds.max.z : bounds.min.z);
+        if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TerrainCuller::CullingEntry TerrainCuller::CreateEntry(int index, const CullingBounds& bounds) const
+{
+    CullingEntry entry;
+    entry.index = index;
+
+    glm::vec2 eye(eyePosition.x, eyePosition.y);
+    glm::vec2 boundsMin(bounds.min.x, bounds.min.y);
+    glm::vec2 boundsMax(bounds.max.x, bounds.max.y);
+    glm::vec2 closestPoint(std::min(std::max(eye.x, boundsMin.x), boundsMax.x), std::min(std::max(eye.y, boundsMin.y), boundsMax.y));
+    glm::vec2 furthestPoint(eye.x - boundsMin.x > boundsMax.x - eye.x ? boundsMin.x : boundsMax.x, eye.y - boundsMin.y > boundsMax.y - eye.y ? boundsMin.y : boundsMax.y);
+    entry.nearDistance = glm::length(closestPoint - eye);
+    entry.farDistance = glm::length(furthestPoint - eye);
+
+    entry.containsEye = entry.nearDistance == 0.0f;
+    entry.firstBin = 0.0f;
+    entry.lastBin = 0.0f;
+    if (!entry.containsEye)
+    {
+        // Measure the corners relative to the direction to the center, so the range never wraps around.
+        glm::vec2 center = (boundsMin + boundsMax) * 0.5f - eye;
+        float centerAngle = std::atan2(center.y, center.x);
+        float minAngle = 0.0f;
+        float maxAngle = 0.0f;
+
+        glm::vec2 corners[4] = { boundsMin, glm::vec2(boundsMax.x, boundsMin.y), glm::vec2(boundsMin.x, boundsMax.y), boundsMax };
+        for (const glm::vec2& corner : corners)
+        {
+            glm::vec2 offset = corner - eye;
+            float angle = std::atan2(offset.y, offset.x) - centerAngle;
+            if (angle > Pi)
+            {
+                angle -= 2 * Pi;
+            }
+            else if (angle < -Pi)
+            {
+                angle += 2 * Pi;
+            }
+
+            minAngle = std::min(minAngle, angle);
+            maxAngle = std::max(maxAngle, angle);
+        }
+
+        float binsPerRadian = (float)HorizonBins / (2 * Pi);
+        entry.firstBin = (centerAngle + minAngle + Pi) * binsPerRadian;
+        entry.lastBin = (centerAngle + maxAngle + Pi) * binsPerRadian;
+    }
+
+    return entry;
+}
+
+void TerrainCuller::AddOccluder(const CullingEntry& occluder, const CullingBounds& bounds)
+{
+    // Along any ray through the occluder, the ground is at least the occluder's minimum height.
+    //  The lowest slope that height can have is at the furthest distance if above the eye, or the nearest if below.
+    float heightAboveEye = bounds.min.z - eyePosition.z;
+    float slope = heightAboveEye / (heightAboveEye > 0 ? occluder.farDistance : occluder.nearDistance);
+
+    // Only bins entirely within the occluder are guaranteed to be blocked by it.
+    int firstBin = (int)std::ceil(occluder.firstBin);
+    int lastBin = (int)std::floor(occluder.lastBin) - 1;
+    for (int bin = firstBin; bin <= lastBin; bin++)
+    {
+        float& horizonSlope = horizon[(bin % HorizonBins + HorizonBins) % HorizonBins];
+        horizonSlope = std::max(horizonSlope, slope);
+    }
+}
+
+bool TerrainCuller::IsBelowHorizon(const CullingEntry& entry, const CullingBounds& bounds) const
+{
+    // The highest slope the bounds can have is at the nearest distance if above the eye, or the furthest if below.
+    float heightAboveEye = bounds.max.z - eyePosition.z;
+    float slope = heightAboveEye / (heightAboveEye > 0 ? entry.nearDistance : entry.farDistance);
+
+    int firstBin = (int)std::floor(entry.firstBin);
+    int lastBin = (int)std::floor(entry.lastBin);
+    for (int bin = firstBin; bin <= lastBin; bin++)
+    {
+        if (horizon[(bin % HorizonBins + HorizonBins) % HorizonBins] <= slope)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TerrainCuller::Cull(const std::vector<CullingBounds>& bounds, std::vector<int>* visibleIndices)
+{
+    sf::Clock clock;
+    visibleIndices->clear();
+    std::fill(horizon.begin(), horizon.end(), -std::numeric_limits<float>::max());
+
+    entries.clear();
+    for (int i = 0; i < (int)bounds.size(); i++)
+    {
+        entries.push_back(CreateEntry(i, bounds[i]));
+    }
+
+    // Visit the bounds nearest first. An occluder only hides bounds that start beyond its far edge, so occluders are added in order of their far distance.
+    occluders = entries;
+    std::sort(entries.begin(), entries.end(), [](const CullingEntry& lhs, const CullingEntry& rhs) { return lhs.nearDistance < rhs.nearDistance; });
+    std::sort(occluders.begin(), occluders.end(), [](const CullingEntry& lhs, const CullingEntry& rhs) { return lhs.farDistance < rhs.farDistance; });
+
+    size_t nextOccluder = 0;
+    for (const CullingEntry& entry : entries)
+    {
+        while (nextOccluder < occluders.size() && occluders[nextOccluder].farDistance <= entry.nearDistance)
+        {
+            if (!occluders[nextOccluder].containsEye)
+            {
+                AddOccluder(occluders[nextOccluder], bounds[occluders[nextOccluder].index]);
+            }
+
+            ++nextOccluder;
+        }
+
+        const CullingBounds& entryBounds = bounds[entry.index];
+        if (!IsInFrustum(entryBounds))
+        {
+            ++stats.frustumCulled;
+        }
+        else if (!entry.containsEye && IsBelowHorizon(entry, entryBounds))
+        {
+            ++stats.horizonCulled;
+        }
+        else
+        {
+            visibleIndices->push_back(entry.index);
+        }
+    }
+
+    stats.frames++;
+    stats.subtilesTested += (long)bounds.size();
+    stats.usCullingTime += (long)clock.getElapsedTime().asMicroseconds();
+}
+
+void TerrainCuller::LogStats()
+{
+    float frames = (float)std::max(stats.frames, 1L);
+    Logger::Log("Terrain Culling: ", (float)stats.subtilesTested / frames, " subtiles tested, ", (float)stats.frustumCulled / frames, " frustum culled and ",
+        (float)stats.horizonCulled / frames, " horizon culled per frame, in ", (float)stats.usCullingTime / frames, " us per frame.");
+    stats.Reset();
+}
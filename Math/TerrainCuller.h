@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <glm\vec3.hpp>
+#include <glm\vec4.hpp>
+#include <glm\mat4x4.hpp>
+
+// An axis-aligned box around a subtile and everything drawn on it, in real units.
+struct CullingBounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    CullingBounds(glm::vec3 min, glm::vec3 max)
+        : min(min), max(max)
+    {
+    }
+};
+
+// Tracks how many subtiles are culled, and how long culling takes.
+struct CullingStats
+{
+    long frames;
+    long subtilesTested;
+    long frustumCulled;
+    long horizonCulled;
+    long usCullingTime;
+
+    CullingStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        frames = 0;
+        subtilesTested = 0;
+        frustumCulled = 0;
+        horizonCulled = 0;
+        usCullingTime = 0;
+    }
+};
+
+// Culls terrain subtiles outside the view frustum or hidden behind nearer terrain. Doesn't use OpenGL.
+// Horizon culling keeps the highest ground seen so far (as a slope from the eye) for each direction around the eye.
+//  Each subtile is guaranteed to be at least its minimum height everywhere, so it hides anything further away that's below that slope in all the directions it covers.
+class TerrainCuller
+{
+    static const int HorizonBins = 512;
+
+    // Planes point inwards, as (normal, distance).
+    glm::vec4 frustumPlanes[6];
+    glm::vec3 eyePosition;
+
+    // The highest slope (height above the eye over horizontal distance) of the terrain in front of each direction bin.
+    std::vector<float> horizon;
+
+    // Per-bounds data computed while culling.
+    struct CullingEntry
+    {
+        int index;
+
+        // Horizontal distance from the eye to the closest and furthest point of the bounds.
+        float nearDistance;
+        float farDistance;
+
+        // Range of direction bins the bounds cover, as fractional bins. Not valid if the bounds contain the eye.
+        float firstBin;
+        float lastBin;
+        bool containsEye;
+    };
+
+    std::vector<CullingEntry> entries;
+    std::vector<CullingEntry> occluders;
+    CullingStats stats;
+
+    CullingEntry CreateEntry(int index, const CullingBounds& bounds) const;
+
+    // Raises the horizon in the direction bins entirely covered by the occluder.
+    void AddOccluder(const CullingEntry& occluder, const CullingBounds& bounds);
+    bool IsBelowHorizon(const CullingEntry& entry, const CullingBounds& bounds) const;
+
+public:
+    TerrainCuller();
+
+    // Sets the view to cull with. The eye position is the camera position, in real units.
+    void SetView(const glm::mat4& projectionViewMatrix, const glm::vec3& eyePosition);
+
+    bool IsInFrustum(const CullingBounds& bounds) const;
+
+    // Fills in the indices of the bounds that may be visible. All bounds act as occluders, so should include every loaded subtile around the eye.
+    void Cull(const std::vector<CullingBounds>& bounds, std::vector<int>* visibleIndices);
+
+    void LogStats();
+};
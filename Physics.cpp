@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <limits>
 #include <glm\gtc\quaternion.hpp>
 #include "Data\UserPhysics.h"
@@ -11,7 +12,7 @@ std::vector<ContactCallback> Physics::contactCallbacks = std::vector<ContactCall
 std::map<void*, std::set<void*>> Physics::contactCallbacksFound = std::map<void*, std::set<void*>>();
 
 Physics::Physics()
-    : queuedCommands(), accumulatedTimestep(0.0f), simulating(false)
+    : queuedCommands(), queuedHeightfieldUpdates(), dynamicBodyStates(), appliedGeneration(0), accumulatedTimestep(0.0f), simulating(false)
 {
 }
 
@@ -54,6 +55,8 @@ void Physics::Step(float timestep)
     
     if (!simulating)
     {
+        UpdateDynamicBodyStates();
+
         // Run our simulation!
         simulationThread = std::async(std::launch::async, &Physics::PerformStep, this, accumulatedTimestep);
         accumulatedTimestep = 0;
@@ -61,6 +64,30 @@ void Physics::Step(float timestep)
     }
 }
 
+void Physics::StepImmediately(float timestep)
+{
+    PerformQueuedActions();
+    PerformStep(timestep);
+    PerformPostStepActions();
+    UpdateDynamicBodyStates();
+}
+
+void Physics::UpdateDynamicBodyStates()
+{
+    dynamicBodyStates.clear();
+    const btCollisionObjectArray& collisionObjects = dynamicsWorld->getCollisionObjectArray();
+    for (int i = 0; i < collisionObjects.size(); i++)
+    {
+        const btRigidBody* body = btRigidBody::upcast(collisionObjects[i]);
+        if (body != nullptr && !body->isStaticObject())
+        {
+            const btVector3& position = body->getWorldTransform().getOrigin();
+            const btVector3& velocity = body->getLinearVelocity();
+            dynamicBodyStates.push_back(DynamicBodyState(glm::vec3(position.x(), position.y(), position.z()), glm::vec3(velocity.x(), velocity.y(), velocity.z())));
+        }
+    }
+}
+
 bool Physics::AddContactCallback(btManifoldPoint& cp, void* body0, void* body1)
 {
     if (cp.getDistance() >= 0.0f)
@@ -129,6 +156,44 @@ void Physics::PerformQueuedActions()
     }
 
     queuedCommands.clear();
+
+    for (const HeightfieldUpdate& update : queuedHeightfieldUpdates)
+    {
+        for (int y = 0; y < update.height; y++)
+        {
+            std::copy(&update.heights[y * update.width], &update.heights[y * update.width] + update.width,
+                update.heightfieldData + update.x + (update.y + y) * update.heightfieldWidth);
+        }
+
+        // Skip heightfields removed from the world, whose shapes may already be deleted.
+        if (update.body == nullptr || update.body->getBroadphaseHandle() == nullptr)
+        {
+            continue;
+        }
+
+        dynamicsWorld->updateSingleAabb(update.body);
+
+        // Sleeping bodies don't notice the terrain moving under them, so would hang in the air over a crater.
+        struct WakeBodiesCallback : public btBroadphaseAabbCallback
+        {
+            virtual bool process(const btBroadphaseProxy* proxy)
+            {
+                btCollisionObject* collisionObject = (btCollisionObject*)proxy->m_clientObject;
+                if (!collisionObject->isStaticObject())
+                {
+                    collisionObject->activate(true);
+                }
+
+                return true;
+            }
+        } wakeBodies;
+
+        broadphaseCollisionDetector->aabbTest(btVector3(update.boundsMin.x, update.boundsMin.y, update.boundsMin.z),
+            btVector3(update.boundsMax.x, update.boundsMax.y, update.boundsMax.z), wakeBodies);
+    }
+
+    queuedHeightfieldUpdates.clear();
+    ++appliedGeneration;
 }
 
 void Physics::PerformPostStepActions()
@@ -201,6 +266,21 @@ void Physics::UnloadPhysics()
     delete collisionConfiguration;
 }
 
+const std::vector<DynamicBodyState>& Physics::GetDynamicBodyStates() const
+{
+    return dynamicBodyStates;
+}
+
+int Physics::GetCollisionObjectCount() const
+{
+    return dynamicsWorld->getNumCollisionObjects();
+}
+
+int Physics::GetOverlappingPairCount() const
+{
+    return broadphaseCollisionDetector->getOverlappingPairCache()->getNumOverlappingPairs();
+}
+
 void Physics::AddBody(btRigidBody* body)
 {
     queuedCommands.push_back(PhysicsCommand(PhysicsCommand::AddBody, body));
@@ -216,4 +296,26 @@ void Physics::DeleteBody(btRigidBody* body, bool eraseCollisionShape)
     queuedCommands.push_back(PhysicsCommand(
         eraseCollisionShape ? PhysicsCommand::DeleteBodyAndCollisionShapes : PhysicsCommand::DeleteBody,
         body));
-}
\ No newline at end of file
+}
+
+void Physics::UpdateHeightfield(const HeightfieldUpdate& update)
+{
+    queuedHeightfieldUpdates.push_back(update);
+}
+
+void Physics::CancelHeightfieldUpdates(const short* heightfieldData)
+{
+    queuedHeightfieldUpdates.erase(std::remove_if(queuedHeightfieldUpdates.begin(), queuedHeightfieldUpdates.end(),
+        [heightfieldData](const HeightfieldUpdate& update) { return update.heightfieldData == heightfieldData; }), queuedHeightfieldUpdates.end());
+}
+
+long Physics::GetQueuedGeneration() const
+{
+    // Bodies are only added to or removed from the simulation between steps, so with nothing queued, nothing removed is still referenced.
+    return queuedCommands.empty() && queuedHeightfieldUpdates.empty() ? appliedGeneration : appliedGeneration + 1;
+}
+
+long Physics::GetAppliedGeneration() const
+{
+    return appliedGeneration;
+}
@@ -4,6 +4,7 @@
 #include <set>
 #include <vector>
 #include <Bullet\btBulletDynamicsCommon.h>
+#include <glm\vec3.hpp>
 #include "PhysicsDebugDrawer.h"
 
 struct ContactCallback
@@ -36,6 +37,44 @@ struct PhysicsCommand
     }
 };
 
+// The position and velocity of a body that isn't static, as of the last physics step.
+struct DynamicBodyState
+{
+    glm::vec3 position;
+    glm::vec3 velocity;
+
+    DynamicBodyState(glm::vec3 position, glm::vec3 velocity)
+        : position(position), velocity(velocity)
+    {
+    }
+};
+
+// A rectangle of heights to copy into the data a heightfield reads.
+struct HeightfieldUpdate
+{
+    // The heightfield's body, or nullptr if nothing collides with the heights yet.
+    btRigidBody* body;
+
+    // Copied into when the update is applied, so must stay allocated until then, or until the update is cancelled.
+    short* heightfieldData;
+    int heightfieldWidth;
+
+    int x;
+    int y;
+    int width;
+    int height;
+    std::vector<short> heights;
+
+    // World bounds of the changed heights. Bodies within them are woken, as they may be resting on terrain that moved.
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    HeightfieldUpdate()
+        : body(nullptr), heightfieldData(nullptr), heightfieldWidth(0), x(0), y(0), width(0), height(0), heights(), boundsMin(0.0f), boundsMax(0.0f)
+    {
+    }
+};
+
 // Defines the basics of physics (ie, gravity) the rest of the game uses.
 // Also holds generic framework code.
 class Physics
@@ -43,6 +82,11 @@ class Physics
     static std::vector<ContactCallback> contactCallbacks;
     static std::map<void*, std::set<void*>> contactCallbacksFound;
     std::vector<PhysicsCommand> queuedCommands;
+    std::vector<HeightfieldUpdate> queuedHeightfieldUpdates;
+    std::vector<DynamicBodyState> dynamicBodyStates;
+
+    // Counts the times the queued actions have been applied.
+    long appliedGeneration;
 
     float accumulatedTimestep;
     bool simulating;
@@ -60,6 +104,7 @@ class Physics
     void PerformStep(float timestep); // Runs the physics simulation on a separate thread.
     void PerformQueuedActions(); // Performs any queued physics actions that could not be done in multiple threads.
     void PerformPostStepActions(); // Performs physics that occurs after a step occurs.
+    void UpdateDynamicBodyStates(); // Records where the non-static bodies are, while the simulation isn't running.
 
     static bool AddContactCallback(btManifoldPoint& cp, void* body0, void* body1);
 
@@ -68,10 +113,30 @@ public:
     Physics();
     bool LoadPhysics(PhysicsDebugDrawer* debugDrawer);
     void Step(float timestep);
+
+    // Runs a single step on the calling thread, applying queued actions first. Used when benchmarking, instead of Step.
+    void StepImmediately(float timestep);
     void UnloadPhysics();
 
     void AddBody(btRigidBody* body);
     void RemoveBody(btRigidBody* body);
     void DeleteBody(btRigidBody* body, bool deleteCollisionShape);
+
+    // Copies heights into a heightfield's data between steps, as the simulation thread reads them while stepping. Applied after the queued bodies are added or removed.
+    void UpdateHeightfield(const HeightfieldUpdate& update);
+
+    // Drops the queued updates that copy into heights about to be freed.
+    void CancelHeightfieldUpdates(const short* heightfieldData);
+
+    // Returns the generation the actions queued so far are applied in. Once GetAppliedGeneration reaches it, neither they nor the simulation reference
+    //  anything removed by them, however many frames the simulation took.
+    long GetQueuedGeneration() const;
+    long GetAppliedGeneration() const;
+
+    // Gets the bodies that can move, which need terrain around them.
+    const std::vector<DynamicBodyState>& GetDynamicBodyStates() const;
+
+    int GetCollisionObjectCount() const;
+    int GetOverlappingPairCount() const;
 };
 
@@ -81,6 +81,12 @@ const glm::vec2 Player::Get2DOrientation() const
     return glm::normalize(glm::vec2(forwardsVector.x, forwardsVector.y));
 }
 
+const glm::vec3 Player::GetVelocity() const
+{
+    const btVector3& velocity = model.body->getLinearVelocity();
+    return glm::vec3(velocity.x(), velocity.y(), velocity.z());
+}
+
 const glm::mat4 Player::GetViewMatrix() const
 {
     return camera.GetViewMatrix();
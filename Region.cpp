@@ -1,13 +1,27 @@
-#include <glm\gtc\matrix_transform.hpp>
+#include <algorithm>
 #include "Region.h"
 #include "Config\PhysicsConfig.h"
+#include "Data\Model.h"
 #include "Data\UserPhysics.h"
 #include "Utils\TypedCallback.h"
 
-Region::Region(glm::ivec2 pos, TerrainManager* terrainManager)
-    : pos(pos)
+Region::Region(glm::ivec2 pos, TerrainManager* terrainManager, float priority)
+    : pos(pos), loadedHeightmaps(glm::ivec2(0, 0), glm::ivec2(TerrainTile::Subdivisions - 1, TerrainTile::Subdivisions - 1))
 {
-    terrainManager->LoadTerrainTile(pos, &regionTile);
+    regionTile = terrainManager->RequestTerrainTile(pos, priority);
+}
+
+void Region::EnsureTileLoaded(TerrainManager* terrainManager)
+{
+    if (!regionTile->loadedSubtiles)
+    {
+        terrainManager->LoadTerrainTile(pos, &regionTile);
+    }
+}
+
+bool Region::IsTileLoaded() const
+{
+    return regionTile->loadedSubtiles;
 }
 
 glm::ivec2 Region::GetPos() const
@@ -15,23 +29,137 @@ glm::ivec2 Region::GetPos() const
     return pos;
 }
 
-void Region::EnsureHeightmapsLoaded(Physics* physics, const std::vector<glm::ivec2>* tilesToLoadHeightmapsFor)
+bool Region::EnsureHeightmapLoaded(Physics* physics, const glm::ivec2 tilePos)
 {
-    for (const glm::ivec2& tilePos : *tilesToLoadHeightmapsFor)
+    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
+    if (!regionTile->IsSubtileLoaded(localPos))
     {
-        glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
-        bool inRegion = (localPos.x >= 0 && localPos.y >= 0 && localPos.x < TerrainTile::Subdivisions && localPos.y < TerrainTile::Subdivisions);
-        if (inRegion && loadedHeightmaps.find(localPos) == loadedHeightmaps.end())
-        {
-            loadedHeightmaps[localPos] = CreateHeightmap(tilePos, regionTile->subtiles[localPos], physics);
-        }
+        return false;
     }
+
+    if (!loadedHeightmaps.Contains(localPos))
+    {
+        loadedHeightmaps.Set(localPos, CreateHeightmap(tilePos, regionTile->GetSubtile(localPos), physics));
+    }
+
+    return true;
 }
 
-btRigidBody* Region::CreateHeightmap(glm::ivec2 tilePos, SubTile* subTile, Physics* physics)
+void Region::RemoveHeightmap(Physics* physics, const glm::ivec2 tilePos)
+{
+    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
+    btRigidBody** heightmap = loadedHeightmaps.Find(localPos);
+    if (heightmap != nullptr)
+    {
+        // Pending updates of the subtile's heights are still applied, as they outlive the heightfield and are read by the next one. Updates skip removed bodies.
+        physics->RemoveBody(*heightmap);
+        physics->DeleteBody(*heightmap, true);
+        loadedHeightmaps.Remove(localPos);
+    }
+}
+
+bool Region::UpdateDeformedHeightmap(Physics* physics, const glm::ivec2 tilePos, const HeightmapRect& deformedRect, bool* replacedHeightfield)
+{
+    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
+    SubTile* subtile = regionTile->GetSubtile(localPos);
+    *replacedHeightfield = false;
+    if (subtile == nullptr || !subtile->IsDeformed())
+    {
+        return false;
+    }
+
+    // Heightfields can't be pointed at other heights, so one created before the subtile was first deformed is swapped for a new one between physics steps.
+    btRigidBody** heightmap = loadedHeightmaps.Find(localPos);
+    if (heightmap != nullptr && subtile->isPhysicsHeightmapMoved)
+    {
+        physics->RemoveBody(*heightmap);
+        physics->DeleteBody(*heightmap, true);
+        *heightmap = CreateHeightmap(tilePos, subtile, physics);
+        *replacedHeightfield = true;
+    }
+
+    subtile->isPhysicsHeightmapMoved = false;
+
+    HeightfieldUpdate update;
+    update.body = heightmap == nullptr ? nullptr : *heightmap;
+    update.heightfieldData = &subtile->deformedPhysicsHeightmap[0];
+    update.heightfieldWidth = TerrainTile::BorderedSubtileSize;
+    update.x = deformedRect.minX;
+    update.y = deformedRect.minY;
+    update.width = deformedRect.GetWidth();
+    update.height = deformedRect.GetHeight();
+    update.heights.resize(update.width * update.height);
+    for (int y = 0; y < update.height; y++)
+    {
+        const short* row = subtile->heightmap + update.x + (update.y + y) * TerrainTile::BorderedSubtileSize;
+        std::copy(row, row + update.width, &update.heights[y * update.width]);
+    }
+
+    // Heightfield points are a meter apart, with the first border point half a meter before the tile. Pad by a point, as the triangles next to the points also moved.
+    glm::vec2 origin = glm::vec2((float)tilePos.x, (float)tilePos.y) * (float)TerrainTile::SubtileSize - glm::vec2(0.5f);
+    update.boundsMin = glm::vec3(origin + glm::vec2((float)(deformedRect.minX - 1), (float)(deformedRect.minY - 1)), 0.0f);
+    update.boundsMax = glm::vec3(origin + glm::vec2((float)(deformedRect.maxX + 1), (float)(deformedRect.maxY + 1)), (float)TerrainTile::MaxHeight);
+    physics->UpdateHeightfield(update);
+    return true;
+}
+
+bool Region::ActivateSubtile(TerrainManager* terrainManager, const glm::ivec2 tilePos)
+{
+    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
+    if (!regionTile->IsSubtileLoaded(localPos))
+    {
+        return false;
+    }
+
+    terrainManager->ActivateSubTile(pos, localPos);
+    return true;
+}
+
+void Region::DeactivateSubtile(TerrainManager* terrainManager, const glm::ivec2 tilePos)
+{
+    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
+    if (regionTile->IsSubtileLoaded(localPos))
+    {
+        terrainManager->DeactivateSubTile(pos, localPos);
+    }
+}
+
+bool Region::IsSubtileLoaded(const glm::ivec2 tilePos) const
 {
-    btHeightfieldTerrainShape* heightfield = new btHeightfieldTerrainShape(TerrainTile::SubtileSize, TerrainTile::SubtileSize, subTile->heightmap, 900.0f, 2, true, false);
+    return regionTile->IsSubtileLoaded(tilePos - (pos * TerrainTile::Subdivisions));
+}
+
+bool Region::GetSubtileHeightRange(const glm::ivec2 tilePos, float* minHeight, float* maxHeight) const
+{
+    SubTile* subtile = regionTile->GetSubtile(tilePos - (pos * TerrainTile::Subdivisions));
+    if (subtile == nullptr)
+    {
+        return false;
+    }
+
+    *minHeight = subtile->minHeight;
+    *maxHeight = subtile->maxHeight;
+    return true;
+}
+
+void Region::AddMemoryUsage(const TerrainManager* terrainManager, TerrainMemoryUsage* memoryUsage) const
+{
+    terrainManager->AddTileMemoryUsage(pos, memoryUsage);
+    memoryUsage->physicsBytes += loadedHeightmaps.Size() * (sizeof(btHeightfieldTerrainShape) + Model::PhysicsBodySize);
+}
+
+btHeightfieldTerrainShape* Region::CreateHeightfieldShape(const short* heightmap)
+{
+    // Bullet reads the bordered 16-bit heightmap directly from the terrain pack, scaling it to real units. The border adds a row of points on each side, which keeps the heightfield centered.
+    btHeightfieldTerrainShape* heightfield = new btHeightfieldTerrainShape(TerrainTile::BorderedSubtileSize, TerrainTile::BorderedSubtileSize, heightmap,
+        (float)TerrainTile::MaxHeight / (float)TerrainTile::MaxHeightValue, 0.0f, (float)TerrainTile::MaxHeight, 2, PHY_SHORT, false);
     heightfield->setMargin(2.0f);
+    return heightfield;
+}
+
+btRigidBody* Region::CreateHeightmap(glm::ivec2 tilePos, SubTile* subTile, Physics* physics)
+{
+    btHeightfieldTerrainShape* heightfield = CreateHeightfieldShape(subTile->physicsHeightmap);
 
     // Position the heightfield so that it's not repositioned incorrectly.
     btTransform heightfieldPos;
@@ -49,57 +177,42 @@ btRigidBody* Region::CreateHeightmap(glm::ivec2 tilePos, SubTile* subTile, Physi
     return heightmap;
 }
 
-float Region::GetPointHeight(const glm::ivec2 tilePos, const glm::ivec2 fullPos) const
+const SubTile* Region::GetSubtile(const glm::ivec2 tilePos) const
 {
-    // Map to the correct subtile.
-    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
-
-    // Map to the correct point within the subtile.
-    glm::ivec2 subtileOffset = fullPos - (tilePos *  TerrainTile::SubtileSize);
-    return regionTile->subtiles[localPos]->heightmap[subtileOffset.x + subtileOffset.y *  TerrainTile::SubtileSize];
+    return regionTile->GetSubtile(tilePos - (pos * TerrainTile::Subdivisions));
 }
 
-int Region::GetPointType(const glm::ivec2 tilePos, const glm::ivec2 fullPos) const
+void Region::QueueSimulation(TerrainManager* terrainManager, glm::ivec2 tilePos)
 {
-    // Map to the correct subtile.
-    glm::ivec2 localPos = tilePos - (pos * TerrainTile::Subdivisions);
-
-    // Map to the correct point within the subtile.
-    glm::ivec2 subtileOffset = fullPos - (tilePos *  TerrainTile::SubtileSize);
-    return (int)(regionTile->subtiles[localPos]->type[subtileOffset.x + subtileOffset.y *  TerrainTile::SubtileSize]);
+    terrainManager->QueueTileSimulation(pos, tilePos - (pos * TerrainTile::Subdivisions));
 }
 
-void Region::Simulate(TerrainManager* terrainManager, glm::ivec2 tilePos, float elapsedSeconds)
+void Region::RenderRegion(glm::ivec2 tilePos, TerrainManager* terrainManager) const
 {
-    terrainManager->Simulate(pos, tilePos - (pos * TerrainTile::Subdivisions), elapsedSeconds);
+    terrainManager->QueueTileRender(pos, tilePos - (pos * TerrainTile::Subdivisions));
 }
 
-void Region::RenderRegion(glm::ivec2 tilePos, const glm::vec3& playerPosition, const glm::vec2& playerDirection, TerrainManager* terrainManager, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix) const
+void Region::CleanupRegion(TerrainManager* terrainManager, Physics* physics)
 {
-    // TODO investigate how to make this work and apply to city buildings.
-    // glm::vec2 playerFlatPos = glm::vec2(playerPosition.x, playerPosition.y);
-    // glm::vec2 tileOrigin = glm::vec2((float)tilePos.x, (float)tilePos.y) * (float)TerrainTile::SubtileSize;
-    // glm::vec2 tileXP = tileOrigin + glm::vec2(TerrainTile::SubtileSize, 0) - playerFlatPos;
-    // glm::vec2 tileYP = tileOrigin + glm::vec2(0, TerrainTile::SubtileSize) - playerFlatPos;
-    // glm::vec2 tileXPYP = tileOrigin + glm::vec2(TerrainTile::SubtileSize, TerrainTile::SubtileSize) - playerFlatPos;
-    // tileOrigin -= -playerFlatPos;
-    if (true)
-        // glm::dot(tileOrigin, playerDirection) > 0 && glm::dot(tileXP, playerDirection) > 0 &&
-        // glm::dot(tileYP, playerDirection) > 0 && glm::dot(tileXPYP, playerDirection) > 0)
+    // The heightfields are removed first, so the tile is kept until physics stops reading its heights.
+    for (const glm::ivec2& heightmapPos : loadedHeightmaps.GetPositions())
     {
-        glm::mat4 mvMatrix = glm::translate(glm::mat4(), glm::vec3((float)(tilePos.x * TerrainTile::SubtileSize), (float)(tilePos.y * TerrainTile::SubtileSize), 0));
-        terrainManager->RenderTile(pos, tilePos - (pos * TerrainTile::Subdivisions), perspectiveMatrix, viewMatrix, mvMatrix);
+        btRigidBody* heightmap = loadedHeightmaps.Get(heightmapPos);
+        physics->RemoveBody(heightmap);
+        physics->DeleteBody(heightmap, true);
     }
-}
 
-void Region::CleanupRegion(TerrainManager* terrainManager, Physics* physics)
-{
-    terrainManager->UnloadTerrainTile(pos);
-    for (std::pair<const glm::ivec2, btRigidBody*> heightmap : loadedHeightmaps)
+    // Nothing will read the deformed heights once the tile is gone, so pending copies into them are dropped.
+    for (const glm::ivec2& subtilePos : regionTile->subtiles.GetPositions())
     {
-        physics->RemoveBody(heightmap.second);
-        physics->DeleteBody(heightmap.second, true);
+        SubTile* subtile = regionTile->subtiles.Get(subtilePos);
+        if (subtile->IsDeformed())
+        {
+            physics->CancelHeightfieldUpdates(&subtile->deformedPhysicsHeightmap[0]);
+        }
     }
+
+    terrainManager->UnloadTerrainTile(pos);
 }
 
 Region::~Region()
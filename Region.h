@@ -4,6 +4,7 @@
 #include <Bullet\BulletCollision\CollisionShapes\btHeightfieldTerrainShape.h>
 #include <glm\vec3.hpp>
 #include "Data\TerrainTile.h"
+#include "Data\TileGrid.h"
 #include "Managers\TerrainManager.h"
 #include "Physics.h"
 
@@ -13,21 +14,51 @@ class Region
     glm::ivec2 pos;
 
     TerrainTile* regionTile;
-    std::map<glm::ivec2, btRigidBody*, iVec2Comparer> loadedHeightmaps;
+    TileGrid<btRigidBody*> loadedHeightmaps;
 
     btRigidBody* CreateHeightmap(glm::ivec2 tilePos, SubTile *subTile, Physics* physics);
      
 public:
-    Region(glm::ivec2 pos,  TerrainManager* terrainManager);
+    // Creates the collision shape of a subtile from its bordered 16-bit heightmap, which must outlive the shape. Not offset to the subtile's position.
+    static btHeightfieldTerrainShape* CreateHeightfieldShape(const short* heightmap);
+
+    // Creates a region, streaming in its terrain tile in the background. See TerrainManager::RequestTerrainTile for the priority.
+    Region(glm::ivec2 pos, TerrainManager* terrainManager, float priority);
     glm::ivec2 GetPos() const;
 
-    void EnsureHeightmapsLoaded(Physics* physics, const std::vector<glm::ivec2>* tilesToLoadHeightmapsFor);
+    // Blocks until the region's terrain tile is fully loaded.
+    void EnsureTileLoaded(TerrainManager* terrainManager);
+    bool IsTileLoaded() const;
+
+    // Creates the physics heightmap of a tile if it doesn't have one. Returns false if the tile hasn't streamed in yet.
+    bool EnsureHeightmapLoaded(Physics* physics, const glm::ivec2 tilePos);
+    void RemoveHeightmap(Physics* physics, const glm::ivec2 tilePos);
+
+    // Queues copying the deformed heights of a tile into the heights its physics heightfield reads. A heightfield still reading the terrain pack is replaced.
+    //  Returns false if the tile isn't deformed.
+    bool UpdateDeformedHeightmap(Physics* physics, const glm::ivec2 tilePos, const HeightmapRect& deformedRect, bool* replacedHeightfield);
+
+    // Creates the textures and effects of a visible tile. Returns false if the tile hasn't streamed in yet.
+    bool ActivateSubtile(TerrainManager* terrainManager, const glm::ivec2 tilePos);
+    bool IsSubtileLoaded(const glm::ivec2 tilePos) const;
+
+    // Gets the height range of a tile, in real units. Returns false if the tile hasn't streamed in yet.
+    bool GetSubtileHeightRange(const glm::ivec2 tilePos, float* minHeight, float* maxHeight) const;
+
+    // Releases the GPU resources of a tile that left the view.
+    void DeactivateSubtile(TerrainManager* terrainManager, const glm::ivec2 tilePos);
+
+    // Adds the memory used by the region's tile, effects, and heightmaps.
+    void AddMemoryUsage(const TerrainManager* terrainManager, TerrainMemoryUsage* memoryUsage) const;
+
+    // Returns the data of a tile, or nullptr if it hasn't streamed in yet.
+    const SubTile* GetSubtile(const glm::ivec2 tilePos) const;
 
-    float GetPointHeight(const glm::ivec2 tilePos, const glm::ivec2 fullPos) const;
-    int GetPointType(const glm::ivec2 tilePos, const glm::ivec2 fullPos) const;
+    // Queues the tile's effects to be simulated with the rest of the visible terrain.
+    void QueueSimulation(TerrainManager* terrainManager, glm::ivec2 tilePos);
 
-    void Simulate(TerrainManager* terrainManager, glm::ivec2 tilePos, float elapsedSeconds);
-    void RenderRegion(glm::ivec2 tilePos, const glm::vec3& playerPosition, const glm::vec2& playerDirection, TerrainManager* terrainManager, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix) const;
+    // Queues the tile to be drawn with the rest of the visible terrain.
+    void RenderRegion(glm::ivec2 tilePos, TerrainManager* terrainManager) const;
 
     void CleanupRegion(TerrainManager* terrainManager, Physics* physics);
     virtual ~Region();
@@ -1,7 +1,8 @@
 #include <glm\gtc\matrix_transform.hpp>
-#include <glm\gtc\random.hpp>
 #include <SFML\System.hpp>
+#include <type_traits>
 #include "Config\PhysicsConfig.h"
+#include "Data\SubtileLayout.h"
 #include "Generators\BuildingGenerator.h"
 #include "Generators\ColorGenerator.h"
 #include "Generators\PhysicsGenerator.h"
@@ -12,6 +13,9 @@
 
 CityStats CityEffect::stats = CityStats();
 
+// The building collision callbacks point into the buildings, which only stay put if the effect pool moves (rather than copies) the effects.
+static_assert(std::is_nothrow_move_constructible<CityEffectData>::value, "City effects must be movable without copying their buildings.");
+
 CityEffect::CityEffect(ModelManager* modelManager, Physics* physics, const std::string& cacheFolder)
     : modelManager(modelManager), physics(physics) // TODO use the cache to avoid regenerating buildings.
 {
@@ -23,111 +27,60 @@ bool CityEffect::LoadBasics(ShaderFactory* shaderManager)
     return true;
 }
 
-bool CityEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile)
+bool CityEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, CityEffectData* cityEffect)
 {
+    // TODO configurable
+    int minRegionSize = 11;
+
+    // Too few city pixels to form a single region.
+    if (tile->typeIndex.GetPixelCount(TerrainTypes::CITY) < minRegionSize * minRegionSize)
+    {
+        return false;
+    }
+
     BuildingGenerator buildingGenerator(modelManager, physics);
 
     // V1: Placed in square regions according to the size of the building generated.
     std::vector<std::tuple<int, int, int>> squareRegionsFound;
 
-    bool* checkedTiles = new bool[TerrainTile::SubtileSize * TerrainTile::SubtileSize];
-    for (int i = 0; i < TerrainTile::SubtileSize * TerrainTile::SubtileSize; i++)
+    RowMajorLayout layout(TerrainTile::SubtileSize);
+    bool* checkedTiles = new bool[layout.GetStorageSize()];
+    for (int i = 0; i < layout.GetStorageSize(); i++)
     {
         checkedTiles[i] = false;
     }
 
-    // TODO configurable
-    int minRegionSize = 11;
-
-    // Scan the image for city pixels, forming valid square regions to put buildings within.
-    for (int i = 0; i < TerrainTile::SubtileSize; i++)
+    // Visit the city pixels, forming valid square regions to put buildings within.
+    tile->typeIndex.ForEachPixel(tile->packedTypes, TerrainTypes::CITY, [&](int i, int j)
     {
-        for (int j = 0; j < TerrainTile::SubtileSize; j++)
+        if (checkedTiles[layout.GetIndex(i, j)])
         {
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::CITY && !checkedTiles[pixelId])
-            {
-                // This is a new square region. Add it to the regions found.
-                checkedTiles[pixelId] = true;
-                int regionSize = 1;
-
-                bool endOfRegion = false;
-                auto isInBounds = [&]() { return (i + regionSize < TerrainTile::SubtileSize && j + regionSize < TerrainTile::SubtileSize); };
-                while (!endOfRegion && isInBounds())
-                {
-                    // Check horizontal. Also go one additional pixel to get the corner pixel.
-                    for (int m = i; m < i + regionSize; m++)
-                    {
-                        int posId = tile->GetPixelId(glm::ivec2(m, (j + regionSize)));
-                        if (tile->type[posId] != TerrainTypes::CITY || checkedTiles[posId])
-                        {
-                            endOfRegion = true;
-                            break;
-                        }
-                    }
-
-                    if (!endOfRegion)
-                    {
-                        // Check vertical.
-                        for (int m = j; m < j + regionSize - 1; m++)
-                        {
-                            int posId = tile->GetPixelId(glm::ivec2((i + regionSize), m));
-                            if (tile->type[posId] != TerrainTypes::CITY || checkedTiles[posId])
-                            {
-                                endOfRegion = true;
-                                break;
-                            }
-                        }
-                    }
-
-                    if (!endOfRegion)
-                    {
-                        // We now can add both areas we just scanned onto the checked tiles list.
-                        for (int m = i; m < i + regionSize; m++)
-                        {
-                            checkedTiles[tile->GetPixelId(glm::ivec2(m, (j + regionSize)))] = true;
-                        }
-
-                        for (int m = j; m < j + regionSize - 1; m++)
-                        {
-                            checkedTiles[tile->GetPixelId(glm::ivec2((i + regionSize), m))] = true;
-                        }
-
-                        // Our region size includes the existing pixel, but in our calculations above it included an additional horizontal and vertical
-                        //  column. We can therefore add an additional row and continue searching for the end of the city region.
-                        ++regionSize;
-                    }
-                }
+            return;
+        }
 
-                // Add the valid region.
-                if (regionSize >= minRegionSize)
-                {
-                    squareRegionsFound.push_back(std::tuple<int, int, int>(i, j, regionSize));
-                }
-            }
+        // This is a new square region. Add it to the regions found.
+        int regionSize = GrowSquareRegion(layout, tile->packedTypes, i, j, checkedTiles);
+        if (regionSize >= minRegionSize)
+        {
+            squareRegionsFound.push_back(std::tuple<int, int, int>(i, j, regionSize));
         }
-    }
+    });
 
     delete[] checkedTiles;
 
-    if (squareRegionsFound.size() != 0)
+    // TODO configurable
+    // Add a building to all regions found with at least a size of '5' (building size), stuck in the middle.
+    if (squareRegionsFound.empty())
     {
-        Logger::Log("Found ", squareRegionsFound.size(), " regions to put a city building within.");
+        return false;
     }
 
-    // TODO configurable
-    // Add a building to all regions found with at least a size of '5' (building size), stuck in the middle.
-    bool hasCityEffect = false;
-    CityEffectData* cityEffect = nullptr;
+    EffectRandom random(subtileId, EffectRandom::CITY);
+    cityEffect->isHighDensity = random.Float() > 0.75f; // TODO configurable.
+    cityEffect->regionsFound = (int)squareRegionsFound.size();
+    cityEffect->isAtBuildingLimit = false;
     for (auto iter = squareRegionsFound.cbegin(); iter != squareRegionsFound.cend(); iter++)
     {
-        if (!hasCityEffect)
-        {
-            hasCityEffect = true;
-            cityEffect = new CityEffectData();
-            cityEffect->isHighDensity = glm::linearRand(0.0f, 1.0f) > 0.75f; // TODO configurable.
-        }
-
         int buildingXPos = std::get<0>(*iter);
         int buildingYPos = std::get<1>(*iter);
         int regionSize = std::get<2>(*iter);
@@ -140,14 +93,14 @@ bool CityEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* ti
 
                 // Get a building.
                 float buildingFootprintSize, buildingHeight;
-                float height = tile->heightmap[buildingXPos + buildingYPos * TerrainTile::SubtileSize];// -0.50f; // Ground inset, TODO configurable.
+                float height = tile->GetHeight(glm::ivec2(buildingXPos, buildingYPos));// -0.50f; // Ground inset, TODO configurable.
                 glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(xPos, yPos));
                 glm::vec3 offset((float)realPos.x, (float)realPos.y, height);
                 Building building;
                 building.segments = cityEffect->isHighDensity ? 
-                    buildingGenerator.GetRandomHighDensityBuilding(offset, &buildingFootprintSize, &buildingHeight) :
-                    buildingGenerator.GetRandomLowDensityBuilding(offset, &buildingFootprintSize, &buildingHeight);
-                building.color = ColorGenerator::GetBuildingColor();
+                    buildingGenerator.GetRandomHighDensityBuilding(&random, offset, &buildingFootprintSize, &buildingHeight) :
+                    buildingGenerator.GetRandomLowDensityBuilding(&random, offset, &buildingFootprintSize, &buildingHeight);
+                building.color = ColorGenerator::GetBuildingColor(&random);
                 for (unsigned int i = 0; i < building.segments.size(); i++)
                 {
                     building.segments[i].color = building.color;
@@ -161,13 +114,6 @@ bool CityEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* ti
                 btRigidBody* analysisBody = PhysicsGenerator::GetGhostObject(collisionShape, PhysicsOps::Convert(offset + glm::vec3(0, 0, buildingHeight / 2.0f)));
                 analysisBody->setActivationState(ISLAND_SLEEPING);
 
-                BuildingCollisionCallbackData* collisionData = new BuildingCollisionCallbackData();
-                collisionData->effect = cityEffect;
-                collisionData->buildingId = cityEffect->buildings.size();
-
-                analysisBody->setUserPointer(new TypedCallback<UserPhysics::ObjectType>(UserPhysics::ObjectType::BUILDING_COVER, this, collisionData, true));
-                physics->AddBody(analysisBody);
-
                 for (unsigned int i = 0; i < building.segments.size(); i++)
                 {
                     building.segments[i].analysisBody = analysisBody;
@@ -177,26 +123,50 @@ bool CityEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* ti
                 if (cityEffect->buildings.size() == 50)
                 {
                     // Too many buildings!
-                    Logger::Log("Hit building limit at tile [", subtileId.x, " ", subtileId.y, "].");
+                    cityEffect->isAtBuildingLimit = true;
                     break;
                 }
             }
         }
     }
 
-    if (hasCityEffect)
+    return true;
+}
+
+void CityEffect::UploadEffect(CityEffectData* cityEffect)
+{
+    // Buildings start whole, so only the body covering each building is simulated.
+    //  The effect doesn't move once it's uploaded, so the collision callbacks can refer to its buildings.
+    for (Building& building : cityEffect->buildings)
     {
-        Logger::Log("Loaded ", cityEffect->buildings.size(), " randomly-generated buildings in the city areas.");
-        *effectData = cityEffect;
+        BuildingCollisionCallbackData* collisionData = new BuildingCollisionCallbackData();
+        collisionData->building = &building;
+
+        building.segments[0].analysisBody->setUserPointer(new TypedCallback<UserPhysics::ObjectType>(UserPhysics::ObjectType::BUILDING_COVER, this, collisionData, true));
+        physics->AddBody(building.segments[0].analysisBody);
     }
 
-    return hasCityEffect;
+    stats.tilesLoaded++;
+    stats.regionsFound += cityEffect->regionsFound;
+    stats.buildingsLoaded += (long)cityEffect->buildings.size();
+    stats.tilesAtBuildingLimit += cityEffect->isAtBuildingLimit ? 1 : 0;
 }
 
-void CityEffect::UnloadEffect(void* effectData)
+void CityEffect::DiscardEffect(CityEffectData* cityEffect)
+{
+    // The bodies were never added to the physics world, so they only need deleting.
+    for (const Building& building : cityEffect->buildings)
+    {
+        physics->DeleteBody(building.segments[0].analysisBody, true);
+        for (const Model& segment : building.segments)
+        {
+            physics->DeleteBody(segment.body, true);
+        }
+    }
+}
+
+void CityEffect::UnloadEffect(CityEffectData* cityEffect)
 {
-    CityEffectData* cityEffect = (CityEffectData*)effectData;
-    
     // Remove the physics bodies and custom collision shapes.
     for (unsigned int i = 0; i < cityEffect->buildings.size(); i++)
     {
@@ -215,19 +185,49 @@ void CityEffect::UnloadEffect(void* effectData)
             physics->DeleteBody(cityEffect->buildings[i].segments[j].body, true);
         }
     }
+}
+
+size_t CityEffect::GetMemoryUsage(const CityEffectData& cityEffect) const
+{
+    // Buildings that haven't been interacted with also have a body for the whole building.
+    size_t bytes = 0;
+    for (const Building& building : cityEffect.buildings)
+    {
+        bytes += sizeof(Building) + building.segments.size() * (sizeof(Model) + Model::PhysicsBodySize);
+        if (!building.separated)
+        {
+            bytes += Model::PhysicsBodySize;
+        }
+    }
+
+    return bytes;
+}
+
+unsigned int CityEffect::GetPlacementChecksum(const CityEffectData& cityEffect) const
+{
+    unsigned int checksum = AddToChecksum(ChecksumBasis, cityEffect.isHighDensity);
+    for (const Building& building : cityEffect.buildings)
+    {
+        checksum = AddToChecksum(checksum, building.color);
+        for (const Model& segment : building.segments)
+        {
+            checksum = AddToChecksum(checksum, segment.modelId);
+            checksum = AddToChecksum(checksum, segment.scaleFactor);
+            checksum = AddToChecksum(checksum, PhysicsGenerator::GetBodyPosition(segment.body));
+        }
+    }
 
-    delete cityEffect;
+    return checksum;
 }
 
-void CityEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds)
+void CityEffect::Simulate(const glm::ivec2 subtileId, CityEffectData* cityEffect, float elapsedSeconds)
 {
 }
 
-void CityEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void CityEffect::Render(CityEffectData* cityEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
 {
     sf::Clock clock;
     glm::mat4 projectionMatrix = perspectiveMatrix * viewMatrix;
-    CityEffectData* cityEffect = (CityEffectData*)effectData;
     for (Building& building : cityEffect->buildings)
     {
         stats.segmentsRendered += building.segments.size();
@@ -244,20 +244,22 @@ void CityEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, co
 void CityEffect::LogStats()
 {
     Logger::Log("City Rendering: ", stats.usRenderTime, " us, ", stats.segmentsRendered, " segments, ", stats.tilesRendered, " tiles.");
+    Logger::Log("City Loading: ", stats.buildingsLoaded, " buildings in ", stats.regionsFound, " regions of ", stats.tilesLoaded, " tiles, ",
+        stats.tilesAtBuildingLimit, " tiles at the building limit.");
     stats.Reset();
 }
 
 void CityEffect::Callback(UserPhysics::ObjectType collidingObject, void* callbackSpecificData)
 {
     BuildingCollisionCallbackData* callbackData = (BuildingCollisionCallbackData*)callbackSpecificData;
-    if (callbackData->effect->buildings[callbackData->buildingId].separated)
+    if (callbackData->building->separated)
     {
         // This building has already been separated and has been called by multiple objects at once.
         return;
     }
 
     // Doesn't matter what we collided with, this building is being split into segments now.
-    auto& segments = callbackData->effect->buildings[callbackData->buildingId].segments;
+    auto& segments = callbackData->building->segments;
 
     physics->RemoveBody(segments[0].analysisBody);
     physics->DeleteBody(segments[0].analysisBody, true);
@@ -269,5 +271,5 @@ void CityEffect::Callback(UserPhysics::ObjectType collidingObject, void* callbac
         physics->AddBody(segments[i].body);
     }
 
-    callbackData->effect->buildings[callbackData->buildingId].separated = true;
+    callbackData->building->separated = true;
 }
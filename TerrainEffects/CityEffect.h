@@ -1,11 +1,12 @@
 #pragma once
 #include <vector>
+#include "Data\TerrainTypes.h"
 #include "Data\Model.h"
 #include "Data\UserPhysics.h"
 #include "Managers\ModelManager.h"
 #include "Utils\TypedCallback.h"
 #include "Physics.h"
-#include "TerrainEffect.h"
+#include "PooledTerrainEffect.h"
 
 struct Building
 {
@@ -18,12 +19,15 @@ struct CityEffectData
 {
     std::vector<Building> buildings;
     bool isHighDensity;
+
+    // Only used for logging, once the effect is uploaded.
+    int regionsFound;
+    bool isAtBuildingLimit;
 };
 
 struct BuildingCollisionCallbackData
 {
-    CityEffectData* effect;
-    int buildingId;
+    Building* building;
 };
 
 struct CityStats
@@ -33,6 +37,12 @@ struct CityStats
     long tilesRendered;
     long usRenderTime;
 
+    // Counted as effects are uploaded, as they're built on the build threads.
+    long tilesLoaded;
+    long regionsFound;
+    long buildingsLoaded;
+    long tilesAtBuildingLimit;
+
     CityStats()
     {
         Reset();
@@ -44,10 +54,15 @@ struct CityStats
         tilesRendered = 0;
 
         usRenderTime = 0;
+
+        tilesLoaded = 0;
+        regionsFound = 0;
+        buildingsLoaded = 0;
+        tilesAtBuildingLimit = 0;
     }
 };
 
-class CityEffect : public TerrainEffect, ICallback<UserPhysics::ObjectType>
+class CityEffect : public PooledTerrainEffect<CityEffectData>, ICallback<UserPhysics::ObjectType>
 {
     ModelManager* modelManager;
     Physics* physics;
@@ -56,11 +71,63 @@ class CityEffect : public TerrainEffect, ICallback<UserPhysics::ObjectType>
 
 public:
     CityEffect(ModelManager* modelManager, Physics* physics, const std::string& cacheFolder);
+
+    // Grows a square region of city pixels down and to the right of an unchecked city pixel, marking the pixels it covers as checked. Returns the size of the region.
+    //  The checked pixels are in the same layout as the types.
+    template <typename Layout>
+    static int GrowSquareRegion(const Layout& layout, const unsigned char* packedTypes, int x, int y, bool* checkedPixels)
+    {
+        checkedPixels[layout.GetIndex(x, y)] = true;
+        int regionSize = 1;
+        while (x + regionSize < layout.GetSize() && y + regionSize < layout.GetSize())
+        {
+            // Check horizontal, then vertical.
+            bool endOfRegion = false;
+            int rowStart = layout.GetIndex(x, y + regionSize);
+            int columnStart = layout.GetIndex(x + regionSize, y);
+            for (int m = 0, index = rowStart; m < regionSize && !endOfRegion; m++, index = layout.GetRight(index))
+            {
+                endOfRegion = TerrainTypes::GetPackedType(packedTypes, index) != TerrainTypes::CITY || checkedPixels[index];
+            }
+
+            for (int m = 0, index = columnStart; m < regionSize - 1 && !endOfRegion; m++, index = layout.GetDown(index))
+            {
+                endOfRegion = TerrainTypes::GetPackedType(packedTypes, index) != TerrainTypes::CITY || checkedPixels[index];
+            }
+
+            if (endOfRegion)
+            {
+                break;
+            }
+
+            // We now can add both areas we just scanned onto the checked tiles list.
+            for (int m = 0, index = rowStart; m < regionSize; m++, index = layout.GetRight(index))
+            {
+                checkedPixels[index] = true;
+            }
+
+            for (int m = 0, index = columnStart; m < regionSize - 1; m++, index = layout.GetDown(index))
+            {
+                checkedPixels[index] = true;
+            }
+
+            // Our region size includes the existing pixel, but in our calculations above it included an additional horizontal and vertical
+            //  column. We can therefore add an additional row and continue searching for the end of the city region.
+            ++regionSize;
+        }
+
+        return regionSize;
+    }
+
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile * tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, CityEffectData* cityEffect) override;
+    virtual void UploadEffect(CityEffectData* cityEffect) override;
+    virtual void DiscardEffect(CityEffectData* cityEffect) override;
+    virtual void UnloadEffect(CityEffectData* cityEffect) override;
+    virtual size_t GetMemoryUsage(const CityEffectData& cityEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const CityEffectData& cityEffect) const override;
+    virtual void Simulate(const glm::ivec2 subtileId, CityEffectData* cityEffect, float elapsedSeconds) override;
+    virtual void Render(CityEffectData* cityEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
 
     // Handles building collisions.
     virtual void Callback(UserPhysics::ObjectType callingObject, void* callbackSpecificData) override;
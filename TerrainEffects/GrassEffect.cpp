@@ -1,144 +1,172 @@
-#include <glm\mat4x4.hpp>
-#include <glm\gtc\random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <glm\gtc\matrix_transform.hpp>
 #include <SFML\System.hpp>
+#include "Config\TerrainConfig.h"
 #include "logging\Logger.h"
+#include "Math\EffectRandom.h"
 #include "GrassEffect.h"
 
 GrassStats GrassEffect::stats = GrassStats();
 
-GrassEffect::GrassEffect()
+GrassEffect::GrassEffect(const TerrainTexturePool* texturePool)
+    : programId(0), vao(0), texturePool(texturePool), windTime(0.0f), cameraPosition(0.0f)
 {
 }
 
 bool GrassEffect::LoadBasics(ShaderFactory* shaderManager)
 {
     // Load our shader program to custom-render grass.
-    if (!shaderManager->CreateShaderProgramWithGeometryShader("grassRender", &programId))
+    if (!shaderManager->CreateShaderProgram("grassRender", &programId))
     {
         Logger::LogError("Failed to load the basic grass rendering shader; cannot continue.");
         return false;
     }
 
     projMatrixLocation = glGetUniformLocation(programId, "projMatrix");
-    mvMatrixLocation = glGetUniformLocation(programId, "mvMatrix");
-
+    viewMatrixLocation = glGetUniformLocation(programId, "viewMatrix");
+    terrainTextureLocation = glGetUniformLocation(programId, "terrainTexture");
+    terrainTypeLocation = glGetUniformLocation(programId, "terrainType");
+    subtileOriginLocation = glGetUniformLocation(programId, "subtileOrigin");
+    subtileLayerLocation = glGetUniformLocation(programId, "subtileLayer");
+    seedLocation = glGetUniformLocation(programId, "seed");
+    cameraPositionLocation = glGetUniformLocation(programId, "cameraPosition");
+    fullDensityDistanceLocation = glGetUniformLocation(programId, "fullDensityDistance");
+    maxDistanceLocation = glGetUniformLocation(programId, "maxDistance");
+    windTimeLocation = glGetUniformLocation(programId, "windTime");
+
+    glGenVertexArrays(1, &vao);
     return true;
 }
 
-bool GrassEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile)
+float GrassEffect::GetDensity(float distance)
 {
-    bool hasGrassEffect = false;
-    GrassEffectData* grassEffect = nullptr;
+    // Must match the grass shader.
+    float fade = (distance - TerrainConfig::GrassFullDensityDistance) / std::max(TerrainConfig::GrassMaxDistance - TerrainConfig::GrassFullDensityDistance, 1.0f);
+    return 1.0f - std::min(std::max(fade, 0.0f), 1.0f);
+}
 
-    // Scan the image for grass pixels.
-    for (int i = 0; i < TerrainTile::SubtileSize; i++)
+bool GrassEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, GrassEffectData* grassEffect)
+{
+    int grassPixels = tile->typeIndex.GetPixelCount(TerrainTypes::GRASSLAND);
+    if (grassPixels == 0)
     {
-        for (int j = 0; j < TerrainTile::SubtileSize; j++)
-        {
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::GRASSLAND)
-            {
-                if (!hasGrassEffect)
-                {
-                    grassEffect = new GrassEffectData();
-                    hasGrassEffect = true;
-                }
-                
-                float height = tile->heightmap[pixelId];
-                
-                // TODO configurable
-                glm::vec3 bottomColor = glm::vec3(0.0f, 0.90f + glm::linearRand(0.0f, 0.10f), 0.0f);
-                glm::vec3 topColor = glm::vec3(0.0f, 0.50f + glm::linearRand(0.0f, 0.30f), 0.20f + glm::linearRand(0.0f, 0.60f));
-                glm::vec3 bottomPos = glm::vec3((float)i + glm::linearRand(-0.5f, 0.5f), (float)j + glm::linearRand(-0.5f, 0.5f), height);
-                glm::vec3 topPos = bottomPos + glm::vec3(glm::linearRand(-0.10f, 0.10f), glm::linearRand(-0.10f, 0.10f), 0.15f + 0.50f * glm::linearRand(0.0f, 1.0f));
-
-                // Add grass
-                glm::vec3 lowerOffset = glm::vec3(0.0f);
-                glm::vec3 upperOffset = glm::vec3(0.0f);
-                grassEffect->grassOffsets.push_back(lowerOffset);
-                grassEffect->grassOffsets.push_back(upperOffset);
-
-                grassEffect->grassStalks.positions.push_back(bottomPos + lowerOffset);
-                grassEffect->grassStalks.positions.push_back(topPos + upperOffset);
-                grassEffect->grassStalks.colors.push_back(bottomColor);
-                grassEffect->grassStalks.colors.push_back(topColor);
-                grassEffect->grassStalks.ids.push_back(grassEffect->grassStalks.positions.size() - 1); // Starts at 1
-                grassEffect->grassStalks.ids.push_back(grassEffect->grassStalks.positions.size());
-            }
-        }
+        return false;
     }
 
-    if (hasGrassEffect)
-    {
-        // Grass vertex data.
-        glGenVertexArrays(1, &grassEffect->vao);
-        glBindVertexArray(grassEffect->vao);
-        glGenBuffers(1, &grassEffect->positionBuffer);
-        glGenBuffers(1, &grassEffect->colorBuffer);
-
-        Logger::Log("Parsed ", grassEffect->grassStalks.positions.size() / 2, " grass stalks.");
-        grassEffect->grassStalks.TransferStaticPositionToOpenGl(grassEffect->positionBuffer);
-        grassEffect->grassStalks.TransferStaticColorToOpenGl(grassEffect->colorBuffer);
-        *effectData = grassEffect;
-    }
+    // The blades themselves are only generated when drawn.
+    EffectRandom random(subtileId, EffectRandom::GRASS);
+    grassEffect->tile = tile;
+    grassEffect->seed = random.Next();
+    grassEffect->grassPixels = grassPixels;
+    return true;
+}
 
-    return hasGrassEffect;
+void GrassEffect::UploadEffect(GrassEffectData* grassEffect)
+{
+    // The grass is drawn straight from the terrain texture pool.
 }
 
-void GrassEffect::UnloadEffect(void* effectData)
+void GrassEffect::DiscardEffect(GrassEffectData* grassEffect)
 {
-    GrassEffectData* grassEffect = (GrassEffectData*)effectData;
-    glDeleteVertexArrays(1, &grassEffect->vao);
-    glDeleteBuffers(1, &grassEffect->positionBuffer);
-    glDeleteBuffers(1, &grassEffect->colorBuffer);
-    delete grassEffect;
 }
 
-void GrassEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds)
+void GrassEffect::UnloadEffect(GrassEffectData* grassEffect)
 {
-    // This is still too slow. I need to randomly update not only specific elements, but specific grass segments per subtile.
-    // Don't update all the grass at once, that's too slow. Just move a few elements.
-    /*int minimizationFactor = 5 + (int)(MathOps::Rand() * 10);
-    for (int i = 0; i < effectData[start]->grassEffect.grassOffsets.size() / 2; i++)
-    {
-    if (i % minimizationFactor == 0)
-    {
-    glm::vec3 upperOffset = glm::vec3(MathOps::Rand(), MathOps::Rand(), 0.0f);
-    effectData[start]->grassEffect.grassStalks.positions[i * 2 + 1] =
-    (effectData[start]->grassEffect.grassStalks.positions[i * 2 + 1]
-    - effectData[start]->grassEffect.grassOffsets[i * 2 + 1]) + upperOffset;
-    effectData[start]->grassEffect.grassOffsets[i * 2 + 1] = upperOffset;
-    }
-    }
+}
+
+size_t GrassEffect::GetMemoryUsage(const GrassEffectData& grassEffect) const
+{
+    return 0;
+}
+
+unsigned int GrassEffect::GetPlacementChecksum(const GrassEffectData& grassEffect) const
+{
+    // The shader places the blades from the seed and the terrain.
+    unsigned int checksum = AddToChecksum(ChecksumBasis, grassEffect.seed);
+    return AddToChecksum(checksum, grassEffect.grassPixels);
+}
+
+int GrassEffect::SimulateEffects(const std::vector<long>& slotPasses, long pass, float elapsedSeconds)
+{
+    windTime += elapsedSeconds;
+    return PooledTerrainEffect<GrassEffectData>::SimulateEffects(slotPasses, pass, elapsedSeconds);
+}
 
-    // Modify the grass image to result in a slight waviness of the grass.
-    glBindVertexArray(effectData[start]->grassEffect.vao);
-    effectData[start]->grassEffect.grassStalks.TransferPositionToOpenGl(effectData[start]->grassEffect.positionBuffer);*/
+void GrassEffect::Simulate(const glm::ivec2 subtileId, GrassEffectData* grassEffect, float elapsedSeconds)
+{
 }
 
-void GrassEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+int GrassEffect::RenderEffects(const std::vector<long>& slotPasses, long pass, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix)
 {
     sf::Clock clock;
-    GrassEffectData* grassEffect = (GrassEffectData*)effectData;
+    cameraPosition = glm::vec3(glm::inverse(viewMatrix)[3]);
 
-    glLineWidth(3.0f);
     glUseProgram(programId);
-    glBindVertexArray(grassEffect->vao);
+    glBindVertexArray(vao);
 
-    glm::mat4 viewModelMatrix = viewMatrix * modelMatrix;
-    glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE, &perspectiveMatrix[0][0]);
-    glUniformMatrix4fv(mvMatrixLocation, 1, GL_FALSE, &viewModelMatrix[0][0]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texturePool->GetHeightmapTextureId());
+    glUniform1i(terrainTextureLocation, 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texturePool->GetTypeTextureId());
+    glUniform1i(terrainTypeLocation, 1);
 
-    glDrawArrays(GL_LINES, 0, grassEffect->grassStalks.positions.size());
-    glLineWidth(1.0f);
+    glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE, &perspectiveMatrix[0][0]);
+    glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, &viewMatrix[0][0]);
+    glUniform3f(cameraPositionLocation, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    glUniform1f(fullDensityDistanceLocation, TerrainConfig::GrassFullDensityDistance);
+    glUniform1f(maxDistanceLocation, TerrainConfig::GrassMaxDistance);
+    glUniform1f(windTimeLocation, windTime);
 
+    int rendered = PooledTerrainEffect<GrassEffectData>::RenderEffects(slotPasses, pass, perspectiveMatrix, viewMatrix);
     stats.usRenderTime += clock.getElapsedTime().asMicroseconds();
-    stats.stalksRendered += grassEffect->grassStalks.positions.size();
+    return rendered;
+}
+
+void GrassEffect::Render(GrassEffectData* grassEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+{
+    if (!grassEffect->tile->textureSlot.IsValid())
+    {
+        return;
+    }
+
+    // Blades are drawn in a shuffled order, so drawing only the first few thins the grass evenly. Enough are drawn for the nearest point of the subtile.
+    glm::vec2 origin = glm::vec2(modelMatrix[3].x, modelMatrix[3].y);
+    glm::vec2 nearestPoint = glm::vec2(
+        std::min(std::max(cameraPosition.x, origin.x), origin.x + (float)TerrainTile::SubtileSize),
+        std::min(std::max(cameraPosition.y, origin.y), origin.y + (float)TerrainTile::SubtileSize));
+    float density = GetDensity(glm::length(glm::vec2(cameraPosition.x, cameraPosition.y) - nearestPoint));
+    int blades = (int)std::ceil(density * (float)(TerrainTile::SubtileSize * TerrainTile::SubtileSize));
+    if (blades == 0)
+    {
+        return;
+    }
+
+    glUniform2f(subtileOriginLocation, origin.x, origin.y);
+    glUniform1i(subtileLayerLocation, grassEffect->tile->textureSlot.slot);
+    glUniform1ui(seedLocation, grassEffect->seed);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 3, blades);
+
+    // Not every blade drawn is on grassland, so this counts the blades that could be.
+    stats.bladesRendered += (long)(density * (float)grassEffect->grassPixels);
     stats.tilesRendered++;
+    stats.grassPixelsRendered += grassEffect->grassPixels;
 }
 
 void GrassEffect::LogStats()
 {
-    Logger::Log("Grass Rendering: ", stats.usRenderTime, " us, ", stats.stalksRendered, " stalks, ", stats.tilesRendered, " tiles.");
+    long cpuBuiltBytesPerSubtile = stats.tilesRendered == 0 ? 0 : stats.grassPixelsRendered * CpuBuiltBytesPerBlade / stats.tilesRendered;
+    Logger::Log("Grass Rendering: ", stats.usRenderTime, " us, ~", stats.bladesRendered, " blades, ", stats.tilesRendered, " tiles, ", sizeof(GrassEffectData),
+        " bytes per subtile, instead of ~", cpuBuiltBytesPerSubtile, " bytes of CPU-built blades.");
     stats.Reset();
 }
+
+GrassEffect::~GrassEffect()
+{
+    if (vao != 0)
+    {
+        glDeleteVertexArrays(1, &vao);
+    }
+}
@@ -1,22 +1,29 @@
 #pragma once
-#include "Utils\Vertex.h"
-#include "TerrainEffect.h"
+#include "Managers\TerrainTexturePool.h"
+#include "PooledTerrainEffect.h"
 
+// Grass blades are generated by the grass shader from the terrain textures of the subtile, so only what's needed to find them is kept here.
 struct GrassEffectData
 {
-    GLuint vao;
-    GLuint positionBuffer;
-    GLuint colorBuffer;
+    // Holds the texture pool slot the subtile is drawn from.
+    const SubTile* tile;
+
+    // Varies the blades between subtiles.
+    unsigned int seed;
+    int grassPixels;
 
-    universalVertices grassStalks;
-    std::vector<glm::vec3> grassOffsets;
+    GrassEffectData()
+        : tile(nullptr), seed(0), grassPixels(0)
+    {
+    }
 };
 
 struct GrassStats
 {
-    long stalksRendered;
+    long bladesRendered;
 
     long tilesRendered;
+    long grassPixelsRendered;
     long usRenderTime;
 
     GrassStats()
@@ -26,28 +33,66 @@ struct GrassStats
 
     void Reset()
     {
-        stalksRendered = 0;
+        bladesRendered = 0;
         tilesRendered = 0;
+        grassPixelsRendered = 0;
 
         usRenderTime = 0;
     }
 };
 
-class GrassEffect : public TerrainEffect
+// Draws a blade of grass on each grassland pixel, thinning out with distance and swaying in the wind.
+//  Each subtile is a single instanced draw without vertex data: the shader picks the pixel of each blade, reads its type and height from the terrain texture pool, and randomizes the blade from the subtile's seed.
+class GrassEffect : public PooledTerrainEffect<GrassEffectData>
 {
     GLuint programId;
 
     GLuint projMatrixLocation;
-    GLuint mvMatrixLocation;
+    GLuint viewMatrixLocation;
+    GLuint terrainTextureLocation;
+    GLuint terrainTypeLocation;
+    GLuint subtileOriginLocation;
+    GLuint subtileLayerLocation;
+    GLuint seedLocation;
+    GLuint cameraPositionLocation;
+    GLuint fullDensityDistanceLocation;
+    GLuint maxDistanceLocation;
+    GLuint windTimeLocation;
+
+    // The blades are drawn without any vertex data, but a VAO still has to be bound.
+    GLuint vao;
+
+    const TerrainTexturePool* texturePool;
 
+    // Advanced as the grass is simulated, so the wind stops when the game does.
+    float windTime;
+    glm::vec3 cameraPosition;
 
     static GrassStats stats;
+
+    // Blades used to be built on the CPU, with two positions, colors, ids and offsets each, and the positions and colors copied into OpenGL buffers.
+    static const int CpuBuiltBytesPerBlade = 2 * (3 * sizeof(glm::vec3) + sizeof(unsigned int)) + 2 * 2 * sizeof(glm::vec3);
+
+    // Returns the fraction of grass pixels with a blade at a distance from the camera.
+    static float GetDensity(float distance);
+
 public:
-    GrassEffect();
+    GrassEffect(const TerrainTexturePool* texturePool);
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile * tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, GrassEffectData* grassEffect) override;
+    virtual void UploadEffect(GrassEffectData* grassEffect) override;
+    virtual void DiscardEffect(GrassEffectData* grassEffect) override;
+    virtual void UnloadEffect(GrassEffectData* grassEffect) override;
+    virtual size_t GetMemoryUsage(const GrassEffectData& grassEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const GrassEffectData& grassEffect) const override;
+
+    // The wind is animated by the shader, so only its time is advanced.
+    virtual int SimulateEffects(const std::vector<long>& slotPasses, long pass, float elapsedSeconds) override;
+    virtual void Simulate(const glm::ivec2 subtileId, GrassEffectData* grassEffect, float elapsedSeconds) override;
+
+    // Sets up the grass shader once for all the subtiles drawn.
+    virtual int RenderEffects(const std::vector<long>& slotPasses, long pass, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix) override;
+    virtual void Render(GrassEffectData* grassEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
     virtual void LogStats() override;
-};
\ No newline at end of file
+    virtual ~GrassEffect();
+};
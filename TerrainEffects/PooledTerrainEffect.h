@@ -0,0 +1,228 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include <glm\gtc\matrix_transform.hpp>
+#include "Data\EffectPool.h"
+#include "Data\RetirementQueue.h"
+#include "TerrainEffect.h"
+
+// A terrain effect whose data is stored by value in an effect pool, so each effect only deals with its own data type.
+//  Builds are made in place in a build array, then moved into the pool when uploaded.
+template <typename T>
+class PooledTerrainEffect : public TerrainEffect
+{
+    EffectPool<T> pool;
+    RetirementQueue<T> retiredEffects;
+
+    std::vector<T> builds;
+
+    // Not a vector<bool>, as builds on different threads write neighboring elements.
+    std::vector<unsigned char> isBuilt;
+    long buildAllocations;
+
+protected:
+    // Builds the CPU data of an effect into an empty effect, returning false if the subtile doesn't have the effect. See TerrainEffect::Build.
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, T* effect) = 0;
+
+    // Creates the OpenGL resources of a built effect and adds its bodies to the physics world. The effect is in the pool, where it stays until it's retired.
+    virtual void UploadEffect(T* effect) = 0;
+
+    // Frees a built effect that was never uploaded.
+    virtual void DiscardEffect(T* effect) = 0;
+
+    // Unloads an uploaded effect.
+    virtual void UnloadEffect(T* effect) = 0;
+
+    // Returns the approximate bytes used by an effect beyond its place in the pool.
+    virtual size_t GetMemoryUsage(const T& effect) const = 0;
+
+    // Returns a checksum of the placement of everything in a built effect, such as with AddToChecksum.
+    virtual unsigned int GetPlacementChecksum(const T& effect) const = 0;
+
+    virtual void Simulate(const glm::ivec2 subtileId, T* effect, float elapsedSeconds) = 0;
+    virtual void Render(T* effect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) = 0;
+
+    // Mixes the bytes of a value into a checksum (FNV-1a), so identical placements always give identical checksums.
+    template <typename V>
+    static unsigned int AddToChecksum(unsigned int checksum, const V& value)
+    {
+        const unsigned char* bytes = (const unsigned char*)&value;
+        for (size_t i = 0; i < sizeof(V); i++)
+        {
+            checksum = (checksum ^ bytes[i]) * 16777619u;
+        }
+
+        return checksum;
+    }
+
+    template <typename V>
+    static unsigned int AddToChecksum(unsigned int checksum, const std::vector<V>& values)
+    {
+        for (const V& value : values)
+        {
+            checksum = AddToChecksum(checksum, value);
+        }
+
+        return checksum;
+    }
+
+public:
+    // The starting value of AddToChecksum.
+    static const unsigned int ChecksumBasis = 2166136261u;
+
+    PooledTerrainEffect()
+        : pool(), retiredEffects(0), builds(), isBuilt(), buildAllocations(0)
+    {
+    }
+
+    virtual void SetRetireFrames(int retireFrames) override
+    {
+        retiredEffects.SetDelayFrames(retireFrames);
+    }
+
+    virtual void PrepareBuilds(int buildCount) override
+    {
+        if ((size_t)buildCount > builds.capacity())
+        {
+            ++buildAllocations;
+        }
+
+        builds.clear();
+        builds.resize(buildCount);
+        isBuilt.assign(buildCount, 0);
+    }
+
+    virtual bool Build(int build, glm::ivec2 subtileId, const SubTile* tile) override
+    {
+        isBuilt[build] = BuildEffect(subtileId, tile, &builds[build]) ? 1 : 0;
+        return isBuilt[build] != 0;
+    }
+
+    virtual void UploadBuild(int build, glm::ivec2 subtileId, int subtileSlot) override
+    {
+        isBuilt[build] = 0;
+        UploadEffect(&pool.Add(subtileSlot, subtileId, std::move(builds[build])));
+    }
+
+    virtual void DiscardBuilds() override
+    {
+        for (unsigned int i = 0; i < builds.size(); i++)
+        {
+            if (isBuilt[i] != 0)
+            {
+                DiscardEffect(&builds[i]);
+                isBuilt[i] = 0;
+            }
+        }
+
+        builds.clear();
+    }
+
+    virtual unsigned int GetBuildChecksum(int build) const override
+    {
+        return isBuilt[build] != 0 ? GetPlacementChecksum(builds[build]) : 0;
+    }
+
+    virtual bool RetireEffect(int subtileSlot) override
+    {
+        T effect;
+        if (!pool.Remove(subtileSlot, &effect))
+        {
+            return false;
+        }
+
+        retiredEffects.Retire(std::move(effect));
+        return true;
+    }
+
+    virtual void AdvanceRetirementFrame() override
+    {
+        retiredEffects.AdvanceFrame();
+    }
+
+    virtual bool UnloadRetiredEffect() override
+    {
+        T effect;
+        if (!retiredEffects.TryPopExpired(&effect))
+        {
+            return false;
+        }
+
+        UnloadEffect(&effect);
+        return true;
+    }
+
+    virtual int GetRetiringEffectCount() const override
+    {
+        return (int)retiredEffects.Size();
+    }
+
+    virtual size_t GetSubtileMemoryUsage(int subtileSlot) const override
+    {
+        const T* effect = pool.Find(subtileSlot);
+        return effect == nullptr ? 0 : sizeof(T) + GetMemoryUsage(*effect);
+    }
+
+    virtual int SimulateEffects(const std::vector<long>& slotPasses, long pass, float elapsedSeconds) override
+    {
+        int simulated = 0;
+        for (int i = 0; i < (int)pool.Size(); i++)
+        {
+            if (slotPasses[pool.GetSlot(i)] == pass)
+            {
+                Simulate(pool.GetSubtileId(i), &pool.GetEffect(i), elapsedSeconds);
+                ++simulated;
+            }
+        }
+
+        return simulated;
+    }
+
+    virtual int RenderEffects(const std::vector<long>& slotPasses, long pass, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix) override
+    {
+        int rendered = 0;
+        for (int i = 0; i < (int)pool.Size(); i++)
+        {
+            if (slotPasses[pool.GetSlot(i)] == pass)
+            {
+                const glm::ivec2& subtileId = pool.GetSubtileId(i);
+                glm::mat4 modelMatrix = glm::translate(glm::mat4(), glm::vec3((float)(subtileId.x * TerrainTile::SubtileSize), (float)(subtileId.y * TerrainTile::SubtileSize), 0));
+                Render(&pool.GetEffect(i), perspectiveMatrix, viewMatrix, modelMatrix);
+                ++rendered;
+            }
+        }
+
+        return rendered;
+    }
+
+    virtual int GetEffectCount() const override
+    {
+        return (int)pool.Size();
+    }
+
+    virtual long GetAllocationCount() const override
+    {
+        return pool.GetAllocationCount() + buildAllocations;
+    }
+
+    virtual void UnloadAllEffects() override
+    {
+        std::vector<T> effects;
+        pool.Clear(&effects);
+
+        T effect;
+        while (retiredEffects.TryPop(&effect))
+        {
+            effects.push_back(std::move(effect));
+        }
+
+        for (T& unloadedEffect : effects)
+        {
+            UnloadEffect(&unloadedEffect);
+        }
+    }
+
+    virtual ~PooledTerrainEffect()
+    {
+    }
+};
@@ -1,5 +1,4 @@
 #include <glm\mat4x4.hpp>
-#include <glm\gtc\random.hpp>
 #include <SFML\System.hpp>
 #include <algorithm>
 #include "Generators\ColorGenerator.h"
@@ -8,7 +7,8 @@
 
 RoadStats RoadEffect::stats = RoadStats();
 
-RoadEffect::RoadEffect()
+RoadEffect::RoadEffect(GlResourcePool* resourcePool)
+    : resourcePool(resourcePool)
 {
 }
 
@@ -26,77 +26,85 @@ bool RoadEffect::LoadBasics(ShaderFactory* shaderManager)
     return true;
 }
 
-bool RoadEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile)
+bool RoadEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, RoadEffectData* roadEffect)
 {
-    bool hasRoadEffect = false;
-    RoadEffectData* roadEffect = nullptr;
-
-    // Scan the image for road pixels.
+    // Every ROAD_SUBCOUNT-th road pixel gets a traveller, so there's nothing to do with fewer pixels than that.
     int roadCounter = 1;
     const long ROAD_SUBCOUNT = 10;
-    for (int i = 0; i < TerrainTile::SubtileSize; i++)
+    if (roadCounter + tile->typeIndex.GetPixelCount(TerrainTypes::ROADS) < ROAD_SUBCOUNT)
     {
-        for (int j = 0; j <  TerrainTile::SubtileSize; j++)
+        return false;
+    }
+
+    bool hasRoadEffect = false;
+    EffectRandom random(subtileId, EffectRandom::ROADS);
+
+    // Visit only the road pixels.
+    tile->typeIndex.ForEachPixel(tile->packedTypes, TerrainTypes::ROADS, [&](int i, int j)
+    {
+        ++roadCounter;
+
+        if (roadCounter % ROAD_SUBCOUNT == 0)
         {
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::ROADS)
+            if (!hasRoadEffect)
             {
-                ++roadCounter;
-
-                if (roadCounter % ROAD_SUBCOUNT == 0)
-                {
-                    if (!hasRoadEffect)
-                    {
-                        hasRoadEffect = true;
-                        roadEffect = new RoadEffectData(tile);
-                    }
-
-                    float height = tile->heightmap[pixelId];
-                    
-                    // TODO configurable
-                    glm::vec3 bottomColor = ColorGenerator::GetTravellerColor();
-                    glm::vec3 topColor = ColorGenerator::GetTravellerColor() * 1.10f;
-                    glm::vec3 position = glm::vec3((float)i, (float)j, height + 0.1f);
-                    glm::vec2 velocity = glm::vec2(glm::linearRand(-1.0f, 1.0f), glm::linearRand(-1.0f, 1.0f)) * 1.0f;
-
-                    glm::vec3 endPosition = position + glm::normalize(glm::vec3(velocity.x, velocity.y, 0.0f));
-
-                    // Add road travelers
-                    roadEffect->travellers.positions.push_back(position);
-                    roadEffect->travellers.positions.push_back(endPosition);
-                    roadEffect->travellers.colors.push_back(bottomColor);
-                    roadEffect->travellers.colors.push_back(topColor);
-
-                    roadEffect->positions.push_back(glm::vec2(position.x, position.y));
-                    roadEffect->velocities.push_back(velocity);
-                }
+                hasRoadEffect = true;
+                roadEffect->tile = tile;
             }
-        }
-    }
 
-    if (hasRoadEffect)
-    {
-        glGenVertexArrays(1, &roadEffect->vao);
-        glBindVertexArray(roadEffect->vao);
-        glGenBuffers(1, &roadEffect->positionBuffer);
-        glGenBuffers(1, &roadEffect->colorBuffer);
-
-        Logger::Log("Parsed ", roadEffect->travellers.positions.size() / 2, " road travellers.");
-        roadEffect->travellers.TransferPositionToOpenGl(roadEffect->positionBuffer);
-        roadEffect->travellers.TransferStaticColorToOpenGl(roadEffect->colorBuffer);
-        *effectData = roadEffect;
-    }
+            float height = tile->GetHeight(glm::ivec2(i, j));
+            
+            // TODO configurable
+            glm::vec3 bottomColor = ColorGenerator::GetTravellerColor(&random);
+            glm::vec3 topColor = ColorGenerator::GetTravellerColor(&random) * 1.10f;
+            glm::vec3 position = glm::vec3((float)i, (float)j, height + 0.1f);
+            glm::vec2 velocity = random.Vec2(glm::vec2(-1.0f), glm::vec2(1.0f)) * 1.0f;
+
+            glm::vec3 endPosition = position + glm::normalize(glm::vec3(velocity.x, velocity.y, 0.0f));
+
+            // Add road travelers
+            roadEffect->travellers.positions.push_back(position);
+            roadEffect->travellers.positions.push_back(endPosition);
+            roadEffect->travellers.colors.push_back(bottomColor);
+            roadEffect->travellers.colors.push_back(topColor);
+
+            roadEffect->positions.push_back(glm::vec2(position.x, position.y));
+            roadEffect->velocities.push_back(velocity);
+        }
+    });
 
     return hasRoadEffect;
 }
 
-void RoadEffect::UnloadEffect(void* effectData)
+void RoadEffect::UploadEffect(RoadEffectData* roadEffect)
 {
-    RoadEffectData* roadEffect = (RoadEffectData*)effectData;
-    glDeleteVertexArrays(1, &roadEffect->vao);
-    glDeleteBuffers(1, &roadEffect->positionBuffer);
-    glDeleteBuffers(1, &roadEffect->colorBuffer);
-    delete roadEffect;
+    roadEffect->vao = resourcePool->AcquireVertexArray();
+    glBindVertexArray(roadEffect->vao);
+    roadEffect->positionBuffer = resourcePool->AcquireBuffer(roadEffect->travellers.positions.size() * sizeof(glm::vec3));
+    roadEffect->colorBuffer = resourcePool->AcquireBuffer(roadEffect->travellers.colors.size() * sizeof(glm::vec3));
+
+    Logger::Log("Parsed ", roadEffect->travellers.positions.size() / 2, " road travellers.");
+
+    // The pool sizes the storage, so the travellers' data is uploaded through it rather than as the vertices would themselves.
+    glEnableVertexAttribArray(0);
+    resourcePool->SetBufferData(roadEffect->positionBuffer, roadEffect->travellers.positions.size() * sizeof(glm::vec3), &roadEffect->travellers.positions[0], GL_DYNAMIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    glEnableVertexAttribArray(1);
+    resourcePool->SetBufferData(roadEffect->colorBuffer, roadEffect->travellers.colors.size() * sizeof(glm::vec3), &roadEffect->travellers.colors[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+}
+
+void RoadEffect::DiscardEffect(RoadEffectData* roadEffect)
+{
+    // The travellers are only in the effect itself until uploaded.
+}
+
+void RoadEffect::UnloadEffect(RoadEffectData* roadEffect)
+{
+    resourcePool->RetireVertexArray(roadEffect->vao);
+    resourcePool->RetireBuffer(roadEffect->positionBuffer, roadEffect->travellers.positions.size() * sizeof(glm::vec3));
+    resourcePool->RetireBuffer(roadEffect->colorBuffer, roadEffect->travellers.colors.size() * sizeof(glm::vec3));
 }
 
 float RoadEffect::MoveTraveller(const glm::ivec2 subtileId, RoadEffectData* roadEffect, int i, float elapsedSeconds)
@@ -129,7 +137,7 @@ float RoadEffect::MoveTraveller(const glm::ivec2 subtileId, RoadEffectData* road
     {
         // See if we went off a road. If so, correct.
         int pixelId = roadEffect->tile->GetPixelId(subTilePos);
-        if (roadEffect->tile->type[pixelId] != TerrainTypes::ROADS)
+        if (roadEffect->tile->GetPixelType(pixelId) != TerrainTypes::ROADS)
         {
             glm::ivec2 offRoad = subTilePos;
             roadEffect->positions[i] -= (roadEffect->velocities[i] * elapsedSeconds);
@@ -170,12 +178,25 @@ float RoadEffect::MoveTraveller(const glm::ivec2 subtileId, RoadEffectData* road
         }
     }
 
-    return roadEffect->tile->heightmap[roadEffect->tile->GetPixelId(subTilePos)];
+    return roadEffect->tile->GetHeight(subTilePos);
+}
+
+size_t RoadEffect::GetMemoryUsage(const RoadEffectData& roadEffect) const
+{
+    // The positions and colors are also in OpenGL buffers.
+    size_t bufferBytes = (roadEffect.travellers.positions.size() + roadEffect.travellers.colors.size()) * sizeof(glm::vec3);
+    return roadEffect.travellers.GetByteSize() + (roadEffect.positions.size() + roadEffect.velocities.size()) * sizeof(glm::vec2) + bufferBytes;
+}
+
+unsigned int RoadEffect::GetPlacementChecksum(const RoadEffectData& roadEffect) const
+{
+    unsigned int checksum = AddToChecksum(ChecksumBasis, roadEffect.travellers.positions);
+    checksum = AddToChecksum(checksum, roadEffect.travellers.colors);
+    return AddToChecksum(checksum, roadEffect.velocities);
 }
 
-void RoadEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds)
+void RoadEffect::Simulate(const glm::ivec2 subtileId, RoadEffectData* roadEffect, float elapsedSeconds)
 {
-    RoadEffectData* roadEffect = (RoadEffectData*)effectData;
     auto& travellers = roadEffect->travellers.positions;
     for (unsigned int i = 0; i < travellers.size() / 2; i++)
     {
@@ -192,13 +213,12 @@ void RoadEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float el
     roadEffect->travellers.TransferUpdatePositionToOpenGl(roadEffect->positionBuffer);
 }
 
-void RoadEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void RoadEffect::Render(RoadEffectData* roadEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
 {
     sf::Clock clock;
 
     // TODO configurable
     glLineWidth(3.0f);
-    RoadEffectData* roadEffect = (RoadEffectData*)effectData;
     glUseProgram(programId);
     glBindVertexArray(roadEffect->vao);
 
@@ -1,10 +1,11 @@
 #pragma once
+#include "Managers\GlResourcePool.h"
 #include "Utils\Vertex.h"
-#include "TerrainEffect.h"
+#include "PooledTerrainEffect.h"
 
 struct RoadEffectData
 {
-    SubTile* tile;
+    const SubTile* tile;
 
     GLuint vao;
     GLuint positionBuffer;
@@ -14,8 +15,8 @@ struct RoadEffectData
     std::vector<glm::vec2> positions;
     std::vector<glm::vec2> velocities;
 
-    RoadEffectData(SubTile* tile)
-        : tile(tile)
+    RoadEffectData()
+        : tile(nullptr)
     {
     }
 };
@@ -41,25 +42,31 @@ struct RoadStats
     }
 };
 
-class RoadEffect : public TerrainEffect
+class RoadEffect : public PooledTerrainEffect<RoadEffectData>
 {
     GLuint programId;
 
     GLuint projMatrixLocation;
     GLuint mvMatrixLocation;
 
+    GlResourcePool* resourcePool;
+
     static RoadStats stats;
 
     // Moves the specified traveller, returning the height of the ground the traveller is now above.
     float MoveTraveller(const glm::ivec2 subtileId, RoadEffectData* roadEffect, int travellerId, float elapsedSeconds);
 
 public:
-    RoadEffect();
+    RoadEffect(GlResourcePool* resourcePool);
 
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, RoadEffectData* roadEffect) override;
+    virtual void UploadEffect(RoadEffectData* roadEffect) override;
+    virtual void DiscardEffect(RoadEffectData* roadEffect) override;
+    virtual void UnloadEffect(RoadEffectData* roadEffect) override;
+    virtual size_t GetMemoryUsage(const RoadEffectData& roadEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const RoadEffectData& roadEffect) const override;
+    virtual void Simulate(const glm::ivec2 subtileId, RoadEffectData* roadEffect, float elapsedSeconds) override;
+    virtual void Render(RoadEffectData* roadEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
     virtual void LogStats() override;
 };
\ No newline at end of file
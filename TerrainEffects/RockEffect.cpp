@@ -1,4 +1,3 @@
-#include <glm\gtc\random.hpp>
 #include "Config\PhysicsConfig.h"
 #include "Generators\RockGenerator.h"
 #include "Generators\PhysicsGenerator.h"
@@ -16,90 +15,92 @@ bool RockEffect::LoadBasics(ShaderFactory* shaderManager)
     return true;
 }
 
-bool RockEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile)
+bool RockEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, RockEffectData* rockEffect)
 {
-    bool hasRockEffect = false;
-    RockEffectData* rockEffect = nullptr;
-
-    // Scan the image for rock pixels.
+    // Every ROCK_SUBCOUNT-th rock pixel gets a rock, so there's nothing to do with fewer pixels than that.
     int rockCounter = 1;
     const long ROCK_SUBCOUNT = 8;
     const long MOVABLE_ROCK_SUBCOUNT = 16;
-    for (int i = 0; i < TerrainTile::SubtileSize; i++)
+    if (rockCounter + tile->typeIndex.GetPixelCount(TerrainTypes::ROCKS) < ROCK_SUBCOUNT)
+    {
+        return false;
+    }
+
+    EffectRandom random(subtileId, EffectRandom::ROCKS);
+
+    // Visit only the rock pixels.
+    tile->typeIndex.ForEachPixel(tile->packedTypes, TerrainTypes::ROCKS, [&](int i, int j)
     {
-        for (int j = 0; j < TerrainTile::SubtileSize; j++)
+        ++rockCounter;
+        if (rockCounter % ROCK_SUBCOUNT == 0)
+        {
+            // Add a non-movable rock substrate.
+            Model model = Model();
+            PhysicsGenerator::CShape shape;
+
+            RockGenerator rockGenerator;
+            rockGenerator.GetRandomRockModel(&random, &model.modelId, &shape);
+
+            // TODO randomly generated from the rock generator
+            model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
+
+            // TODO configurable
+            // TODO randomly generated masses.
+            float height = tile->GetHeight(glm::ivec2(i, j));
+            glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i, j)) + random.Vec2(glm::vec2(0.0f), glm::vec2(1.0f));
+            model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height), 0.0f);
+            model.body->setActivationState(ISLAND_SLEEPING);
+
+            rockEffect->rocks.push_back(model);
+        }
+
+        if (rockCounter % MOVABLE_ROCK_SUBCOUNT == 0)
         {
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::ROCKS)
-            {
-                ++rockCounter;
-                if (rockCounter % ROCK_SUBCOUNT == 0)
-                {
-                    if (!hasRockEffect)
-                    {
-                        hasRockEffect = true;
-                        rockEffect = new RockEffectData();
-                    }
-
-                    // Add a non-movable rock substrate.
-                    Model model = Model();
-                    PhysicsGenerator::CShape shape;
-
-                    RockGenerator rockGenerator;
-                    rockGenerator.GetRandomRockModel(&model.modelId, &shape);
-
-                    // TODO randomly generated from the rock generator
-                    model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
-
-                    // TODO configurable
-                    // TODO randomly generated masses.
-                    float height = tile->heightmap[pixelId];
-                    glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i, j)) + glm::vec2(glm::linearRand(0.0f, 1.0f), glm::linearRand(0.0f, 1.0f));
-                    model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height), 0.0f);
-                    model.body->setActivationState(ISLAND_SLEEPING);
-
-                    rockEffect->rocks.push_back(model);
-                    physics->AddBody(model.body);
-                }
-
-                if (rockCounter % MOVABLE_ROCK_SUBCOUNT == 0)
-                {
-                    // Add a movable rock layer above the substrate
-                    Model model = Model();
-                    PhysicsGenerator::CShape shape;
-
-                    RockGenerator rockGenerator;
-                    rockGenerator.GetRandomRockModel(&model.modelId, &shape);
-
-                    // TODO randomly generated from the rock generator
-                    model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
-
-                    // TODO configurable
-                    // TODO randomly generated masses.
-                    float height = tile->heightmap[pixelId];
-                    glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i, j)) + glm::vec2(glm::linearRand(0.0f, 1.0f), glm::linearRand(0.0f, 1.0f));
-                    model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height + 2.0f), 30.0f);
-                    model.body->setActivationState(ISLAND_SLEEPING);
-
-                    rockEffect->rocks.push_back(model);
-                    physics->AddBody(model.body);
-                }
-            }
+            // Add a movable rock layer above the substrate
+            Model model = Model();
+            PhysicsGenerator::CShape shape;
+
+            RockGenerator rockGenerator;
+            rockGenerator.GetRandomRockModel(&random, &model.modelId, &shape);
+
+            // TODO randomly generated from the rock generator
+            model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
+
+            // TODO configurable
+            // TODO randomly generated masses.
+            float height = tile->GetHeight(glm::ivec2(i, j));
+            glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i, j)) + random.Vec2(glm::vec2(0.0f), glm::vec2(1.0f));
+            model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height + 2.0f), 30.0f);
+            model.body->setActivationState(ISLAND_SLEEPING);
+
+            rockEffect->rocks.push_back(model);
         }
-    }
+    });
+
+    return !rockEffect->rocks.empty();
+}
 
-    if (hasRockEffect)
+void RockEffect::UploadEffect(RockEffectData* rockEffect)
+{
+    for (const Model& model : rockEffect->rocks)
     {
-        Logger::Log("Loaded ", rockEffect->rocks.size(), " randomly-generated rocks in the rock field.");
-        *effectData = rockEffect;
+        physics->AddBody(model.body);
     }
 
-    return hasRockEffect;
+    Logger::Log("Loaded ", rockEffect->rocks.size(), " randomly-generated rocks in the rock field.");
+}
+
+void RockEffect::DiscardEffect(RockEffectData* rockEffect)
+{
+    // The bodies were never added to the physics world, so they only need deleting.
+    for (const Model& model : rockEffect->rocks)
+    {
+        physics->DeleteBody(model.body, false);
+    }
 }
 
-void RockEffect::UnloadEffect(void * effectData)
+void RockEffect::UnloadEffect(RockEffectData* rockEffect)
 {
-    RockEffectData* rockEffect = (RockEffectData*)effectData;
     for (const Model& model : rockEffect->rocks)
     {
         // TODO -- we should not regenerate rigid bodies for rocky areas, but they (like cities) should go in a persistent store.
@@ -107,18 +108,32 @@ void RockEffect::UnloadEffect(void * effectData)
         physics->RemoveBody(model.body);
         physics->DeleteBody(model.body, false);
     }
+}
+
+size_t RockEffect::GetMemoryUsage(const RockEffectData& rockEffect) const
+{
+    return rockEffect.rocks.size() * (sizeof(Model) + Model::PhysicsBodySize);
+}
+
+unsigned int RockEffect::GetPlacementChecksum(const RockEffectData& rockEffect) const
+{
+    unsigned int checksum = ChecksumBasis;
+    for (const Model& model : rockEffect.rocks)
+    {
+        checksum = AddToChecksum(checksum, model.modelId);
+        checksum = AddToChecksum(checksum, PhysicsGenerator::GetBodyPosition(model.body));
+    }
 
-    delete rockEffect;
+    return checksum;
 }
 
-void RockEffect::Simulate(const glm::ivec2 subtileId, void * effectData, float elapsedSeconds)
+void RockEffect::Simulate(const glm::ivec2 subtileId, RockEffectData* rockEffect, float elapsedSeconds)
 {
 }
 
-void RockEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void RockEffect::Render(RockEffectData* rockEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
 {
     glm::mat4 projectionMatrix = perspectiveMatrix * viewMatrix;
-    RockEffectData* rockEffect = (RockEffectData*)effectData;
     for (Model& model : rockEffect->rocks)
     {
         modelManager->RenderModel(projectionMatrix, &model);
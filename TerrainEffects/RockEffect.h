@@ -2,14 +2,14 @@
 #include "Data\Model.h"
 #include "Managers\ModelManager.h"
 #include "Physics.h"
-#include "TerrainEffect.h"
+#include "PooledTerrainEffect.h"
 
 struct RockEffectData
 {
     std::vector<Model> rocks;
 };
 
-class RockEffect : public TerrainEffect
+class RockEffect : public PooledTerrainEffect<RockEffectData>
 {
     ModelManager* modelManager;
     Physics* physics;
@@ -17,9 +17,13 @@ class RockEffect : public TerrainEffect
 public:
     RockEffect(ModelManager* modelManager, Physics* physics);
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, RockEffectData* rockEffect) override;
+    virtual void UploadEffect(RockEffectData* rockEffect) override;
+    virtual void DiscardEffect(RockEffectData* rockEffect) override;
+    virtual void UnloadEffect(RockEffectData* rockEffect) override;
+    virtual size_t GetMemoryUsage(const RockEffectData& rockEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const RockEffectData& rockEffect) const override;
+    virtual void Simulate(const glm::ivec2 subtileId, RockEffectData* rockEffect, float elapsedSeconds) override;
+    virtual void Render(RockEffectData* rockEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
     virtual void LogStats() override;
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Config\PhysicsConfig.h"
+#include "Data\SubtileLayout.h"
 #include "Generators\SignGenerator.h"
 #include "Generators\PhysicsGenerator.h"
 #include "Managers\TerrainManager.h"
@@ -16,91 +17,108 @@ bool SignEffect::LoadBasics(ShaderFactory* shaderManager)
     return true;
 }
 
-bool SignEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile * tile)
+bool SignEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, SignEffectData* signEffect)
 {
-    bool hasSignEffect = false;
-    SignEffectData* signEfect = nullptr;
+    // A sign needs two grass and five dirt pixels.
+    if (tile->typeIndex.GetPixelCount(TerrainTypes::GRASSLAND) < 2 || tile->typeIndex.GetPixelCount(TerrainTypes::DIRTLAND) < 5)
+    {
+        return false;
+    }
 
-    // Scan the image for the sign setting.
+    RowMajorLayout layout(TerrainTile::SubtileSize);
+    EffectRandom random(subtileId, EffectRandom::SIGNS);
+
+    // Visit the dirt pixels, looking for the sign setting.
     // A sign is a grass-dirt corner. TODO figure out real size.
     // TODO handle signs stradling subtiles.****
-    for (int i = 1; i < TerrainTile::SubtileSize - 4; i++)
+    tile->typeIndex.ForEachPixel(tile->packedTypes, TerrainTypes::DIRTLAND, [&](int i, int j)
     {
-        for (int j = 1; j < TerrainTile::SubtileSize - 4; j++)
+        if (i < 1 || j < 1 || i >= TerrainTile::SubtileSize - 4 || j >= TerrainTile::SubtileSize - 4)
         {
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::DIRTLAND)
-            {
-                // See if the upper-left is grass in x and y.
-                if (tile->type[(i - 1) + j * TerrainTile::SubtileSize] == TerrainTypes::GRASSLAND && tile->type[i + (j - 1) * TerrainTile::SubtileSize] == TerrainTypes::GRASSLAND)
-                {
-                    // See if dirtland is in the next two followed by grassland.
-                    if (tile->type[(i + 1) + j * TerrainTile::SubtileSize] == TerrainTypes::DIRTLAND && tile->type[i + (j + 1) * TerrainTile::SubtileSize] == TerrainTypes::DIRTLAND)
-                    {
-                        if (tile->type[(i + 2) + j * TerrainTile::SubtileSize] == TerrainTypes::DIRTLAND && tile->type[i + (j + 2) * TerrainTile::SubtileSize] == TerrainTypes::DIRTLAND)
-                        {
-                            // Valid sign! 
-                            if (!hasSignEffect)
-                            {
-                                hasSignEffect = true;
-                                signEfect = new SignEffectData();
-                            }
-
-                            // Add a barely-movable sign shape.
-                            Model model = Model();
-                            PhysicsGenerator::CShape shape;
-
-                            SignGenerator signGenerator;
-                            signGenerator.GetRandomSignModel(&model.modelId, &shape);
-
-                            // TODO configurable.
-                            model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
-
-                            // TODO configurable masses.
-                            float height = tile->heightmap[pixelId];
-                            glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i + 1, j + 1));
-                            model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height), 0.0f);
-
-                            signEfect->signs.push_back(model);
-                            physics->AddBody(model.body);
-                        }
-                    }
-                }
-            }
+            return;
         }
-    }
 
-    if (hasSignEffect)
+        // The upper-left must be grass in x and y, with dirtland in the next two.
+        if (!IsSignCorner(layout, tile->packedTypes, layout.GetIndex(i, j)))
+        {
+            return;
+        }
+
+        // Valid sign! Add a barely-movable sign shape.
+        Model model = Model();
+        PhysicsGenerator::CShape shape;
+
+        SignGenerator signGenerator;
+        signGenerator.GetRandomSignModel(&random, &model.modelId, &shape);
+
+        // TODO configurable.
+        model.color = glm::vec4(0.60f, 0.70f, 0.60f, 1.0f);
+
+        // TODO configurable masses.
+        float height = tile->GetHeight(glm::ivec2(i, j));
+        glm::vec2 realPos = TerrainTile::GetRealPosition(subtileId, glm::ivec2(i + 1, j + 1));
+        model.body = PhysicsGenerator::GetDynamicBody(shape, btVector3(realPos.x, realPos.y, height), 0.0f);
+
+        signEffect->signs.push_back(model);
+    });
+
+    return !signEffect->signs.empty();
+}
+
+void SignEffect::UploadEffect(SignEffectData* signEffect)
+{
+    for (const Model& model : signEffect->signs)
     {
-        Logger::Log("Loaded ", signEfect->signs.size(), " signs in the subtile.");
-        *effectData = signEfect;
+        physics->AddBody(model.body);
     }
 
-    return hasSignEffect;
+    Logger::Log("Loaded ", signEffect->signs.size(), " signs in the subtile.");
 }
 
-void SignEffect::UnloadEffect(void * effectData)
+void SignEffect::DiscardEffect(SignEffectData* signEffect)
 {
-    SignEffectData* rockEffect = (SignEffectData*)effectData;
-    for (const Model& model : rockEffect->signs)
+    // The bodies were never added to the physics world, so they only need deleting.
+    for (const Model& model : signEffect->signs)
+    {
+        physics->DeleteBody(model.body, false);
+    }
+}
+
+void SignEffect::UnloadEffect(SignEffectData* signEffect)
+{
+    for (const Model& model : signEffect->signs)
     {
         // TODO -- we should not regenerate signs, they should go in a persistent store.
         physics->RemoveBody(model.body);
     }
+}
+
+size_t SignEffect::GetMemoryUsage(const SignEffectData& signEffect) const
+{
+    return signEffect.signs.size() * (sizeof(Model) + Model::PhysicsBodySize);
+}
+
+unsigned int SignEffect::GetPlacementChecksum(const SignEffectData& signEffect) const
+{
+    unsigned int checksum = ChecksumBasis;
+    for (const Model& model : signEffect.signs)
+    {
+        checksum = AddToChecksum(checksum, model.modelId);
+        checksum = AddToChecksum(checksum, PhysicsGenerator::GetBodyPosition(model.body));
+    }
 
-    delete rockEffect;
+    return checksum;
 }
 
-void SignEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds)
+void SignEffect::Simulate(const glm::ivec2 subtileId, SignEffectData* signEffect, float elapsedSeconds)
 {
     // No custom simulation.
 }
 
-void SignEffect::Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void SignEffect::Render(SignEffectData* signEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
 {
     glm::mat4 projectionMatrix = perspectiveMatrix * viewMatrix;
-    SignEffectData* rockEffect = (SignEffectData*)effectData;
-    for (Model& model : rockEffect->signs)
+    for (Model& model : signEffect->signs)
     {
         modelManager->RenderModel(projectionMatrix, &model);
     }
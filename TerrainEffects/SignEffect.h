@@ -1,25 +1,44 @@
 #pragma once
 #include "Data\Model.h"
+#include "Data\TerrainTypes.h"
 #include "Managers\ModelManager.h"
 #include "Physics.h"
-#include "TerrainEffect.h"
+#include "PooledTerrainEffect.h"
 
 struct SignEffectData
 {
     std::vector<Model> signs;
 };
 
-class SignEffect : public TerrainEffect
+class SignEffect : public PooledTerrainEffect<SignEffectData>
 {
     ModelManager* modelManager;
     Physics* physics;
 
 public:
     SignEffect(ModelManager* modelManager, Physics* physics);
+
+    // Returns true if a dirt pixel is a grass-dirt corner: grass to the left and above, with dirt in the next two pixels in x and y.
+    //  The pixel must be at least one pixel in from the left and top of the subtile, and three from the right and bottom.
+    template <typename Layout>
+    static bool IsSignCorner(const Layout& layout, const unsigned char* packedTypes, int index)
+    {
+        int right = layout.GetRight(index);
+        int down = layout.GetDown(index);
+        return TerrainTypes::GetPackedType(packedTypes, layout.GetLeft(index)) == TerrainTypes::GRASSLAND &&
+            TerrainTypes::GetPackedType(packedTypes, layout.GetUp(index)) == TerrainTypes::GRASSLAND &&
+            TerrainTypes::GetPackedType(packedTypes, right) == TerrainTypes::DIRTLAND && TerrainTypes::GetPackedType(packedTypes, down) == TerrainTypes::DIRTLAND &&
+            TerrainTypes::GetPackedType(packedTypes, layout.GetRight(right)) == TerrainTypes::DIRTLAND && TerrainTypes::GetPackedType(packedTypes, layout.GetDown(down)) == TerrainTypes::DIRTLAND;
+    }
+
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, SignEffectData* signEffect) override;
+    virtual void UploadEffect(SignEffectData* signEffect) override;
+    virtual void DiscardEffect(SignEffectData* signEffect) override;
+    virtual void UnloadEffect(SignEffectData* signEffect) override;
+    virtual size_t GetMemoryUsage(const SignEffectData& signEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const SignEffectData& signEffect) const override;
+    virtual void Simulate(const glm::ivec2 subtileId, SignEffectData* signEffect, float elapsedSeconds) override;
+    virtual void Render(SignEffectData* signEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
     virtual void LogStats() override;
 };
\ No newline at end of file
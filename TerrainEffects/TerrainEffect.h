@@ -1,24 +1,65 @@
 #pragma once
+#include <vector>
 #include "Data\TerrainTile.h"
 #include "shaders\ShaderFactory.h"
 
 // Defines how a terrain effect is operated.
+//  Effects are loaded in two phases: a CPU build on the effect build threads, then an upload on the main thread.
+//  Each effect type keeps the data of every resident subtile itself, which the effect manager refers to by subtile slot.
 class TerrainEffect
 {
 public:
     // Loads runtime constants required for this effect.
     virtual bool LoadBasics(ShaderFactory* shaderManager) = 0;
 
-    // Loads and unloads an effect into / out of the effect data.
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile) = 0;
-    virtual void UnloadEffect(void* effectData) = 0;
+    // Unloaded effects are kept for the given number of frames, until they're no longer drawn.
+    virtual void SetRetireFrames(int retireFrames) = 0;
 
-    // Simulates an effect.
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) = 0;
+    // Makes room for the given number of builds, dropping any that weren't uploaded or discarded.
+    virtual void PrepareBuilds(int buildCount) = 0;
+
+    // Builds the CPU data of a subtile's effect, returning false if the subtile doesn't have the effect.
+    //  Runs on the effect build threads, so must only read the tile, the effect's own constants and its own build. OpenGL and the physics world are main-thread only.
+    virtual bool Build(int build, glm::ivec2 subtileId, const SubTile* tile) = 0;
+
+    // Creates the OpenGL resources of a build and adds its bodies to the physics world, making it the effect of the slot.
+    virtual void UploadBuild(int build, glm::ivec2 subtileId, int subtileSlot) = 0;
+
+    // Frees the builds that were never uploaded.
+    virtual void DiscardBuilds() = 0;
+
+    // Returns a checksum of what a build placed where, or 0 if the subtile doesn't have the effect. Used to check builds don't depend on the thread building them.
+    virtual unsigned int GetBuildChecksum(int build) const = 0;
+
+    // Stops drawing and simulating the effect of a slot, returning false if it doesn't have one. It's unloaded by UnloadRetiredEffect once enough frames have passed.
+    virtual bool RetireEffect(int subtileSlot) = 0;
+    virtual void AdvanceRetirementFrame() = 0;
+
+    // Unloads the oldest retired effect if enough frames have passed, returning false if there wasn't one.
+    virtual bool UnloadRetiredEffect() = 0;
+    virtual int GetRetiringEffectCount() const = 0;
+
+    // Returns the approximate bytes used by the effect of a slot's CPU data, OpenGL buffers, and physics bodies, or 0 if it doesn't have one.
+    virtual size_t GetSubtileMemoryUsage(int subtileSlot) const = 0;
+
+    // Simulates the effects of the slots stamped with the pass, returning the number simulated.
+    virtual int SimulateEffects(const std::vector<long>& slotPasses, long pass, float elapsedSeconds) = 0;
     
-    // Renders an effect.
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) = 0;
+    // Renders the effects of the slots stamped with the pass, returning the number rendered.
+    virtual int RenderEffects(const std::vector<long>& slotPasses, long pass, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix) = 0;
+
+    virtual int GetEffectCount() const = 0;
+
+    // Returns how many times the effect's storage has been allocated or grown.
+    virtual long GetAllocationCount() const = 0;
+
+    // Unloads every effect, including the retired ones. Only safe once nothing is drawn anymore, such as on shutdown.
+    virtual void UnloadAllEffects() = 0;
     
     // Logs effect statistics. 
     virtual void LogStats() = 0;
-};
\ No newline at end of file
+
+    virtual ~TerrainEffect()
+    {
+    }
+};
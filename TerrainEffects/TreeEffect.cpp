@@ -1,5 +1,5 @@
+#include <cstddef>
 #include <glm\mat4x4.hpp>
-#include <glm\gtc\random.hpp>
 #include <SFML\System.hpp>
 #include <algorithm>
 #include "Generators\ColorGenerator.h"
@@ -9,8 +9,9 @@
 
 TreeStats TreeEffect::stats = TreeStats();
 
-TreeEffect::TreeEffect(const std::string& cacheFolder)
-    : treeCache(cacheFolder, "trees")
+TreeEffect::TreeEffect(GlResourcePool* resourcePool, const std::string& cacheFolder)
+    : treeCache(cacheFolder, "trees"), archetypes(), trunkVao(0), trunkPositionBuffer(0), trunkColorBuffer(0), trunkThicknessBuffer(0),
+      leafVao(0), leafPositionBuffer(0), leafColorBuffer(0), resourcePool(resourcePool)
 {
 }
 
@@ -36,6 +37,7 @@ bool TreeEffect::LoadBasics(ShaderFactory* shaderManager)
     leafProgram.mvMatrixLocation = glGetUniformLocation(leafProgram.programId, "mvMatrix");
 
     // TODO configurable number of trees we generate.
+    std::vector<TreeCacheData> trees;
     for (int i = 0; i < 100; i++)
     {
         TreeCacheData generatedTree;
@@ -47,19 +49,20 @@ bool TreeEffect::LoadBasics(ShaderFactory* shaderManager)
         }
         else
         {
-            // Generate the possible tree models to use for rendering trees.
-            GenerationResults results = treeGenerator.GenerateTree(&generatedTree.branches, &generatedTree.branchThicknesses, &generatedTree.leaves);
+            // Generate the possible tree models to use for rendering trees. Seeded by ID, so a cleared cache regenerates the same trees.
+            EffectRandom random(treeId, EffectRandom::TREE_ARCHETYPES);
+            GenerationResults results = treeGenerator.GenerateTree(&random, &generatedTree.branches, &generatedTree.branchThicknesses, &generatedTree.leaves);
             for (unsigned int i = 0; i < results.branches; i++)
             {
                 // Add tree trunk colors;
-                generatedTree.branchColors.push_back(ColorGenerator::GetTreeBranchColor());
-                generatedTree.branchColors.push_back(ColorGenerator::GetTreeBranchColor());
+                generatedTree.branchColors.push_back(ColorGenerator::GetTreeBranchColor(&random));
+                generatedTree.branchColors.push_back(ColorGenerator::GetTreeBranchColor(&random));
             }
 
             // Add tree leaf colors.
             for (unsigned int i = 0; i < results.leaves; i++)
             {
-                generatedTree.leafColors.push_back(ColorGenerator::GetTreeLeafColor());
+                generatedTree.leafColors.push_back(ColorGenerator::GetTreeLeafColor(&random));
             }
 
             // Save to cache so we don't need to generate it next time.
@@ -69,144 +72,235 @@ bool TreeEffect::LoadBasics(ShaderFactory* shaderManager)
             treeCache.SaveToCache(treeId, &inputData);
         }
 
-        cachedTrees.push_back(generatedTree);
+        trees.push_back(generatedTree);
     }
 
+    UploadArchetypes(trees);
     return true;
 }
 
-bool TreeEffect::LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile)
+void TreeEffect::UploadArchetypes(const std::vector<TreeCacheData>& trees)
 {
-    bool hasTreeEffect = false;
-    TreeEffectData* treeEffect = nullptr;
+    universalVertices trunkVertices;
+    universalVertices leafVertices;
+    for (const TreeCacheData& tree : trees)
+    {
+        TreeArchetype archetype;
+        archetype.firstTrunkVertex = (int)trunkVertices.positions.size();
+        archetype.trunkVertexCount = (int)tree.branches.size();
+        archetype.firstLeafVertex = (int)leafVertices.positions.size();
+        archetype.leafVertexCount = (int)tree.leaves.size();
+        archetype.copiedByteSize = 2 * (tree.branches.size() * (2 * sizeof(glm::vec3) + sizeof(unsigned int)) + tree.leaves.size() * 2 * sizeof(glm::vec3));
+        archetypes.push_back(archetype);
+
+        trunkVertices.positions.insert(trunkVertices.positions.end(), tree.branches.begin(), tree.branches.end());
+        trunkVertices.colors.insert(trunkVertices.colors.end(), tree.branchColors.begin(), tree.branchColors.end());
+        trunkVertices.ids.insert(trunkVertices.ids.end(), tree.branchThicknesses.begin(), tree.branchThicknesses.end());
+        leafVertices.positions.insert(leafVertices.positions.end(), tree.leaves.begin(), tree.leaves.end());
+        leafVertices.colors.insert(leafVertices.colors.end(), tree.leafColors.begin(), tree.leafColors.end());
+    }
+
+    // The instance attributes are pointed at each subtile's instance buffer when it's drawn.
+    glGenVertexArrays(1, &trunkVao);
+    glBindVertexArray(trunkVao);
+    glGenBuffers(1, &trunkPositionBuffer);
+    glGenBuffers(1, &trunkColorBuffer);
+    glGenBuffers(1, &trunkThicknessBuffer);
+    trunkVertices.TransferStaticPositionToOpenGl(trunkPositionBuffer);
+    trunkVertices.TransferStaticColorToOpenGl(trunkColorBuffer);
+    trunkVertices.TransferStaticIdsToOpenGl(trunkThicknessBuffer);
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+    glEnableVertexAttribArray(6);
+    glVertexAttribDivisor(6, 1);
+
+    glGenVertexArrays(1, &leafVao);
+    glBindVertexArray(leafVao);
+    glGenBuffers(1, &leafPositionBuffer);
+    glGenBuffers(1, &leafColorBuffer);
+    leafVertices.TransferStaticPositionToOpenGl(leafPositionBuffer);
+    leafVertices.TransferStaticColorToOpenGl(leafColorBuffer);
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+    glEnableVertexAttribArray(6);
+    glVertexAttribDivisor(6, 1);
+
+    Logger::Log("Uploaded ", archetypes.size(), " tree archetypes with ", trunkVertices.positions.size() / 2, " trunks and ", leafVertices.positions.size(), " leaves in ",
+        trunkVertices.GetByteSize() + leafVertices.GetByteSize(), " bytes.");
+}
 
-    // TODO do we want to cache from the cached trees?
-    // Scan the image for tree pixels.
-    int treesInRegion = 0;
-    for (int i = 0; i < TerrainTile::SubtileSize; i++)
+bool TreeEffect::BuildEffect(glm::ivec2 subtileId, const SubTile* tile, TreeEffectData* treeEffect)
+{
+    if (tile->typeIndex.GetPixelCount(TerrainTypes::TREES) == 0)
     {
-        for (int j = 0; j < TerrainTile::SubtileSize; j++)
+        return false;
+    }
+
+    // Visit only the tree pixels.
+    std::vector<TreeInstance> instances;
+    std::vector<int> instanceArchetypes;
+    EffectRandom random(subtileId, EffectRandom::TREES);
+    tile->typeIndex.ForEachPixel(tile->packedTypes, TerrainTypes::TREES, [&](int i, int j)
+    {
+        // TOOD configurable density
+        if (random.Float() <= 0.90f)
         {
-            // TOOD configurable density
-            int pixelId = tile->GetPixelId(glm::ivec2(i, j));
-            if (tile->type[pixelId] == TerrainTypes::TREES && glm::linearRand(0.0f, 1.0f) > 0.90f)
-            {
-                ++treesInRegion;
-                if (!hasTreeEffect)
-                {
-                    treeEffect = new TreeEffectData();
-                    hasTreeEffect = true;
-                }
-
-                float height = tile->heightmap[i + j * TerrainTile::SubtileSize];
-                glm::vec3 bottomPos = glm::vec3((float)i + glm::linearRand(-1.0f, 1.0f), (float)j + glm::linearRand(-1.0f, 1.0f), height);
-
-                // Copy over a cached tree into this location.
-                const TreeCacheData& tree = cachedTrees[glm::linearRand(0, (int)(cachedTrees.size() - 1))];
-
-                // Append the vectors that can be appended.
-                treeEffect->treeTrunks.vertices.colors.insert(treeEffect->treeTrunks.vertices.colors.begin(), tree.branchColors.begin(), tree.branchColors.end());
-                treeEffect->treeTrunks.vertices.ids.insert(treeEffect->treeTrunks.vertices.ids.begin(), tree.branchThicknesses.begin(), tree.branchThicknesses.end());
-                treeEffect->treeLeaves.vertices.colors.insert(treeEffect->treeLeaves.vertices.colors.begin(), tree.leafColors.begin(), tree.leafColors.end());
-                
-                // Translate those elements that cannot be.
-                for (unsigned int i = 0; i < tree.branches.size(); i++)
-                {
-                    treeEffect->treeTrunks.vertices.positions.push_back(tree.branches[i] + bottomPos);
-                }
-
-                for (unsigned int i = 0; i < tree.leaves.size(); i++)
-                {
-                    treeEffect->treeLeaves.vertices.positions.push_back(tree.leaves[i] + bottomPos);
-                }
-            }
+            return;
         }
+
+        float height = tile->GetHeight(glm::ivec2(i, j));
+        glm::vec2 treeOffset = random.Vec2(glm::vec2(-1.0f), glm::vec2(1.0f));
+
+        TreeInstance instance;
+        instance.position = glm::vec3((float)i + treeOffset.x, (float)j + treeOffset.y, height);
+        instanceArchetypes.push_back(random.Int(0, (int)(archetypes.size() - 1)));
+        instance.rotation = random.Float(0.0f, 6.2831853f);
+        instance.scale = random.Float(0.85f, 1.15f);
+        instances.push_back(instance);
+    });
+
+    if (instances.empty())
+    {
+        return false;
+    }
+
+    // Sort the instances by archetype (a counting sort, as there are few archetypes) so each archetype's trees are drawn together.
+    std::vector<int> archetypeStarts(archetypes.size() + 1, 0);
+    for (int archetype : instanceArchetypes)
+    {
+        ++archetypeStarts[archetype + 1];
+    }
+
+    for (unsigned int i = 0; i < archetypes.size(); i++)
+    {
+        int instanceCount = archetypeStarts[i + 1];
+        archetypeStarts[i + 1] += archetypeStarts[i];
+        if (instanceCount != 0)
+        {
+            TreeGroup group;
+            group.archetype = (int)i;
+            group.firstInstance = archetypeStarts[i];
+            group.instanceCount = instanceCount;
+            treeEffect->groups.push_back(group);
+        }
+    }
+
+    treeEffect->instances.resize(instances.size());
+    for (unsigned int i = 0; i < instances.size(); i++)
+    {
+        treeEffect->instances[archetypeStarts[instanceArchetypes[i]]++] = instances[i];
     }
 
-    if (hasTreeEffect)
+    return true;
+}
+
+void TreeEffect::UploadEffect(TreeEffectData* treeEffect)
+{
+    treeEffect->instanceBuffer = resourcePool->AcquireBuffer(treeEffect->instances.size() * sizeof(TreeInstance));
+    resourcePool->SetBufferData(treeEffect->instanceBuffer, treeEffect->instances.size() * sizeof(TreeInstance), &treeEffect->instances[0], GL_STATIC_DRAW);
+
+    stats.tilesLoaded++;
+    stats.treesLoaded += (long)treeEffect->instances.size();
+    stats.instanceBytesLoaded += (long)GetMemoryUsage(*treeEffect);
+    for (const TreeGroup& group : treeEffect->groups)
     {
-        Logger::Log("Parsed ", treesInRegion, " trees in [", subtileId.x, ", ", subtileId.y, "].");
-
-        // Tree trunk and leave vertex data.
-        glGenVertexArrays(1, &treeEffect->treeTrunks.vao);
-        glBindVertexArray(treeEffect->treeTrunks.vao);
-        glGenBuffers(1, &treeEffect->treeTrunks.positionBuffer);
-        glGenBuffers(1, &treeEffect->treeTrunks.colorBuffer);
-        glGenBuffers(1, &treeEffect->treeTrunks.idBuffer);
-
-        Logger::Log("Parsed ", treeEffect->treeTrunks.vertices.positions.size() / 2, " tree trunks.");
-        treeEffect->treeTrunks.vertices.TransferPositionToOpenGl(treeEffect->treeTrunks.positionBuffer);
-        treeEffect->treeTrunks.vertices.TransferIdsToOpenGl(treeEffect->treeTrunks.idBuffer);
-        treeEffect->treeTrunks.vertices.TransferColorToOpenGl(treeEffect->treeTrunks.colorBuffer);
-
-        glGenVertexArrays(1, &treeEffect->treeLeaves.vao);
-        glBindVertexArray(treeEffect->treeLeaves.vao);
-        glGenBuffers(1, &treeEffect->treeLeaves.positionBuffer);
-        glGenBuffers(1, &treeEffect->treeLeaves.colorBuffer);
-
-        Logger::Log("Parsed ", treeEffect->treeLeaves.vertices.positions.size() / 2, " tree leaves.");
-        treeEffect->treeLeaves.vertices.TransferPositionToOpenGl(treeEffect->treeLeaves.positionBuffer);
-        treeEffect->treeLeaves.vertices.TransferColorToOpenGl(treeEffect->treeLeaves.colorBuffer);
-
-        *effectData = treeEffect;
+        stats.copiedBytesLoaded += (long)(group.instanceCount * archetypes[group.archetype].copiedByteSize);
     }
+}
 
-    return hasTreeEffect;
+void TreeEffect::DiscardEffect(TreeEffectData* treeEffect)
+{
+    // The trees are only in the effect itself until uploaded.
 }
 
-void TreeEffect::UnloadEffect(void* effectData)
+void TreeEffect::UnloadEffect(TreeEffectData* treeEffect)
 {
-    TreeEffectData* treeEffect = (TreeEffectData*)effectData;
-    glDeleteVertexArrays(1, &treeEffect->treeTrunks.vao);
-    glDeleteBuffers(1, &treeEffect->treeTrunks.positionBuffer);
-    glDeleteBuffers(1, &treeEffect->treeTrunks.colorBuffer);
-    glDeleteBuffers(1, &treeEffect->treeTrunks.idBuffer);
+    resourcePool->RetireBuffer(treeEffect->instanceBuffer, treeEffect->instances.size() * sizeof(TreeInstance));
+}
 
-    glDeleteVertexArrays(1, &treeEffect->treeLeaves.vao);
-    glDeleteBuffers(1, &treeEffect->treeLeaves.positionBuffer);
-    glDeleteBuffers(1, &treeEffect->treeLeaves.colorBuffer);
+size_t TreeEffect::GetMemoryUsage(const TreeEffectData& treeEffect) const
+{
+    // The instances are also in an OpenGL buffer. The archetypes are shared by every subtile, so aren't counted here.
+    return 2 * treeEffect.instances.size() * sizeof(TreeInstance) + treeEffect.groups.size() * sizeof(TreeGroup);
+}
 
-    delete treeEffect;
+unsigned int TreeEffect::GetPlacementChecksum(const TreeEffectData& treeEffect) const
+{
+    unsigned int checksum = AddToChecksum(ChecksumBasis, treeEffect.instances);
+    return AddToChecksum(checksum, treeEffect.groups);
 }
 
-void TreeEffect::Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds)
+void TreeEffect::Simulate(const glm::ivec2 subtileId, TreeEffectData* treeEffect, float elapsedSeconds)
 {
     // TODO wave the trees slightly over time.
 }
 
-void TreeEffect::Render(void* effectData, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
+void TreeEffect::SetFirstInstance(int firstInstance)
+{
+    const GLubyte* offset = (const GLubyte*)nullptr + firstInstance * sizeof(TreeInstance);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(TreeInstance), offset + offsetof(TreeInstance, position));
+    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(TreeInstance), offset + offsetof(TreeInstance, scale));
+}
+
+void TreeEffect::Render(TreeEffectData* treeEffect, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix)
 {
     sf::Clock clock;
-    TreeEffectData* treeEffect = (TreeEffectData*)effectData;
+    glm::mat4 mvMatrix = viewMatrix * modelMatrix;
 
     // Render trunks.
     glLineWidth(2.0f);
     glUseProgram(trunkProgram.programId);
-    glBindVertexArray(treeEffect->treeTrunks.vao);
+    glBindVertexArray(trunkVao);
+    glBindBuffer(GL_ARRAY_BUFFER, treeEffect->instanceBuffer);
 
     glUniformMatrix4fv(trunkProgram.projMatrixLocation, 1, GL_FALSE, &projectionMatrix[0][0]);
-    glUniformMatrix4fv(trunkProgram.mvMatrixLocation, 1, GL_FALSE, &(viewMatrix * modelMatrix)[0][0]);
+    glUniformMatrix4fv(trunkProgram.mvMatrixLocation, 1, GL_FALSE, &mvMatrix[0][0]);
+
+    for (const TreeGroup& group : treeEffect->groups)
+    {
+        const TreeArchetype& archetype = archetypes[group.archetype];
+        SetFirstInstance(group.firstInstance);
+        glDrawArraysInstanced(GL_LINES, archetype.firstTrunkVertex, archetype.trunkVertexCount, group.instanceCount);
+        stats.trunksRendered += group.instanceCount * archetype.trunkVertexCount / 2;
+    }
 
-    glDrawArrays(GL_LINES, 0, treeEffect->treeTrunks.vertices.positions.size());
     glLineWidth(1.0f);
 
     // Render leaves.
     glUseProgram(leafProgram.programId);
-    glBindVertexArray(treeEffect->treeLeaves.vao);
+    glBindVertexArray(leafVao);
 
     glUniformMatrix4fv(leafProgram.projMatrixLocation, 1, GL_FALSE, &projectionMatrix[0][0]);
-    glUniformMatrix4fv(leafProgram.mvMatrixLocation, 1, GL_FALSE, &(viewMatrix * modelMatrix)[0][0]);
+    glUniformMatrix4fv(leafProgram.mvMatrixLocation, 1, GL_FALSE, &mvMatrix[0][0]);
 
-    glDrawArrays(GL_POINTS, 0, treeEffect->treeLeaves.vertices.positions.size());
+    for (const TreeGroup& group : treeEffect->groups)
+    {
+        const TreeArchetype& archetype = archetypes[group.archetype];
+        SetFirstInstance(group.firstInstance);
+        glDrawArraysInstanced(GL_POINTS, archetype.firstLeafVertex, archetype.leafVertexCount, group.instanceCount);
+        stats.leavesRendered += group.instanceCount * archetype.leafVertexCount;
+    }
 
     stats.usRenderTime += (long)clock.getElapsedTime().asMicroseconds();
-    stats.trunksRendered += treeEffect->treeTrunks.vertices.positions.size() / 2;
-    stats.leavesRendered += treeEffect->treeLeaves.vertices.positions.size();
+    stats.treesRendered += (long)treeEffect->instances.size();
+    stats.drawCalls += 2 * (long)treeEffect->groups.size();
     stats.tilesRendered++;
 }
 
 void TreeEffect::LogStats()
 {
-    Logger::Log("Tree Rendering: ", stats.usRenderTime, " us, ", stats.trunksRendered, " trunks, ", stats.leavesRendered, " leaves, ", stats.tilesRendered, " tiles.");
+    Logger::Log("Tree Rendering: ", stats.usRenderTime, " us, ", stats.treesRendered, " trees, ", stats.trunksRendered, " trunks, ", stats.leavesRendered, " leaves, ",
+        stats.tilesRendered, " tiles, ", stats.drawCalls, " draw calls.");
+    Logger::Log("Tree Loading: ", stats.treesLoaded, " trees in ", stats.tilesLoaded, " tiles, using ", stats.instanceBytesLoaded, " bytes instead of ",
+        stats.copiedBytesLoaded, " bytes of copied tree vertices.");
     stats.Reset();
 }
+
+TreeEffect::~TreeEffect()
+{
+    GLuint buffers[] = { trunkPositionBuffer, trunkColorBuffer, trunkThicknessBuffer, leafPositionBuffer, leafColorBuffer };
+    glDeleteBuffers(5, buffers);
+
+    GLuint vertexArrays[] = { trunkVao, leafVao };
+    glDeleteVertexArrays(2, vertexArrays);
+}
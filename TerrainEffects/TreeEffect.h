@@ -1,23 +1,52 @@
 #pragma once
 #include "Cache\TreeCache.h"
 #include "Generators\TreeGenerator.h"
+#include "Managers\GlResourcePool.h"
 #include "Utils\Vertex.h"
-#include "TerrainEffect.h"
+#include "PooledTerrainEffect.h"
 
-struct VertexData
+// A tree drawn as an instance of one of the shared tree archetypes, relative to the subtile origin.
+struct TreeInstance
 {
-    GLuint vao;
-    GLuint positionBuffer;
-    GLuint colorBuffer;
-    GLuint idBuffer;
+    glm::vec3 position;
 
-    universalVertices vertices;
+    // Radians about the Z axis.
+    float rotation;
+    float scale;
+};
+
+// The instances of one archetype, which are drawn together.
+struct TreeGroup
+{
+    int archetype;
+    int firstInstance;
+    int instanceCount;
 };
 
 struct TreeEffectData
 {
-    VertexData treeTrunks;
-    VertexData treeLeaves;
+    // Sorted by archetype, with a group for each archetype used.
+    std::vector<TreeInstance> instances;
+    std::vector<TreeGroup> groups;
+
+    GLuint instanceBuffer;
+
+    TreeEffectData()
+        : instances(), groups(), instanceBuffer(0)
+    {
+    }
+};
+
+// Where the vertices of an archetype are in the shared trunk and leaf buffers.
+struct TreeArchetype
+{
+    int firstTrunkVertex;
+    int trunkVertexCount;
+    int firstLeafVertex;
+    int leafVertexCount;
+
+    // The bytes each tree used back when its vertices were copied into the subtile, on both the CPU and GPU. Only used for logging.
+    size_t copiedByteSize;
 };
 
 struct TreeProgram
@@ -30,12 +59,20 @@ struct TreeProgram
 
 struct TreeStats
 {
+    long treesRendered;
     long trunksRendered;
     long leavesRendered;
 
     long tilesRendered;
+    long drawCalls;
     long usRenderTime;
 
+    // Counted as effects are uploaded, as they're built on the build threads.
+    long tilesLoaded;
+    long treesLoaded;
+    long instanceBytesLoaded;
+    long copiedBytesLoaded;
+
     TreeStats()
     {
         Reset();
@@ -43,31 +80,63 @@ struct TreeStats
 
     void Reset()
     {
+        treesRendered = 0;
         trunksRendered = 0;
         leavesRendered = 0;
         tilesRendered = 0;
+        drawCalls = 0;
 
         usRenderTime = 0;
+
+        tilesLoaded = 0;
+        treesLoaded = 0;
+        instanceBytesLoaded = 0;
+        copiedBytesLoaded = 0;
     }
 };
 
-class TreeEffect : public TerrainEffect
+// Draws trees as instances of a set of generated tree archetypes.
+//  The archetype vertices are uploaded once, so each subtile only holds the position, rotation, and scale of its trees, and draws each archetype it uses with one instanced call.
+class TreeEffect : public PooledTerrainEffect<TreeEffectData>
 {
     TreeCache treeCache;
-    std::vector<TreeCacheData> cachedTrees;
+    std::vector<TreeArchetype> archetypes;
 
     TreeProgram trunkProgram;
     TreeProgram leafProgram;
     TreeGenerator treeGenerator;
 
+    // The vertices of every archetype, shared by all subtiles.
+    GLuint trunkVao;
+    GLuint trunkPositionBuffer;
+    GLuint trunkColorBuffer;
+    GLuint trunkThicknessBuffer;
+    GLuint leafVao;
+    GLuint leafPositionBuffer;
+    GLuint leafColorBuffer;
+
+    GlResourcePool* resourcePool;
+
+    // Uploads the vertices of the generated trees into the shared buffers, recording where each archetype is.
+    void UploadArchetypes(const std::vector<TreeCacheData>& trees);
+
+    // Points the instance attributes of the bound vertex array at an instance of the bound instance buffer.
+    //  Without base instance drawing (OpenGL 4.2) this is how each archetype's instanced draw starts at its own group.
+    static void SetFirstInstance(int firstInstance);
+
     static TreeStats stats;
 
 public:
-    TreeEffect(const std::string& cacheFolder);
+    TreeEffect(GlResourcePool* resourcePool, const std::string& cacheFolder);
     virtual bool LoadBasics(ShaderFactory* shaderManager) override;
-    virtual bool LoadEffect(glm::ivec2 subtileId, void** effectData, SubTile* tile) override;
-    virtual void UnloadEffect(void* effectData) override;
-    virtual void Simulate(const glm::ivec2 subtileId, void* effectData, float elapsedSeconds) override;
-    virtual void Render(void* effectData, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
+    virtual bool BuildEffect(glm::ivec2 subtileId, const SubTile* tile, TreeEffectData* treeEffect) override;
+    virtual void UploadEffect(TreeEffectData* treeEffect) override;
+    virtual void DiscardEffect(TreeEffectData* treeEffect) override;
+    virtual void UnloadEffect(TreeEffectData* treeEffect) override;
+    virtual size_t GetMemoryUsage(const TreeEffectData& treeEffect) const override;
+    virtual unsigned int GetPlacementChecksum(const TreeEffectData& treeEffect) const override;
+    virtual void Simulate(const glm::ivec2 subtileId, TreeEffectData* treeEffect, float elapsedSeconds) override;
+    virtual void Render(TreeEffectData* treeEffect, const glm::mat4& perspectiveMatrix, const glm::mat4& viewMatrix, const glm::mat4& modelMatrix) override;
     virtual void LogStats() override;
-};
\ No newline at end of file
+    virtual ~TreeEffect();
+};
@@ -0,0 +1,197 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "logging\Logger.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr), fileSize(0), granularity(0)
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    granularity = systemInfo.dwAllocationGranularity;
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size))
+    {
+        Logger::LogError("Unable to determine the size of '", path, "': ", GetLastError());
+        Close();
+        return false;
+    }
+
+    fileSize = (unsigned long long)size.QuadPart;
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+    {
+        Logger::LogError("Unable to memory-map '", path, "': ", GetLastError());
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool MappedFile::IsOpen() const
+{
+    return mappingHandle != nullptr;
+}
+
+void MappedFile::Close()
+{
+    if (mappingHandle != nullptr)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+    }
+
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    fileSize = 0;
+}
+
+bool MappedFile::MapView(unsigned long long offset, size_t size, MappedView* view) const
+{
+    if (!IsOpen() || offset + size > fileSize)
+    {
+        return false;
+    }
+
+    unsigned long long alignedOffset = offset - (offset % granularity);
+    size_t mappedSize = (size_t)(offset - alignedOffset) + size;
+    void* base = MapViewOfFile(mappingHandle, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), mappedSize);
+    if (base == nullptr)
+    {
+        Logger::LogError("Unable to map a view of ", size, " bytes at ", offset, ": ", GetLastError());
+        return false;
+    }
+
+    view->base = base;
+    view->mappedSize = mappedSize;
+    view->data = (const unsigned char*)base + (offset - alignedOffset);
+    view->size = size;
+    return true;
+}
+
+void MappedFile::UnmapView(MappedView* view)
+{
+    if (view->base != nullptr)
+    {
+        UnmapViewOfFile(view->base);
+    }
+
+    *view = MappedView();
+}
+
+#else
+
+MappedFile::MappedFile()
+    : fileDescriptor(-1), fileSize(0), granularity((unsigned long long)sysconf(_SC_PAGESIZE))
+{
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+    fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor == -1)
+    {
+        return false;
+    }
+
+    struct stat fileStats;
+    if (fstat(fileDescriptor, &fileStats) != 0)
+    {
+        Logger::LogError("Unable to determine the size of '", path, "'.");
+        Close();
+        return false;
+    }
+
+    fileSize = (unsigned long long)fileStats.st_size;
+    return true;
+}
+
+bool MappedFile::IsOpen() const
+{
+    return fileDescriptor != -1;
+}
+
+void MappedFile::Close()
+{
+    if (fileDescriptor != -1)
+    {
+        close(fileDescriptor);
+        fileDescriptor = -1;
+    }
+
+    fileSize = 0;
+}
+
+bool MappedFile::MapView(unsigned long long offset, size_t size, MappedView* view) const
+{
+    if (!IsOpen() || offset + size > fileSize)
+    {
+        return false;
+    }
+
+    unsigned long long alignedOffset = offset - (offset % granularity);
+    size_t mappedSize = (size_t)(offset - alignedOffset) + size;
+    void* base = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fileDescriptor, (off_t)alignedOffset);
+    if (base == MAP_FAILED)
+    {
+        Logger::LogError("Unable to map a view of ", size, " bytes at ", offset, ".");
+        return false;
+    }
+
+    view->base = base;
+    view->mappedSize = mappedSize;
+    view->data = (const unsigned char*)base + (offset - alignedOffset);
+    view->size = size;
+    return true;
+}
+
+void MappedFile::UnmapView(MappedView* view)
+{
+    if (view->base != nullptr)
+    {
+        munmap(view->base, view->mappedSize);
+    }
+
+    *view = MappedView();
+}
+
+#endif
+
+unsigned long long MappedFile::GetSize() const
+{
+    return fileSize;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
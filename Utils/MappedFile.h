@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// A read-only window into a memory-mapped file. Pages are only read from disk when first touched.
+struct MappedView
+{
+    // The start of the mapping itself, which may begin before the requested offset for alignment.
+    void* base;
+    size_t mappedSize;
+
+    const unsigned char* data;
+    size_t size;
+
+    MappedView()
+        : base(nullptr), mappedSize(0), data(nullptr), size(0)
+    {
+    }
+};
+
+// Read-only memory-mapped access to a single file. Views may be mapped and unmapped from any thread.
+class MappedFile
+{
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    unsigned long long fileSize;
+    unsigned long long granularity;
+
+public:
+    MappedFile();
+
+    bool Open(const std::string& path);
+    bool IsOpen() const;
+    void Close();
+
+    unsigned long long GetSize() const;
+
+    // Maps a view of the file. The offset does not need to be aligned.
+    bool MapView(unsigned long long offset, size_t size, MappedView* view) const;
+    static void UnmapView(MappedView* view);
+
+    virtual ~MappedFile();
+};
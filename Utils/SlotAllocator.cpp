@@ -0,0 +1,84 @@
+#include "SlotAllocator.h"
+
+SlotAllocator::SlotAllocator()
+    : generations(), freeSlots(), retiredSlots(0)
+{
+}
+
+void SlotAllocator::Initialize(int capacity, int retireFrames)
+{
+    int retiredSlot;
+    while (retiredSlots.TryPop(&retiredSlot))
+    {
+    }
+
+    retiredSlots.SetDelayFrames(retireFrames);
+    generations.assign(capacity, 0);
+
+    // Hand out the lowest slots first.
+    freeSlots.clear();
+    for (int slot = capacity - 1; slot >= 0; slot--)
+    {
+        freeSlots.push_back(slot);
+    }
+}
+
+SlotHandle SlotAllocator::Allocate()
+{
+    if (freeSlots.empty())
+    {
+        return SlotHandle();
+    }
+
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return SlotHandle(slot, generations[slot]);
+}
+
+bool SlotAllocator::Free(const SlotHandle& handle)
+{
+    if (!IsCurrent(handle))
+    {
+        return false;
+    }
+
+    ++generations[handle.slot];
+    retiredSlots.Retire(handle.slot);
+    return true;
+}
+
+bool SlotAllocator::IsCurrent(const SlotHandle& handle) const
+{
+    return handle.slot >= 0 && handle.slot < (int)generations.size() && generations[handle.slot] == handle.generation;
+}
+
+bool SlotAllocator::IsRetiring(int slot) const
+{
+    return retiredSlots.Contains(slot);
+}
+
+void SlotAllocator::AdvanceFrame()
+{
+    retiredSlots.AdvanceFrame();
+
+    int slot;
+    while (retiredSlots.TryPopExpired(&slot))
+    {
+        freeSlots.push_back(slot);
+    }
+}
+
+int SlotAllocator::GetCapacity() const
+{
+    return (int)generations.size();
+}
+
+int SlotAllocator::GetRetiringCount() const
+{
+    return (int)retiredSlots.Size();
+}
+
+int SlotAllocator::GetUsedCount() const
+{
+    return (int)generations.size() - (int)freeSlots.size();
+}
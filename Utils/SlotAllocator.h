@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include "Data\RetirementQueue.h"
+
+// A slot handed out by a SlotAllocator. The generation changes each time the slot is freed, so a handle kept after that can be detected.
+struct SlotHandle
+{
+    int slot;
+    unsigned int generation;
+
+    SlotHandle()
+        : slot(-1), generation(0)
+    {
+    }
+
+    SlotHandle(int slot, unsigned int generation)
+        : slot(slot), generation(generation)
+    {
+    }
+
+    bool IsValid() const
+    {
+        return slot != -1;
+    }
+};
+
+// Hands out a fixed number of slots. Freed slots are held back for a number of frames before they're handed out again,
+//  so a slot isn't overwritten while frames that read it may still be in flight on the GPU.
+class SlotAllocator
+{
+    std::vector<unsigned int> generations;
+    std::vector<int> freeSlots;
+    RetirementQueue<int> retiredSlots;
+
+public:
+    SlotAllocator();
+
+    void Initialize(int capacity, int retireFrames);
+
+    // Returns an invalid handle if every slot is in use or still retiring.
+    SlotHandle Allocate();
+
+    // Starts retiring the slot. Returns false (doing nothing) if the handle is stale, as the slot was already freed.
+    bool Free(const SlotHandle& handle);
+
+    // Returns true if the handle refers to a slot that hasn't been freed since it was allocated.
+    bool IsCurrent(const SlotHandle& handle) const;
+    bool IsRetiring(int slot) const;
+
+    // Returns the slots that finished retiring to the free list.
+    void AdvanceFrame();
+
+    int GetCapacity() const;
+    int GetRetiringCount() const;
+
+    // Allocated and retiring slots, which aren't available.
+    int GetUsedCount() const;
+};
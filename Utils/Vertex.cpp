@@ -57,6 +57,12 @@ void universalVertices::Reset()
     indices.clear();
 }
 
+size_t universalVertices::GetByteSize() const
+{
+    return positions.size() * sizeof(glm::vec3) + colors.size() * sizeof(glm::vec3) + barycentrics.size() * sizeof(glm::vec4) +
+        uvs.size() * sizeof(glm::vec2) + ids.size() * sizeof(unsigned int) + indices.size() * sizeof(unsigned int);
+}
+
 void universalVertices::AddColorTextureVertex(glm::vec3 position, glm::vec3 color, glm::vec2 uv)
 {
     positions.push_back(position);
@@ -39,6 +39,9 @@ public:
     // Clears all the data in the universal vertices, minus IDs.
     void Reset();
 
+    // Returns the number of bytes of vertex data held on the CPU.
+    size_t GetByteSize() const;
+
     // Adds a position, color, UV vertex.
     void AddColorTextureVertex(glm::vec3 position, glm::vec3 color, glm::vec2 uv);
 
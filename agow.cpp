@@ -26,7 +26,7 @@ Constants agow::Constant;
 PhysicsOps agow::PhysicsOp;
 
 agow::agow()
-    : graphicsConfig("config/graphics.txt"), keyBindingConfig("config/keyBindings.txt"), physicsConfig("config/physics.txt"),
+    : graphicsConfig("config/graphics.txt"), keyBindingConfig("config/keyBindings.txt"), physicsConfig("config/physics.txt"), terrainConfig("config/terrain.txt"),
       physics(), shaderManager(), imageManager(), modelManager(&imageManager),
       regionManager(&shaderManager, &modelManager, &physics, "ContourTiler/rasters", glm::ivec2(5, 17), glm::ivec2(40, 52), 10), // All pulled from the Contour tiler, TODO configurable, make distance ~10
       scenery(), player(&modelManager, &physics), npcManager(&player, &physics)
@@ -105,6 +105,11 @@ Constants::Status agow::Initialize()
         return Constants::Status::BAD_GLFW;
     }
 
+    return LoadConfiguration();
+}
+
+Constants::Status agow::LoadConfiguration()
+{
     Logger::Log("Loading graphics config file...");
     if (!graphicsConfig.ReadConfiguration())
     {
@@ -126,6 +131,13 @@ Constants::Status agow::Initialize()
         return Constants::Status::BAD_CONFIG;
     }
 
+    Logger::Log("Loading terrain config file...");
+    if (!terrainConfig.ReadConfiguration())
+    {
+        Logger::Log("Bad terrain config file!");
+        return Constants::Status::BAD_CONFIG;
+    }
+
     Logger::Log("Configuration loaded!");
 
     return Constants::Status::OK;
@@ -354,7 +366,7 @@ void agow::Update(float currentGameTime, float frameTime)
 
     scenery.Update(frameTime);
 
-    regionManager.UpdateVisibleRegion(player.GetPosition(), player.Get2DOrientation(), &physics);
+    regionManager.UpdateVisibleRegion(player.GetPosition(), player.Get2DOrientation(), player.GetVelocity(), &physics);
     regionManager.SimulateVisibleRegions(currentGameTime, frameTime);
 
     // Update useful statistics that are fancier than the standard GUI
@@ -405,7 +417,7 @@ void agow::Render(GLFWwindow* window, glm::mat4& viewMatrix)
     }
 }
 
-Constants::Status agow::Run()
+Constants::Status agow::CreateGameWindow(GLFWwindow** window)
 {
     // 24 depth bits, 8 stencil bits, 8x AA, major version 4.
     Logger::Log("Graphics Initializing...");
@@ -418,16 +430,16 @@ Constants::Status agow::Run()
     glfwWindowHint(GLFW_SAMPLES, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    GLFWwindow* window = glfwCreateWindow(GraphicsConfig::ScreenWidth, GraphicsConfig::ScreenHeight, "Advanced Graphics-Open World", monitor, nullptr);
-    if (!window)
+    *window = glfwCreateWindow(GraphicsConfig::ScreenWidth, GraphicsConfig::ScreenHeight, "Advanced Graphics-Open World", monitor, nullptr);
+    if (!*window)
     {
         Logger::LogError("Could not create the GLFW window!");
         return Constants::Status::BAD_GLFW;
     }
 
-    glfwMakeContextCurrent(window);
+    glfwMakeContextCurrent(*window);
     glfwSwapInterval(1);
-    Input::Setup(window, GraphicsConfig::ScreenWidth, GraphicsConfig::ScreenHeight);
+    Input::Setup(*window, GraphicsConfig::ScreenWidth, GraphicsConfig::ScreenHeight);
 
     // Setup GLEW
     GLenum err = glewInit();
@@ -445,6 +457,17 @@ Constants::Status agow::Run()
     }
 
     Logger::Log("Graphics Initialized!");
+    return Constants::Status::OK;
+}
+
+Constants::Status agow::Run()
+{
+    GLFWwindow* window;
+    Constants::Status windowStatus = CreateGameWindow(&window);
+    if (windowStatus != Constants::Status::OK)
+    {
+        return windowStatus;
+    }
 
     sf::Clock clock;
     sf::Clock frameClock;
@@ -493,6 +516,121 @@ void agow::UnloadGraphics()
     PlasmaWeapon::UnloadGraphics();
 }
 
+Constants::Status agow::BuildTerrainPack()
+{
+    Logger::Log("Building the terrain pack...");
+    if (!regionManager.GetTerrainManager().BuildTerrainPack())
+    {
+        Logger::LogError("Unable to build the terrain pack!");
+        return Constants::Status::BAD_TERRAIN;
+    }
+
+    return Constants::Status::OK;
+}
+
+Constants::Status agow::ConvertTerrainRasters()
+{
+    Logger::Log("Compressing the terrain rasters...");
+    if (!regionManager.GetTerrainManager().ConvertTerrainRasters())
+    {
+        Logger::LogError("Unable to compress the terrain rasters!");
+        return Constants::Status::BAD_TERRAIN;
+    }
+
+    return Constants::Status::OK;
+}
+
+void agow::RenderBenchmarkFrame(GLFWwindow* window, float gameTime, float frameTime)
+{
+    glfwPollEvents();
+    glm::mat4 viewMatrix = player.GetViewMatrix();
+
+    physics.Step(frameTime);
+    Update(gameTime, frameTime);
+    Render(window, viewMatrix);
+    glfwSwapBuffers(window);
+
+    // Include the GPU time of the frame.
+    glFinish();
+}
+
+Constants::Status agow::RunBenchmark(const Benchmark& benchmark, const std::vector<std::string>& arguments)
+{
+    Constants::Status status = Constants::Status::OK;
+    GLFWwindow* window = nullptr;
+    bool hasWindow = benchmark.setup == BenchmarkSetup::HIDDEN_WINDOW || benchmark.setup == BenchmarkSetup::GAME_WINDOW;
+    if (hasWindow)
+    {
+        status = Initialize();
+        if (status == Constants::Status::OK)
+        {
+            // The effect generators place models that live in OpenGL, so benchmarks that draw no frames still need a window.
+            glfwWindowHint(GLFW_VISIBLE, benchmark.setup == BenchmarkSetup::GAME_WINDOW ? GL_TRUE : GL_FALSE);
+            status = CreateGameWindow(&window);
+        }
+
+        if (status != Constants::Status::OK)
+        {
+            Deinitialize();
+            return status;
+        }
+
+        // Frames aren't limited to the refresh rate, so the frame times are the actual cost of each frame.
+        glfwSwapInterval(0);
+    }
+    else if (benchmark.setup != BenchmarkSetup::NONE)
+    {
+        status = LoadConfiguration();
+        if (status != Constants::Status::OK)
+        {
+            return status;
+        }
+
+        bool hasTerrain = benchmark.setup == BenchmarkSetup::TERRAIN || benchmark.setup == BenchmarkSetup::TERRAIN_PHYSICS;
+        if (hasTerrain && !regionManager.GetTerrainManager().StartStreaming())
+        {
+            return Constants::Status::BAD_TERRAIN;
+        }
+
+        if (benchmark.setup == BenchmarkSetup::TERRAIN_PHYSICS && !physics.LoadPhysics(&debugDrawer))
+        {
+            return Constants::Status::BAD_PHYSICS;
+        }
+    }
+
+    BenchmarkContext context;
+    context.regionManager = &regionManager;
+    context.physics = &physics;
+    context.arguments = arguments;
+    if (hasWindow)
+    {
+        context.renderFrame = [this, window](float gameTime, float frameTime) { RenderBenchmarkFrame(window, gameTime, frameTime); };
+    }
+
+    Logger::Log("Running ", benchmark.flag, "...");
+    bool isSuccessful = benchmark.run(context);
+
+    if (hasWindow)
+    {
+        UnloadGraphics();
+        glfwDestroyWindow(window);
+        Deinitialize();
+    }
+    else if (benchmark.setup == BenchmarkSetup::TERRAIN_PHYSICS)
+    {
+        regionManager.CleanupPhysics(&physics);
+        physics.UnloadPhysics();
+    }
+
+    if (!isSuccessful)
+    {
+        Logger::LogError(benchmark.failureMessage != nullptr ? benchmark.failureMessage : "The benchmark failed!");
+        return Constants::Status::BAD_TERRAIN;
+    }
+
+    return Constants::Status::OK;
+}
+
 void agow::Deinitialize()
 {
     UnloadPhysics();
@@ -514,17 +652,33 @@ int main(int argc, char* argv[])
 
     Constants::Status runStatus;
     std::unique_ptr<agow> agow(new agow());
+    const Benchmark* benchmark = nullptr;
 
-    // Run the application.
-    runStatus = agow->Initialize();
-    if (runStatus == Constants::Status::OK)
+    if (argc > 1 && std::string(argv[1]) == "--build-terrain-pack")
+    {
+        runStatus = agow->BuildTerrainPack();
+    }
+    else if (argc > 1 && std::string(argv[1]) == "--convert-terrain-rasters")
+    {
+        runStatus = agow->ConvertTerrainRasters();
+    }
+    else if (argc > 1 && (benchmark = Benchmarks::Find(argv[1])) != nullptr)
     {
-        runStatus = agow->Run();
-        agow->Deinitialize();
+        runStatus = agow->RunBenchmark(*benchmark, std::vector<std::string>(argv + 2, argv + argc));
     }
     else
     {
-        Logger::LogError("Could not initialize agow: ", runStatus);
+        // Run the application.
+        runStatus = agow->Initialize();
+        if (runStatus == Constants::Status::OK)
+        {
+            runStatus = agow->Run();
+            agow->Deinitialize();
+        }
+        else
+        {
+            Logger::LogError("Could not initialize agow: ", runStatus);
+        }
     }
 
     // Wait before closing for display purposes.
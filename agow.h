@@ -2,9 +2,11 @@
 #include <SFML\System.hpp>
 #include <vector>
 #include <glm\mat4x4.hpp>
+#include "Benchmarks\Benchmarks.h"
 #include "Config\GraphicsConfig.h"
 #include "Config\KeyBindingConfig.h"
 #include "Config\PhysicsConfig.h"
+#include "Config\TerrainConfig.h"
 #include "Data\Model.h"
 #include "Generators\BuildingGenerator.h"
 #include "Generators\RockGenerator.h"
@@ -35,6 +37,7 @@ class agow
     GraphicsConfig graphicsConfig;
     KeyBindingConfig keyBindingConfig;
     PhysicsConfig physicsConfig;
+    TerrainConfig terrainConfig;
 
     // Managers
     FontManager fontManager;
@@ -73,6 +76,12 @@ class agow
     // Renders the scene.
     void Render(GLFWwindow* window, glm::mat4& viewMatrix);
 
+    // Creates the game window and loads everything that needs OpenGL.
+    Constants::Status CreateGameWindow(GLFWwindow** window);
+
+    // Runs a single frame of the game from wherever the player is, waiting for the GPU to finish it.
+    void RenderBenchmarkFrame(GLFWwindow* window, float gameTime, float frameTime);
+
 public:
     // Used just for data storage.
     static Constants Constant;
@@ -84,6 +93,9 @@ public:
     // Initializes data that can be setup before an OpenGL context is created.
     Constants::Status Initialize();
 
+    // Reads the config files. Part of Initialize, and also needed by the offline modes that use the terrain or physics config.
+    Constants::Status LoadConfiguration();
+
     // Initializes generic OpenGL data after an OpenGL context is created.
     Constants::Status LoadGraphics();
 
@@ -93,6 +105,15 @@ public:
     // Runs the game loop.
     Constants::Status Run();
 
+    // Builds the terrain pack offline, without starting the game.
+    Constants::Status BuildTerrainPack();
+
+    // Compresses the terrain images into the format the terrain pack builder prefers, without starting the game.
+    Constants::Status ConvertTerrainRasters();
+
+    // Loads what a benchmark needs, runs it, then unloads everything again.
+    Constants::Status RunBenchmark(const Benchmark& benchmark, const std::vector<std::string>& arguments);
+
     // Unloads any OpenGL assets that were statically loaded.
     void UnloadGraphics();
 
@@ -1,16 +1,110 @@
 #version 400 core
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 color;
+// The heightmaps (normalized) and palette-packed types of the active subtiles. See TerrainTexturePool.
+uniform sampler2DArray terrainTexture;
+uniform usampler2DArray terrainType;
 
-out vec4 gs_color;
+// The subtile drawn: its world origin, texture pool layer, and the seed varying its blades.
+uniform vec2 subtileOrigin;
+uniform int subtileLayer;
+uniform uint seed;
+
+// Blades thin out past the full density distance, until none are left at the max distance. Must match GrassEffect::GetDensity.
+uniform vec3 cameraPosition;
+uniform float fullDensityDistance;
+uniform float maxDistance;
+
+uniform float windTime;
 
 uniform mat4 projMatrix;
-uniform mat4 mvMatrix;
+uniform mat4 viewMatrix;
+
+out vec4 fs_color;
+
+// The TerrainTypes::Palette index of GRASSLAND.
+const uint GRASSLAND = 4u;
+
+// Must match TerrainTile::SubtileSize and TerrainTile::MaxHeight.
+const int subtileSize = 100;
+const float depth = 900;
+
+// Each instance is a blade on one pixel. The stride shares no factors with the pixel count, so every pixel is visited once, in a scattered order.
+const uint bladeStride = 7919u;
+
+// Integer hash (lowbias32), well mixed for consecutive inputs.
+uint Hash(uint value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+// Returns the next random number of a blade, in [0, 1).
+float Random(inout uint state)
+{
+    state = Hash(state);
+    return float(state >> 8) * (1.0 / 16777216.0);
+}
 
-// Renders grass stalks for GRASSLAND areas.
+// Renders grass blades for GRASSLAND areas, without any vertex data.
 void main(void)
 {
-	gs_color = vec4(color, 0.8f);
-    gl_Position = projMatrix * mvMatrix * vec4(position.x, position.y, position.z, 1.0f);
+    uint pixelCount = uint(subtileSize * subtileSize);
+    uint pixelIndex = (uint(gl_InstanceID) * bladeStride + seed % pixelCount) % pixelCount;
+    ivec2 pixel = ivec2(int(pixelIndex) % subtileSize, int(pixelIndex) / subtileSize);
+
+    // Two 4-bit palette indices per texel, the even pixel in the low bits, as in terrainRender.fs.
+    uint packedTypes = texelFetch(terrainType, ivec3(pixel.x / 2, pixel.y, subtileLayer), 0).r;
+    uint type = (packedTypes >> uint((pixel.x & 1) * 4)) & 0xFu;
+
+    // The heightmap has a one pixel border.
+    float height = texelFetch(terrainTexture, ivec3(pixel + ivec2(1), subtileLayer), 0).r * depth;
+
+    // All three vertices of a blade draw the same numbers.
+    uint state = Hash(pixelIndex ^ seed);
+    vec2 jitter = vec2(Random(state), Random(state)) - vec2(0.5);
+    vec3 bottomPosition = vec3(subtileOrigin + vec2(pixel) + jitter, height);
+
+    // Enough blades are drawn for the nearest point of the subtile, so each blade is also thinned by its own distance to avoid seams between subtiles.
+    float density = 1.0 - clamp((distance(bottomPosition.xy, cameraPosition.xy) - fullDensityDistance) / max(maxDistance - fullDensityDistance, 1.0), 0.0, 1.0);
+    float bladeRank = float(gl_InstanceID) / float(subtileSize * subtileSize);
+    if (type != GRASSLAND || bladeRank >= density)
+    {
+        // Outside the clip volume, so the blade is never rasterized.
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        fs_color = vec4(0.0);
+        return;
+    }
+
+    vec3 bottomColor = vec3(0.0, 0.90 + Random(state) * 0.10, 0.0);
+    vec3 topColor = vec3(0.0, 0.50 + Random(state) * 0.30, 0.20 + Random(state) * 0.60);
+    vec2 lean = (vec2(Random(state), Random(state)) - vec2(0.5)) * 0.20;
+    float bladeHeight = 0.15 + 0.50 * Random(state);
+
+    // Gusts roll across the terrain along the wind direction, with each blade fluttering on its own.
+    const vec2 windDirection = vec2(0.8, 0.6);
+    float gust = sin(windTime * 1.7 - dot(bottomPosition.xy, windDirection) * 0.15) * 0.5 + 0.5;
+    float flutter = sin(windTime * 5.3 + Random(state) * 6.2831853) * 0.15;
+    vec2 wind = windDirection * (gust * 0.8 + flutter) * bladeHeight * 0.5;
+
+    // The base faces the camera, and the tip leans with the blade and the wind.
+    const float halfWidth = 0.04;
+    vec3 position;
+    if (gl_VertexID == 2)
+    {
+        position = bottomPosition + vec3(lean + wind, bladeHeight);
+        fs_color = vec4(topColor, 0.8);
+    }
+    else
+    {
+        vec2 toCamera = cameraPosition.xy - bottomPosition.xy;
+        vec2 side = normalize(vec2(-toCamera.y, toCamera.x) + vec2(0.0001, 0.0)) * (gl_VertexID == 0 ? -halfWidth : halfWidth);
+        position = bottomPosition + vec3(side, 0.0);
+        fs_color = vec4(bottomColor, 0.8);
+    }
+
+    gl_Position = projMatrix * viewMatrix * vec4(position, 1.0);
 }
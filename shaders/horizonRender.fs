@@ -0,0 +1,20 @@
+#version 400 core
+
+// The streamed terrain is drawn within the inner radius of the ring.
+uniform vec2 ringCenter;
+uniform float ringInnerRadius;
+
+smooth in vec2 world_position;
+smooth in vec3 fs_color;
+
+out vec4 color;
+
+void main(void)
+{
+    if (distance(world_position, ringCenter) < ringInnerRadius)
+    {
+        discard;
+    }
+
+    color = vec4(fs_color, 1.0f);
+}
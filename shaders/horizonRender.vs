@@ -0,0 +1,43 @@
+#version 400 core
+
+// The average height (normalized) and TerrainTypes::Palette index of each horizon sample. See TerrainPack.
+uniform sampler2D horizonHeights;
+uniform usampler2D horizonTypes;
+
+// The world position of the first sample, and the distance between samples.
+uniform vec2 origin;
+uniform float sampleSpacing;
+
+uniform mat4 projMatrix;
+uniform mat4 viewMatrix;
+
+smooth out vec2 world_position;
+smooth out vec3 fs_color;
+
+// Copied from terrainRender.fs, in palette order.
+const vec3 TYPE_COLORS[10] = vec3[](
+    vec3(245.0f / 255.0f,  244.0f / 255.0f,  253.0f / 255.0f),
+    vec3(140.0f / 255.0f,  115.0f / 255.0f,  115.0f / 255.0f),
+    vec3(22.0f / 255.0f,  137.0f / 255.0f,  10.0f / 255.0f),
+    vec3(185.0f / 255.0f,  122.0f / 255.0f,  87.0f / 255.0f),
+    vec3(122.0f / 255.0f,  243.0f / 255.0f,  129.0f / 255.0f),
+    vec3(192.0f / 255.0f,  192.0f / 255.0f,  192.0f / 255.0f),
+    vec3(170.0f / 255.0f,  34.0f / 255.0f,  181.0f / 255.0f),
+    vec3(255.0f / 255.0f,  255.0f / 255.0f,  128.0f / 255.0f),
+    vec3(121.0f / 255.0f,  121.0f / 255.0f,  255.0f / 255.0f),
+    vec3(0.0f / 255.0f,  0.0f / 255.0f,  179.0f / 255.0f));
+
+void main(void)
+{
+    // Must match TerrainTile::MaxHeight, as in terrainRender.te.
+    const float depth = 900;
+
+    // Each instance is a strip between a row of samples and the next, alternating between them.
+    ivec2 samplePosition = ivec2(gl_VertexID / 2, gl_InstanceID + gl_VertexID % 2);
+    float height = texelFetch(horizonHeights, samplePosition, 0).r * depth;
+    uint type = min(texelFetch(horizonTypes, samplePosition, 0).r, 9u);
+    
+    world_position = origin + vec2(samplePosition) * sampleSpacing;
+    fs_color = vec3(0.4f, 0.4f, 0.4f) * TYPE_COLORS[type];
+    gl_Position = projMatrix * viewMatrix * vec4(world_position, height, 1.0f);
+}
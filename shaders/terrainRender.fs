@@ -1,13 +1,15 @@
 #version 400 core
 
 // Use the terrain texture for fragment shading. TODO this eventually will be a lot more complicated / interesting and use the other color components.
-uniform sampler2D terrainTexture;
-uniform sampler2D terrainType;
+uniform sampler2DArray terrainTexture;
+// Two 4-bit palette indices per texel, the even pixel in the low bits.
+uniform usampler2DArray terrainType;
 
 uniform float gameTime;
 
 smooth in vec2 tc_fs;
 smooth in vec3 fragment_position;
+flat in float layer_fs;
 
 out vec4 color;
 
@@ -51,54 +53,13 @@ vec4 GetTypeColor(int type)
 	}
 }
 
-int GetNearestType(int type)	
+// Must match TerrainTypes::Palette.
+const int TYPE_PALETTE[16] = int[](SNOW_PEAK, ROCKS, TREES, DIRTLAND, GRASSLAND, ROADS, CITY, SAND, RIVER, LAKE, LAKE, LAKE, LAKE, LAKE, LAKE, LAKE);
+
+int GetPixelType(ivec2 pixel, int layer)
 {
-	if (type < LAKE)
-    {
-        if (type < RIVER)
-        {
-            if (type < SAND)
-            {
-                if (type < CITY)
-                {
-                    if (type < ROADS)
-                    {
-                        if (type < GRASSLAND)
-                        {
-                            if (type < DIRTLAND)
-                            {
-                                if (type < TREES)
-                                {
-                                    if (type < ROCKS)
-                                    {
-										return SNOW_PEAK;
-                                    }
-
-									return ROCKS;
-                                }
-
-								return TREES;
-                            }
-
-							return DIRTLAND;
-                        }
-
-						return GRASSLAND;
-                    }
-
-					return ROADS;
-                }
-
-				return CITY;
-            }
-
-			return SAND;
-        }
-
-		return RIVER;
-    }
-	
-	return LAKE;
+    uint packedTypes = texelFetch(terrainType, ivec3(pixel.x / 2, pixel.y, layer), 0).r;
+    return TYPE_PALETTE[int((packedTypes >> uint((pixel.x & 1) * 4)) & 0xFu)];
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -179,7 +140,8 @@ void main(void)
     const float min = 0.155;
     const float max = 0.173;
     
-    float height = texture(terrainTexture, tc_fs).r;
+    // The heightmap is padded from 102 to 104 texels. See terrainRender.te.
+    float height = texture(terrainTexture, vec3(tc_fs * (102.0f / 104.0f), layer_fs)).r;
     if (int(height * 10000) % 10 == 1)
     {
         color = vec4(0.4f, 0.45f, 0.4f, 1.0f);
@@ -189,7 +151,7 @@ void main(void)
         color = vec4(0.4f, 0.4f, 0.4f, 1.0f);
     }
     
-	int type = GetNearestType(int(texelFetch(terrainType, ivec2(tc_fs.x * 100 + 1, tc_fs.y * 100 + 1), 0).r * 255.0f));
+	int type = GetPixelType(ivec2(tc_fs.x * 100 + 1, tc_fs.y * 100 + 1), int(layer_fs));
 	vec4 typeColor = GetTypeColor(type);
 	
 	if (type == LAKE)
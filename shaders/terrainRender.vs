@@ -1,29 +1,41 @@
 #version 400 core
 
+// Per drawn subtile: world origin (xy) and texture pool layer (z).
+uniform samplerBuffer subtileData;
+
 out vec2 tcs_in;
+out vec3 tcs_subtile;
 
 void main(void)
 {
     // A cell 1m x 1m in size, gives us ~3ft x 3ft, which is the export from our program.
-    const float terrainCellHalfSize = 0.5;
+    // Each patch covers 10x10 cells, and is tessellated down to single cells when close by. Must match TerrainManager::PatchSize.
+    const int patchSize = 10;
+    const float patchHalfSize = patchSize * 0.5;
 	
     // Hardcode our vertex data so we don't need to send it into the program.
     const vec4 vertices[] = vec4[](
-        vec4(-terrainCellHalfSize, -terrainCellHalfSize, 0.0, 1.0),
-        vec4( terrainCellHalfSize, -terrainCellHalfSize, 0.0, 1.0),
-        vec4(-terrainCellHalfSize,  terrainCellHalfSize, 0.0, 1.0),
-        vec4( terrainCellHalfSize,  terrainCellHalfSize, 0.0, 1.0));
+        vec4(-patchHalfSize, -patchHalfSize, 0.0, 1.0),
+        vec4( patchHalfSize, -patchHalfSize, 0.0, 1.0),
+        vec4(-patchHalfSize,  patchHalfSize, 0.0, 1.0),
+        vec4( patchHalfSize,  patchHalfSize, 0.0, 1.0));
     
     // This is 100, not 1k, because the regions are subdivided.
     const int textureSize = 100;
-    int x = gl_InstanceID % textureSize;
-    int y = gl_InstanceID / textureSize;
-    vec2 offset = vec2(x, y);
+    const int patchesPerSide = textureSize / patchSize;
+    int subtile = gl_InstanceID / (patchesPerSide * patchesPerSide);
+    int patchIndex = gl_InstanceID % (patchesPerSide * patchesPerSide);
+    int x = patchIndex % patchesPerSide;
+    int y = patchIndex / patchesPerSide;
+    tcs_subtile = texelFetch(subtileData, subtile).xyz;
+
+    // The center of the patch, in cells. Cell centers are on whole numbers, so patches span [-0.5, 9.5] and so on.
+    vec2 offset = vec2(x, y) * patchSize + vec2((patchSize - 1) * 0.5);
     
-    // Figure out the texture coordinate by taking the position on the height texture and then the position in the cell.
+    // Figure out the texture coordinate by taking the position on the height texture and then the position in the patch.
 	// We add a pixel upon division to avoid seam errors.
     tcs_in = (offset + (vertices[gl_VertexID].xy)) / float(textureSize + 2);
     
-    // Move the terrain cells appropriately.
-    gl_Position = vertices[gl_VertexID] + vec4(float(x), float(y), 0.0, 0.0);
+    // Move the terrain patches appropriately. The subtile origin is applied after tessellation, so positions stay local to the subtile.
+    gl_Position = vertices[gl_VertexID] + vec4(offset, 0.0, 0.0);
 }
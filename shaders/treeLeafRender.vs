@@ -3,6 +3,10 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 color;
 
+// Per tree: the position in the subtile and rotation about Z, then the scale.
+layout (location = 5) in vec4 instance;
+layout (location = 6) in float instanceScale;
+
 out vec4 fs_color;
 
 uniform mat4 projMatrix;
@@ -17,7 +21,10 @@ void main(void)
 {
 	fs_color = vec4(color, 0.66f);
     
-    vec4 eyePos = mvMatrix * vec4(position.x, position.y, position.z, 1.0f);
+    float s = sin(instance.w);
+    float c = cos(instance.w);
+    vec3 treePosition = instance.xyz + instanceScale * vec3(c * position.x - s * position.y, s * position.x + c * position.y, position.z);
+    vec4 eyePos = mvMatrix * vec4(treePosition, 1.0f);
     float dist = distance(eyePos, vec4(0.0f, 0.0f, 0.0f, 1.0f));
     eyePos.z += 0.1f;
     
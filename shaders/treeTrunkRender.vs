@@ -4,6 +4,10 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 color;
 layout (location = 4) in uint size;
 
+// Per tree: the position in the subtile and rotation about Z, then the scale.
+layout (location = 5) in vec4 instance;
+layout (location = 6) in float instanceScale;
+
 out vec3 fs_color;
 
 uniform mat4 projMatrix;
@@ -14,5 +18,9 @@ void main(void)
 {
     // TODO scale the size based on uniforms to give a nice-sized tree trunk w/ branches.
 	fs_color = color * sin(size);
-    gl_Position = projMatrix * mvMatrix * vec4(position.x, position.y, position.z, 1.0f);
+
+    float s = sin(instance.w);
+    float c = cos(instance.w);
+    vec3 treePosition = instance.xyz + instanceScale * vec3(c * position.x - s * position.y, s * position.x + c * position.y, position.z);
+    gl_Position = projMatrix * mvMatrix * vec4(treePosition, 1.0f);
 }